@@ -0,0 +1,261 @@
+/*
+ * Allocation test of the request path.
+ * The server is built into this program with malloc(), calloc() and realloc()
+ * interposed, started on a thread, and sent requests answered by the fast path
+ * (FC03, FC04, FC06, FC16, exceptions) and by libmodbus (FC01, FC05, FC15, FC23).
+ * After one warm-up round, serving the requests must not allocate at all, not
+ * even for a unit identifier no earlier round used. Each run of test_runs is
+ * made in a child process, with and without the fast path and --units.
+ * Arguments are passed on to the server in every run, e.g. --threads 4.
+ */
+#define main modbus_server_main
+#include "modbus_server.c"
+#undef main
+
+#define TEST_PORT 15502                  // Port the server of the first run listens on, the next runs count up
+#define TEST_UNITS "1-2"                 // Units served by the --units runs
+#define TEST_LAST_UNIT 2                 // Last unit of TEST_UNITS
+#define ROAMING_UNIT -1                  // Unit of a request that changes every round
+#define TEST_ROUNDS 1000                 // Rounds of requests counted after the warm-up round
+#define TEST_CONNECTIONS 4               // Client connections, spread over the workers
+#define MAX_SERVER_ARGS 64               // Upper bound of the server's command line
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+static atomic_int counting;              // Allocations are counted while set
+static atomic_long allocations;          // Allocations made while counting
+
+void *malloc(size_t size) {
+    if (atomic_load_explicit(&counting, memory_order_relaxed)) atomic_fetch_add(&allocations, 1);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size) {
+    if (atomic_load_explicit(&counting, memory_order_relaxed)) atomic_fetch_add(&allocations, 1);
+    return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    if (atomic_load_explicit(&counting, memory_order_relaxed)) atomic_fetch_add(&allocations, 1);
+    return __libc_realloc(ptr, size);
+}
+
+/**
+ * One request of a round and the function code its reply must carry.
+ */
+typedef struct {
+    const char *name;                // Shown when the reply is wrong
+    int unit;                        // Unit identifier, ROAMING_UNIT for the round number modulo 256
+    uint8_t pdu[16];                 // Request PDU, function code first
+    int length;                      // Length of the PDU
+    uint8_t reply_function;          // Function code of the expected reply, with 0x80 for an exception
+} test_request_t;
+
+static const test_request_t requests[] = {
+    { "FC03", 1, { 0x03, 0x00, 0x00, 0x00, 0x0A }, 5, 0x03 },
+    { "FC04", 1, { 0x04, 0x00, 0x00, 0x00, 0x0A }, 5, 0x04 },
+    { "FC06", 1, { 0x06, 0x00, 0x01, 0x12, 0x34 }, 5, 0x06 },
+    { "FC16", 1, { 0x10, 0x00, 0x02, 0x00, 0x02, 0x04, 0x00, 0x01, 0x00, 0x02 }, 10, 0x10 },
+    { "FC03 out of range", 1, { 0x03, 0xFF, 0x00, 0x00, 0x01 }, 5, 0x83 },
+    { "FC01", 1, { 0x01, 0x00, 0x00, 0x00, 0x10 }, 5, 0x01 },
+    { "FC05", 1, { 0x05, 0x00, 0x03, 0xFF, 0x00 }, 5, 0x05 },
+    { "FC15", 1, { 0x0F, 0x00, 0x04, 0x00, 0x08, 0x01, 0xA5 }, 7, 0x0F },
+    { "FC23", 1, { 0x17, 0x00, 0x00, 0x00, 0x02, 0x00, 0x05, 0x00, 0x01, 0x02, 0x00, 0x07 }, 12, 0x17 },
+    { "FC06 unit 2", 2, { 0x06, 0x00, 0x01, 0x56, 0x78 }, 5, 0x06 },
+    { "FC01 unit 2", 2, { 0x01, 0x00, 0x00, 0x00, 0x10 }, 5, 0x01 },
+    { "FC03 roaming unit", ROAMING_UNIT, { 0x03, 0x00, 0x00, 0x00, 0x01 }, 5, 0x03 },
+};
+
+/**
+ * Server options of one run, besides the common ones.
+ */
+typedef struct {
+    const char *options[4];          // NULL-terminated
+    int units;                       // The run serves TEST_UNITS only, other units get an exception
+} test_run_t;
+
+static const test_run_t test_runs[] = {
+    { { "--fast-path" }, 0 },
+    { { NULL }, 0 },
+    { { "--fast-path", "--units", TEST_UNITS }, 1 },
+    { { "--units", TEST_UNITS }, 1 },
+};
+
+/**
+ * Thread entry point running the server.
+ *
+ * @param arg  The server's command line, NULL-terminated.
+ *
+ * @return Never, the server only returns if it failed.
+ */
+void *run_server(void *arg) {
+    char **argv = arg;
+    int argc = 0;
+    while (argv[argc]) argc++;
+    modbus_server_main(argc, argv);
+    fprintf(stderr, "[ERROR] The server under test stopped\n");
+    exit(-1);
+}
+
+/**
+ * Function to connect to the server under test, retrying while it starts.
+ *
+ * @param port  The port the server listens on.
+ *
+ * @return The connected socket if successful, -1 otherwise.
+ */
+int connect_server(int port) {
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(port) };
+    inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+    for (int attempt = 0; attempt < 100; attempt++) {
+        int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd == -1) return -1;
+        if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0) return fd;
+        close(fd);
+        usleep(50000);
+    }
+    return -1;
+}
+
+/**
+ * Function to send one request and check its reply.
+ *
+ * @param fd       The connected socket.
+ * @param request  The request.
+ * @param id       The transaction identifier.
+ * @param round    The round number, picks the unit of a roaming request.
+ * @param run      The run, tells which units are served.
+ *
+ * @return 0 if the reply is the expected one, -1 otherwise.
+ */
+int exchange(int fd, const test_request_t *request, uint16_t id, int round, const test_run_t *run) {
+    int unit = request->unit == ROAMING_UNIT ? round % UNIT_ID_COUNT : request->unit;
+    int served = !run->units || (unit >= 1 && unit <= TEST_LAST_UNIT);
+    uint8_t reply_function = served ? request->reply_function : request->reply_function | 0x80;
+    uint8_t frame[MBAP_HEADER_LENGTH + 16] = { id >> 8, id & 0xFF, 0, 0, 0, request->length + 1, unit };
+    memcpy(frame + MBAP_HEADER_LENGTH, request->pdu, request->length);
+    if (send_all(fd, frame, MBAP_HEADER_LENGTH + request->length) == -1) return -1;
+
+    uint8_t reply[MODBUS_TCP_MAX_ADU_LENGTH];
+    int received = 0, expected = MBAP_HEADER_LENGTH + 1;
+    while (received < expected) {
+        ssize_t rc = recv(fd, reply + received, expected - received, 0);
+        if (rc <= 0) return -1;
+        received += rc;
+        if (received >= 6) expected = 6 + ((reply[4] << 8) | reply[5]);
+        if (expected > (int)sizeof(reply)) return -1;
+    }
+    if (reply[0] != frame[0] || reply[1] != frame[1] || reply[MBAP_HEADER_LENGTH] != reply_function) {
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Function to send every request once on each connection.
+ *
+ * @param sockets  The connected sockets.
+ * @param round    The round number, used in transaction identifiers.
+ * @param run      The run, tells which units are served.
+ *
+ * @return 0 if every reply was the expected one, -1 otherwise.
+ */
+int run_round(const int *sockets, int round, const test_run_t *run) {
+    for (int c = 0; c < TEST_CONNECTIONS; c++) {
+        for (size_t i = 0; i < sizeof(requests) / sizeof(requests[0]); i++) {
+            if (exchange(sockets[c], &requests[i], round * 16 + i, round, run) == -1) {
+                atomic_store(&counting, 0);
+                fprintf(stderr, "[ERROR] Wrong or missing reply to %s on connection %d\n", requests[i].name, c);
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+/**
+ * Function to make one run: start the server with the run's options, serve a
+ * warm-up round, then count allocations over TEST_ROUNDS rounds.
+ *
+ * @param run   The run.
+ * @param port  The port the server listens on.
+ * @param argc  The number of arguments passed on to the server.
+ * @param argv  The arguments passed on to the server.
+ *
+ * @return 0 if nothing was allocated, -1 otherwise.
+ */
+int test_run(const test_run_t *run, int port, int argc, char *argv[]) {
+    char port_arg[8];
+    snprintf(port_arg, sizeof(port_arg), "%d", port);
+    char *server_argv[MAX_SERVER_ARGS] = {
+        "modbus_server", "-i", "127.0.0.1", "-p", port_arg, "--coils", "0:100",
+        "--holding-registers", "0:100", "--input-registers", "0:100", "--log-level", "error",
+    };
+    int server_argc = 13;
+    for (int i = 0; run->options[i] && server_argc < MAX_SERVER_ARGS - 1; i++) {
+        server_argv[server_argc++] = (char *)run->options[i];
+    }
+    for (int i = 0; i < argc && server_argc < MAX_SERVER_ARGS - 1; i++) server_argv[server_argc++] = argv[i];
+
+    pthread_t server;
+    if (pthread_create(&server, NULL, run_server, server_argv) != 0) {
+        fprintf(stderr, "[ERROR] Error starting the server thread\n");
+        return -1;
+    }
+
+    int sockets[TEST_CONNECTIONS];
+    for (int c = 0; c < TEST_CONNECTIONS; c++) {
+        sockets[c] = connect_server(port);
+        if (sockets[c] == -1) {
+            fprintf(stderr, "[ERROR] Error connecting to the server: %s\n", strerror(errno));
+            return -1;
+        }
+    }
+
+    // Anything set up on first use is allocated in the warm-up round
+    if (run_round(sockets, 0, run) == -1) return -1;
+    atomic_store(&counting, 1);
+    for (int round = 1; round <= TEST_ROUNDS; round++) {
+        if (run_round(sockets, round, run) == -1) return -1;
+    }
+    atomic_store(&counting, 0);
+
+    long count = atomic_load(&allocations);
+    if (count != 0) {
+        fprintf(stderr, "[ERROR] %ld allocations while serving %d rounds of requests\n", count, TEST_ROUNDS);
+        return -1;
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    int failed = 0;
+    for (size_t r = 0; r < sizeof(test_runs) / sizeof(test_runs[0]); r++) {
+        const test_run_t *run = &test_runs[r];
+        char options[64] = "";
+        for (int i = 0; run->options[i]; i++) {
+            snprintf(options + strlen(options), sizeof(options) - strlen(options), " %s", run->options[i]);
+        }
+
+        // The server never returns, each run gets a process of its own
+        fflush(stdout);
+        pid_t pid = fork();
+        if (pid == -1) {
+            fprintf(stderr, "[ERROR] Error starting run %zu: %s\n", r + 1, strerror(errno));
+            return -1;
+        }
+        if (pid == 0) _exit(test_run(run, TEST_PORT + r, argc - 1, argv + 1) == 0 ? 0 : 1);
+
+        int status;
+        if (waitpid(pid, &status, 0) == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            fprintf(stderr, "[ERROR] Run %zu (%s) failed\n", r + 1, *options ? options + 1 : "libmodbus only");
+            failed = 1;
+            continue;
+        }
+        printf("[INFO] Run %zu (%s): no allocation while serving %d rounds of requests\n", r + 1,
+               *options ? options + 1 : "libmodbus only", TEST_ROUNDS);
+    }
+    return failed ? -1 : 0;
+}
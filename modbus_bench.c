@@ -0,0 +1,1258 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "modbus_trace.h"
+
+#define DEFAULT_SERVER_IP "127.0.0.1"    // Default server IP address
+#define DEFAULT_SERVER_PORT 502          // Default server port
+#define DEFAULT_CONNECTIONS 1            // Default number of client connections
+#define DEFAULT_THREADS 1                // Default number of client threads
+#define DEFAULT_DURATION 10              // Default measurement time in seconds
+#define DEFAULT_DEPTH 1                  // Default requests in flight per connection
+#define DEFAULT_UNIT_ID 1                // Default unit identifier
+#define DEFAULT_REG_COUNT 10             // Default registers per FC03/FC16 request
+#define DEFAULT_SPAN 10                  // Default number of addresses the requests spread over
+#define MAX_CONNECTIONS 65536            // Upper bound for -c
+#define MAX_THREADS 256                  // Upper bound for -t
+#define MAX_DEPTH 256                    // Upper bound for --depth
+#define MAX_READ_REGISTERS 125           // Largest FC03 quantity
+#define MAX_WRITE_REGISTERS 123          // Largest FC16 quantity
+#define MAX_EPOLL_EVENTS 64              // Events handled per epoll_wait() call
+#define MBAP_HEADER_LENGTH 7             // Transaction ID, protocol ID, length and unit ID
+#define MAX_ADU_LENGTH 260               // Largest Modbus TCP frame
+#define LATENCY_BUCKETS 320              // Histogram buckets, covers latencies up to 2^40 ns
+#define MAX_PRINTED_MISMATCHES 10        // Replies differing from the trace printed in full
+#define VERSION "1.0.0"                  // Benchmark version
+
+// Long-only option identifiers
+#define OPT_DEPTH 256
+#define OPT_MIX 257
+#define OPT_UNIT 258
+#define OPT_ADDRESS 259
+#define OPT_REPLAY 260
+#define OPT_SPEED 261
+
+/**
+ * Function codes the benchmark can send.
+ */
+enum {
+    MIX_READ_HOLDING_REGISTERS,
+    MIX_WRITE_SINGLE_REGISTER,
+    MIX_WRITE_MULTIPLE_REGISTERS,
+    MIX_COUNT,
+    MIX_OTHER = MIX_COUNT           // Latency slot of replayed function codes outside the mix
+};
+
+static const int mix_functions[MIX_COUNT] = { 0x03, 0x06, 0x10 };
+static const char *mix_names[MIX_COUNT + 1] = { "FC03", "FC06", "FC16", "other" };
+
+/**
+ * Benchmark settings collected from the command line.
+ */
+typedef struct {
+    char *server_ip;       // IP address of the server
+    int server_port;       // TCP port of the server
+    int connections;       // Number of client connections
+    int threads;           // Number of client threads, connections are spread across them
+    int duration;          // Measurement time in seconds
+    double rate;           // Total requests per second, 0 sends as fast as replies come back
+    int depth;             // Requests in flight per connection
+    int mix[MIX_COUNT];    // Relative weight of each function code, indexed by MIX_*
+    int unit_id;           // Unit identifier of every request
+    int address;           // First address used by the requests
+    int span;              // Number of addresses the requests spread over
+    int count;             // Registers per FC03/FC16 request
+    char *replay_file;     // Frame trace whose requests are replayed instead of the mix, NULL for the mix
+    double speed;          // Replay speed relative to the trace, 0 to replay flat out
+} bench_config_t;
+
+/**
+ * Log-linear latency histogram in nanoseconds.
+ */
+typedef struct {
+    uint64_t buckets[LATENCY_BUCKETS];  // Samples per bucket, see latency_bucket()
+    uint64_t count;                  // Number of samples
+    uint64_t sum_ns;                 // Sum of all samples
+    uint64_t max_ns;                 // Largest sample
+} latency_histogram_t;
+
+/**
+ * Results of one client thread, merged by the main thread at the end.
+ */
+typedef struct {
+    latency_histogram_t by_function[MIX_COUNT + 1];  // Indexed by MIX_*, MIX_OTHER for other replayed codes
+    uint64_t exceptions;             // Replies carrying an exception code
+    uint64_t errors;                 // Connections lost or replies that did not match their request
+    uint64_t mismatches;             // Replayed requests answered differently than in the trace
+    uint64_t unrecorded;             // Replayed requests whose reply the trace does not hold
+} bench_result_t;
+
+/**
+ * One request of a replayed connection, with the reply the trace recorded for it.
+ */
+typedef struct {
+    uint64_t offset_ns;              // Time since the first frame of the trace
+    const uint8_t *request;          // Request frame, in the loaded trace
+    const uint8_t *reply;            // Recorded reply frame, NULL if only its length is known
+    uint16_t request_length;         // Length of the request frame
+    uint16_t reply_length;           // Length of the recorded reply, 0 if the trace holds no reply
+} replay_request_t;
+
+/**
+ * Requests the trace recorded on one connection, replayed on a connection of their own.
+ */
+typedef struct {
+    uint32_t connection;             // Connection identifier in the trace
+    replay_request_t *requests;      // Requests in the order they were received
+    int nb_requests;                 // Number of requests
+} replay_stream_t;
+
+/**
+ * One request waiting for its reply.
+ */
+typedef struct {
+    uint16_t transaction;            // Transaction identifier of the request
+    uint8_t function;                // MIX_* of the request, MIX_OTHER for other replayed codes
+    uint8_t code;                    // Function code of the request
+    int request;                     // Index of the replayed request, -1 for the mix
+    uint64_t sent_ns;                // Time the request was due, see bench_thread()
+} pending_t;
+
+/**
+ * One client connection.
+ * The server answers in order, so pending requests form a FIFO.
+ */
+typedef struct {
+    int fd;                          // Client socket, -1 once the connection is lost
+    uint16_t next_transaction;       // Transaction identifier of the next request
+    int head;                        // Oldest pending request
+    int inflight;                    // Requests waiting for a reply
+    uint64_t next_send_ns;           // When the next request is due in rate-limited mode
+    const replay_stream_t *replay;   // Requests replayed on this connection, NULL for the mix
+    int next_request;                // Index of the next replayed request
+    int rx_len;                      // Bytes waiting in rx
+    pending_t pending[MAX_DEPTH];    // Requests waiting for their reply, circular
+    uint8_t rx[MAX_DEPTH * MAX_ADU_LENGTH];  // Reply bytes received so far
+} bench_connection_t;
+
+/**
+ * Per-thread client state.
+ */
+typedef struct {
+    int id;                          // Thread index
+    pthread_t thread;                // Thread driving the connections
+    const bench_config_t *config;    // Benchmark settings
+    bench_connection_t *conns;       // Connections owned by this thread
+    int nb_conns;                    // Number of connections
+    int epoll_fd;                    // Event loop watching the connections
+    uint64_t interval_ns;            // Time between two requests on one connection, 0 if not rate-limited
+    uint64_t start_ns;               // Start of the measurement
+    uint64_t end_ns;                 // End of the measurement
+    uint64_t random;                 // xorshift state choosing functions, addresses and values
+    int finished;                    // Connections that replayed every request and got every reply
+    bench_result_t result;           // Results measured by this thread
+} bench_thread_t;
+
+/**
+ * Function to display the usage/help message.
+ */
+void print_usage() {
+    printf("Modbus Benchmark - Version %s\n\n", VERSION);
+    printf("Usage: modbus_bench [OPTIONS]\n\n");
+
+    printf("General Options:\n");
+    printf("  -h, --help        Show this help message\n");
+    printf("  -v, --version     Show version information\n");
+
+    printf("\nLoad Configuration:\n");
+    printf("  -i IP             Server IP address (default: 127.0.0.1)\n");
+    printf("  -p PORT           Server port (default: 502)\n");
+    printf("  -c CONNECTIONS    Number of concurrent connections (default: 1)\n");
+    printf("  -t THREADS        Client threads driving the connections (default: 1)\n");
+    printf("  -d SECONDS        Measurement time (default: 10)\n");
+    printf("  -r RATE           Total requests per second, 0 for flat out (default: 0)\n");
+    printf("  --depth N         Pipelined requests in flight per connection (default: 1)\n");
+    printf("  --mix FC:WEIGHT,...\n");
+    printf("                    Function code mix out of 3, 6 and 16 (default: 3:100)\n");
+    printf("  --unit ID         Unit identifier of every request (default: 1)\n");
+    printf("  --address [START:]SPAN\n");
+    printf("                    Addresses the requests spread over (default: 0:10)\n");
+    printf("  -n COUNT          Registers per FC03/FC16 request (default: 10)\n");
+
+    printf("\nReplay:\n");
+    printf("  --replay FILE     Resend the requests of a modbus_server --trace file, one connection per\n");
+    printf("                    traced connection, and compare the replies with the traced ones;\n");
+    printf("                    -d is then the time a reply may take (-c, -r and the mix do not apply)\n");
+    printf("  --speed FACTOR    Replay FACTOR times faster than traced, 0 for flat out with --depth\n");
+    printf("                    requests in flight (default: 1)\n");
+
+    printf("\nExample:\n");
+    printf("  modbus_bench -i 192.168.1.100 -c 64 -t 4 --depth 8 --mix 3:80,6:10,16:10\n");
+    printf("  modbus_bench -c 20 -r 200 -d 60\n");
+    printf("  modbus_bench --replay production.trace --speed 10\n");
+}
+
+/**
+ * Function to get a monotonic timestamp.
+ *
+ * @return The time in nanoseconds.
+ */
+uint64_t monotonic_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+/**
+ * Function to draw a pseudo-random number.
+ *
+ * @param thread  The thread owning the generator.
+ *
+ * @return The next 64-bit xorshift value.
+ */
+uint64_t next_random(bench_thread_t *thread) {
+    uint64_t x = thread->random;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    thread->random = x;
+    return x;
+}
+
+/**
+ * Function to map a latency to its histogram bucket.
+ * Buckets are log-linear, with 8 sub-buckets per power of two.
+ *
+ * @param ns  The latency in nanoseconds.
+ *
+ * @return The bucket index.
+ */
+int latency_bucket(uint64_t ns) {
+    if (ns < 8) return (int)ns;
+    int shift = 63 - __builtin_clzll(ns) - 3;
+    int bucket = shift * 8 + (int)(ns >> shift);
+    return bucket < LATENCY_BUCKETS ? bucket : LATENCY_BUCKETS - 1;
+}
+
+/**
+ * Function to get the smallest latency held by a histogram bucket.
+ *
+ * @param bucket  The bucket index.
+ *
+ * @return The latency in nanoseconds.
+ */
+uint64_t latency_bucket_floor(int bucket) {
+    if (bucket < 16) return bucket;
+    int shift = bucket / 8 - 1;
+    return (uint64_t)(bucket % 8 + 8) << shift;
+}
+
+/**
+ * Function to record a latency sample.
+ *
+ * @param histogram  The histogram to update.
+ * @param ns         The latency in nanoseconds.
+ */
+void record_latency(latency_histogram_t *histogram, uint64_t ns) {
+    histogram->buckets[latency_bucket(ns)]++;
+    histogram->count++;
+    histogram->sum_ns += ns;
+    if (ns > histogram->max_ns) histogram->max_ns = ns;
+}
+
+/**
+ * Function to add a histogram into another one.
+ *
+ * @param merged     The histogram to add to.
+ * @param histogram  The histogram to add.
+ */
+void merge_histogram(latency_histogram_t *merged, const latency_histogram_t *histogram) {
+    for (int b = 0; b < LATENCY_BUCKETS; b++) merged->buckets[b] += histogram->buckets[b];
+    merged->count += histogram->count;
+    merged->sum_ns += histogram->sum_ns;
+    if (histogram->max_ns > merged->max_ns) merged->max_ns = histogram->max_ns;
+}
+
+/**
+ * Function to estimate a quantile from a histogram.
+ *
+ * @param histogram  The histogram.
+ * @param quantile   The quantile, between 0 and 1.
+ *
+ * @return The quantile in nanoseconds, the floor of the bucket holding it.
+ */
+uint64_t histogram_quantile(const latency_histogram_t *histogram, double quantile) {
+    uint64_t rank = (uint64_t)(quantile * histogram->count);
+    uint64_t seen = 0;
+    for (int b = 0; b < LATENCY_BUCKETS; b++) {
+        seen += histogram->buckets[b];
+        if (seen > rank) return latency_bucket_floor(b);
+    }
+    return histogram->max_ns;
+}
+
+/**
+ * Function to print one line of latency percentiles.
+ *
+ * @param label      The name of the line.
+ * @param histogram  The histogram to summarize.
+ */
+void print_latency(const char *label, const latency_histogram_t *histogram) {
+    if (histogram->count == 0) return;
+    printf("  %-6s %10llu  avg %8.1f  p50 %8.1f  p90 %8.1f  p99 %8.1f  p99.9 %8.1f  max %8.1f\n", label,
+           (unsigned long long)histogram->count, histogram->sum_ns / 1e3 / histogram->count,
+           histogram_quantile(histogram, 0.5) / 1e3, histogram_quantile(histogram, 0.9) / 1e3,
+           histogram_quantile(histogram, 0.99) / 1e3, histogram_quantile(histogram, 0.999) / 1e3,
+           histogram->max_ns / 1e3);
+}
+
+/**
+ * Function to open one client connection.
+ *
+ * @param config  The benchmark settings.
+ *
+ * @return The socket descriptor if successful, -1 otherwise.
+ */
+int open_connection(const bench_config_t *config) {
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(config->server_port) };
+    if (inet_pton(AF_INET, config->server_ip, &addr.sin_addr) != 1) {
+        fprintf(stderr, "[ERROR] Invalid server IP address '%s'\n", config->server_ip);
+        return -1;
+    }
+
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        fprintf(stderr, "[ERROR] Error creating socket: %s\n", strerror(errno));
+        return -1;
+    }
+    int on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+        fprintf(stderr, "[ERROR] Error connecting to %s:%d: %s\n", config->server_ip, config->server_port,
+                strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * Function to drop a connection after an error.
+ *
+ * @param thread  The thread owning the connection.
+ * @param conn    The connection to drop.
+ */
+void drop_connection(bench_thread_t *thread, bench_connection_t *conn) {
+    epoll_ctl(thread->epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+    close(conn->fd);
+    conn->fd = -1;
+    thread->result.errors++;
+}
+
+/**
+ * Function to check whether a replayed connection is done or stuck.
+ * A connection that got a reply to every traced request is closed, one whose
+ * oldest request waited longer than the -d duration for its reply is dropped.
+ *
+ * @param thread  The thread owning the connection.
+ * @param conn    The replayed connection.
+ * @param now     The current time.
+ *
+ * @return 1 if the connection was closed or dropped, 0 if it goes on.
+ */
+int end_replayed_connection(bench_thread_t *thread, bench_connection_t *conn, uint64_t now) {
+    if (conn->next_request == conn->replay->nb_requests && conn->inflight == 0) {
+        epoll_ctl(thread->epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+        close(conn->fd);
+        conn->fd = -1;
+        thread->finished++;
+        return 1;
+    }
+    uint64_t sent = conn->pending[conn->head].sent_ns;
+    if (conn->inflight > 0 && now > sent && now - sent > (uint64_t)thread->config->duration * 1000000000ull) {
+        fprintf(stderr, "[ERROR] No reply to request %d of traced connection %08x within %d s\n",
+                conn->pending[conn->head].request, conn->replay->connection, thread->config->duration);
+        drop_connection(thread, conn);
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * Function to pick the function code of the next request from the configured mix.
+ *
+ * @param thread  The thread sending the request.
+ *
+ * @return The MIX_* of the request.
+ */
+int pick_function(bench_thread_t *thread) {
+    const int *mix = thread->config->mix;
+    int total = mix[0] + mix[1] + mix[2];
+    int pick = (int)(next_random(thread) % total);
+    for (int i = 0; i < MIX_COUNT - 1; i++) {
+        if (pick < mix[i]) return i;
+        pick -= mix[i];
+    }
+    return MIX_COUNT - 1;
+}
+
+/**
+ * Function to encode the next request of a connection.
+ *
+ * @param thread    The thread sending the request.
+ * @param conn      The connection sending the request.
+ * @param function  The MIX_* of the request.
+ * @param frame     The buffer receiving the frame, MAX_ADU_LENGTH bytes.
+ *
+ * @return The length of the frame.
+ */
+int build_request(bench_thread_t *thread, bench_connection_t *conn, int function, uint8_t *frame) {
+    const bench_config_t *config = thread->config;
+    int count = function == MIX_WRITE_SINGLE_REGISTER ? 1 : config->count;
+    int address = config->address + (int)(next_random(thread) % (config->span - count + 1));
+    uint8_t *pdu = frame + MBAP_HEADER_LENGTH;
+    int pdu_length;
+
+    pdu[0] = mix_functions[function];
+    pdu[1] = address >> 8;
+    pdu[2] = address & 0xFF;
+    if (function == MIX_WRITE_SINGLE_REGISTER) {
+        uint16_t value = (uint16_t)next_random(thread);
+        pdu[3] = value >> 8;
+        pdu[4] = value & 0xFF;
+        pdu_length = 5;
+    } else {
+        pdu[3] = count >> 8;
+        pdu[4] = count & 0xFF;
+        pdu_length = 5;
+        if (function == MIX_WRITE_MULTIPLE_REGISTERS) {
+            uint64_t values = next_random(thread);
+            pdu[5] = count * 2;
+            for (int i = 0; i < count; i++) {
+                pdu[6 + 2 * i] = (values >> (i % 4) * 16) >> 8;
+                pdu[7 + 2 * i] = (values >> (i % 4) * 16) & 0xFF;
+            }
+            pdu_length = 6 + count * 2;
+        }
+    }
+
+    uint16_t transaction = conn->next_transaction++;
+    frame[0] = transaction >> 8;
+    frame[1] = transaction & 0xFF;
+    frame[2] = 0;
+    frame[3] = 0;
+    frame[4] = (pdu_length + 1) >> 8;
+    frame[5] = (pdu_length + 1) & 0xFF;
+    frame[6] = config->unit_id;
+    return MBAP_HEADER_LENGTH + pdu_length;
+}
+
+/**
+ * Function to map a function code to its latency slot.
+ *
+ * @param code  The Modbus function code.
+ *
+ * @return The MIX_* of the code, MIX_OTHER if it is not part of the mix.
+ */
+int function_slot(int code) {
+    for (int i = 0; i < MIX_COUNT; i++) {
+        if (mix_functions[i] == code) return i;
+    }
+    return MIX_OTHER;
+}
+
+/**
+ * Function to get when a replayed request is due.
+ *
+ * @param thread   The thread replaying the request.
+ * @param request  The request.
+ *
+ * @return The monotonic time the request is due, its trace offset scaled by the replay speed.
+ */
+uint64_t replay_due_ns(const bench_thread_t *thread, const replay_request_t *request) {
+    return thread->start_ns + (uint64_t)(request->offset_ns / thread->config->speed);
+}
+
+/**
+ * Function to queue the replayed requests that are due on a connection.
+ * Timed replays send each request when it is due, whatever is still in
+ * flight, as the traced client did; flat-out replays keep --depth requests in
+ * flight. Frames are resent as traced, transaction identifiers included.
+ *
+ * @param thread  The thread owning the connection.
+ * @param conn    The connection.
+ * @param now     The current time.
+ * @param tx      The buffer receiving the frames, MAX_DEPTH * MAX_ADU_LENGTH bytes.
+ *
+ * @return The number of bytes queued.
+ */
+int queue_replayed_requests(bench_thread_t *thread, bench_connection_t *conn, uint64_t now, uint8_t *tx) {
+    int timed = thread->config->speed > 0;
+    int depth = timed ? MAX_DEPTH : thread->config->depth;
+    int tx_len = 0;
+    while (conn->inflight < depth && conn->next_request < conn->replay->nb_requests) {
+        const replay_request_t *request = &conn->replay->requests[conn->next_request];
+        uint64_t due = timed ? replay_due_ns(thread, request) : now;
+        if (due > now) break;
+        pending_t *pending = &conn->pending[(conn->head + conn->inflight) % MAX_DEPTH];
+        pending->transaction = (request->request[0] << 8) | request->request[1];
+        pending->code = request->request[MBAP_HEADER_LENGTH];
+        pending->function = function_slot(pending->code);
+        pending->request = conn->next_request++;
+        pending->sent_ns = due;
+        memcpy(tx + tx_len, request->request, request->request_length);
+        tx_len += request->request_length;
+        conn->inflight++;
+    }
+    return tx_len;
+}
+
+/**
+ * Function to format a frame as hexadecimal bytes.
+ *
+ * @param frame   The frame, NULL if only its length is known.
+ * @param length  The length of the frame.
+ * @param buffer  The buffer receiving the text, 3 * MAX_ADU_LENGTH + 32 bytes.
+ */
+void format_frame(const uint8_t *frame, int length, char *buffer) {
+    if (frame == NULL) {
+        sprintf(buffer, "(%d bytes, not traced)", length);
+        return;
+    }
+    for (int i = 0; i < length; i++) sprintf(buffer + (i ? 3 * i - 1 : 0), "%s%02x", i ? " " : "", frame[i]);
+    if (length == 0) buffer[0] = '\0';
+}
+
+/**
+ * Function to compare the reply to a replayed request with the traced one.
+ * Replies the trace only holds the length of are compared by length. The first
+ * MAX_PRINTED_MISMATCHES differences of the whole replay are printed.
+ *
+ * @param thread   The thread owning the connection.
+ * @param conn     The connection.
+ * @param pending  The replayed request.
+ * @param frame    The reply received.
+ * @param length   The length of the reply.
+ */
+void check_replayed_reply(bench_thread_t *thread, const bench_connection_t *conn, const pending_t *pending,
+                          const uint8_t *frame, int length) {
+    static atomic_int printed;
+    const replay_request_t *request = &conn->replay->requests[pending->request];
+    if (request->reply_length == 0) {
+        thread->result.unrecorded++;
+        return;
+    }
+    if (length == request->reply_length && (request->reply == NULL || memcmp(frame, request->reply, length) == 0)) {
+        return;
+    }
+    thread->result.mismatches++;
+    if (atomic_fetch_add(&printed, 1) >= MAX_PRINTED_MISMATCHES) return;
+
+    char sent[3 * MAX_ADU_LENGTH + 32], expected[3 * MAX_ADU_LENGTH + 32], received[3 * MAX_ADU_LENGTH + 32];
+    format_frame(request->request, request->request_length, sent);
+    format_frame(request->reply, request->reply_length, expected);
+    format_frame(frame, length, received);
+    fprintf(stderr, "[ERROR] Reply to request %d of traced connection %08x differs from the trace\n"
+            "  request:  %s\n  traced:   %s\n  received: %s\n", pending->request, conn->replay->connection, sent,
+            expected, received);
+}
+
+/**
+ * Function to send every request that is due on a connection.
+ * Requests due together are sent in a single send(), the way a pipelining
+ * master would. In rate-limited mode a request is timed from the moment it was
+ * due, not from when it could be sent, so a stalled server shows up in the
+ * latencies instead of silently lowering the offered load.
+ *
+ * @param thread  The thread owning the connection.
+ * @param conn    The connection.
+ * @param now     The current time.
+ *
+ * @return 0 if successful, -1 if the connection failed.
+ */
+int send_requests(bench_thread_t *thread, bench_connection_t *conn, uint64_t now) {
+    uint8_t tx[MAX_DEPTH * MAX_ADU_LENGTH];
+    int tx_len = conn->replay ? queue_replayed_requests(thread, conn, now, tx) : 0;
+
+    while (!conn->replay && conn->inflight < thread->config->depth &&
+           (thread->interval_ns == 0 || conn->next_send_ns <= now)) {
+        int function = pick_function(thread);
+        pending_t *pending = &conn->pending[(conn->head + conn->inflight) % MAX_DEPTH];
+        pending->transaction = conn->next_transaction;
+        pending->function = function;
+        pending->code = mix_functions[function];
+        pending->request = -1;
+        pending->sent_ns = thread->interval_ns ? conn->next_send_ns : now;
+        tx_len += build_request(thread, conn, function, tx + tx_len);
+        conn->inflight++;
+        conn->next_send_ns += thread->interval_ns;
+    }
+
+    int sent = 0;
+    while (sent < tx_len) {
+        ssize_t rc = send(conn->fd, tx + sent, tx_len - sent, MSG_NOSIGNAL);
+        if (rc == -1) {
+            if (errno == EINTR) continue;
+            fprintf(stderr, "[ERROR] Error sending request: %s\n", strerror(errno));
+            return -1;
+        }
+        sent += rc;
+    }
+    return 0;
+}
+
+/**
+ * Function to match the replies received on a connection with their requests.
+ *
+ * @param thread  The thread owning the connection.
+ * @param conn    The connection.
+ *
+ * @return 0 if successful, -1 if the connection failed or the server answered out of order.
+ */
+int receive_replies(bench_thread_t *thread, bench_connection_t *conn) {
+    ssize_t len = recv(conn->fd, conn->rx + conn->rx_len, sizeof(conn->rx) - conn->rx_len, 0);
+    if (len == 0) {
+        fprintf(stderr, "[ERROR] Server closed the connection\n");
+        return -1;
+    }
+    if (len == -1) {
+        if (errno == EINTR || errno == EAGAIN) return 0;
+        fprintf(stderr, "[ERROR] Error receiving reply: %s\n", strerror(errno));
+        return -1;
+    }
+    conn->rx_len += len;
+    uint64_t now = monotonic_ns();
+
+    int consumed = 0;
+    while (conn->rx_len - consumed >= MBAP_HEADER_LENGTH) {
+        const uint8_t *frame = conn->rx + consumed;
+        int frame_length = 6 + ((frame[4] << 8) | frame[5]);
+        if (frame_length < MBAP_HEADER_LENGTH + 1 || frame_length > MAX_ADU_LENGTH) {
+            fprintf(stderr, "[ERROR] Invalid MBAP header in reply\n");
+            return -1;
+        }
+        if (conn->rx_len - consumed < frame_length) break;
+
+        pending_t *pending = &conn->pending[conn->head];
+        int transaction = (frame[0] << 8) | frame[1];
+        if (conn->inflight == 0 || transaction != pending->transaction ||
+            (frame[MBAP_HEADER_LENGTH] & 0x7F) != pending->code) {
+            fprintf(stderr, "[ERROR] Reply does not match the oldest pending request\n");
+            return -1;
+        }
+        // Requests still in flight when the measurement ends are not counted
+        if (now <= thread->end_ns) {
+            if (frame[MBAP_HEADER_LENGTH] & 0x80) thread->result.exceptions++;
+            uint64_t sent = pending->sent_ns;
+            record_latency(&thread->result.by_function[pending->function], now > sent ? now - sent : 0);
+        }
+        if (pending->request >= 0) check_replayed_reply(thread, conn, pending, frame, frame_length);
+        conn->head = (conn->head + 1) % MAX_DEPTH;
+        conn->inflight--;
+        consumed += frame_length;
+    }
+
+    conn->rx_len -= consumed;
+    memmove(conn->rx, conn->rx + consumed, conn->rx_len);
+    return 0;
+}
+
+/**
+ * Thread entry point driving a share of the connections.
+ * Every connection keeps up to depth requests in flight. Flat out, a new
+ * request is sent as soon as a reply frees a slot; rate-limited, each
+ * connection sends on a fixed schedule. Replayed connections follow the
+ * schedule of the trace and end once every traced request got its reply.
+ *
+ * @param arg  The bench_thread_t to run.
+ *
+ * @return NULL.
+ */
+void *bench_thread(void *arg) {
+    bench_thread_t *thread = arg;
+    struct epoll_event events[MAX_EPOLL_EVENTS];
+    int alive = thread->nb_conns;
+
+    for (int i = 0; i < thread->nb_conns; i++) {
+        // Spread the first requests over one interval so connections do not fire together
+        thread->conns[i].next_send_ns = thread->start_ns + thread->interval_ns * i / thread->nb_conns;
+    }
+
+    int timed = thread->interval_ns > 0 || (thread->config->replay_file && thread->config->speed > 0);
+    uint64_t now = monotonic_ns();
+    while (now < thread->end_ns && alive > 0) {
+        uint64_t next_due = thread->end_ns;
+        for (int i = 0; i < thread->nb_conns; i++) {
+            bench_connection_t *conn = &thread->conns[i];
+            if (conn->fd == -1) continue;
+            if (send_requests(thread, conn, now) == -1) {
+                drop_connection(thread, conn);
+                alive--;
+                continue;
+            }
+            if (conn->replay) {
+                if (end_replayed_connection(thread, conn, now)) {
+                    alive--;
+                    continue;
+                }
+                if (timed && conn->next_request < conn->replay->nb_requests && conn->inflight < MAX_DEPTH) {
+                    uint64_t due = replay_due_ns(thread, &conn->replay->requests[conn->next_request]);
+                    if (due < next_due) next_due = due;
+                }
+            } else if (thread->interval_ns && conn->inflight < thread->config->depth && conn->next_send_ns < next_due) {
+                next_due = conn->next_send_ns;
+            }
+        }
+
+        uint64_t wait_ms = (next_due - now) / 1000000;  // Rounds down, a late request is timed from when it was due
+        int timeout = !timed || wait_ms > 100 ? 100 : (int)wait_ms;
+        int n = epoll_wait(thread->epoll_fd, events, MAX_EPOLL_EVENTS, timeout);
+        if (n == -1 && errno != EINTR) {
+            fprintf(stderr, "[ERROR] Error waiting for replies: %s\n", strerror(errno));
+            break;
+        }
+        for (int i = 0; i < n; i++) {
+            bench_connection_t *conn = events[i].data.ptr;
+            if (conn->fd != -1 && receive_replies(thread, conn) == -1) {
+                drop_connection(thread, conn);
+                alive--;
+            }
+        }
+        now = monotonic_ns();
+    }
+    return NULL;
+}
+
+/**
+ * Function to parse a function code mix such as 3:80,6:10,16:10.
+ *
+ * @param arg  The option argument.
+ * @param mix  The weights to set, indexed by MIX_*.
+ *
+ * @return 0 if successful, -1 if the mix is malformed.
+ */
+int parse_mix(const char *arg, int *mix) {
+    const char *p = arg;
+    memset(mix, 0, MIX_COUNT * sizeof(int));
+    while (*p) {
+        char *end;
+        long function = strtol(p, &end, 10);
+        if (end == p || *end != ':') return -1;
+        p = end + 1;
+        long weight = strtol(p, &end, 10);
+        if (end == p || weight < 0 || weight > 1000000) return -1;
+
+        int slot = -1;
+        for (int i = 0; i < MIX_COUNT; i++) {
+            if (mix_functions[i] == function) slot = i;
+        }
+        if (slot == -1) return -1;
+        mix[slot] = (int)weight;
+
+        if (*end == ',') end++;
+        else if (*end != '\0') return -1;
+        p = end;
+    }
+    return mix[0] + mix[1] + mix[2] > 0 ? 0 : -1;
+}
+
+/**
+ * Function to parse an address range given as [START:]SPAN.
+ *
+ * @param arg     The option argument.
+ * @param config  The settings to update.
+ *
+ * @return 0 if successful, -1 if the argument is malformed or leaves the address space.
+ */
+int parse_address(const char *arg, bench_config_t *config) {
+    char *end;
+    long start = 0;
+    long span = strtol(arg, &end, 10);
+    if (*end == ':') {
+        start = span;
+        span = strtol(end + 1, &end, 10);
+    }
+    if (*end != '\0' || start < 0 || span < 1 || start + span > 65536) return -1;
+
+    config->address = (int)start;
+    config->span = (int)span;
+    return 0;
+}
+
+/**
+ * Function to parse command-line arguments.
+ *
+ * @param argc    The number of command-line arguments.
+ * @param argv    The array of command-line arguments.
+ * @param config  The benchmark settings to update.
+ */
+void parse_arguments(int argc, char *argv[], bench_config_t *config) {
+    static struct option long_options[] = {
+        {"help", no_argument, NULL, 'h'},
+        {"version", no_argument, NULL, 'v'},
+        {"depth", required_argument, NULL, OPT_DEPTH},
+        {"mix", required_argument, NULL, OPT_MIX},
+        {"unit", required_argument, NULL, OPT_UNIT},
+        {"address", required_argument, NULL, OPT_ADDRESS},
+        {"replay", required_argument, NULL, OPT_REPLAY},
+        {"speed", required_argument, NULL, OPT_SPEED},
+        {0, 0, 0, 0}
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "i:p:c:t:d:r:n:hv", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'i':
+                config->server_ip = optarg;
+                break;
+            case 'p':
+                config->server_port = atoi(optarg);
+                break;
+            case 'c':
+                config->connections = atoi(optarg);
+                if (config->connections < 1 || config->connections > MAX_CONNECTIONS) {
+                    fprintf(stderr, "[ERROR] Connection count must be between 1 and %d\n", MAX_CONNECTIONS);
+                    exit(-1);
+                }
+                break;
+            case 't':
+                config->threads = atoi(optarg);
+                if (config->threads < 1 || config->threads > MAX_THREADS) {
+                    fprintf(stderr, "[ERROR] Thread count must be between 1 and %d\n", MAX_THREADS);
+                    exit(-1);
+                }
+                break;
+            case 'd':
+                config->duration = atoi(optarg);
+                if (config->duration < 1) {
+                    fprintf(stderr, "[ERROR] Duration must be at least 1 second\n");
+                    exit(-1);
+                }
+                break;
+            case 'r':
+                config->rate = atof(optarg);
+                if (config->rate < 0) {
+                    fprintf(stderr, "[ERROR] Rate must not be negative\n");
+                    exit(-1);
+                }
+                break;
+            case 'n':
+                config->count = atoi(optarg);
+                if (config->count < 1 || config->count > MAX_WRITE_REGISTERS) {
+                    fprintf(stderr, "[ERROR] Register count must be between 1 and %d\n", MAX_WRITE_REGISTERS);
+                    exit(-1);
+                }
+                break;
+            case OPT_DEPTH:
+                config->depth = atoi(optarg);
+                if (config->depth < 1 || config->depth > MAX_DEPTH) {
+                    fprintf(stderr, "[ERROR] Pipelining depth must be between 1 and %d\n", MAX_DEPTH);
+                    exit(-1);
+                }
+                break;
+            case OPT_MIX:
+                if (parse_mix(optarg, config->mix) == -1) {
+                    fprintf(stderr, "[ERROR] Invalid mix '%s', expected FC:WEIGHT pairs with FC 3, 6 or 16\n", optarg);
+                    exit(-1);
+                }
+                break;
+            case OPT_UNIT:
+                config->unit_id = atoi(optarg);
+                if (config->unit_id < 0 || config->unit_id > 255) {
+                    fprintf(stderr, "[ERROR] Unit ID must be between 0 and 255\n");
+                    exit(-1);
+                }
+                break;
+            case OPT_ADDRESS:
+                if (parse_address(optarg, config) == -1) {
+                    fprintf(stderr, "[ERROR] Invalid address range '%s', expected [START:]SPAN within 65536 addresses\n",
+                            optarg);
+                    exit(-1);
+                }
+                break;
+            case OPT_REPLAY:
+                config->replay_file = optarg;
+                break;
+            case OPT_SPEED:
+                config->speed = atof(optarg);
+                if (config->speed < 0) {
+                    fprintf(stderr, "[ERROR] Replay speed must not be negative\n");
+                    exit(-1);
+                }
+                break;
+            case 'v':
+                printf("Modbus Benchmark - Version %s\n", VERSION);
+                exit(0);
+            case 'h':
+                print_usage();
+                exit(0);
+            default:
+                print_usage();
+                exit(-1);
+        }
+    }
+
+    if (config->replay_file) return;
+    if (config->count > config->span && (config->mix[MIX_READ_HOLDING_REGISTERS] || config->mix[MIX_WRITE_MULTIPLE_REGISTERS])) {
+        fprintf(stderr, "[ERROR] Register count %d does not fit in an address span of %d\n", config->count, config->span);
+        exit(-1);
+    }
+    if (config->mix[MIX_READ_HOLDING_REGISTERS] && config->count > MAX_READ_REGISTERS) {
+        fprintf(stderr, "[ERROR] Register count must be at most %d for FC03\n", MAX_READ_REGISTERS);
+        exit(-1);
+    }
+    if (config->threads > config->connections) config->threads = config->connections;
+}
+
+/**
+ * Function to swap the fields of a trace record written on a host of the other byte order.
+ *
+ * @param record  The record to swap.
+ */
+void swap_trace_record(trace_record_t *record) {
+    record->timestamp_ns = __builtin_bswap64(record->timestamp_ns);
+    record->connection = __builtin_bswap32(record->connection);
+    record->captured_length = __builtin_bswap16(record->captured_length);
+    record->frame_length = __builtin_bswap16(record->frame_length);
+}
+
+/**
+ * Function to order traced frames by connection, then by position in the file.
+ */
+int compare_traced_frames(const void *a, const void *b) {
+    const trace_record_t *x = *(trace_record_t *const *)a, *y = *(trace_record_t *const *)b;
+    if (x->connection != y->connection) return x->connection < y->connection ? -1 : 1;
+    return x < y ? -1 : x > y;
+}
+
+/**
+ * Function to load the requests of a frame trace written by modbus_server --trace.
+ * Requests are grouped by traced connection and each reply is paired with the
+ * oldest unanswered request of its connection carrying the same transaction
+ * identifier. Requests the trace did not capture in full are skipped. The
+ * streams point into the returned file contents; the requests of all streams
+ * are one allocation starting at the first stream's.
+ *
+ * @param path         The trace file.
+ * @param streams      Set to the streams, one per traced connection with requests.
+ * @param nb_streams   Set to the number of streams.
+ * @param duration_ns  Set to the time between the first and the last traced request.
+ *
+ * @return The file contents if successful, NULL otherwise.
+ */
+uint8_t *load_trace(const char *path, replay_stream_t **streams, int *nb_streams, uint64_t *duration_ns) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        fprintf(stderr, "[ERROR] Error opening trace '%s': %s\n", path, strerror(errno));
+        return NULL;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    rewind(file);
+    uint8_t *data = size > 0 ? malloc(size) : NULL;
+    if (data == NULL || fread(data, 1, size, file) != (size_t)size) {
+        fprintf(stderr, "[ERROR] Error reading trace '%s'\n", path);
+        fclose(file);
+        free(data);
+        return NULL;
+    }
+    fclose(file);
+
+    trace_file_header_t header;
+    int swap = 0;
+    if ((size_t)size >= sizeof(header)) {
+        memcpy(&header, data, sizeof(header));
+        swap = header.magic == __builtin_bswap32(TRACE_MAGIC);
+        if (swap) header.version_major = __builtin_bswap16(header.version_major);
+    }
+    if ((size_t)size < sizeof(header) || (header.magic != TRACE_MAGIC && !swap) ||
+        header.version_major != TRACE_VERSION_MAJOR) {
+        fprintf(stderr, "[ERROR] '%s' is not a version %d frame trace\n", path, TRACE_VERSION_MAJOR);
+        free(data);
+        return NULL;
+    }
+
+    // Records are 8-byte aligned in the file but payloads are not, so each record is copied to an aligned array
+    int capacity = 1024, nb_records = 0;
+    trace_record_t *records = malloc(capacity * sizeof(*records));
+    const uint8_t **payloads = malloc(capacity * sizeof(*payloads));
+    int failed = records == NULL || payloads == NULL;
+    size_t offset = sizeof(header);
+    while (!failed && offset + sizeof(trace_record_t) <= (size_t)size) {
+        if (nb_records == capacity) {
+            capacity *= 2;
+            trace_record_t *grown = realloc(records, capacity * sizeof(*records));
+            if (grown) records = grown;
+            const uint8_t **grown_payloads = realloc(payloads, capacity * sizeof(*payloads));
+            if (grown_payloads) payloads = grown_payloads;
+            failed = grown == NULL || grown_payloads == NULL;
+            if (failed) break;
+        }
+        trace_record_t *record = &records[nb_records];
+        memcpy(record, data + offset, sizeof(*record));
+        if (swap) swap_trace_record(record);
+        offset += sizeof(*record);
+        if (offset + record->captured_length > (size_t)size) {
+            fprintf(stderr, "[INFO] Ignoring the truncated last record of '%s'\n", path);
+            break;
+        }
+        payloads[nb_records++] = data + offset;
+        offset += record->captured_length;
+    }
+    trace_record_t **order = failed ? NULL : malloc((nb_records + 1) * sizeof(*order));
+    replay_request_t *requests = malloc((nb_records + 1) * sizeof(*requests));
+    *streams = calloc(nb_records + 1, sizeof(**streams));
+    if (order == NULL || requests == NULL || *streams == NULL) {
+        fprintf(stderr, "[ERROR] Error allocating the trace of '%s'\n", path);
+        free(records);
+        free(payloads);
+        free(order);
+        free(requests);
+        free(*streams);
+        free(data);
+        return NULL;
+    }
+
+    uint64_t first_ns = UINT64_MAX, last_ns = 0;
+    for (int i = 0; i < nb_records; i++) {
+        order[i] = &records[i];
+        if (records[i].direction == TRACE_REQUEST && records[i].timestamp_ns < first_ns) {
+            first_ns = records[i].timestamp_ns;
+        }
+        if (records[i].direction == TRACE_REQUEST && records[i].timestamp_ns > last_ns) {
+            last_ns = records[i].timestamp_ns;
+        }
+    }
+    qsort(order, nb_records, sizeof(*order), compare_traced_frames);
+
+    int nb_requests = 0;
+    *nb_streams = 0;
+    for (int i = 0; i < nb_records;) {
+        replay_stream_t *stream = &(*streams)[*nb_streams];
+        stream->connection = order[i]->connection;
+        stream->requests = requests + nb_requests;
+        int unanswered = 0;
+        for (; i < nb_records && order[i]->connection == stream->connection; i++) {
+            const trace_record_t *record = order[i];
+            const uint8_t *frame = payloads[record - records];
+            if (record->captured_length < MBAP_HEADER_LENGTH + 1) continue;
+            if (record->direction == TRACE_REQUEST) {
+                if (record->captured_length < record->frame_length || record->frame_length > MAX_ADU_LENGTH) continue;
+                replay_request_t *request = &stream->requests[stream->nb_requests++];
+                request->offset_ns = record->timestamp_ns - first_ns;
+                request->request = frame;
+                request->request_length = record->frame_length;
+                request->reply = NULL;
+                request->reply_length = 0;
+            } else if (record->direction == TRACE_RESPONSE) {
+                // Requests skipped by a reply went unanswered, e.g. when the server closed the connection
+                while (unanswered < stream->nb_requests &&
+                       memcmp(stream->requests[unanswered].request, frame, 2) != 0) unanswered++;
+                if (unanswered == stream->nb_requests) continue;
+                replay_request_t *request = &stream->requests[unanswered++];
+                request->reply_length = record->frame_length;
+                if (!(record->flags & TRACE_FLAG_NO_PAYLOAD) && record->captured_length >= record->frame_length) {
+                    request->reply = frame;
+                }
+            }
+        }
+        if (stream->nb_requests > 0) {
+            nb_requests += stream->nb_requests;
+            (*nb_streams)++;
+        }
+    }
+    *duration_ns = nb_requests > 0 ? last_ns - first_ns : 0;
+
+    free(records);
+    free(payloads);
+    free(order);
+    if (*nb_streams == 0) {
+        fprintf(stderr, "[ERROR] Trace '%s' holds no complete request\n", path);
+        free(requests);
+        free(*streams);
+        free(data);
+        return NULL;
+    }
+    return data;
+}
+
+/**
+ * Main function to run the benchmark.
+ * All connections are opened before the measurement starts, then each thread
+ * drives its share of them for the configured duration, or until every traced
+ * request is replayed, and the merged results are printed.
+ *
+ * @param argc  The number of command-line arguments.
+ * @param argv  The array of command-line arguments.
+ *
+ * @return 0 if the benchmark ran without errors, -1 otherwise.
+ */
+int main(int argc, char *argv[]) {
+    bench_config_t config = {
+        .server_ip = DEFAULT_SERVER_IP,
+        .server_port = DEFAULT_SERVER_PORT,
+        .connections = DEFAULT_CONNECTIONS,
+        .threads = DEFAULT_THREADS,
+        .duration = DEFAULT_DURATION,
+        .depth = DEFAULT_DEPTH,
+        .mix = { [MIX_READ_HOLDING_REGISTERS] = 100 },
+        .unit_id = DEFAULT_UNIT_ID,
+        .span = DEFAULT_SPAN,
+        .count = DEFAULT_REG_COUNT,
+        .speed = 1,
+    };
+    parse_arguments(argc, argv, &config);
+
+    replay_stream_t *streams = NULL;
+    uint8_t *trace = NULL;
+    uint64_t trace_ns = 0;
+    if (config.replay_file) {
+        int nb_streams;
+        trace = load_trace(config.replay_file, &streams, &nb_streams, &trace_ns);
+        if (trace == NULL) return -1;
+        if (nb_streams > MAX_CONNECTIONS) {
+            fprintf(stderr, "[ERROR] Trace holds %d connections, at most %d can be replayed\n", nb_streams,
+                    MAX_CONNECTIONS);
+            free(streams[0].requests);
+            free(streams);
+            free(trace);
+            return -1;
+        }
+        int nb_requests = 0;
+        for (int i = 0; i < nb_streams; i++) nb_requests += streams[i].nb_requests;
+        config.connections = nb_streams;
+        if (config.threads > nb_streams) config.threads = nb_streams;
+        config.rate = 0;
+
+        printf("[INFO] Replaying %d request(s) of %d connection(s) from %s against %s:%d on %d thread(s), ",
+               nb_requests, nb_streams, config.replay_file, config.server_ip, config.server_port, config.threads);
+        if (config.speed > 0) printf("%gx speed\n", config.speed);
+        else printf("flat out, depth %d\n", config.depth);
+    } else {
+        printf("[INFO] Benchmarking %s:%d with %d connection(s) on %d thread(s), depth %d, ", config.server_ip,
+               config.server_port, config.connections, config.threads, config.depth);
+        if (config.rate > 0) printf("%.0f requests/s\n", config.rate);
+        else printf("flat out\n");
+    }
+
+    bench_connection_t *conns = calloc(config.connections, sizeof(*conns));
+    bench_thread_t *threads = calloc(config.threads, sizeof(*threads));
+    if (conns == NULL || threads == NULL) {
+        fprintf(stderr, "[ERROR] Error allocating connections: %s\n", strerror(errno));
+        return -1;
+    }
+    for (int i = 0; streams && i < config.connections; i++) conns[i].replay = &streams[i];
+
+    // Connections are spread evenly, thread i owns a contiguous share of them
+    int rc = 0;
+    int next = 0;
+    for (int t = 0; t < config.threads && rc == 0; t++) {
+        bench_thread_t *thread = &threads[t];
+        thread->id = t;
+        thread->config = &config;
+        thread->conns = conns + next;
+        thread->nb_conns = config.connections / config.threads + (t < config.connections % config.threads);
+        thread->random = 0x9E3779B97F4A7C15ull * (t + 1);
+        thread->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        if (thread->epoll_fd == -1) {
+            fprintf(stderr, "[ERROR] Error creating epoll instance: %s\n", strerror(errno));
+            rc = -1;
+            break;
+        }
+        if (config.rate > 0) {
+            thread->interval_ns = (uint64_t)(1e9 * config.connections / config.rate);
+            if (thread->interval_ns == 0) thread->interval_ns = 1;
+        }
+
+        for (int i = 0; i < thread->nb_conns; i++) {
+            bench_connection_t *conn = &thread->conns[i];
+            conn->fd = open_connection(&config);
+            if (conn->fd == -1) {
+                rc = -1;
+                break;
+            }
+            struct epoll_event ev = { .events = EPOLLIN, .data.ptr = conn };
+            epoll_ctl(thread->epoll_fd, EPOLL_CTL_ADD, conn->fd, &ev);
+        }
+        next += thread->nb_conns;
+    }
+
+    int started = 0;
+    uint64_t start_ns = monotonic_ns();
+    if (rc == 0) {
+        for (int t = 0; t < config.threads; t++) {
+            threads[t].start_ns = start_ns;
+            threads[t].end_ns = streams ? UINT64_MAX : start_ns + (uint64_t)config.duration * 1000000000ull;
+            int err = pthread_create(&threads[t].thread, NULL, bench_thread, &threads[t]);
+            if (err != 0) {
+                fprintf(stderr, "[ERROR] Error starting client thread: %s\n", strerror(err));
+                rc = -1;
+                break;
+            }
+            started++;
+        }
+    }
+
+    bench_result_t total = { 0 };
+    int finished = 0;
+    for (int t = 0; t < started; t++) {
+        pthread_join(threads[t].thread, NULL);
+        for (int f = 0; f <= MIX_OTHER; f++) {
+            merge_histogram(&total.by_function[f], &threads[t].result.by_function[f]);
+        }
+        total.exceptions += threads[t].result.exceptions;
+        total.errors += threads[t].result.errors;
+        total.mismatches += threads[t].result.mismatches;
+        total.unrecorded += threads[t].result.unrecorded;
+        finished += threads[t].finished;
+    }
+    double elapsed = (monotonic_ns() - start_ns) / 1e9;
+
+    if (started > 0) {
+        latency_histogram_t all = { 0 };
+        for (int f = 0; f <= MIX_OTHER; f++) merge_histogram(&all, &total.by_function[f]);
+        printf("\n[INFO] Results over %.1f s:\n", elapsed);
+        printf("  Requests:   %llu (%llu exceptions, %llu connection errors)\n", (unsigned long long)all.count,
+               (unsigned long long)total.exceptions, (unsigned long long)total.errors);
+        if (streams) {
+            printf("  Replay:     %d of %d connection(s) completed, traced over %.1f s\n", finished,
+                   config.connections, trace_ns / 1e9);
+            printf("  Replies:    %llu differ from the trace, %llu not in the trace\n",
+                   (unsigned long long)total.mismatches, (unsigned long long)total.unrecorded);
+            printf("  Throughput: %.0f requests/s\n", elapsed > 0 ? all.count / elapsed : 0);
+        } else {
+            printf("  Throughput: %.0f requests/s\n", all.count / (elapsed < config.duration ? elapsed : config.duration));
+        }
+        printf("  Latency (us):\n");
+        for (int f = 0; f <= MIX_OTHER; f++) print_latency(mix_names[f], &total.by_function[f]);
+        print_latency("all", &all);
+        if (total.errors || total.mismatches) rc = -1;
+    }
+
+    for (int i = 0; i < config.connections; i++) {
+        if (conns[i].fd > 0) close(conns[i].fd);
+    }
+    for (int t = 0; t < config.threads; t++) {
+        if (threads[t].epoll_fd > 0) close(threads[t].epoll_fd);
+    }
+    free(conns);
+    free(threads);
+    if (streams) free(streams[0].requests);
+    free(streams);
+    free(trace);
+    return rc;
+}
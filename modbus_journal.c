@@ -0,0 +1,506 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
+
+#include "modbus_journal.h"
+
+#define ADDRESS_SPACE 65536              // Number of addresses in each Modbus table
+#define UNIT_ID_COUNT 256                // Number of Modbus unit identifiers
+#define MAX_FILES 64                     // Upper bound of journal files read together
+#define CSV_VALUES_PER_LINE 16           // Values per line of the rebuilt register map
+#define VERSION "1.0.0"                  // Tool version
+
+// Long-only option identifiers
+#define OPT_AT 256
+#define OPT_STATE 257
+#define OPT_SINGLE_MAP 258
+
+/**
+ * Tool settings collected from the command line.
+ */
+typedef struct {
+    uint64_t at_ns;        // Ignore writes after this CLOCK_REALTIME time, UINT64_MAX for none
+    int state;             // Print the rebuilt register map instead of the writes
+    int single_map;        // The server had one register map shared by every unit
+} journal_config_t;
+
+/**
+ * One record found in a journal file.
+ */
+typedef struct {
+    journal_record_t record;         // Copy of the record header, records are not aligned in the file
+    const uint8_t *values;           // Entries before the write, then after it, in the mapped file
+    uint64_t order_ns;               // Timestamp, raised to keep the run in sequence order
+    int file;                        // Index of the file the record was read from
+    int run;                         // Server run within that file
+} journal_entry_t;
+
+/**
+ * Register map rebuilt from the journal.
+ * Only written entries are known; tables are allocated on the first write.
+ */
+typedef struct {
+    uint16_t *values[UNIT_ID_COUNT][2];   // Per unit, coils then holding registers, NULL if never written
+    uint8_t *known[UNIT_ID_COUNT][2];     // 1 for each entry a write set
+} rebuilt_map_t;
+
+/**
+ * Function to display the usage/help message.
+ */
+void print_usage() {
+    printf("Modbus Journal Decoder - Version %s\n\n", VERSION);
+    printf("Usage: modbus_journal [OPTIONS] FILE...\n\n");
+
+    printf("General Options:\n");
+    printf("  -h, --help        Show this help message\n");
+    printf("  -v, --version     Show version information\n");
+
+    printf("\nDecoding:\n");
+    printf("  --at TIME         Ignore writes after TIME, Unix seconds or YYYY-MM-DDTHH:MM:SS[.FRACTION] UTC\n");
+    printf("  --state           Print the register values as of TIME, in the --load-map CSV format,\n");
+    printf("                    instead of listing the writes\n");
+    printf("  --single-map      The server shared one register map between all units\n");
+
+    printf("\nExample:\n");
+    printf("  modbus_journal /var/lib/modbus/journal\n");
+    printf("  modbus_journal --state --at 2026-03-02T14:05:00 journal.0 journal.1 > before.csv\n");
+}
+
+/**
+ * Function to parse a time given as Unix seconds or as an ISO 8601 UTC date and time.
+ *
+ * @param arg  The option argument.
+ * @param ns   Set to the time in nanoseconds since the epoch.
+ *
+ * @return 0 if successful, -1 if the argument is malformed.
+ */
+int parse_time(const char *arg, uint64_t *ns) {
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    const char *fraction = strptime(arg, "%Y-%m-%dT%H:%M:%S", &tm);
+    double seconds;
+    char *end;
+    if (fraction) {
+        seconds = (double)timegm(&tm);
+        if (*fraction == '.') {
+            seconds += strtod(fraction, &end);
+            fraction = end;
+        }
+        if (*fraction == 'Z') fraction++;
+        if (*fraction != '\0') return -1;
+    } else {
+        seconds = strtod(arg, &end);
+        if (end == arg || *end != '\0') return -1;
+    }
+    if (seconds < 0) return -1;
+    *ns = (uint64_t)(seconds * 1e9);
+    return 0;
+}
+
+/**
+ * Function to format a journal timestamp as an ISO 8601 UTC date and time.
+ *
+ * @param ns      The time in nanoseconds since the epoch.
+ * @param buffer  The buffer receiving the text.
+ * @param size    The size of the buffer.
+ */
+void format_time(uint64_t ns, char *buffer, size_t size) {
+    time_t seconds = ns / 1000000000ull;
+    struct tm tm;
+    gmtime_r(&seconds, &tm);
+    size_t length = strftime(buffer, size, "%Y-%m-%dT%H:%M:%S", &tm);
+    snprintf(buffer + length, size - length, ".%09lluZ", (unsigned long long)(ns % 1000000000ull));
+}
+
+/**
+ * Function to get the size of each half of a record's values.
+ *
+ * @param record  The record.
+ *
+ * @return The number of bytes taken by the entries before, or after, the write.
+ */
+int value_bytes(const journal_record_t *record) {
+    return record->table == JOURNAL_TABLE_COILS ? (record->count + 7) / 8 : record->count * 2;
+}
+
+/**
+ * Function to read entry i of one half of a record's values.
+ *
+ * @param record  The record.
+ * @param values  The half of its values.
+ * @param i       The index of the entry.
+ *
+ * @return The coil state or register value.
+ */
+uint16_t record_value(const journal_record_t *record, const uint8_t *values, int i) {
+    if (record->table == JOURNAL_TABLE_COILS) return (values[i / 8] >> (i % 8)) & 1;
+    uint16_t value;
+    memcpy(&value, values + 2 * i, sizeof(value));
+    return value;
+}
+
+/**
+ * Function to check whether a run starts at a position of a journal.
+ *
+ * @param base      The mapped journal.
+ * @param offset    The position to check.
+ * @param size      The size of the journal.
+ * @param after_ns  The time of the last record read, the run must start later.
+ *
+ * @return 1 if a JOURNAL_START record is found there, 0 otherwise.
+ */
+int is_run_start(const uint8_t *base, size_t offset, size_t size, uint64_t after_ns) {
+    journal_record_t record, start = { .type = JOURNAL_START };
+    if (size - offset < sizeof(record)) return 0;
+    memcpy(&record, base + offset, sizeof(record));
+    start.timestamp_ns = record.timestamp_ns;
+    return record.timestamp_ns >= after_ns && memcmp(&record, &start, sizeof(record)) == 0;
+}
+
+/**
+ * Function to find the next run of a journal.
+ *
+ * @param base      The mapped journal.
+ * @param offset    The position to search from.
+ * @param end       The position to search up to, excluded.
+ * @param size      The size of the journal.
+ * @param after_ns  The time of the last record read, the run must start later.
+ *
+ * @return The position of the run's JOURNAL_START record, end if there is none.
+ */
+size_t find_run_start(const uint8_t *base, size_t offset, size_t end, size_t size, uint64_t after_ns) {
+    for (; offset < end; offset++) {
+        if (is_run_start(base, offset, size, after_ns)) return offset;
+    }
+    return end;
+}
+
+/**
+ * Function to map a journal file and collect its records.
+ * A record cut short by a server that died while appending is reported and
+ * skipped: reading resumes at the run the next server start appended, found
+ * by its JOURNAL_START record, or stops at the end of the file.
+ *
+ * @param path       The journal file.
+ * @param file       The index of the file.
+ * @param entries    The collected records, grown as needed.
+ * @param count      The number of collected records.
+ * @param allocated  The number of records the array can hold.
+ *
+ * @return 0 if successful, -1 otherwise.
+ */
+int read_journal(const char *path, int file, journal_entry_t **entries, size_t *count, size_t *allocated) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) == -1) {
+        fprintf(stderr, "[ERROR] Error opening journal %s: %s\n", path, strerror(errno));
+        if (fd != -1) close(fd);
+        return -1;
+    }
+    size_t size = st.st_size;
+    journal_file_header_t header;
+    if (size < sizeof(header)) {
+        fprintf(stderr, "[ERROR] %s is too short to be a journal\n", path);
+        close(fd);
+        return -1;
+    }
+    // The mapping stays until the tool exits, the entries point into it
+    const uint8_t *base = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        fprintf(stderr, "[ERROR] Error mapping journal %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    memcpy(&header, base, sizeof(header));
+    if (header.magic != JOURNAL_MAGIC) {
+        fprintf(stderr, "[ERROR] %s is not a journal, or was written on a host of the other byte order\n", path);
+        return -1;
+    }
+    if (header.version_major != JOURNAL_VERSION_MAJOR) {
+        fprintf(stderr, "[ERROR] %s is a version %d journal, only version %d is supported\n", path,
+                header.version_major, JOURNAL_VERSION_MAJOR);
+        return -1;
+    }
+
+    size_t offset = sizeof(header);
+    int run = -1;
+    uint64_t last_ns = 0;
+    while (offset < size) {
+        journal_record_t record = { 0 };
+        memcpy(&record, base + offset, size - offset < sizeof(record) ? size - offset : sizeof(record));
+        size_t length = sizeof(record) + (record.type == JOURNAL_WRITE ? 2 * value_bytes(&record) : 0);
+        int valid = size - offset >= length &&
+                    (record.type == JOURNAL_START || (record.type == JOURNAL_WRITE && record.count > 0 &&
+                     (record.table == JOURNAL_TABLE_COILS || record.table == JOURNAL_TABLE_HOLDING_REGISTERS)));
+
+        // The run appended after a record cut short would otherwise be read as the rest of that record
+        size_t next = find_run_start(base, offset + 1, valid ? offset + length : size, size,
+                                     valid ? record.timestamp_ns : last_ns);
+        if (!valid || next < offset + length) {
+            fprintf(stderr, "[ERROR] %s: skipping a record cut short at offset %zu\n", path, offset);
+            offset = next;
+            continue;
+        }
+        last_ns = record.timestamp_ns;
+        if (record.type == JOURNAL_START) {
+            run++;
+        } else if (record.type == JOURNAL_WRITE && run >= 0) {
+            if (*count == *allocated) {
+                size_t grown = *allocated ? 2 * *allocated : 4096;
+                journal_entry_t *array = realloc(*entries, grown * sizeof(journal_entry_t));
+                if (array == NULL) {
+                    fprintf(stderr, "[ERROR] Error allocating journal records: %s\n", strerror(errno));
+                    return -1;
+                }
+                *entries = array;
+                *allocated = grown;
+            }
+            journal_entry_t *entry = &(*entries)[(*count)++];
+            entry->record = record;
+            entry->values = base + offset + sizeof(record);
+            entry->order_ns = record.timestamp_ns;
+            entry->file = file;
+            entry->run = run;
+        }
+        offset += length;
+    }
+    return 0;
+}
+
+/**
+ * Function to order records by file, run and sequence number.
+ */
+int compare_sequence(const void *a, const void *b) {
+    const journal_entry_t *x = a, *y = b;
+    if (x->file != y->file) return x->file < y->file ? -1 : 1;
+    if (x->run != y->run) return x->run < y->run ? -1 : 1;
+    if (x->record.sequence != y->record.sequence) return x->record.sequence < y->record.sequence ? -1 : 1;
+    return 0;
+}
+
+/**
+ * Function to order records as the writes happened across files.
+ */
+int compare_order(const void *a, const void *b) {
+    const journal_entry_t *x = a, *y = b;
+    if (x->order_ns != y->order_ns) return x->order_ns < y->order_ns ? -1 : 1;
+    return compare_sequence(a, b);
+}
+
+/**
+ * Function to put the records of every file in the order the writes were applied.
+ * Within a run, sequence numbers are authoritative: timestamps are raised where
+ * the clock stepped back so they never contradict them. Runs of different files,
+ * e.g. the processes of --reuseport, are then merged by time. Missing sequence
+ * numbers are reported as dropped writes.
+ *
+ * @param entries  The records.
+ * @param count    The number of records.
+ * @param paths    The journal files, for messages.
+ */
+void order_entries(journal_entry_t *entries, size_t count, char **paths) {
+    qsort(entries, count, sizeof(*entries), compare_sequence);
+    for (size_t i = 1; i < count; i++) {
+        journal_entry_t *previous = &entries[i - 1], *entry = &entries[i];
+        if (entry->file != previous->file || entry->run != previous->run) continue;
+        if (entry->order_ns < previous->order_ns) entry->order_ns = previous->order_ns;
+        uint64_t missing = entry->record.sequence - previous->record.sequence - 1;
+        if (missing) {
+            fprintf(stderr, "[ERROR] %s: %llu writes were dropped after sequence %llu of run %d\n",
+                    paths[entry->file], (unsigned long long)missing,
+                    (unsigned long long)previous->record.sequence, entry->run + 1);
+        }
+    }
+    qsort(entries, count, sizeof(*entries), compare_order);
+}
+
+/**
+ * Function to print one half of a record's values, separated by commas.
+ *
+ * @param record  The record.
+ * @param values  The half of its values.
+ */
+void print_values(const journal_record_t *record, const uint8_t *values) {
+    for (int i = 0; i < record->count; i++) {
+        printf("%s%u", i ? "," : "", record_value(record, values, i));
+    }
+}
+
+/**
+ * Function to print a write.
+ *
+ * @param entry  The record of the write.
+ */
+void print_write(const journal_entry_t *entry) {
+    const journal_record_t *record = &entry->record;
+    char when[64];
+    char client[INET_ADDRSTRLEN] = "serial";
+    format_time(record->timestamp_ns, when, sizeof(when));
+    if (record->client) inet_ntop(AF_INET, &record->client, client, sizeof(client));
+    printf("%s seq=%llu client=%s connection=%08x unit=%u fc=%u table=%s address=%u count=%u old=", when,
+           (unsigned long long)record->sequence, client, record->connection, record->unit, record->function,
+           record->table == JOURNAL_TABLE_COILS ? "coils" : "holding-registers", record->address, record->count);
+    print_values(record, entry->values);
+    printf(" new=");
+    print_values(record, entry->values + value_bytes(record));
+    printf("\n");
+}
+
+/**
+ * Function to apply the new values of a write to the rebuilt register map.
+ *
+ * @param map    The rebuilt register map.
+ * @param entry  The record of the write.
+ * @param unit   The map the write went to.
+ *
+ * @return 0 if successful, -1 if memory ran out.
+ */
+int apply_entry(rebuilt_map_t *map, const journal_entry_t *entry, int unit) {
+    const journal_record_t *record = &entry->record;
+    int table = record->table == JOURNAL_TABLE_COILS ? 0 : 1;
+    if (map->values[unit][table] == NULL) {
+        map->values[unit][table] = calloc(ADDRESS_SPACE, sizeof(uint16_t));
+        map->known[unit][table] = calloc(ADDRESS_SPACE, sizeof(uint8_t));
+        if (map->values[unit][table] == NULL || map->known[unit][table] == NULL) return -1;
+    }
+    const uint8_t *values = entry->values + value_bytes(record);
+    for (int i = 0; i < record->count && record->address + i < ADDRESS_SPACE; i++) {
+        map->values[unit][table][record->address + i] = record_value(record, values, i);
+        map->known[unit][table][record->address + i] = 1;
+    }
+    return 0;
+}
+
+/**
+ * Function to print the rebuilt register map in the --load-map CSV format.
+ * Consecutive known entries share a line, up to CSV_VALUES_PER_LINE values.
+ *
+ * @param map         The rebuilt register map.
+ * @param single_map  Print the shared map for every unit (*).
+ */
+void print_state(const rebuilt_map_t *map, int single_map) {
+    static const char *tables[2] = { "coils", "holding-registers" };
+    printf("# UNIT,TABLE,ADDRESS,VALUE[,VALUE...]\n");
+    for (int unit = 0; unit < UNIT_ID_COUNT; unit++) {
+        for (int table = 0; table < 2; table++) {
+            const uint16_t *values = map->values[unit][table];
+            const uint8_t *known = map->known[unit][table];
+            if (values == NULL) continue;
+            for (int address = 0; address < ADDRESS_SPACE;) {
+                if (!known[address]) {
+                    address++;
+                    continue;
+                }
+                if (single_map) printf("*,%s,%d", tables[table], address);
+                else printf("%d,%s,%d", unit, tables[table], address);
+                for (int n = 0; n < CSV_VALUES_PER_LINE && address < ADDRESS_SPACE && known[address]; n++) {
+                    printf(",%u", values[address++]);
+                }
+                printf("\n");
+            }
+        }
+    }
+}
+
+/**
+ * Function to parse command-line arguments.
+ *
+ * @param argc    The number of command-line arguments.
+ * @param argv    The array of command-line arguments.
+ * @param config  The tool settings to update.
+ */
+void parse_arguments(int argc, char *argv[], journal_config_t *config) {
+    static struct option long_options[] = {
+        {"help", no_argument, NULL, 'h'},
+        {"version", no_argument, NULL, 'v'},
+        {"at", required_argument, NULL, OPT_AT},
+        {"state", no_argument, NULL, OPT_STATE},
+        {"single-map", no_argument, NULL, OPT_SINGLE_MAP},
+        {0, 0, 0, 0}
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "hv", long_options, NULL)) != -1) {
+        switch (opt) {
+            case OPT_AT:
+                if (parse_time(optarg, &config->at_ns) == -1) {
+                    fprintf(stderr, "[ERROR] Invalid time '%s', expected Unix seconds or YYYY-MM-DDTHH:MM:SS\n",
+                            optarg);
+                    exit(-1);
+                }
+                break;
+            case OPT_STATE:
+                config->state = 1;
+                break;
+            case OPT_SINGLE_MAP:
+                config->single_map = 1;
+                break;
+            case 'v':
+                printf("Modbus Journal Decoder - Version %s\n", VERSION);
+                exit(0);
+            case 'h':
+                print_usage();
+                exit(0);
+            default:
+                print_usage();
+                exit(-1);
+        }
+    }
+
+    if (optind == argc) {
+        fprintf(stderr, "[ERROR] No journal file given\n");
+        print_usage();
+        exit(-1);
+    }
+    if (argc - optind > MAX_FILES) {
+        fprintf(stderr, "[ERROR] At most %d journal files can be read together\n", MAX_FILES);
+        exit(-1);
+    }
+}
+
+/**
+ * Main function to decode journals.
+ * Every file is read, the writes are put in the order they were applied, and
+ * either listed or replayed into a register map that is printed at the end.
+ *
+ * @param argc  The number of command-line arguments.
+ * @param argv  The array of command-line arguments.
+ *
+ * @return 0 if successful, -1 otherwise.
+ */
+int main(int argc, char *argv[]) {
+    journal_config_t config = { .at_ns = UINT64_MAX };
+    parse_arguments(argc, argv, &config);
+
+    char **paths = argv + optind;
+    int nb_files = argc - optind;
+    journal_entry_t *entries = NULL;
+    size_t count = 0, allocated = 0;
+    for (int i = 0; i < nb_files; i++) {
+        if (read_journal(paths[i], i, &entries, &count, &allocated) == -1) return -1;
+    }
+    order_entries(entries, count, paths);
+
+    static rebuilt_map_t map;
+    for (size_t i = 0; i < count && entries[i].order_ns <= config.at_ns; i++) {
+        if (!config.state) {
+            print_write(&entries[i]);
+        } else if (apply_entry(&map, &entries[i], config.single_map ? 0 : entries[i].record.unit) == -1) {
+            fprintf(stderr, "[ERROR] Error allocating register map: %s\n", strerror(errno));
+            return -1;
+        }
+    }
+    if (config.state) print_state(&map, config.single_map);
+    free(entries);
+    return 0;
+}
@@ -0,0 +1,56 @@
+#ifndef MODBUS_JOURNAL_H
+#define MODBUS_JOURNAL_H
+
+#include <stdint.h>
+
+/*
+ * Write journal appended to by modbus_server --journal FILE and read by
+ * modbus_journal.
+ *
+ * The file starts with one journal_file_header_t followed by records. Every
+ * record is a journal_record_t immediately followed by its values: for a
+ * JOURNAL_WRITE, the count entries the range held before the write, then the
+ * count entries it holds after it. Holding registers take one uint16_t each;
+ * coils are packed eight per byte, the first coil in the least significant
+ * bit, so each half takes (count + 7) / 8 bytes. Fields and registers are
+ * stored in the byte order of the host that wrote the file.
+ *
+ * A server appends to an existing journal and starts its run with a
+ * JOURNAL_START record. Within a run, sequence numbers give the order in
+ * which writes were applied; records of different workers may reach the file
+ * out of that order, and a missing number is a record the server dropped
+ * because the journal could not keep up. Writes made by --load-map and by
+ * --shm producers are not journaled.
+ */
+
+#define JOURNAL_MAGIC 0x4D424A4Cu        // "MBJL"
+#define JOURNAL_VERSION_MAJOR 1
+#define JOURNAL_VERSION_MINOR 0
+
+#define JOURNAL_WRITE 0                  // A client write applied to the register map
+#define JOURNAL_START 1                  // A server run starts appending, no values follow
+
+#define JOURNAL_TABLE_COILS 0            // Same numbering as MODBUS_SHM_TABLE_* in modbus_shm.h
+#define JOURNAL_TABLE_HOLDING_REGISTERS 2
+
+typedef struct {
+    uint32_t magic;                      // JOURNAL_MAGIC
+    uint16_t version_major;              // JOURNAL_VERSION_MAJOR
+    uint16_t version_minor;              // JOURNAL_VERSION_MINOR
+    uint32_t reserved;                   // Zero
+} journal_file_header_t;
+
+typedef struct {
+    uint64_t timestamp_ns;               // CLOCK_REALTIME when the write was applied or the run started
+    uint64_t sequence;                   // Order of the write within the run, from 1; 0 for JOURNAL_START
+    uint32_t client;                     // Client IPv4 address in network byte order, 0 for serial ports
+    uint32_t connection;                 // Identifier of the client connection, as in the frame trace
+    uint16_t address;                    // First address written
+    uint16_t count;                      // Number of entries written
+    uint8_t type;                        // JOURNAL_WRITE or JOURNAL_START
+    uint8_t unit;                        // Unit identifier of the request
+    uint8_t table;                       // JOURNAL_TABLE_COILS or JOURNAL_TABLE_HOLDING_REGISTERS
+    uint8_t function;                    // Function code of the request
+} journal_record_t;
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef MODBUS_NOTIFY_H
+#define MODBUS_NOTIFY_H
+
+#include <stdint.h>
+
+/*
+ * Change sets sent by modbus_server --notify PATH.
+ *
+ * Subscribers connect a SOCK_SEQPACKET UNIX socket to PATH and only read.
+ * The server first sends a snapshot of every register map, then, once per
+ * notification interval in which something changed, the blocks of
+ * MODBUS_NOTIFY_BLOCK_SIZE entries written since the previous change set.
+ * Writes to the same block within an interval are coalesced, and adjacent
+ * dirty blocks are sent as one change.
+ *
+ * A change set is one or more messages with the same sequence number; every
+ * message but the last has MODBUS_NOTIFY_FLAG_MORE set. A message is a
+ * modbus_notify_header_t followed by nb_changes changes, each a
+ * modbus_notify_change_t immediately followed by count entries (uint8_t 0/1
+ * per bit, or uint16_t per register) padded to 4 bytes. Everything is in host
+ * byte order and registers hold the value itself.
+ *
+ * A subscriber that does not keep up misses change sets rather than slowing
+ * the server down; a gap in the sequence numbers means it must read the
+ * register map again, over Modbus or by reconnecting for a new snapshot.
+ */
+
+#define MODBUS_NOTIFY_MAGIC 0x4D42434Eu  // "MBCN"
+#define MODBUS_NOTIFY_VERSION 1
+#define MODBUS_NOTIFY_BLOCK_SIZE 64      // Granularity of change tracking, in table entries
+#define MODBUS_NOTIFY_MAX_MESSAGE 65536  // Upper bound of one message
+
+#define MODBUS_NOTIFY_FLAG_MORE 0x01     // More messages of the same change set follow
+#define MODBUS_NOTIFY_FLAG_SNAPSHOT 0x02 // Every entry of every table, sent once on connection
+
+#define MODBUS_NOTIFY_TABLE_COILS 0
+#define MODBUS_NOTIFY_TABLE_DISCRETE_INPUTS 1
+#define MODBUS_NOTIFY_TABLE_HOLDING_REGISTERS 2
+#define MODBUS_NOTIFY_TABLE_INPUT_REGISTERS 3
+
+typedef struct {
+    uint32_t magic;                      // MODBUS_NOTIFY_MAGIC
+    uint16_t version;                    // MODBUS_NOTIFY_VERSION
+    uint8_t flags;                       // MODBUS_NOTIFY_FLAG_* bits
+    uint8_t reserved;                    // Zero
+    uint64_t sequence;                   // Change set number from 1, a snapshot carries the last one it includes
+    uint64_t timestamp_ns;               // CLOCK_REALTIME when the change set was collected
+    uint32_t nb_changes;                 // Changes in this message
+    uint32_t length;                     // Bytes in this message, header included
+} modbus_notify_header_t;
+
+typedef struct {
+    uint8_t unit;                        // Unit identifier, 0 when one map serves every unit
+    uint8_t table;                       // MODBUS_NOTIFY_TABLE_*
+    uint16_t address;                    // First address of the change
+    uint16_t count;                      // Number of entries that follow
+    uint16_t reserved;                   // Zero
+} modbus_notify_change_t;
+
+#endif
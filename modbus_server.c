@@ -1,292 +1,8247 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <modbus/modbus.h>
 #include <errno.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stddef.h>
+#include <limits.h>
 #include <getopt.h>
 #include <stdarg.h>
+#include <math.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <dirent.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <signal.h>
+#include <semaphore.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/signalfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <linux/serial.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <linux/mempolicy.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#ifdef USE_IO_URING
+#include <linux/io_uring.h>
+#include <linux/time_types.h>
+#endif
+#ifdef USE_TLS
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#endif
+
+#include "modbus_trace.h"
+#include "modbus_journal.h"
+#include "modbus_shm.h"
+#include "modbus_notify.h"
 
 #define DEFAULT_SERVER_IP "0.0.0.0"      // Default server IP address
 #define DEFAULT_SERVER_PORT 502          // Default server port
-#define DEFAULT_REG_COUNT 10             // Default number of registers
+#define DEFAULT_TLS_PORT 802             // Default server port with --tls, registered for Modbus/TCP Security
+#define DEFAULT_REG_COUNT 10             // Default number of holding registers
+#define LISTEN_BACKLOG 64                // Pending connections queued by the kernel
+#define MAX_EPOLL_EVENTS 64              // Events handled per epoll_wait() call
+#define DEFAULT_THREADS 1                // Default number of worker threads
+#define MAX_THREADS 256                  // Upper bound for --threads
+#define MAX_PROCESSES 64                 // Upper bound for --reuseport
+#define RESPAWN_DELAY_MS 1000            // Pause before restarting a server process that died early
+#define ADDRESS_SPACE 65536              // Number of addresses in each Modbus table
+#define UNIT_ID_COUNT 256                // Number of Modbus unit identifiers
+#define MBAP_HEADER_LENGTH 7             // Transaction ID, protocol ID, length and unit ID
+#define CONN_RX_BUFFER 4096              // Per-connection receive buffer, holds many pipelined requests
+#define CONN_TX_BUFFER 8192              // Per-connection transmit buffer for batched replies
+#define DEFAULT_MAX_CONNECTIONS 1024     // Default connection slots preallocated per worker
+#define TRACE_RING_SLOTS 4096            // Frames buffered per worker trace ring, a power of two
+#define TRACE_DRAIN_INTERVAL_US 10000    // Trace thread sleep when the rings are empty
+#define JOURNAL_RING_SLOTS 1024          // Writes buffered per worker journal ring, a power of two
+#define JOURNAL_VALUE_BYTES (MODBUS_MAX_WRITE_REGISTERS * 2)  // Largest half of a journal record, also fits 1968 coils
+#define LOG_RINGS (MAX_THREADS + 16)     // Threads logging through a ring, any further thread writes directly
+#define LOG_RING_SLOTS 128               // Messages buffered per thread log ring, a power of two
+#define LOG_MESSAGE_LENGTH 1024          // Longest message, fits a frame dump; longer ones are truncated
+#define LOG_SITES 64                     // Call sites tracked per thread by the repeat limit, a power of two
+#define LOG_BURST 10                     // Messages one call site may log per thread and second
+#define LOG_DRAIN_INTERVAL_MS 10         // Log writer sleep when the rings are empty
+#define LATENCY_BUCKETS 320              // Histogram buckets, covers latencies up to 2^40 ns
+#define CACHE_LINE_SIZE 64               // Alignment of per-worker statistics
+#define DEFAULT_PERSIST_INTERVAL_MS 1000 // Default time between two msync() of the store file
+#define MAX_SERIAL_PORTS 8               // Upper bound for --rtu
+#define DEFAULT_RTU_BAUD 19200           // Default serial baud rate
+#define DEFAULT_RTU_UNIT 1               // Default unit answered on RTU with a single register map
+#define RTU_RX_BUFFER 512                // Per-stream RTU receive buffer, two maximum-size frames
+#define RTU_TX_BUFFER 512                // Per-stream RTU-over-TCP transmit buffer, two maximum-size replies
+#define RTU_WRITE_FRAMES 4               // Line times of a serial reply it may take to write it out
+#define RTU_WRITE_SLACK_MS 100           // Added to that for the driver and adapter
+#define DEFAULT_NOTIFY_INTERVAL_MS 100   // Default time between two change sets
+#define MAX_SUBSCRIBERS 64               // Upper bound of connected change subscribers
+#define DEFAULT_BYTE_TIMEOUT_MS 500      // Default time allowed to receive the rest of a started frame
+#define DEFAULT_RESPONSE_TIMEOUT_MS 5000 // Default time a client may leave its replies unread
+#define MIN_SWEEP_INTERVAL_MS 10         // Shortest period of the connection timeout sweep
+#define DEFAULT_KEEPALIVE_INTERVAL 10    // Default seconds between two keepalive probes
+#define DEFAULT_KEEPALIVE_COUNT 3        // Default unanswered probes before a peer is considered dead
+#define MAX_GENERATORS 64                // Upper bound for --generator
+#define MAX_WALK_STEPS 1024              // Random walk steps caught up by one read, older periods are dropped
+#define URING_ENTRIES 1024               // Submission queue entries of a worker's io_uring
+#define URING_BUFFERS 1024               // Receive buffers provided to a worker's io_uring, a power of two
+#define URING_BUFFER_SIZE 2048           // Size of one provided receive buffer
+#define URING_BUFFER_GROUP 0             // Buffer group of the provided receive buffers
+#define TLS_TICKET_KEY_LENGTH 80         // Bytes of a --tls-ticket-key file: key name, HMAC and AES keys
+#define DIRTY_WORDS (ADDRESS_SPACE / REG_BLOCK_SIZE / 64)  // 64-bit dirty words covering a whole table
+#define REG_BLOCK_SIZE MODBUS_SHM_BLOCK_SIZE  // Table entries covered by one seqlock, fixed by modbus_shm.h
+#define REG_PAGE_SIZE MODBUS_SHM_PAGE_SIZE    // Table entries per page, a multiple of REG_BLOCK_SIZE
+#define MAX_SPAN_BLOCKS (MODBUS_MAX_READ_BITS / REG_BLOCK_SIZE + 2)  // Blocks touched by the largest request
+#define SEQ_WAIT_MS 100                  // Longest wait for a busy block before a request fails
+#define SEQ_STALE_MS 1000                // Time a block stays busy before the supervisor releases it for a dead process
+#define MAX_STALE_WORDS 256              // Busy blocks checked at once after a server process died
+#define CACHE_SPAN_BLOCKS (MODBUS_MAX_READ_REGISTERS / REG_BLOCK_SIZE + 2)  // Blocks touched by a register read
+#define MAX_READ_CACHE 65536             // Upper bound for --read-cache
+#define FRAMES_PER_TURN 16               // Pipelined requests served per connection before the others get a turn
+#define MAX_RATE_CLIENTS 4096            // Client addresses tracked by --client-rate-limit
+#define CLIENT_PROBES 8                  // Entries searched for a client address before giving up
+#define MAX_WRITE_PREFIXES 64            // Upper bound for --write-allow
+#define WRITE_FUNCTIONS (1u << MODBUS_FC_WRITE_SINGLE_COIL | 1u << MODBUS_FC_WRITE_SINGLE_REGISTER | \
+                         1u << MODBUS_FC_WRITE_MULTIPLE_COILS | 1u << MODBUS_FC_WRITE_MULTIPLE_REGISTERS | \
+                         1u << MODBUS_FC_MASK_WRITE_REGISTER | 1u << MODBUS_FC_WRITE_AND_READ_REGISTERS)  // By code
 #define VERSION "1.0.0"                  // Server version
 
+// Long-only option identifiers, kept in TABLE_* order
+#define OPT_COILS 256
+#define OPT_DISCRETE_INPUTS 257
+#define OPT_HOLDING_REGISTERS 258
+#define OPT_INPUT_REGISTERS 259
+#define OPT_SPARSE 260
+#define OPT_FAST_PATH 261
+#define OPT_TRACE 262
+#define OPT_STATS_PORT 263
+#define OPT_PERSIST 264
+#define OPT_PERSIST_INTERVAL 265
+#define OPT_SHM 266
+#define OPT_RTU 267
+#define OPT_RTU_UNIT 268
+#define OPT_RTU_OVER_TCP 269
+#define OPT_RS485 270
+#define OPT_RTU_GAP 271
+#define OPT_NOTIFY 272
+#define OPT_NOTIFY_INTERVAL 273
+#define OPT_IDLE_TIMEOUT 274
+#define OPT_BYTE_TIMEOUT 275
+#define OPT_RESPONSE_TIMEOUT 276
+#define OPT_KEEPALIVE 277
+#define OPT_REUSEPORT 278
+#define OPT_MAX_CONNECTIONS 279
+#define OPT_LOAD_MAP 280
+#define OPT_GENERATOR 281
+#define OPT_TLS 282
+#define OPT_TLS_CERT 283
+#define OPT_TLS_KEY 284
+#define OPT_TLS_CA 285
+#define OPT_TLS_TICKET_KEY 286
+#define OPT_RELOAD 287
+#define OPT_CPU_AFFINITY 288
+#define OPT_BUSY_POLL 289
+#define OPT_READ_CACHE 290
+#define OPT_RATE_LIMIT 291
+#define OPT_CLIENT_RATE_LIMIT 292
+#define OPT_WRITE_ALLOW 293
+#define OPT_READ_ONLY 294
+#define OPT_JOURNAL 295
+#define OPT_LOG_LEVEL 296
+#define OPT_LOG_FORMAT 297
+
+/**
+ * Tables of the Modbus data model.
+ */
+enum {
+    TABLE_COILS,
+    TABLE_DISCRETE_INPUTS,
+    TABLE_HOLDING_REGISTERS,
+    TABLE_INPUT_REGISTERS,
+    TABLE_COUNT
+};
+
+/**
+ * Kinds of generated register values.
+ */
+enum {
+    GENERATOR_COUNTER,     // Integer increasing by STEP every PERIOD, spread over the range
+    GENERATOR_SINE,        // OFFSET + AMPLITUDE * sin(), each register of the range shifted in phase
+    GENERATOR_RANDOM,      // Random walk of STEP every PERIOD within [MIN, MAX], one per register
+    GENERATOR_CLOCK        // Unix time in seconds, spread over the range
+};
+
+/**
+ * Severities of log messages, also the levels selecting which ones are written.
+ */
+enum {
+    LOG_LEVEL_ERROR,       // Failures, always written
+    LOG_LEVEL_INFO,        // Startup, reloads and other events of the server as a whole
+    LOG_LEVEL_DEBUG        // Connection events and frame dumps
+};
+
+/**
+ * Output formats of the log.
+ */
+enum {
+    LOG_FORMAT_TEXT,       // "[LEVEL] message"
+    LOG_FORMAT_JSON,       // One JSON object per line
+    LOG_FORMAT_KV          // key=value pairs, logfmt style
+};
+
+/**
+ * Values computed for a range of registers when a request reads them.
+ * Integers spread over a range are stored most significant register first.
+ */
+typedef struct {
+    int table;             // TABLE_HOLDING_REGISTERS or TABLE_INPUT_REGISTERS
+    int address;           // First register of the range
+    int count;             // Number of registers in the range
+    int kind;              // GENERATOR_*
+    double step;           // Counter and random walk increment
+    double amplitude;      // Sine amplitude
+    double offset;         // Sine offset
+    double min, max;       // Random walk bounds
+    uint64_t period_ns;    // Counter and random walk step period, sine period
+    uint64_t start_ns;     // CLOCK_MONOTONIC origin of the counter, the sine and the walk
+    pthread_mutex_t lock;  // Serializes readers catching up the random walk
+    uint64_t walked;       // Random walk periods applied so far
+    uint64_t rng;          // Random walk xorshift state
+    double *walk;          // Current random walk value of each register
+} generator_t;
+
+/**
+ * Address layout of one table, in the style of modbus_mapping_new_start_address().
+ */
+typedef struct {
+    int start;             // Address of the first entry
+    int count;             // Number of entries, 0 leaves the table empty
+} table_layout_t;
+
+/**
+ * Settings of one serial port given as DEVICE[:BAUD[:FORMAT]].
+ */
+typedef struct {
+    char *device;          // Serial device, e.g. /dev/ttyUSB0
+    int baud;              // Baud rate
+    char parity;           // 'N', 'E' or 'O'
+    int data_bits;         // 5 to 8
+    int stop_bits;         // 1 or 2
+} serial_config_t;
+
+/**
+ * Request rate limit, enforced as a token bucket in its GCRA form: a bucket is
+ * the time its next request is due, which each admitted request pushes back by
+ * one interval, and requests may run ahead of it by the burst tolerance.
+ */
+typedef struct {
+    uint64_t interval_ns;            // Time to earn one request, 0 for no limit
+    uint64_t tolerance_ns;           // How far ahead of the due time a burst may run
+} rate_limit_t;
+
+/**
+ * Token bucket shared by the connections of one client address.
+ */
+typedef struct {
+    atomic_uint addr;                // IPv4 address in network byte order, 0 for a free entry
+    atomic_ullong due_ns;            // When the client's next request is due
+} client_bucket_t;
+
+/**
+ * Client subnet given as ADDRESS[/LENGTH].
+ */
+typedef struct {
+    uint32_t network;                // Network address in host byte order, host bits cleared
+    uint32_t mask;                   // Netmask in host byte order
+} ip_prefix_t;
+
+/**
+ * Server settings collected from the command line.
+ */
+typedef struct {
+    char *server_ip;       // IP address the server listens on
+    int server_port;       // TCP port the server listens on
+    table_layout_t layouts[TABLE_COUNT];  // Size and start address of each table, indexed by TABLE_*
+    int sparse;            // Allocate table pages on demand
+    char *persist_file;    // File mapped as the register store, NULL to keep the store in memory
+    int persist_interval;  // Milliseconds between two flushes of the store file
+    char *shm_name;        // POSIX shared-memory segment holding the register store, NULL if not shared
+    char *load_map;        // CSV or binary file with the initial table values, NULL to keep the store as is
+    char *reload_file;     // Settings file applied at startup and again on SIGHUP, NULL to disable reloading
+    int multi_unit;        // Serve a separate register map per unit identifier
+    int fast_path;         // Answer TCP requests for FC03/04/06/16 without libmodbus
+    char *trace_file;      // File receiving captured frames, NULL to disable tracing
+    char *journal_file;    // File the client writes are appended to, NULL to disable the journal
+    int stats_port;        // HTTP port serving Prometheus metrics, 0 to disable
+    uint8_t units[UNIT_ID_COUNT];  // Unit identifiers served in multi-unit mode
+    serial_config_t serial_ports[MAX_SERIAL_PORTS];  // Serial ports serving Modbus RTU
+    int nb_serial_ports;   // Number of serial ports
+    int rtu_unit;          // Unit answered on RTU streams with a single register map
+    int rtu_over_tcp_port; // TCP port carrying RTU frames, 0 to disable
+    int rs485;             // Put the serial ports in RS-485 mode
+    int rtu_gap_us;        // Silence ending an RTU frame, 0 for 3.5 characters
+    char *notify_path;     // UNIX socket serving change sets, NULL to disable
+    int notify_interval;   // Time between two change sets, in milliseconds
+    int idle_timeout;      // Close connections without a request for this many ms, 0 to disable
+    int byte_timeout;      // Close connections that leave a frame incomplete for this many ms, 0 to disable
+    int response_timeout;  // Close connections that leave replies unread for this many ms, 0 to disable
+    int keepalive_idle;    // Seconds before TCP keepalive probes start, 0 to disable keepalive
+    int keepalive_interval;  // Seconds between two keepalive probes
+    int keepalive_count;   // Unanswered probes before the connection is dropped
+    int reuseport;         // Number of server processes sharing the port, 0 for a single process
+    int max_connections;   // Client connections each worker can hold
+    int cpus[CPU_SETSIZE]; // CPUs the workers are pinned to in turn, in the order given
+    int nb_cpus;           // Number of CPUs in cpus, 0 to leave thread placement to the scheduler
+    int busy_poll;         // Microseconds to poll for events before blocking, 0 to block right away
+    int read_cache;        // Register read replies cached per worker, a power of two, 0 to disable
+    rate_limit_t connection_rate;  // Requests each connection may send
+    rate_limit_t client_rate;      // Requests the connections of a client address may send together
+    ip_prefix_t write_allow[MAX_WRITE_PREFIXES];  // Client subnets allowed to write
+    int nb_write_allow;    // Number of subnets in write_allow, 0 lets every client write
+    uint64_t *read_only[TABLE_COUNT];  // One bit per address no client may write, NULL if the table has none
+    int tls;               // Serve Modbus/TCP Security (TLS) instead of plain Modbus TCP on the server port
+    char *tls_cert;        // PEM certificate chain presented to clients
+    char *tls_key;         // PEM private key, NULL if it follows the certificates in tls_cert
+    char *tls_ca;          // PEM CA certificates that must have signed a client certificate, NULL to not ask for one
+    char *tls_ticket_key;  // Session ticket key file shared by a group of servers, NULL for a key per start
+    generator_t generators[MAX_GENERATORS];  // Generated register ranges, sorted by table and address
+    int nb_generators;     // Number of generated ranges
+    int log_level;         // Highest LOG_LEVEL_* written
+    int log_format;        // LOG_FORMAT_*
+    int threads;           // Number of worker threads (1 serves everything from the main thread)
+} server_config_t;
+
+/**
+ * One table of the register store.
+ * Entries live in pages of REG_PAGE_SIZE reached through a small page index.
+ * A dense table allocates all of its pages up front in one block, or maps them
+ * from the store file; a sparse table allocates a page on the first write into
+ * it, and missing pages read as zero.
+ * Entries are also grouped in blocks of REG_BLOCK_SIZE, each guarded by a sequence
+ * counter that is odd while a writer is publishing into the block. When change
+ * notifications are enabled, writers also set the block's bit in the dirty bitmap.
+ * Generated ranges are computed by readers and never stored.
+ */
+typedef struct {
+    int start;                       // Address of the first entry
+    int count;                       // Number of entries
+    int bits;                        // 1 for coil and discrete input tables (uint8_t 0/1), 0 for uint16_t registers
+    int sparse;                      // Pages are allocated on first write
+    int nb_pages;                    // Number of entries in the page index
+    _Atomic(void *) *pages;          // Page index, NULL for pages not allocated yet
+    void *dense;                     // Storage backing every page of a dense table
+    int mapped;                      // The dense storage belongs to the store file, not to the table
+    atomic_uint *seq;                // Per-block sequence counters
+    atomic_ullong *dirty;            // One bit per block written since the last change set, NULL if not tracked
+    generator_t *generators;         // Generated ranges overriding stored values on read, sorted by address
+    int nb_generators;               // Number of generated ranges
+} reg_table_t;
+
+/**
+ * Register map shared by all workers.
+ * Readers take no lock; the write lock only orders concurrent writers.
+ */
+typedef struct {
+    reg_table_t tables[TABLE_COUNT];  // Indexed by TABLE_*
+    pthread_mutex_t write_lock;       // Held by writers while they publish
+    int retired;                      // Replaced by a reload, writers finding it set under the lock move on
+} register_store_t;
+
+/**
+ * Register store mapped from a file or a shared-memory segment, see modbus_shm.h.
+ * A file is flushed from a background thread; a segment lives in memory only.
+ */
+typedef struct {
+    int fd;                          // Store file or shared-memory segment
+    void *base;                      // Mapping of the whole file, NULL if the store is not mapped
+    size_t size;                     // Size of the file and the mapping
+    int shm;                         // Mapped from a shared-memory segment, never flushed
+    int interval_ms;                 // Time between two flushes
+    int flushing;                    // The flush thread is running
+    pthread_t thread;                // Flush thread
+} persist_t;
+
+// Sequence words of mapped tables are shared with producers as plain uint32_t
+_Static_assert(sizeof(atomic_uint) == sizeof(uint32_t), "atomic_uint must match the shared layout");
+_Static_assert(REG_BLOCK_SIZE == MODBUS_NOTIFY_BLOCK_SIZE, "change sets are tracked per store block");
+_Static_assert(TABLE_COILS == JOURNAL_TABLE_COILS && TABLE_HOLDING_REGISTERS == JOURNAL_TABLE_HOLDING_REGISTERS,
+               "journal records number tables as TABLE_*");
+
+/**
+ * Register maps selected by the unit identifier of a request.
+ * Without multi-unit mode every entry points to the same store.
+ */
+typedef struct {
+    register_store_t *stores;                  // Distinct register maps
+    int nb_stores;                             // Number of distinct register maps
+    register_store_t *by_unit[UNIT_ID_COUNT];  // Register map per unit identifier, NULL if not served
+} unit_map_t;
+
+/**
+ * Settings a reload can change, published to the workers as one object.
+ * A published object is never modified; a reload publishes a new one and
+ * releases the old one once no worker can still be using it.
+ */
+typedef struct {
+    table_layout_t layouts[TABLE_COUNT];  // Size and start address of each table, indexed by TABLE_*
+    int multi_unit;                  // Serve a separate register map per unit identifier
+    uint8_t units[UNIT_ID_COUNT];    // Unit identifiers served in multi-unit mode
+    unit_map_t *map;                 // Register maps built from the layouts and units
+    int idle_timeout;                // Connection timeouts in milliseconds, 0 to disable
+    int byte_timeout;
+    int response_timeout;
+    int log_level;                   // Highest LOG_LEVEL_* written, applied to the logger when published
+} live_settings_t;
+
+/**
+ * Address range of one table touched by a request.
+ */
+typedef struct {
+    int table;                       // TABLE_* index
+    int address;                     // First address
+    int count;                       // Number of entries
+    int write;                       // Set if the request modifies the range
+} request_span_t;
+
+/**
+ * Request decoded far enough to know which part of the data model it touches.
+ */
+typedef struct {
+    int function;                    // Modbus function code
+    int nb_spans;                    // Number of spans used, 0 if the request touches no table
+    request_span_t spans[2];         // FC23 reads one span and writes another, the write comes last
+    int valid_quantity;              // Quantities and byte counts are within protocol limits
+    int valid_data;                  // Written values are acceptable (coil values are 0x0000 or 0xFF00)
+} request_info_t;
+
+/**
+ * Kinds of descriptors watched by a worker's event loop.
+ */
+enum {
+    SOURCE_LISTENER,
+    SOURCE_HANDOFF,
+    SOURCE_CLIENT,
+    SOURCE_SERIAL,
+    SOURCE_RTU_LISTENER,
+    SOURCE_RTU_CLIENT
+};
+
+/**
+ * Descriptor registered with epoll; the event data points to one of these.
+ */
+typedef struct {
+    int type;                        // SOURCE_* kind of descriptor
+    int fd;                          // The descriptor itself
+} event_source_t;
+
+/**
+ * Per-connection state.
+ * The receive buffer is filled by one large recv() and may hold several
+ * pipelined frames; the transmit buffer collects the fast-path replies of a
+ * whole batch so they leave in a single send(). When the client stops reading,
+ * the unsent replies stay in the transmit buffer and the connection waits for
+ * EPOLLOUT instead of reading further requests.
+ * A connection serves at most FRAMES_PER_TURN frames per event; one with more
+ * complete frames joins the worker's ready list and gets its next turn after
+ * the other connections. Connections are slots of the worker's slab,
+ * everything up to rx is reset when a slot is reused.
+ */
+typedef struct connection {
+    event_source_t source;           // Must stay first, epoll events point here
+    uint32_t id;                     // Connection identifier used in traces
+    struct connection *prev;         // Worker's connection list, swept for timeouts
+    struct connection *next;         // Also links the free slots of the slab
+    uint64_t last_active_ns;         // When the last request bytes arrived
+    uint64_t frame_started_ns;       // When the first byte of the incomplete frame in rx arrived
+    uint64_t blocked_since_ns;       // When a reply could not be sent in full, 0 if nothing is pending
+    uint64_t due_ns;                 // When the next request is due under --rate-limit
+    uint32_t peer_addr;              // Client IPv4 address in network byte order, 0 if unknown
+    client_bucket_t *client;         // Bucket of peer_addr last found, checked before each use
+    int may_write;                   // The client address passed --write-allow
+    int ready;                       // Waiting in the worker's ready list with frames left to serve
+    struct connection *ready_prev;   // Worker's ready list, served round-robin
+    struct connection *ready_next;
+    int rx_len;                      // Bytes waiting in rx
+    int tx_len;                      // Reply bytes waiting in tx
+#ifdef USE_IO_URING
+    int inflight;                    // io_uring operations using the slot
+    int sending;                     // Bytes of tx handed to an io_uring send, 0 if none is in flight
+    int receiving;                   // An io_uring receive is in flight
+    int closing;                     // Closed, the slot is released when the last operation completes
+#endif
+#ifdef USE_TLS
+    SSL *ssl;                        // TLS session, rx and tx hold plaintext
+    int tls_want_write;              // The handshake waits for the socket to become writable
+    int tls_established;             // The handshake completed and was counted
+#endif
+    uint8_t rx[CONN_RX_BUFFER];      // Request bytes received so far
+    uint8_t tx[CONN_TX_BUFFER];      // Replies built by the fast path, not sent yet
+} connection_t;
+
+#ifdef USE_TLS
+typedef SSL_CTX tls_context_t;       // Shared by every worker, so are the session cache and ticket keys
+#else
+typedef void tls_context_t;          // TLS needs a build with USE_TLS
+#endif
+
+/**
+ * Serial port or RTU-over-TCP connection carrying Modbus RTU frames.
+ * RTU-over-TCP connections are held to the same timeouts, rate limits and
+ * connection limit as Modbus TCP ones, and batch their replies in tx the same
+ * way; serial ports are rate limited as one connection but never dropped.
+ * Like a connection, a stream serves at most FRAMES_PER_TURN frames per event.
+ */
+typedef struct rtu_stream {
+    event_source_t source;           // Must stay first; SOURCE_SERIAL or SOURCE_RTU_CLIENT
+    modbus_t *ctx;                   // RTU context encoding the replies left to libmodbus
+    const char *device;              // Serial device, NULL for RTU-over-TCP connections
+    uint32_t id;                     // Connection identifier used in traces
+    struct rtu_stream *prev;         // Worker's RTU-over-TCP connection list, swept for timeouts
+    struct rtu_stream *next;         // Also links the free streams of the pool
+    uint64_t gap_ns;                 // Silence that ends a frame on a serial line, 0 over TCP
+    uint64_t char_ns;                // Time one character takes on a serial line, 0 over TCP
+    uint64_t last_rx_ns;             // When bytes were last received
+    uint64_t frame_started_ns;       // When the first byte of the incomplete frame in rx arrived
+    uint32_t peer_addr;              // Client IPv4 address in network byte order, 0 for serial ports
+    int may_write;                   // Serial masters may always write, RTU-over-TCP clients per --write-allow
+    uint64_t blocked_since_ns;       // When replies could not be sent in full, 0 if nothing is pending
+    uint64_t due_ns;                 // When the next request is due under --rate-limit
+    client_bucket_t *client;         // Bucket of peer_addr last found, checked before each use
+    int ready;                       // Waiting in the worker's RTU ready list with frames left to serve
+    struct rtu_stream *ready_prev;   // Worker's RTU ready list, served round-robin after the connections
+    struct rtu_stream *ready_next;
+    int tx_len;                      // Reply bytes waiting in tx
+    int rx_len;                      // Bytes waiting in rx
+    uint8_t rx[RTU_RX_BUFFER];       // Request bytes received so far
+    uint8_t tx[RTU_TX_BUFFER];       // Replies the RTU-over-TCP client has not taken yet
+} rtu_stream_t;
+
+#ifdef USE_IO_URING
+/**
+ * A worker's io_uring, set up by hand from <linux/io_uring.h>.
+ * Client sockets are accepted, read and written through the ring; everything
+ * else stays on the worker's epoll instance, which the ring polls.
+ */
+typedef struct {
+    int fd;                          // io_uring instance
+    void *rings;                     // Submission and completion rings, one mapping
+    size_t rings_size;               // Size of the ring mapping
+    struct io_uring_sqe *sqes;       // Submission queue entries
+    size_t sqes_size;                // Size of the entries mapping
+    unsigned *sq_head;               // Consumed by the kernel
+    unsigned *sq_tail;               // Published to the kernel
+    unsigned sq_mask;                // Submission ring index mask
+    unsigned sq_entries;             // Submission ring size
+    unsigned sq_local_tail;          // Entries prepared, published on the next submit
+    unsigned *cq_head;               // Consumed by the worker
+    unsigned *cq_tail;               // Produced by the kernel
+    unsigned cq_mask;                // Completion ring index mask
+    struct io_uring_cqe *cqes;       // Completion queue entries
+    struct io_uring_buf_ring *buffers;  // Ring handing receive buffers to the kernel
+    uint8_t *buffer_memory;          // URING_BUFFERS buffers of URING_BUFFER_SIZE bytes
+    unsigned buffer_tail;            // Next free entry of the buffer ring
+} uring_t;
+
+// Operation of an io_uring completion, kept in the low bits of its user data
+enum {
+    URING_ACCEPT,          // Multishot accept on the listening socket
+    URING_POLL,            // The worker's epoll instance became readable
+    URING_RECV,            // Receive on a client connection
+    URING_SEND             // Send of a client connection's replies
+};
+#endif
+
+/**
+ * One captured frame waiting in a trace ring.
+ */
+typedef struct {
+    trace_record_t record;           // Record header as written to the trace file
+    uint8_t data[MODBUS_TCP_MAX_ADU_LENGTH];  // Captured frame bytes
+} trace_slot_t;
+
+/**
+ * Single-producer, single-consumer ring of captured frames.
+ * The owning worker advances head, the trace thread advances tail.
+ */
+typedef struct {
+    trace_slot_t *slots;             // TRACE_RING_SLOTS entries
+    atomic_uint head;                // Next slot written by the worker
+    atomic_uint tail;                // Next slot read by the trace thread
+    atomic_ulong dropped;            // Frames lost because the ring was full
+} trace_ring_t;
+
+/**
+ * Frame tracer draining the worker rings into the trace file from a background thread.
+ */
+typedef struct {
+    FILE *file;                      // Trace file, see modbus_trace.h
+    trace_ring_t *rings;             // One ring per worker
+    int nb_rings;                    // Number of rings
+    atomic_int running;              // Cleared to stop the drain thread
+    pthread_t thread;                // Drain thread
+} tracer_t;
+
+/**
+ * One client write waiting in a journal ring.
+ */
+typedef struct {
+    journal_record_t record;         // Record header as written to the journal
+    uint8_t values[2 * JOURNAL_VALUE_BYTES];  // Entries before the write, then after it
+} journal_slot_t;
+
+/**
+ * Single-producer, single-consumer ring of journaled writes.
+ * The owning worker advances head, the journal thread advances tail.
+ */
+typedef struct {
+    journal_slot_t *slots;           // JOURNAL_RING_SLOTS entries
+    atomic_uint head;                // Next slot written by the worker
+    atomic_uint tail;                // Next slot read by the journal thread
+    atomic_ulong dropped;            // Writes lost because the ring was full
+} journal_ring_t;
+
+/**
+ * Write journal appended to from a background thread, see modbus_journal.h.
+ */
+typedef struct {
+    FILE *file;                      // Journal file
+    journal_ring_t *rings;           // One ring per worker
+    int nb_rings;                    // Number of rings
+    atomic_ullong sequence;          // Last sequence number handed to a write
+    atomic_int running;              // Cleared to stop the drain thread
+    pthread_t thread;                // Drain thread
+} journal_t;
+
+/**
+ * One message waiting in a log ring, formatted by the thread that logged it.
+ */
+typedef struct {
+    uint64_t timestamp_ns;           // CLOCK_REALTIME when the message was logged
+    int level;                       // LOG_LEVEL_*
+    int length;                      // Bytes of text
+    char text[LOG_MESSAGE_LENGTH];   // Message without level prefix or newline
+} log_slot_t;
+
+/**
+ * Call site of log messages, for the limit on repeated messages.
+ */
+typedef struct {
+    const char *format;              // Format string identifying the call site, NULL if unused
+    uint64_t window_ns;              // Start of the current one-second window
+    int count;                       // Messages logged from the site in the window
+} log_site_t;
+
+/**
+ * Log ring of one thread.
+ * The thread is the only producer and the log writer the only consumer; the
+ * call sites are only touched by the thread.
+ */
+typedef struct {
+    log_slot_t slots[LOG_RING_SLOTS];
+    atomic_uint head;                // Next slot filled by the thread
+    atomic_uint tail;                // Next slot written out by the log writer
+    atomic_ulong dropped;            // Messages lost because the ring was full
+    atomic_ulong suppressed;         // Messages held back by the repeat limit
+    pid_t tid;                       // Kernel thread ID of the thread, in structured output
+    log_site_t sites[LOG_SITES];     // Recent call sites, indexed by a hash of their format string
+} log_ring_t;
+
+/**
+ * Asynchronous logger shared by every thread of the process.
+ * Until it starts, messages are written directly by the thread logging them.
+ * While it runs, a thread claims a ring the first time it logs and only
+ * formats its messages into it; the writer thread does the output.
+ */
+typedef struct {
+    atomic_int level;                // Highest LOG_LEVEL_* written
+    atomic_int base_level;           // Level set by the options or the reload file, SIGUSR2 toggles debug over it
+    int format;                      // LOG_FORMAT_*
+    atomic_int running;              // Set while the writer thread runs
+    _Atomic(log_ring_t *) rings[LOG_RINGS];  // Claimed rings, NULL until published by their thread
+    atomic_int nb_rings;             // Rings claimed so far, beyond LOG_RINGS threads write directly
+    int signal_fd;                   // SIGUSR2 descriptor, -1 if the level cannot be toggled
+    pthread_t thread;                // Writer thread
+} logger_t;
+
+static const char *log_level_names[] = { "error", "info", "debug" };  // Indexed by LOG_LEVEL_*
+static const char *log_format_names[] = { "text", "json", "kv" };     // Indexed by LOG_FORMAT_*
+
+static logger_t logger = { .level = LOG_LEVEL_INFO, .base_level = LOG_LEVEL_INFO, .signal_fd = -1 };
+static __thread log_ring_t *thread_log_ring;  // Ring of the calling thread, NULL until it logs while the logger runs
+static __thread int thread_log_direct;        // Set when no ring was left for the calling thread
+
+/**
+ * Function codes with their own latency histogram, the rest share the last slot.
+ */
+static const int stat_functions[] = {
+    MODBUS_FC_READ_COILS, MODBUS_FC_READ_DISCRETE_INPUTS, MODBUS_FC_READ_HOLDING_REGISTERS,
+    MODBUS_FC_READ_INPUT_REGISTERS, MODBUS_FC_WRITE_SINGLE_COIL, MODBUS_FC_WRITE_SINGLE_REGISTER,
+    MODBUS_FC_WRITE_MULTIPLE_COILS, MODBUS_FC_WRITE_MULTIPLE_REGISTERS, MODBUS_FC_REPORT_SLAVE_ID,
+    MODBUS_FC_MASK_WRITE_REGISTER, MODBUS_FC_WRITE_AND_READ_REGISTERS,
+};
+#define STAT_FUNCTION_OTHER ((int)(sizeof(stat_functions) / sizeof(stat_functions[0])))
+
+/**
+ * Log-linear latency histogram in nanoseconds, written only by its worker.
+ */
+typedef struct {
+    atomic_ullong buckets[LATENCY_BUCKETS];  // Samples per bucket, see latency_bucket()
+    atomic_ullong count;             // Number of samples
+    atomic_ullong sum_ns;            // Sum of all samples
+} latency_histogram_t;
+
+/**
+ * Histogram summed over all workers by the statistics thread.
+ */
+typedef struct {
+    uint64_t buckets[LATENCY_BUCKETS];
+    uint64_t count;
+    uint64_t sum_ns;
+} histogram_snapshot_t;
+
+/**
+ * Statistics of one worker.
+ * Each worker only updates its own entry, and entries are cache-line aligned
+ * so workers never write to the same line.
+ */
+typedef struct __attribute__((aligned(CACHE_LINE_SIZE))) {
+    atomic_ullong requests;          // Requests served
+    atomic_ullong exceptions;        // Requests answered with an exception
+    atomic_ullong rx_bytes;          // Request bytes received
+    atomic_ullong tx_bytes;          // Reply bytes sent
+    atomic_ullong connections_opened;  // Connections accepted
+    atomic_ullong connections_closed;  // Connections closed
+    atomic_ullong connections_evicted;  // Connections closed by a timeout, included in connections_closed
+    atomic_ullong tls_handshakes;    // TLS handshakes completed
+    atomic_ullong tls_resumed;       // TLS handshakes that resumed a session, included in tls_handshakes
+    atomic_ullong read_cache_hits;   // Register reads answered from the read cache, included in requests
+    atomic_ullong throttled;         // Requests answered Server Device Busy by a rate limit, included in exceptions
+    atomic_ullong denied;            // Writes refused by --write-allow or --read-only, included in exceptions
+    latency_histogram_t by_function[STAT_FUNCTION_OTHER + 1];  // Indexed by function_slot()
+    _Atomic(latency_histogram_t *) by_unit[UNIT_ID_COUNT];     // One block allocated by init_worker()
+} worker_stats_t;
+
+/**
+ * Statistics thread serving metrics over HTTP and on SIGUSR1.
+ */
+typedef struct {
+    worker_stats_t *workers;         // One entry per worker
+    int count;                       // Number of workers
+    int signal_fd;                   // signalfd receiving SIGUSR1
+    int listen_fd;                   // HTTP listening socket, -1 if disabled
+    pthread_t thread;                // Statistics thread
+} stats_server_t;
+
+/**
+ * Connected change subscriber.
+ */
+typedef struct {
+    int fd;                          // SOCK_SEQPACKET connection, -1 for a free slot
+    uint64_t skip;                   // Change set left unsent after a dropped message, 0 if none
+} subscriber_t;
+
+/**
+ * Change notification thread serving batched change sets, see modbus_notify.h.
+ */
+typedef struct {
+    unit_map_t *units;               // Register maps to watch
+    uint8_t store_units[UNIT_ID_COUNT];  // Unit identifier reported for each store, 0 for a shared map
+    const char *path;                // Path of the UNIX socket, removed on shutdown
+    int listen_fd;                   // Socket accepting subscribers, -1 if notifications are disabled
+    int interval_ms;                 // Time between two change sets
+    unsigned int **seen;             // Sequence words last seen per store table, NULL unless producers share the map
+    subscriber_t subscribers[MAX_SUBSCRIBERS];
+    uint64_t sequence;               // Number of the last change set
+    int target;                      // Subscriber receiving the message being built, -1 for all of them
+    int flags;                       // MODBUS_NOTIFY_FLAG_* bits of the change set being built
+    uint64_t timestamp_ns;           // When the change set being built was collected
+    size_t length;                   // Bytes of the message being built, 0 if none
+    uint32_t nb_changes;             // Changes in the message being built
+    int messages;                    // Messages already sent of the change set being built
+    uint8_t message[MODBUS_NOTIFY_MAX_MESSAGE];
+    pthread_t thread;                // Notification thread
+} notifier_t;
+
+/**
+ * Reply to a register read kept in a worker's read cache.
+ * The reply stays valid while the sequence counters of the blocks it was read
+ * from keep the values they had, which lasts until a writer, or a producer
+ * sharing the map, publishes into one of those blocks.
+ */
+typedef struct {
+    uint64_t key;                    // Unit ID, function code, address and quantity of the request, 0 if empty
+    const atomic_uint *seq;          // Sequence counter of the first block read
+    unsigned int seen[CACHE_SPAN_BLOCKS];  // Counters of the blocks read when the reply was built
+    int nb_blocks;                   // Number of blocks read
+    int length;                      // Length of the reply
+    uint8_t reply[MBAP_HEADER_LENGTH + 2 + 2 * MODBUS_MAX_READ_REGISTERS];
+} cached_reply_t;
+
+/**
+ * Per-thread worker state.
+ * Every worker owns its event loop and its own Modbus context, so no libmodbus
+ * state is shared between threads. Accepted sockets are handed to a worker
+ * through its notification pipe and stay with that worker until they close.
+ */
+typedef struct {
+    int id;                          // Worker index, used in log messages
+    pthread_t thread;                // Thread running the worker's event loop
+    modbus_t *ctx;                   // Context used to frame requests and replies
+    unit_map_t *units;               // Register maps shared by all workers
+    modbus_mapping_t window;         // Mapping handed to modbus_reply(), covers only the requested range
+    int window_start;                // Address of the first scratch entry
+    uint8_t *bit_scratch;            // Window storage for coils and discrete inputs
+    uint16_t *reg_scratch;           // Window storage for registers
+    int epoll_fd;                    // Event loop watching the worker's client sockets
+    int notify_pipe[2];              // Accepted client sockets written by the acceptor thread, never blocking it
+    atomic_int stopped;              // Set once the event loop returned, the acceptor then skips the worker
+    event_source_t listener;         // Listening socket, when the worker accepts connections itself
+    event_source_t handoff;          // Read end of notify_pipe
+    trace_ring_t *trace;             // Frame trace ring, NULL if tracing is disabled
+    journal_t *journal;              // Write journal, the worker fills rings[id]; NULL if disabled
+    uint32_t request_client;         // Client address of the request being served, for the journal
+    uint32_t request_connection;     // Connection identifier of that request
+    worker_stats_t *stats;           // Statistics updated by this worker
+    uint32_t next_connection;        // Sequence used to build connection identifiers
+    int fast_path;                   // Answer FC03/04/06/16 without libmodbus
+    rtu_stream_t serial[MAX_SERIAL_PORTS];  // Serial ports, only served by worker 0
+    int nb_serial;                   // Number of serial ports
+    event_source_t rtu_listener;     // RTU-over-TCP listening socket, fd -1 if disabled
+    modbus_t *rtu_ctx;               // Unconnected RTU context replying on RTU-over-TCP sockets
+    int rtu_unit;                    // Unit answered on RTU streams, -1 to answer every served unit
+    _Atomic(live_settings_t *) *live;  // Settings published by the reloader
+    const live_settings_t *settings; // Settings picked up at the start of the current batch of events
+    atomic_uint epoch;               // Odd while the worker handles a batch of events
+    connection_t *connections;       // Open client connections
+    rtu_stream_t *rtu_clients;       // Open RTU-over-TCP connections
+    rtu_stream_t *rtu_pool;          // RTU-over-TCP streams allocated with the listener, max_connections of them
+    rtu_stream_t *free_rtu_streams;  // Streams of the pool not in use
+    int nb_connections;              // Open client connections of both kinds, up to max_connections
+    connection_t *slab;              // Connection slots allocated at startup
+    connection_t *free_slots;        // Slots not in use
+    int max_connections;             // Number of slots in the slab, also the limit on open connections
+    int cpu;                         // CPU the worker's thread is pinned to, -1 if not pinned
+    int node;                        // NUMA node of that CPU, -1 if unknown
+    uint64_t busy_poll_ns;           // Time to poll for events before blocking, 0 to block right away
+    cached_reply_t *read_cache;      // Replies to recent register reads, NULL if the cache is disabled
+    client_bucket_t *clients;        // Buckets of --client-rate-limit, MAX_RATE_CLIENTS entries, NULL if disabled
+    connection_t *ready_head;        // Connections with frames left after their turn, oldest first
+    connection_t *ready_tail;
+    int nb_ready;                    // Number of connections in the ready list
+    rtu_stream_t *rtu_ready_head;    // RTU streams with frames left after their turn, oldest first
+    rtu_stream_t *rtu_ready_tail;
+    int access_control;              // Requests are checked against --write-allow and --read-only
+    uint32_t read_cache_mask;        // Number of cache entries minus one
+    uint64_t idle_timeout_ns;        // Connection timeouts, 0 when disabled
+    uint64_t byte_timeout_ns;
+    uint64_t response_timeout_ns;
+    uint64_t sweep_interval_ns;      // Period of the timeout sweep, 0 if no timeout is enabled
+    uint64_t next_sweep_ns;          // When the connections are swept next
+    const server_config_t *config;   // Socket options applied to accepted connections
+#ifdef USE_IO_URING
+    uring_t *ring;                   // Ring serving the client sockets, NULL when they are on epoll
+#endif
+    tls_context_t *tls;              // Context of the TLS client sessions, NULL for plain Modbus TCP
+    int reply_pair[2];               // Socket pair catching the replies libmodbus encodes for TCP clients
+} worker_t;
+
+/**
+ * Thread applying the reload file whenever the process receives SIGHUP.
+ */
+typedef struct {
+    _Atomic(live_settings_t *) live; // Settings the workers serve
+    live_settings_t initial;         // Settings the server started with, never released
+    server_config_t *config;         // Server settings, for what a reload cannot change
+    worker_t *workers;               // Workers to wait for before replaced settings are released
+    int count;                       // Number of workers
+    sem_t attached;                  // Posted once workers and count are set, reloads wait for it
+    int signal_fd;                   // SIGHUP descriptor, -1 if reloading is disabled
+    pthread_t thread;                // Reload thread
+} reloader_t;
+
+/**
+ * Function to display the usage/help message.
+ * This function provides information about the available options and configuration
+ * arguments for the Modbus server.
+ */
+void print_usage() {
+    printf("Modbus Server - Version %s\n", VERSION);
+    printf("Copyright (c) 2025 Aleksandra Matysik MikroB S.A.\n\n");
+    printf("Usage: modbus_server [OPTIONS]\n\n");
+
+    printf("General Options:\n");
+    printf("  -h, --help        Show this help message\n");
+    printf("  -v, --version     Show version information\n");
+
+    printf("\nServer Configuration:\n");
+    printf("  -i IP             Set server IP address (default: 0.0.0.0)\n");
+    printf("  -p PORT           Set server port (default: 502, 802 with --tls)\n");
+    printf("  -r REG_COUNT      Set number of holding registers (default: 10)\n");
+    printf("  --coils [START:]COUNT\n");
+    printf("                    Map COUNT coils from address START (default: none)\n");
+    printf("  --discrete-inputs [START:]COUNT\n");
+    printf("                    Map COUNT discrete inputs from address START (default: none)\n");
+    printf("  --holding-registers [START:]COUNT\n");
+    printf("                    Map COUNT holding registers from address START (default: 0:10)\n");
+    printf("  --input-registers [START:]COUNT\n");
+    printf("                    Map COUNT input registers from address START (default: none)\n");
+    printf("  --sparse          Allocate table pages on first write instead of at startup\n");
+    printf("  --persist FILE    Map the register tables from FILE so they survive restarts\n");
+    printf("  --persist-interval MS\n");
+    printf("                    Flush the store file every MS milliseconds (default: 1000)\n");
+    printf("  --shm NAME        Keep the register tables in shared-memory segment NAME so local\n");
+    printf("                    producers can update them directly (see modbus_shm.h)\n");
+    printf("  --load-map FILE   Fill the tables from FILE at startup, a CSV file of\n");
+    printf("                    UNIT,TABLE,ADDRESS,VALUE[,VALUE...] lines or a --persist file\n");
+    printf("  --reload FILE     Apply the table layouts, units and timeouts of FILE at startup and again\n");
+    printf("                    on SIGHUP, without dropping connections or register values\n");
+    printf("  --generator TABLE:ADDRESS[:COUNT]=KIND[:ARG...]\n");
+    printf("                    Compute registers when they are read instead of storing them, KIND is\n");
+    printf("                    counter[:STEP[:PERIOD_MS]], sine[:AMPLITUDE[:OFFSET[:PERIOD_MS]]],\n");
+    printf("                    random[:STEP[:MIN[:MAX[:PERIOD_MS]]]] or clock; repeat for up to %d ranges\n",
+           MAX_GENERATORS);
+    printf("  --fast-path       Answer FC03/04/06/16 natively instead of through libmodbus\n");
+    printf("  --trace FILE      Capture every frame with a timestamp into FILE (see modbus_trace.h)\n");
+    printf("  --journal FILE    Append every client write with its old and new values to FILE\n");
+    printf("                    (see modbus_journal.h)\n");
+    printf("  --idle-timeout MS Close connections that send no request for MS milliseconds (default: off)\n");
+    printf("  --byte-timeout MS Close connections that leave a frame incomplete for MS milliseconds\n");
+    printf("                    (default: %d, 0 for no limit)\n", DEFAULT_BYTE_TIMEOUT_MS);
+    printf("  --response-timeout MS\n");
+    printf("                    Close connections that leave their replies unread for MS milliseconds\n");
+    printf("                    (default: %d, 0 for no limit)\n", DEFAULT_RESPONSE_TIMEOUT_MS);
+    printf("  --keepalive IDLE[:INTERVAL[:COUNT]]\n");
+    printf("                    Probe silent peers after IDLE seconds, every INTERVAL seconds (default: %d),\n",
+           DEFAULT_KEEPALIVE_INTERVAL);
+    printf("                    and drop them after COUNT unanswered probes (default: %d)\n", DEFAULT_KEEPALIVE_COUNT);
+    printf("  --notify PATH     Send batched change sets to subscribers of UNIX socket PATH\n");
+    printf("                    (see modbus_notify.h)\n");
+    printf("  --notify-interval MS\n");
+    printf("                    Collect changes every MS milliseconds (default: %d)\n", DEFAULT_NOTIFY_INTERVAL_MS);
+    printf("  --stats-port PORT Serve Prometheus metrics on http://IP:PORT/metrics (default: off);\n");
+    printf("                    SIGUSR1 always dumps them to stderr\n");
+    printf("  -u, --units LIST  Serve a separate register map for each unit ID in LIST,\n");
+    printf("                    e.g. 1-32,100 (default: one map for every unit ID)\n");
+    printf("  -t, --threads N   Spread client connections across N worker threads (default: 1)\n");
+    printf("  --reuseport N     Fork N server processes accepting on the same port, sharing the\n");
+    printf("                    register map of --shm or --persist (default: off)\n");
+    printf("  --max-connections N\n");
+    printf("                    Connection slots preallocated per worker (default: %d)\n", DEFAULT_MAX_CONNECTIONS);
+    printf("  --cpu-affinity LIST\n");
+    printf("                    Pin the workers to the CPUs of LIST in turn, e.g. 2-5, with their buffers\n");
+    printf("                    on the NUMA node of their CPU (default: off)\n");
+    printf("  --busy-poll US    Poll sockets for US microseconds before blocking, for lower latency\n");
+    printf("                    at the cost of CPU time (default: off)\n");
+    printf("  --read-cache N    Keep the replies to N recent FC03/FC04 requests per worker until the\n");
+    printf("                    registers they read are written, with --fast-path (default: off)\n");
+    printf("  --rate-limit RATE[:BURST]\n");
+    printf("                    Answer requests beyond RATE per second on a connection, after a burst\n");
+    printf("                    of BURST (default: RATE), with Server Device Busy (default: off)\n");
+    printf("  --client-rate-limit RATE[:BURST]\n");
+    printf("                    Same limit for all the connections of a client IP address together\n");
+    printf("  --write-allow ADDRESS[/LENGTH]\n");
+    printf("                    Only let clients of this subnet write; repeat for up to %d subnets\n",
+           MAX_WRITE_PREFIXES);
+    printf("                    (default: every client may write)\n");
+    printf("  --read-only TABLE:ADDRESS[:COUNT]\n");
+    printf("                    Refuse writes to COUNT (default: 1) coils or holding registers from ADDRESS\n");
+    printf("  --tls             Serve Modbus/TCP Security (TLS 1.2 or later) on the server port\n");
+    printf("  --tls-cert FILE   PEM certificate chain of the server, followed by its key unless --tls-key\n");
+    printf("  --tls-key FILE    PEM private key of the server certificate\n");
+    printf("  --tls-ca FILE     Require client certificates signed by the PEM CA certificates in FILE\n");
+    printf("  --tls-ticket-key FILE\n");
+    printf("                    Encrypt session tickets with the %d-byte key in FILE, so servers sharing it\n",
+           TLS_TICKET_KEY_LENGTH);
+    printf("                    resume each other's sessions (default: random key per start)\n");
+    printf("  --rtu DEVICE[:BAUD[:FORMAT]]\n");
+    printf("                    Also serve Modbus RTU on a serial port, e.g. /dev/ttyUSB0:115200:8E1\n");
+    printf("                    (default: 19200:8E1); repeat for up to %d ports\n", MAX_SERIAL_PORTS);
+    printf("  --rtu-unit ID     Unit answered on RTU without --units (default: 1)\n");
+    printf("  --rtu-over-tcp PORT\n");
+    printf("                    Serve RTU frames (with CRC, no MBAP header) on TCP port PORT\n");
+    printf("  --rtu-gap US      Silence that ends an RTU frame (default: 3.5 characters)\n");
+    printf("  --rs485           Switch the serial ports to RS-485 mode\n");
+    printf("  --debug           Log debug messages, same as --log-level debug\n");
+    printf("  --log-level LEVEL Log error, info or debug messages and above (default: info); SIGUSR2\n");
+    printf("                    toggles debug messages, a --reload file may set log-level\n");
+    printf("  --log-format FORMAT\n");
+    printf("                    Write log lines as text, json or kv (key=value) (default: text)\n");
+    
+    printf("\nExample:\n");
+    printf("  modbus_server -i 192.168.1.100 -p 502 -r 20 -t 4 --debug\n");
+    printf("  modbus_server --coils 100 --input-registers 30000:500 --holding-registers 40000:200\n");
+}
+
+/**
+ * Function to check whether messages of a level are written.
+ * Callers building a costly message check this first.
+ *
+ * @param level  The LOG_LEVEL_* of the message.
+ *
+ * @return 1 if the messages are written, 0 otherwise.
+ */
+static inline int log_enabled(int level) {
+    return level <= atomic_load_explicit(&logger.level, memory_order_relaxed);
+}
+
+/**
+ * Function to get a monotonic timestamp for latency measurements.
+ *
+ * @return The time in nanoseconds.
+ */
+uint64_t monotonic_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+/**
+ * Function to get the current time for log messages.
+ *
+ * @return CLOCK_REALTIME in nanoseconds.
+ */
+uint64_t realtime_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+/**
+ * Function to write one log line in the configured format.
+ * Errors and debug messages go to stderr and the others to stdout, where they
+ * went before the logger existed.
+ *
+ * @param timestamp_ns  The time the message was logged.
+ * @param level         The LOG_LEVEL_* of the message.
+ * @param tid           The kernel thread ID of the thread that logged it.
+ * @param text          The message.
+ * @param length        The length of the message.
+ */
+void write_log_line(uint64_t timestamp_ns, int level, pid_t tid, const char *text, int length) {
+    static const char *prefixes[] = { "[ERROR] ", "[INFO] ", "[DEBUG] " };
+    FILE *out = level == LOG_LEVEL_INFO ? stdout : stderr;
+    if (logger.format == LOG_FORMAT_TEXT) {
+        fprintf(out, "%s%.*s\n", prefixes[level], length, text);
+        return;
+    }
+
+    char line[128 + 6 * LOG_MESSAGE_LENGTH];
+    time_t seconds = timestamp_ns / 1000000000ull;
+    struct tm tm;
+    gmtime_r(&seconds, &tm);
+    char stamp[80];  // Sized for any int the compiler assumes tm fields may hold
+    snprintf(stamp, sizeof(stamp), "%04d-%02d-%02dT%02d:%02d:%02d.%06uZ", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday,
+             tm.tm_hour, tm.tm_min, tm.tm_sec, (unsigned int)(timestamp_ns % 1000000000ull / 1000));
+    const char *header = logger.format == LOG_FORMAT_JSON ?
+        "{\"time\":\"%s\",\"level\":\"%s\",\"pid\":%d,\"tid\":%d,\"message\":\"" :
+        "time=%s level=%s pid=%d tid=%d message=\"";
+    int pos = sprintf(line, header, stamp, log_level_names[level], (int)getpid(), (int)tid);
+
+    // Both formats quote the message the JSON way
+    for (int i = 0; i < length; i++) {
+        unsigned char c = text[i];
+        if (c == '"' || c == '\\') {
+            line[pos++] = '\\';
+            line[pos++] = c;
+        } else if (c < 0x20) {
+            pos += sprintf(line + pos, "\\u%04x", c);
+        } else {
+            line[pos++] = c;
+        }
+    }
+    pos += sprintf(line + pos, logger.format == LOG_FORMAT_JSON ? "\"}\n" : "\"\n");
+    fwrite(line, 1, pos, out);
+}
+
+/**
+ * Function to give the calling thread a log ring.
+ *
+ * @return The ring, NULL if the logger is not running or has no ring left.
+ */
+log_ring_t *claim_log_ring(void) {
+    if (thread_log_direct || !atomic_load_explicit(&logger.running, memory_order_acquire)) return NULL;
+    int index = atomic_fetch_add(&logger.nb_rings, 1);
+    log_ring_t *ring = index < LOG_RINGS ? calloc(1, sizeof(log_ring_t)) : NULL;
+    if (ring == NULL) {
+        thread_log_direct = 1;
+        return NULL;
+    }
+    ring->tid = syscall(SYS_gettid);
+    atomic_store_explicit(&logger.rings[index], ring, memory_order_release);
+    thread_log_ring = ring;
+    return ring;
+}
+
+/**
+ * Function to apply the repeat limit to a message.
+ * Each call site, told apart by its format string, may log LOG_BURST messages
+ * per second on each thread; the messages held back are counted and reported
+ * by the log writer. Colliding call sites share an entry and reset each other.
+ *
+ * @param ring    The ring of the calling thread.
+ * @param format  The format string of the message.
+ * @param now     The time of the message.
+ *
+ * @return 1 if the message is logged, 0 if it is held back.
+ */
+int log_repeat_allowed(log_ring_t *ring, const char *format, uint64_t now) {
+    log_site_t *site = &ring->sites[((uintptr_t)format * 0x9E3779B97F4A7C15ull) >> 58 & (LOG_SITES - 1)];
+    if (site->format != format || now - site->window_ns >= 1000000000ull) {
+        site->format = format;
+        site->window_ns = now;
+        site->count = 0;
+    }
+    if (site->count++ < LOG_BURST) return 1;
+    atomic_fetch_add_explicit(&ring->suppressed, 1, memory_order_relaxed);
+    return 0;
+}
+
+/**
+ * Function to log a message.
+ * While the logger runs this only formats the message into the thread's ring;
+ * a message is dropped and counted if the writer has fallen behind and the
+ * ring is full. Before the logger starts, messages are written directly.
+ *
+ * @param level   The LOG_LEVEL_* of the message.
+ * @param limit   Apply the repeat limit of the call site.
+ * @param format  The format string of the message, without a trailing newline.
+ * @param args    The arguments of the format string.
+ */
+void log_vmessage(int level, int limit, const char *format, va_list args) {
+    if (!log_enabled(level)) return;
+    log_ring_t *ring = NULL;
+    if (atomic_load_explicit(&logger.running, memory_order_acquire)) {
+        ring = thread_log_ring ? thread_log_ring : claim_log_ring();
+    }
+    uint64_t now = realtime_ns();
+
+    if (ring == NULL) {
+        char text[LOG_MESSAGE_LENGTH];
+        int length = vsnprintf(text, sizeof(text), format, args);
+        if (length >= (int)sizeof(text)) length = sizeof(text) - 1;
+        write_log_line(now, level, syscall(SYS_gettid), text, length < 0 ? 0 : length);
+        fflush(level == LOG_LEVEL_INFO ? stdout : stderr);
+        return;
+    }
+
+    if (limit && !log_repeat_allowed(ring, format, now)) return;
+    unsigned int head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    unsigned int tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    if (head - tail >= LOG_RING_SLOTS) {
+        atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+        return;
+    }
+    log_slot_t *slot = &ring->slots[head & (LOG_RING_SLOTS - 1)];
+    int length = vsnprintf(slot->text, sizeof(slot->text), format, args);
+    if (length >= (int)sizeof(slot->text)) length = sizeof(slot->text) - 1;
+    slot->length = length < 0 ? 0 : length;
+    slot->level = level;
+    slot->timestamp_ns = now;
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+/**
+ * Function to log a message, subject to the repeat limit of its call site.
+ *
+ * @param level   The LOG_LEVEL_* of the message.
+ * @param format  The format string of the message, without a trailing newline.
+ * @param ...     The arguments of the format string.
+ */
+void log_message(int level, const char *format, ...) __attribute__((format(printf, 2, 3)));
+void log_message(int level, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    log_vmessage(level, 1, format, args);
+    va_end(args);
+}
+
+/**
+ * Function to log a message that is not subject to the repeat limit, such as a frame dump.
+ *
+ * @param level   The LOG_LEVEL_* of the message.
+ * @param format  The format string of the message, without a trailing newline.
+ * @param ...     The arguments of the format string.
+ */
+void log_unlimited_message(int level, const char *format, ...) __attribute__((format(printf, 2, 3)));
+void log_unlimited_message(int level, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    log_vmessage(level, 0, format, args);
+    va_end(args);
+}
+
+/**
+ * Function to set the level of the messages written.
+ *
+ * @param level  The highest LOG_LEVEL_* written.
+ */
+void set_log_level(int level) {
+    atomic_store(&logger.base_level, level);
+    atomic_store(&logger.level, level);
+}
+
+/**
+ * Function to parse a log level name.
+ *
+ * @param name  "error", "info" or "debug".
+ *
+ * @return The LOG_LEVEL_*, -1 if the name is unknown.
+ */
+int parse_log_level(const char *name) {
+    for (int level = LOG_LEVEL_ERROR; level <= LOG_LEVEL_DEBUG; level++) {
+        if (strcmp(name, log_level_names[level]) == 0) return level;
+    }
+    return -1;
+}
+
+/**
+ * Function to write every message waiting in the log rings.
+ *
+ * @return The number of messages written.
+ */
+int drain_log_rings(void) {
+    int written = 0;
+    int count = atomic_load(&logger.nb_rings);
+    for (int i = 0; i < count && i < LOG_RINGS; i++) {
+        log_ring_t *ring = atomic_load_explicit(&logger.rings[i], memory_order_acquire);
+        if (ring == NULL) continue;
+        unsigned int tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+        unsigned int head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        for (; tail != head; tail++) {
+            const log_slot_t *slot = &ring->slots[tail & (LOG_RING_SLOTS - 1)];
+            write_log_line(slot->timestamp_ns, slot->level, ring->tid, slot->text, slot->length);
+            written++;
+        }
+        atomic_store_explicit(&ring->tail, tail, memory_order_release);
+    }
+    if (written) {
+        fflush(stdout);
+        fflush(stderr);
+    }
+    return written;
+}
+
+/**
+ * Function to report the messages the rings dropped or held back since the last report.
+ */
+void report_log_losses(void) {
+    unsigned long dropped = 0, suppressed = 0;
+    int count = atomic_load(&logger.nb_rings);
+    for (int i = 0; i < count && i < LOG_RINGS; i++) {
+        log_ring_t *ring = atomic_load_explicit(&logger.rings[i], memory_order_acquire);
+        if (ring == NULL) continue;
+        dropped += atomic_exchange_explicit(&ring->dropped, 0, memory_order_relaxed);
+        suppressed += atomic_exchange_explicit(&ring->suppressed, 0, memory_order_relaxed);
+    }
+    char text[128];
+    if (dropped) {
+        int length = snprintf(text, sizeof(text), "%lu log messages dropped, the log output cannot keep up", dropped);
+        write_log_line(realtime_ns(), LOG_LEVEL_ERROR, syscall(SYS_gettid), text, length);
+    }
+    if (suppressed && log_enabled(LOG_LEVEL_INFO)) {
+        int length = snprintf(text, sizeof(text), "%lu repeated log messages suppressed", suppressed);
+        write_log_line(realtime_ns(), LOG_LEVEL_INFO, syscall(SYS_gettid), text, length);
+    }
+    fflush(stdout);
+    fflush(stderr);
+}
+
+/**
+ * Function to toggle debug messages after a SIGUSR2.
+ * Debug messages are turned off by going back to the configured level, or to
+ * info if that is the debug level.
+ */
+void toggle_debug_messages(void) {
+    struct signalfd_siginfo info;
+    if (read(logger.signal_fd, &info, sizeof(info)) != sizeof(info)) return;
+    int base = atomic_load(&logger.base_level);
+    int level = atomic_load(&logger.level) == LOG_LEVEL_DEBUG ? (base == LOG_LEVEL_DEBUG ? LOG_LEVEL_INFO : base) :
+                LOG_LEVEL_DEBUG;
+    atomic_store(&logger.level, level);
+    char text[64];
+    int length = snprintf(text, sizeof(text), "Debug messages %s (SIGUSR2)", level == LOG_LEVEL_DEBUG ? "on" : "off");
+    write_log_line(realtime_ns(), LOG_LEVEL_INFO, syscall(SYS_gettid), text, length);
+    fflush(stdout);
+}
+
+/**
+ * Thread entry point writing out the log rings.
+ * Losses are reported once per second at most.
+ *
+ * @param arg  Unused.
+ *
+ * @return NULL once the logger is stopped.
+ */
+void *logger_main(void *arg) {
+    (void)arg;
+    struct pollfd signal_poll = { .fd = logger.signal_fd, .events = POLLIN };
+    uint64_t next_report_ns = 0;
+    while (atomic_load(&logger.running)) {
+        // Wait only when the rings were empty, but look at the signal on every pass so a log storm can't hide it
+        int timeout = drain_log_rings() == 0 ? LOG_DRAIN_INTERVAL_MS : 0;
+        if (poll(&signal_poll, logger.signal_fd != -1, timeout) > 0) toggle_debug_messages();
+        uint64_t now = monotonic_ns();
+        if (now >= next_report_ns) {
+            report_log_losses();
+            next_report_ns = now + 1000000000ull;
+        }
+    }
+    drain_log_rings();
+    report_log_losses();
+    return NULL;
+}
+
+/**
+ * Function to set the level and format of the log before the writer starts.
+ *
+ * @param level   The highest LOG_LEVEL_* written.
+ * @param format  The LOG_FORMAT_* of the output.
+ */
+void init_logger(int level, int format) {
+    set_log_level(level);
+    logger.format = format;
+}
+
+/**
+ * Function to start the log writer.
+ * SIGUSR2 must already be blocked in every thread so it is only seen through
+ * the signalfd. If the writer cannot start, messages keep being written
+ * directly.
+ */
+void start_logger(void) {
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGUSR2);
+    logger.signal_fd = signalfd(-1, &mask, SFD_CLOEXEC);
+    if (logger.signal_fd == -1) {
+        log_message(LOG_LEVEL_ERROR, "Error creating log level signal descriptor: %s", strerror(errno));
+    }
+
+    atomic_store(&logger.running, 1);
+    int rc = pthread_create(&logger.thread, NULL, logger_main, NULL);
+    if (rc != 0) {
+        atomic_store(&logger.running, 0);
+        log_message(LOG_LEVEL_ERROR, "Error starting log thread, logging synchronously: %s", strerror(rc));
+    }
+}
+
+/**
+ * Function to stop the log writer after it has written the remaining messages.
+ * No other thread may log any more; later messages are written directly.
+ */
+void stop_logger(void) {
+    if (atomic_load(&logger.running)) {
+        atomic_store(&logger.running, 0);
+        pthread_join(logger.thread, NULL);
+    }
+    int count = atomic_load(&logger.nb_rings);
+    for (int i = 0; i < count && i < LOG_RINGS; i++) {
+        free(atomic_exchange(&logger.rings[i], NULL));
+    }
+    atomic_store(&logger.nb_rings, 0);
+    thread_log_ring = NULL;
+    if (logger.signal_fd != -1) close(logger.signal_fd);
+    logger.signal_fd = -1;
+}
+
+/**
+ * Function to log a frame in hexadecimal format as a debug message.
+ * Frame dumps are not subject to the repeat limit.
+ *
+ * @param label    The message prefix, e.g. "Received query".
+ * @param frame    The frame bytes, NULL if only the length is known.
+ * @param length   The length of the frame.
+ */
+void print_frame(const char *label, const uint8_t *frame, int length) {
+    static const char hex[] = "0123456789ABCDEF";
+    char line[64 + 3 * MODBUS_TCP_MAX_ADU_LENGTH];
+    int pos = snprintf(line, sizeof(line), "%s (Length: %d)%s", label, length, frame ? ": " : "");
+    for (int i = 0; frame && i < length && i < MODBUS_TCP_MAX_ADU_LENGTH; i++) {
+        line[pos++] = hex[frame[i] >> 4];
+        line[pos++] = hex[frame[i] & 0x0F];
+        line[pos++] = ' ';
+    }
+    line[pos - (frame && length > 0)] = '\0';  // Without the last space
+    log_unlimited_message(LOG_LEVEL_DEBUG, "%s", line);
+}
+
+/**
+ * Function to print the Modbus query received.
+ * This function prints the received query in hexadecimal format.
+ *
+ * @param query    The Modbus query byte array.
+ * @param length   The length of the query.
+ */
+void print_query(const uint8_t *query, int length) {
+    print_frame("Received query", query, length);
+}
+
+/**
+ * Function to print the Modbus response being sent.
+ * This function prints the response in hexadecimal format. Replies encoded by
+ * libmodbus are not visible to the server, so only their length is printed.
+ *
+ * @param response    The Modbus response byte array, NULL if only the length is known.
+ * @param length      The length of the response.
+ */
+void print_response(const uint8_t *response, int length) {
+    print_frame("Sending response", response, length);
+}
+
+/**
+ * Function to release the frame tracer.
+ * The drain thread must not be running.
+ *
+ * @param tracer  The tracer to release.
+ */
+void free_tracer(tracer_t *tracer) {
+    for (int i = 0; i < tracer->nb_rings; i++) {
+        free(tracer->rings[i].slots);
+    }
+    free(tracer->rings);
+    if (tracer->file) fclose(tracer->file);
+    memset(tracer, 0, sizeof(*tracer));
+}
+
+/**
+ * Function to initialize the frame tracer.
+ * One ring is created per worker so that every ring has a single producer.
+ *
+ * @param tracer    The tracer to initialize.
+ * @param path      The trace file to create.
+ * @param nb_rings  The number of rings, one per worker.
+ *
+ * @return 0 if successful, -1 otherwise.
+ */
+int init_tracer(tracer_t *tracer, const char *path, int nb_rings) {
+    memset(tracer, 0, sizeof(*tracer));
+    tracer->file = fopen(path, "wb");
+    if (tracer->file == NULL) {
+        log_message(LOG_LEVEL_ERROR, "Error opening trace file %s: %s", path, strerror(errno));
+        return -1;
+    }
+
+    trace_file_header_t header = {
+        .magic = TRACE_MAGIC,
+        .version_major = TRACE_VERSION_MAJOR,
+        .version_minor = TRACE_VERSION_MINOR,
+    };
+    tracer->rings = calloc(nb_rings, sizeof(trace_ring_t));
+    if (tracer->rings == NULL || fwrite(&header, sizeof(header), 1, tracer->file) != 1) {
+        log_message(LOG_LEVEL_ERROR, "Error setting up trace file %s: %s", path, strerror(errno));
+        free_tracer(tracer);
+        return -1;
+    }
+
+    for (int i = 0; i < nb_rings; i++) {
+        tracer->rings[i].slots = calloc(TRACE_RING_SLOTS, sizeof(trace_slot_t));
+        if (tracer->rings[i].slots == NULL) {
+            log_message(LOG_LEVEL_ERROR, "Error allocating trace ring: %s", strerror(errno));
+            free_tracer(tracer);
+            return -1;
+        }
+        tracer->nb_rings++;
+    }
+    return 0;
+}
+
+/**
+ * Function to capture a frame into a worker's trace ring.
+ * This only costs a memcpy on the serving thread. The frame is dropped and
+ * counted if the drain thread has fallen behind and the ring is full.
+ *
+ * @param ring        The worker's trace ring, NULL if tracing is disabled.
+ * @param connection  The connection identifier.
+ * @param direction   TRACE_REQUEST or TRACE_RESPONSE.
+ * @param frame       The frame bytes, NULL if only the length is known.
+ * @param length      The length of the frame.
+ */
+void trace_frame(trace_ring_t *ring, uint32_t connection, int direction, const uint8_t *frame, int length) {
+    if (ring == NULL) return;
+
+    unsigned int head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    unsigned int tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    if (head - tail >= TRACE_RING_SLOTS) {
+        atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+        return;
+    }
+
+    trace_slot_t *slot = &ring->slots[head & (TRACE_RING_SLOTS - 1)];
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    int captured = frame ? (length < MODBUS_TCP_MAX_ADU_LENGTH ? length : MODBUS_TCP_MAX_ADU_LENGTH) : 0;
+    memset(&slot->record, 0, sizeof(slot->record));
+    slot->record.timestamp_ns = (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+    slot->record.connection = connection;
+    slot->record.direction = direction;
+    slot->record.flags = frame ? 0 : TRACE_FLAG_NO_PAYLOAD;
+    slot->record.captured_length = captured;
+    slot->record.frame_length = length;
+    if (captured) memcpy(slot->data, frame, captured);
+
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+/**
+ * Function to write every frame waiting in the trace rings to the trace file.
+ *
+ * @param tracer  The tracer to drain.
+ *
+ * @return The number of frames written.
+ */
+int drain_tracer(tracer_t *tracer) {
+    int written = 0;
+    for (int i = 0; i < tracer->nb_rings; i++) {
+        trace_ring_t *ring = &tracer->rings[i];
+        unsigned int tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+        unsigned int head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        for (; tail != head; tail++) {
+            const trace_slot_t *slot = &ring->slots[tail & (TRACE_RING_SLOTS - 1)];
+            fwrite(&slot->record, sizeof(slot->record), 1, tracer->file);
+            fwrite(slot->data, 1, slot->record.captured_length, tracer->file);
+            written++;
+        }
+        atomic_store_explicit(&ring->tail, tail, memory_order_release);
+    }
+    if (written) fflush(tracer->file);
+    return written;
+}
+
+/**
+ * Thread entry point draining the trace rings into the trace file.
+ *
+ * @param arg  The tracer_t to drain.
+ *
+ * @return NULL once the tracer is stopped.
+ */
+void *tracer_main(void *arg) {
+    tracer_t *tracer = arg;
+    while (atomic_load(&tracer->running)) {
+        if (drain_tracer(tracer) == 0) usleep(TRACE_DRAIN_INTERVAL_US);
+    }
+    drain_tracer(tracer);
+    return NULL;
+}
+
+/**
+ * Function to start the thread draining the trace rings.
+ *
+ * @param tracer  The tracer to start.
+ *
+ * @return 0 if successful, -1 otherwise.
+ */
+int start_tracer(tracer_t *tracer) {
+    atomic_store(&tracer->running, 1);
+    int rc = pthread_create(&tracer->thread, NULL, tracer_main, tracer);
+    if (rc != 0) {
+        log_message(LOG_LEVEL_ERROR, "Error starting trace thread: %s", strerror(rc));
+        atomic_store(&tracer->running, 0);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Function to stop the drain thread after it has written the remaining frames.
+ *
+ * @param tracer  The tracer to stop.
+ */
+void stop_tracer(tracer_t *tracer) {
+    if (!atomic_load(&tracer->running)) return;
+    atomic_store(&tracer->running, 0);
+    pthread_join(tracer->thread, NULL);
+
+    for (int i = 0; i < tracer->nb_rings; i++) {
+        unsigned long dropped = atomic_load(&tracer->rings[i].dropped);
+        if (dropped) log_message(LOG_LEVEL_ERROR, "Trace ring %d dropped %lu frames", i, dropped);
+    }
+}
+
+/**
+ * Function to release the write journal.
+ * The drain thread must not be running.
+ *
+ * @param journal  The journal to release.
+ */
+void free_journal(journal_t *journal) {
+    for (int i = 0; i < journal->nb_rings; i++) {
+        free(journal->rings[i].slots);
+    }
+    free(journal->rings);
+    if (journal->file) fclose(journal->file);
+    memset(journal, 0, sizeof(*journal));
+}
+
+/**
+ * Function to get the size of each half of a journal record's values.
+ *
+ * @param record  The record.
+ *
+ * @return The number of bytes taken by the entries before, or after, the write.
+ */
+static inline int journal_value_bytes(const journal_record_t *record) {
+    return record->table == JOURNAL_TABLE_COILS ? (record->count + 7) / 8 : record->count * 2;
+}
+
+/**
+ * Function to find the end of the last whole record of an existing journal.
+ * A server that died while appending leaves a record cut short, which the
+ * next run must not append after.
+ *
+ * @param file  The journal, positioned after its header.
+ *
+ * @return The offset following the last whole record.
+ */
+off_t journal_end(FILE *file) {
+    off_t end = ftello(file);
+    journal_record_t record;
+    while (fread(&record, sizeof(record), 1, file) == 1) {
+        if (record.type != JOURNAL_START && record.type != JOURNAL_WRITE) break;
+        off_t values = record.type == JOURNAL_WRITE ? 2 * journal_value_bytes(&record) : 0;
+        uint8_t skipped[2 * JOURNAL_VALUE_BYTES];
+        if (values > (off_t)sizeof(skipped) || (values && fread(skipped, values, 1, file) != 1)) break;
+        end += sizeof(record) + values;
+    }
+    return end;
+}
+
+/**
+ * Function to open the write journal for appending.
+ * A new file gets the file header; an existing one must start with it. The
+ * run then starts with a JOURNAL_START record. One ring is created per worker
+ * so that every ring has a single producer.
+ *
+ * @param journal   The journal to initialize.
+ * @param path      The journal file.
+ * @param nb_rings  The number of rings, one per worker.
+ *
+ * @return 0 if successful, -1 otherwise.
+ */
+int init_journal(journal_t *journal, const char *path, int nb_rings) {
+    memset(journal, 0, sizeof(*journal));
+    journal->file = fopen(path, "a+b");
+    if (journal->file == NULL) {
+        log_message(LOG_LEVEL_ERROR, "Error opening journal %s: %s", path, strerror(errno));
+        return -1;
+    }
+
+    journal_file_header_t header;
+    if (fread(&header, sizeof(header), 1, journal->file) == 1) {
+        if (header.magic != JOURNAL_MAGIC || header.version_major != JOURNAL_VERSION_MAJOR) {
+            log_message(LOG_LEVEL_ERROR, "%s is not a version %d journal", path, JOURNAL_VERSION_MAJOR);
+            free_journal(journal);
+            return -1;
+        }
+        off_t end = journal_end(journal->file);
+        fseeko(journal->file, 0, SEEK_END);
+        off_t size = ftello(journal->file);
+        if (size - end > (off_t)(sizeof(journal_record_t) + 2 * JOURNAL_VALUE_BYTES)) {
+            // More than one record can take, this is not the tail of an interrupted append
+            log_message(LOG_LEVEL_ERROR, "Journal %s has unreadable records at offset %lld", path, (long long)end);
+            free_journal(journal);
+            return -1;
+        }
+        if (end < size) {
+            if (ftruncate(fileno(journal->file), end) == -1) {
+                log_message(LOG_LEVEL_ERROR, "Error truncating journal %s: %s", path, strerror(errno));
+                free_journal(journal);
+                return -1;
+            }
+            log_message(LOG_LEVEL_INFO, "Dropped %lld bytes of a record cut short at the end of journal %s",
+                        (long long)(size - end), path);
+        }
+        fseeko(journal->file, 0, SEEK_END);
+    } else {
+        header = (journal_file_header_t){
+            .magic = JOURNAL_MAGIC,
+            .version_major = JOURNAL_VERSION_MAJOR,
+            .version_minor = JOURNAL_VERSION_MINOR,
+        };
+        if (ftell(journal->file) != 0 || fwrite(&header, sizeof(header), 1, journal->file) != 1) {
+            log_message(LOG_LEVEL_ERROR, "%s is not a journal: %s", path, strerror(errno));
+            free_journal(journal);
+            return -1;
+        }
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    journal_record_t start = {
+        .timestamp_ns = (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec,
+        .type = JOURNAL_START,
+    };
+    journal->rings = calloc(nb_rings, sizeof(journal_ring_t));
+    if (journal->rings == NULL || fwrite(&start, sizeof(start), 1, journal->file) != 1 ||
+        fflush(journal->file) != 0) {
+        log_message(LOG_LEVEL_ERROR, "Error setting up journal %s: %s", path, strerror(errno));
+        free_journal(journal);
+        return -1;
+    }
+
+    for (int i = 0; i < nb_rings; i++) {
+        journal->rings[i].slots = calloc(JOURNAL_RING_SLOTS, sizeof(journal_slot_t));
+        if (journal->rings[i].slots == NULL) {
+            log_message(LOG_LEVEL_ERROR, "Error allocating journal ring: %s", strerror(errno));
+            free_journal(journal);
+            return -1;
+        }
+        journal->nb_rings++;
+    }
+    return 0;
+}
+
+/**
+ * Function to append every write waiting in the journal rings to the journal.
+ *
+ * @param journal  The journal to drain.
+ *
+ * @return The number of writes appended.
+ */
+int drain_journal(journal_t *journal) {
+    int written = 0;
+    for (int i = 0; i < journal->nb_rings; i++) {
+        journal_ring_t *ring = &journal->rings[i];
+        unsigned int tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+        unsigned int head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        for (; tail != head; tail++) {
+            const journal_slot_t *slot = &ring->slots[tail & (JOURNAL_RING_SLOTS - 1)];
+            fwrite(&slot->record, sizeof(slot->record), 1, journal->file);
+            fwrite(slot->values, 1, 2 * journal_value_bytes(&slot->record), journal->file);
+            written++;
+        }
+        atomic_store_explicit(&ring->tail, tail, memory_order_release);
+    }
+    if (written) fflush(journal->file);
+    return written;
+}
+
+/**
+ * Thread entry point draining the journal rings into the journal.
+ *
+ * @param arg  The journal_t to drain.
+ *
+ * @return NULL once the journal is stopped.
+ */
+void *journal_main(void *arg) {
+    journal_t *journal = arg;
+    while (atomic_load(&journal->running)) {
+        if (drain_journal(journal) == 0) usleep(TRACE_DRAIN_INTERVAL_US);
+    }
+    drain_journal(journal);
+    return NULL;
+}
+
+/**
+ * Function to start the thread draining the journal rings.
+ *
+ * @param journal  The journal to start.
+ *
+ * @return 0 if successful, -1 otherwise.
+ */
+int start_journal(journal_t *journal) {
+    atomic_store(&journal->running, 1);
+    int rc = pthread_create(&journal->thread, NULL, journal_main, journal);
+    if (rc != 0) {
+        log_message(LOG_LEVEL_ERROR, "Error starting journal thread: %s", strerror(rc));
+        atomic_store(&journal->running, 0);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Function to stop the drain thread after it has appended the remaining writes.
+ *
+ * @param journal  The journal to stop.
+ */
+void stop_journal(journal_t *journal) {
+    if (!atomic_load(&journal->running)) return;
+    atomic_store(&journal->running, 0);
+    pthread_join(journal->thread, NULL);
+
+    for (int i = 0; i < journal->nb_rings; i++) {
+        unsigned long dropped = atomic_load(&journal->rings[i].dropped);
+        if (dropped) log_message(LOG_LEVEL_ERROR, "Journal ring %d dropped %lu writes", i, dropped);
+    }
+}
+
+
+/**
+ * Names of the data model tables, indexed by TABLE_*.
+ */
+static const char *table_names[TABLE_COUNT] = {
+    "Coils", "Discrete Inputs", "Holding Registers", "Input Registers"
+};
+
+/**
+ * Names of the data model tables as in the command-line options, indexed by TABLE_*.
+ */
+static const char *table_options[TABLE_COUNT] = {
+    "coils", "discrete-inputs", "holding-registers", "input-registers"
+};
+
+/**
+ * Function to print the server's current settings.
+ * Displays the server's IP, port, table layouts, worker threads and log level.
+ *
+ * @param config  The server settings.
+ */
+void print_server_settings(const server_config_t *config) {
+    printf("[INFO] Modbus Server Settings:\n");
+    printf("  IP Address: %s\n", config->server_ip);
+    printf("  Port: %d\n", config->server_port);
+    for (int i = 0; i < TABLE_COUNT; i++) {
+        const table_layout_t *layout = &config->layouts[i];
+        if (layout->count > 0) {
+            printf("  %s: %d (addresses %d-%d)\n", table_names[i], layout->count,
+                   layout->start, layout->start + layout->count - 1);
+        } else {
+            printf("  %s: none\n", table_names[i]);
+        }
+    }
+    printf("  Sparse Tables: %s\n", config->sparse ? "Enabled" : "Disabled");
+    if (config->persist_file) {
+        printf("  Store File: %s (flushed every %d ms)\n", config->persist_file, config->persist_interval);
+    } else {
+        printf("  Store File: Disabled\n");
+    }
+    printf("  Shared Memory: %s\n", config->shm_name ? config->shm_name : "Disabled");
+    if (config->load_map) printf("  Initial Values: %s\n", config->load_map);
+    if (config->reload_file) printf("  Reload File: %s (SIGHUP)\n", config->reload_file);
+    if (config->nb_generators > 0) printf("  Generated Ranges: %d\n", config->nb_generators);
+    if (config->multi_unit) {
+        int served = 0;
+        for (int unit = 0; unit < UNIT_ID_COUNT; unit++) served += config->units[unit];
+        printf("  Unit IDs: %d separate register maps\n", served);
+    } else {
+        printf("  Unit IDs: all (one shared register map)\n");
+    }
+    if (config->reuseport > 0) printf("  Server Processes: %d (SO_REUSEPORT)\n", config->reuseport);
+    printf("  Worker Threads: %d%s\n", config->threads, config->reuseport > 0 ? " per process" : "");
+    printf("  Connections: up to %d per worker\n", config->max_connections);
+    if (config->nb_cpus > 0) {
+        printf("  CPU Affinity:");
+        for (int i = 0; i < config->nb_cpus; i++) printf("%s%d", i ? "," : " ", config->cpus[i]);
+        printf("\n");
+    } else {
+        printf("  CPU Affinity: Disabled\n");
+    }
+    if (config->busy_poll > 0) printf("  Busy Poll: %d us\n", config->busy_poll);
+    else printf("  Busy Poll: Disabled\n");
+    const rate_limit_t *limits[] = { &config->connection_rate, &config->client_rate };
+    for (int i = 0; i < 2; i++) {
+        if (limits[i]->interval_ns == 0) {
+            printf("  Rate Limit per %s: Disabled\n", i ? "Client" : "Connection");
+            continue;
+        }
+        printf("  Rate Limit per %s: %llu requests/s, burst %llu\n", i ? "Client" : "Connection",
+               (unsigned long long)(1000000000ull / limits[i]->interval_ns),
+               (unsigned long long)(limits[i]->tolerance_ns / limits[i]->interval_ns + 1));
+    }
+    for (int i = 0; i < config->nb_write_allow; i++) {
+        struct in_addr network = { .s_addr = htonl(config->write_allow[i].network) };
+        printf("  Write Allowed From: %s/%d\n", inet_ntoa(network), __builtin_popcount(config->write_allow[i].mask));
+    }
+    if (config->nb_write_allow == 0) printf("  Write Allowed From: Any\n");
+    for (int t = 0; t < TABLE_COUNT; t++) {
+        if (config->read_only[t] == NULL) continue;
+        int nb_read_only = 0;
+        for (int w = 0; w < ADDRESS_SPACE / 64; w++) nb_read_only += __builtin_popcountll(config->read_only[t][w]);
+        printf("  Read-Only %s: %d addresses\n", table_names[t], nb_read_only);
+    }
+    for (int i = 0; i < config->nb_serial_ports; i++) {
+        const serial_config_t *serial = &config->serial_ports[i];
+        printf("  RTU Port: %s %d %d%c%d%s\n", serial->device, serial->baud, serial->data_bits, serial->parity,
+               serial->stop_bits, config->rs485 ? " RS-485" : "");
+    }
+    if (config->rtu_over_tcp_port > 0) printf("  RTU over TCP Port: %d\n", config->rtu_over_tcp_port);
+    printf("  Fast Path: %s\n", config->fast_path ? "Enabled" : "Disabled");
+    if (config->read_cache > 0) printf("  Read Cache: %d replies per worker\n", config->read_cache);
+    else printf("  Read Cache: Disabled\n");
+#ifdef USE_IO_URING
+    printf("  Client I/O: %s\n", config->tls ? "epoll (TLS)" : "io_uring");
+#else
+    printf("  Client I/O: epoll\n");
+#endif
+    if (config->tls) {
+        printf("  TLS: certificate %s, client certificates %s, ticket key %s\n", config->tls_cert,
+               config->tls_ca ? config->tls_ca : "not required",
+               config->tls_ticket_key ? config->tls_ticket_key : "random");
+    } else {
+        printf("  TLS: Disabled\n");
+    }
+    printf("  Frame Trace: %s\n", config->trace_file ? config->trace_file : "Disabled");
+    printf("  Write Journal: %s\n", config->journal_file ? config->journal_file : "Disabled");
+    printf("  Timeouts: idle %d ms, byte %d ms, response %d ms (0: none)\n", config->idle_timeout,
+           config->byte_timeout, config->response_timeout);
+    if (config->keepalive_idle > 0) {
+        printf("  TCP Keepalive: after %d s, every %d s, %d probes\n", config->keepalive_idle,
+               config->keepalive_interval, config->keepalive_count);
+    } else {
+        printf("  TCP Keepalive: Disabled\n");
+    }
+    if (config->notify_path) {
+        printf("  Change Notifications: %s (every %d ms)\n", config->notify_path, config->notify_interval);
+    } else {
+        printf("  Change Notifications: Disabled\n");
+    }
+    if (config->stats_port > 0) printf("  Statistics Port: %d\n", config->stats_port);
+    else printf("  Statistics Port: Disabled\n");
+    printf("  Log Level: %s (%s, SIGUSR2 toggles debug)\n", log_level_names[config->log_level],
+           log_format_names[config->log_format]);
+    printf("\n");
+}
+
+/**
+ * Function to initialize a Modbus TCP server context.
+ * This function creates and returns a new Modbus context for the TCP server.
+ *
+ * @param server_ip    The IP address of the server.
+ * @param server_port  The port number to listen on.
+ * 
+ * @return A pointer to the Modbus context if successful, NULL otherwise.
+ */
+modbus_t* init_modbus_server(char *server_ip, int server_port) {
+    modbus_t *ctx = modbus_new_tcp(server_ip, server_port);
+    if (ctx == NULL) {
+        log_message(LOG_LEVEL_ERROR, "Error initializing Modbus server: %s", modbus_strerror(errno));
+        return NULL;
+    }
+    return ctx;
+}
+
+/**
+ * Function to initialize one table of the register store.
+ *
+ * @param table   The table to initialize.
+ * @param start   The address of the first entry.
+ * @param count   The number of entries, 0 leaves the table empty.
+ * @param bits    1 for coil and discrete input tables, 0 for register tables.
+ * @param sparse  1 to allocate pages on first write, 0 to allocate the whole table now.
+ * @param mapped  Storage of modbus_shm_table_size() bytes backing the table, NULL to allocate it.
+ *
+ * @return 0 if successful, -1 otherwise.
+ */
+int init_reg_table(reg_table_t *table, int start, int count, int bits, int sparse, void *mapped) {
+    memset(table, 0, sizeof(*table));
+    table->start = start;
+    table->count = count;
+    table->bits = bits;
+    table->sparse = sparse;
+    if (count == 0) return 0;
+
+    size_t entry_size = bits ? sizeof(uint8_t) : sizeof(uint16_t);
+    table->nb_pages = (count + REG_PAGE_SIZE - 1) / REG_PAGE_SIZE;
+    table->pages = calloc(table->nb_pages, sizeof(*table->pages));
+    if (mapped) {
+        // Sequence words come first so producers sharing the map can take part in the seqlock
+        table->seq = mapped;
+        table->dense = (uint8_t *)mapped + modbus_shm_seq_size(count);
+        table->mapped = 1;
+    } else {
+        table->seq = calloc((count + REG_BLOCK_SIZE - 1) / REG_BLOCK_SIZE, sizeof(atomic_uint));
+        if (!sparse) table->dense = calloc((size_t)table->nb_pages * REG_PAGE_SIZE, entry_size);
+    }
+    if (table->pages == NULL || table->seq == NULL || (!sparse && table->dense == NULL)) {
+        free(table->pages);
+        if (!table->mapped) {
+            free(table->seq);
+            free(table->dense);
+        }
+        return -1;
+    }
+
+    for (int p = 0; p < table->nb_pages && !sparse; p++) {
+        atomic_init(&table->pages[p], (uint8_t *)table->dense + (size_t)p * REG_PAGE_SIZE * entry_size);
+    }
+    return 0;
+}
+
+/**
+ * Function to release the memory held by one table of the register store.
+ *
+ * @param table  The table to release.
+ */
+void free_reg_table(reg_table_t *table) {
+    for (int p = 0; p < table->nb_pages && table->sparse; p++) {
+        free(atomic_load(&table->pages[p]));
+    }
+    if (!table->mapped) {
+        free(table->dense);
+        free(table->seq);
+    }
+    free(table->dirty);
+    free(table->pages);
+    memset(table, 0, sizeof(*table));
+}
+
+/**
+ * Function to compute the storage one register map takes in the store file.
+ *
+ * @param layouts  The size and start address of each table, indexed by TABLE_*.
+ *
+ * @return The size in bytes.
+ */
+size_t store_storage_size(const table_layout_t *layouts) {
+    size_t size = 0;
+    for (int i = 0; i < TABLE_COUNT; i++) {
+        size += modbus_shm_table_size(layouts[i].count, i == TABLE_COILS || i == TABLE_DISCRETE_INPUTS);
+    }
+    return size;
+}
+
+/**
+ * Function to release the memory held by the register store.
+ *
+ * @param store  The store to release.
+ */
+void free_register_store(register_store_t *store) {
+    for (int i = 0; i < TABLE_COUNT; i++) {
+        free_reg_table(&store->tables[i]);
+    }
+}
+
+/**
+ * Function to initialize the register store.
+ * The store replaces a single modbus_mapping_t so that several workers can serve
+ * the same register map: reads take no lock and writes publish atomically per block.
+ * Each table only allocates the entries of its own address range.
+ *
+ * @param store    The store to initialize.
+ * @param layouts  The size and start address of each table, indexed by TABLE_*.
+ * @param sparse   1 to allocate table pages on first write, 0 to allocate them now.
+ * @param mapped   Storage of store_storage_size() bytes backing the tables, NULL to allocate them.
+ *
+ * @return 0 if successful, -1 otherwise.
+ */
+int init_register_store(register_store_t *store, const table_layout_t *layouts, int sparse, uint8_t *mapped) {
+    memset(store, 0, sizeof(*store));
+    for (int i = 0; i < TABLE_COUNT; i++) {
+        int bits = i == TABLE_COILS || i == TABLE_DISCRETE_INPUTS;
+        if (init_reg_table(&store->tables[i], layouts[i].start, layouts[i].count, bits, sparse, mapped) == -1) {
+            log_message(LOG_LEVEL_ERROR, "Error allocating memory for register store: %s", strerror(errno));
+            free_register_store(store);
+            return -1;
+        }
+        if (mapped) mapped += modbus_shm_table_size(layouts[i].count, bits);
+    }
+    pthread_mutex_init(&store->write_lock, NULL);
+    return 0;
+}
+
+/**
+ * Function to release the register maps of all unit identifiers.
+ *
+ * @param units  The unit map to release.
+ */
+void free_unit_map(unit_map_t *units) {
+    for (int i = 0; i < units->nb_stores; i++) {
+        free_register_store(&units->stores[i]);
+    }
+    free(units->stores);
+    memset(units, 0, sizeof(*units));
+}
+
+/**
+ * Function to create the register maps for the served unit identifiers.
+ * In multi-unit mode each listed unit gets its own store, otherwise a single
+ * store answers for every unit identifier.
+ *
+ * @param units   The unit map to initialize.
+ * @param config  The server settings.
+ * @param mapped  The table storage of the store file, one map after the other, NULL to allocate it.
+ *
+ * @return 0 if successful, -1 otherwise.
+ */
+int init_unit_map(unit_map_t *units, const server_config_t *config, uint8_t *mapped) {
+    memset(units, 0, sizeof(*units));
+    int count = 1;
+    if (config->multi_unit) {
+        count = 0;
+        for (int unit = 0; unit < UNIT_ID_COUNT; unit++) count += config->units[unit];
+    }
+
+    units->stores = calloc(count, sizeof(register_store_t));
+    if (units->stores == NULL) {
+        log_message(LOG_LEVEL_ERROR, "Error allocating memory for register maps: %s", strerror(errno));
+        return -1;
+    }
+
+    for (int unit = 0; unit < UNIT_ID_COUNT; unit++) {
+        if (config->multi_unit && !config->units[unit]) continue;
+        if (!config->multi_unit && units->nb_stores == 1) {
+            units->by_unit[unit] = &units->stores[0];
+            continue;
+        }
+
+        register_store_t *store = &units->stores[units->nb_stores];
+        uint8_t *storage = mapped ? mapped + units->nb_stores * store_storage_size(config->layouts) : NULL;
+        if (init_register_store(store, config->layouts, config->sparse, storage) == -1) {
+            free_unit_map(units);
+            return -1;
+        }
+        units->nb_stores++;
+        units->by_unit[unit] = store;
+    }
+    return 0;
+}
+
+/**
+ * Function to make every writer record the blocks it changes.
+ * Must be called before the workers start.
+ *
+ * @param units  The register maps to track.
+ *
+ * @return 0 if successful, -1 otherwise.
+ */
+int enable_change_tracking(unit_map_t *units) {
+    for (int i = 0; i < units->nb_stores; i++) {
+        for (int t = 0; t < TABLE_COUNT; t++) {
+            reg_table_t *table = &units->stores[i].tables[t];
+            if (table->count == 0) continue;
+            int blocks = (table->count + REG_BLOCK_SIZE - 1) / REG_BLOCK_SIZE;
+            table->dirty = calloc((blocks + 63) / 64, sizeof(atomic_ullong));
+            if (table->dirty == NULL) {
+                log_message(LOG_LEVEL_ERROR, "Error allocating change tracking bitmap: %s", strerror(errno));
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+/**
+ * Function to count the register maps a configuration creates.
+ *
+ * @param config  The server settings.
+ *
+ * @return The number of distinct register maps.
+ */
+int count_unit_stores(const server_config_t *config) {
+    if (!config->multi_unit) return 1;
+    int count = 0;
+    for (int unit = 0; unit < UNIT_ID_COUNT; unit++) count += config->units[unit];
+    return count;
+}
+
+/**
+ * Function to release sequence words left odd by a writer that stopped mid-publish.
+ * Only safe while nothing else writes to the mapping.
+ *
+ * @param persist  The mapped store.
+ * @param header   The header of the mapping.
+ */
+void reset_sequence_words(persist_t *persist, const modbus_shm_header_t *header) {
+    uint8_t *table = (uint8_t *)persist->base + MODBUS_SHM_HEADER_SIZE;
+    for (uint32_t store = 0; store < header->nb_stores; store++) {
+        for (int i = 0; i < TABLE_COUNT; i++) {
+            uint32_t count = header->layouts[i][1];
+            atomic_uint *seq = (atomic_uint *)table;
+            for (uint32_t b = 0; b < (count + REG_BLOCK_SIZE - 1) / REG_BLOCK_SIZE; b++) {
+                if (atomic_load(&seq[b]) & 1) atomic_fetch_add(&seq[b], 1);
+            }
+            table += modbus_shm_table_size(count, i == TABLE_COILS || i == TABLE_DISCRETE_INPUTS);
+        }
+    }
+}
+
+/**
+ * Function to release the blocks a server process held when it died.
+ * A live writer holds a block only for its copy, so a block that is still busy
+ * with the same sequence number SEQ_STALE_MS after the process died belonged to
+ * it. The block is released with a compare-and-swap, which leaves it alone if
+ * anyone published into it meanwhile.
+ *
+ * @param persist  The mapped store shared with the server processes.
+ */
+void release_stale_sequence_words(persist_t *persist) {
+    const modbus_shm_header_t *header = persist->base;
+    atomic_uint *words[MAX_STALE_WORDS];
+    unsigned int seen[MAX_STALE_WORDS];
+    int nb_words = 0;
+    uint8_t *table = (uint8_t *)persist->base + MODBUS_SHM_HEADER_SIZE;
+    for (uint32_t store = 0; store < header->nb_stores; store++) {
+        for (int i = 0; i < TABLE_COUNT; i++) {
+            uint32_t count = header->layouts[i][1];
+            atomic_uint *seq = (atomic_uint *)table;
+            for (uint32_t b = 0; b < (count + REG_BLOCK_SIZE - 1) / REG_BLOCK_SIZE && nb_words < MAX_STALE_WORDS; b++) {
+                unsigned int value = atomic_load(&seq[b]);
+                if (!(value & 1)) continue;
+                words[nb_words] = &seq[b];
+                seen[nb_words++] = value;
+            }
+            table += modbus_shm_table_size(count, i == TABLE_COILS || i == TABLE_DISCRETE_INPUTS);
+        }
+    }
+    if (nb_words == 0) return;
+
+    usleep(SEQ_STALE_MS * 1000);
+    int released = 0;
+    for (int i = 0; i < nb_words; i++) {
+        unsigned int expected = seen[i];
+        released += atomic_compare_exchange_strong(words[i], &expected, expected + 1);
+    }
+    if (released > 0) log_message(LOG_LEVEL_ERROR, "Released %d blocks left busy by the dead process", released);
+}
+
+/**
+ * Function to map the register store from a file or a shared-memory segment.
+ * A missing or empty file or segment is created at full size, its tables read
+ * as zero and only the pages that get written take memory or disk blocks. An
+ * existing one is mapped as is, so startup takes the same time whatever its
+ * size; it must have been created with the same table layout and unit list.
+ *
+ * @param persist  The store to map.
+ * @param config   The server settings, with either a store file or a segment name.
+ *
+ * @return 0 if successful, -1 otherwise.
+ */
+int open_persist(persist_t *persist, const server_config_t *config) {
+    modbus_shm_header_t expected = {
+        .magic = MODBUS_SHM_MAGIC,
+        .version = MODBUS_SHM_VERSION,
+        .nb_stores = count_unit_stores(config),
+        .header_size = MODBUS_SHM_HEADER_SIZE,
+    };
+    for (int i = 0; i < TABLE_COUNT; i++) {
+        expected.layouts[i][0] = config->layouts[i].start;
+        expected.layouts[i][1] = config->layouts[i].count;
+    }
+    if (config->multi_unit) memcpy(expected.units, config->units, sizeof(expected.units));
+
+    memset(persist, 0, sizeof(*persist));
+    persist->shm = config->shm_name != NULL;
+    persist->interval_ms = config->persist_interval;
+    persist->size = MODBUS_SHM_HEADER_SIZE + expected.nb_stores * store_storage_size(config->layouts);
+    const char *name = persist->shm ? config->shm_name : config->persist_file;
+    const char *kind = persist->shm ? "shared-memory segment" : "store file";
+    if (persist->shm) {
+        persist->fd = shm_open(name, O_RDWR | O_CREAT | O_CLOEXEC, 0660);
+    } else {
+        persist->fd = open(name, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    }
+    if (persist->fd == -1) {
+        log_message(LOG_LEVEL_ERROR, "Error opening %s %s: %s", kind, name, strerror(errno));
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(persist->fd, &st) == -1) {
+        log_message(LOG_LEVEL_ERROR, "Error reading %s %s: %s", kind, name, strerror(errno));
+        close(persist->fd);
+        return -1;
+    }
+    int created = st.st_size == 0;
+    if (created && ftruncate(persist->fd, persist->size) == -1) {
+        log_message(LOG_LEVEL_ERROR, "Error sizing %s %s: %s", kind, name, strerror(errno));
+        close(persist->fd);
+        return -1;
+    }
+    if (!created && (size_t)st.st_size != persist->size) {
+        log_message(LOG_LEVEL_ERROR, "The %s %s does not match the configured tables and units", kind, name);
+        close(persist->fd);
+        return -1;
+    }
+
+    persist->base = mmap(NULL, persist->size, PROT_READ | PROT_WRITE, MAP_SHARED, persist->fd, 0);
+    if (persist->base == MAP_FAILED) {
+        log_message(LOG_LEVEL_ERROR, "Error mapping %s %s: %s", kind, name, strerror(errno));
+        persist->base = NULL;
+        close(persist->fd);
+        return -1;
+    }
+
+    if (created) {
+        memcpy(persist->base, &expected, sizeof(expected));
+    } else if (memcmp(persist->base, &expected, sizeof(expected)) != 0) {
+        log_message(LOG_LEVEL_ERROR, "The %s %s does not match the configured tables and units", kind, name);
+        munmap(persist->base, persist->size);
+        persist->base = NULL;
+        close(persist->fd);
+        return -1;
+    } else if (!persist->shm) {
+        // A file is only written by this server, a counter left odd means it stopped mid-write
+        reset_sequence_words(persist, &expected);
+    }
+    log_message(LOG_LEVEL_INFO, "%s %s %s (%zu bytes)", created ? "Created" : "Restored", kind, name, persist->size);
+    return 0;
+}
+
+/**
+ * Function to get the table storage of the persistent store file.
+ *
+ * @param persist  The mapped store file.
+ *
+ * @return The storage of the first register map, the others follow it.
+ */
+uint8_t *persist_storage(const persist_t *persist) {
+    return (uint8_t *)persist->base + MODBUS_SHM_HEADER_SIZE;
+}
+
+/**
+ * Thread entry point flushing the store file.
+ * Writers only store into the mapping; dirty pages reach the file here, so a
+ * write never waits for the disk.
+ *
+ * @param arg  The persist_t to flush.
+ *
+ * @return Does not return, the thread is cancelled by close_persist().
+ */
+void *persist_main(void *arg) {
+    persist_t *persist = arg;
+    struct timespec interval = {
+        .tv_sec = persist->interval_ms / 1000,
+        .tv_nsec = (persist->interval_ms % 1000) * 1000000L,
+    };
+    while (1) {
+        nanosleep(&interval, NULL);
+        if (msync(persist->base, persist->size, MS_SYNC) == -1) {
+            log_message(LOG_LEVEL_ERROR, "Error flushing store file: %s", strerror(errno));
+        }
+    }
+}
+
+/**
+ * Function to start flushing the store file periodically.
+ * A shared-memory segment has no backing file and is never flushed.
+ *
+ * @param persist  The mapped store.
+ *
+ * @return 0 if successful, -1 otherwise.
+ */
+int start_persist(persist_t *persist) {
+    if (persist->shm) return 0;
+    int rc = pthread_create(&persist->thread, NULL, persist_main, persist);
+    if (rc != 0) {
+        log_message(LOG_LEVEL_ERROR, "Error starting store flush thread: %s", strerror(rc));
+        return -1;
+    }
+    persist->flushing = 1;
+    return 0;
+}
+
+/**
+ * Function to stop the flush thread, flush the store file a last time and unmap it.
+ * A shared-memory segment is left in place for the producers and the next run.
+ * The workers must not be running.
+ *
+ * @param persist  The mapped store.
+ */
+void close_persist(persist_t *persist) {
+    if (persist->flushing) {
+        pthread_cancel(persist->thread);  // The thread only blocks in nanosleep() and msync(), cancellation points
+        pthread_join(persist->thread, NULL);
+    }
+    if (!persist->shm && msync(persist->base, persist->size, MS_SYNC) == -1) {
+        log_message(LOG_LEVEL_ERROR, "Error flushing store file: %s", strerror(errno));
+    }
+    munmap(persist->base, persist->size);
+    close(persist->fd);
+}
+
+/**
+ * Function to check whether an address range lies inside a table.
+ *
+ * @param table    The table to check.
+ * @param address  The first address of the range.
+ * @param count    The number of entries in the range.
+ *
+ * @return 1 if the whole range is mapped, 0 otherwise.
+ */
+int reg_table_contains(const reg_table_t *table, int address, int count) {
+    return address >= table->start && address + count <= table->start + table->count;
+}
+
+/**
+ * Function to copy entries between a table page and a buffer.
+ * Entries are accessed with relaxed atomics since readers and writers race by design.
+ * A NULL page reads as zeros.
+ *
+ * @param table   The table owning the page.
+ * @param page    The page, NULL if it is not allocated.
+ * @param offset  The first entry within the page.
+ * @param count   The number of entries to copy.
+ * @param buffer  The uint8_t bits or uint16_t registers to fill or store.
+ * @param store   1 to copy from the buffer into the page, 0 to copy from the page into the buffer.
+ */
+void copy_page_entries(const reg_table_t *table, void *page, int offset, int count, void *buffer, int store) {
+    if (table->bits) {
+        uint8_t *entries = page;
+        uint8_t *values = buffer;
+        for (int i = 0; i < count; i++) {
+            if (store) {
+                __atomic_store_n(&entries[offset + i], values[i] ? 1 : 0, __ATOMIC_RELAXED);
+            } else {
+                values[i] = page ? __atomic_load_n(&entries[offset + i], __ATOMIC_RELAXED) : 0;
+            }
+        }
+    } else {
+        uint16_t *entries = page;
+        uint16_t *values = buffer;
+        for (int i = 0; i < count; i++) {
+            if (store) {
+                __atomic_store_n(&entries[offset + i], values[i], __ATOMIC_RELAXED);
+            } else {
+                values[i] = page ? __atomic_load_n(&entries[offset + i], __ATOMIC_RELAXED) : 0;
+            }
+        }
+    }
+}
+
+/**
+ * Function to compute the registers of a generated range at a point in time.
+ *
+ * @param generator  The generated range.
+ * @param now_ns     CLOCK_MONOTONIC time of the read.
+ * @param index      The first register to compute, relative to the range.
+ * @param count      The number of registers to compute.
+ * @param dest       The buffer receiving the registers.
+ */
+void compute_generator(generator_t *generator, uint64_t now_ns, int index, int count, uint16_t *dest) {
+    uint64_t elapsed = now_ns - generator->start_ns;
+    uint64_t value = 0;
+    switch (generator->kind) {
+        case GENERATOR_COUNTER:
+            value = (uint64_t)(int64_t)(generator->step * (double)(elapsed / generator->period_ns));
+            break;
+        case GENERATOR_CLOCK:
+            value = (uint64_t)time(NULL);
+            break;
+        case GENERATOR_SINE:
+            for (int i = 0; i < count; i++) {
+                double phase = (double)(elapsed % generator->period_ns) / generator->period_ns;
+                phase += (double)(index + i) / generator->count;
+                dest[i] = (uint16_t)lround(generator->offset + generator->amplitude * sin(2 * M_PI * phase));
+            }
+            return;
+        case GENERATOR_RANDOM: {
+            // The walk only advances when read, by the periods elapsed since the previous read
+            pthread_mutex_lock(&generator->lock);
+            uint64_t periods = elapsed / generator->period_ns;
+            if (periods - generator->walked > MAX_WALK_STEPS) generator->walked = periods - MAX_WALK_STEPS;
+            for (; generator->walked < periods; generator->walked++) {
+                for (int i = 0; i < generator->count; i++) {
+                    generator->rng ^= generator->rng << 13;
+                    generator->rng ^= generator->rng >> 7;
+                    generator->rng ^= generator->rng << 17;
+                    double walk = generator->walk[i] + (generator->rng & 1 ? generator->step : -generator->step);
+                    generator->walk[i] = walk < generator->min ? generator->min
+                                       : walk > generator->max ? generator->max : walk;
+                }
+            }
+            for (int i = 0; i < count; i++) dest[i] = (uint16_t)lround(generator->walk[index + i]);
+            pthread_mutex_unlock(&generator->lock);
+            return;
+        }
+    }
+    for (int i = 0; i < count; i++) {
+        int shift = 16 * (generator->count - 1 - (index + i));
+        dest[i] = (uint16_t)(value >> shift);
+    }
+}
+
+/**
+ * Function to replace the generated registers of a range read from a table.
+ * Only the generators the range overlaps are evaluated, so values nobody reads
+ * are never computed.
+ *
+ * @param table    The table read.
+ * @param address  The first address read.
+ * @param count    The number of registers read.
+ * @param dest     The registers read from the table.
+ */
+void generate_entries(const reg_table_t *table, int address, int count, void *dest) {
+    uint64_t now_ns = 0;
+    for (int i = 0; i < table->nb_generators; i++) {
+        generator_t *generator = &table->generators[i];
+        if (generator->address >= address + count) break;
+        int first = generator->address > address ? generator->address : address;
+        int end = generator->address + generator->count < address + count ? generator->address + generator->count
+                                                                           : address + count;
+        if (first >= end) continue;
+        if (now_ns == 0) {
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            now_ns = (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+        }
+        compute_generator(generator, now_ns, first - generator->address, end - first,
+                          (uint16_t *)dest + (first - address));
+    }
+}
+
+/**
+ * Function to pause in a spin on a busy block.
+ * A writer only holds a block for its copy, but one that died while holding it
+ * never releases it, so the spin is bounded by SEQ_WAIT_MS.
+ *
+ * @param deadline  When the spin gives up, 0 before the first pause.
+ *
+ * @return 0 to spin on, -1 once the deadline passed, with errno EBUSY.
+ */
+static inline int pause_on_busy_block(uint64_t *deadline) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ volatile("yield");
+#endif
+    uint64_t now = monotonic_ns();
+    if (*deadline == 0) *deadline = now + SEQ_WAIT_MS * 1000000ull;
+    if (now < *deadline) return 0;
+    errno = EBUSY;
+    return -1;
+}
+
+/**
+ * Function to read a consistent snapshot of a range of table entries.
+ * The read takes no lock. It retries while a writer is publishing into one of
+ * the blocks covered by the range, which only lasts as long as the writer's copy,
+ * so a multi-entry read never returns a torn snapshot. Generated ranges are then
+ * computed over the copied values.
+ *
+ * @param table    The table to read from.
+ * @param address  The first address to read, must be mapped.
+ * @param count    The number of entries to read.
+ * @param dest     The buffer receiving uint8_t bits or uint16_t registers.
+ *
+ * @return 0 if successful, -1 if a block stayed busy for SEQ_WAIT_MS.
+ */
+int reg_table_read(const reg_table_t *table, int address, int count, void *dest) {
+    if (count <= 0) return 0;
+
+    int index = address - table->start;
+    int first = index / REG_BLOCK_SIZE;
+    int last = (index + count - 1) / REG_BLOCK_SIZE;
+    size_t entry_size = table->bits ? sizeof(uint8_t) : sizeof(uint16_t);
+    unsigned int seen[MAX_SPAN_BLOCKS];  // count never exceeds MODBUS_MAX_READ_BITS
+    uint64_t deadline = 0;
+
+    while (1) {
+        int busy = 0;
+        for (int b = first; b <= last; b++) {
+            seen[b - first] = atomic_load_explicit(&table->seq[b], memory_order_acquire);
+            if (seen[b - first] & 1) busy = 1;
+        }
+        if (busy) {
+            // A writer is publishing, its copy is short
+            if (pause_on_busy_block(&deadline) == -1) return -1;
+            continue;
+        }
+
+        for (int done = 0; done < count;) {
+            int page = (index + done) / REG_PAGE_SIZE;
+            int offset = (index + done) % REG_PAGE_SIZE;
+            int chunk = count - done < REG_PAGE_SIZE - offset ? count - done : REG_PAGE_SIZE - offset;
+            void *data = atomic_load_explicit(&table->pages[page], memory_order_acquire);
+            copy_page_entries(table, data, offset, chunk, (uint8_t *)dest + done * entry_size, 0);
+            done += chunk;
+        }
+
+        atomic_thread_fence(memory_order_acquire);
+        int torn = 0;
+        for (int b = first; b <= last; b++) {
+            if (atomic_load_explicit(&table->seq[b], memory_order_relaxed) != seen[b - first]) torn = 1;
+        }
+        if (!torn) break;
+        if (pause_on_busy_block(&deadline) == -1) return -1;
+    }
+    if (table->nb_generators > 0) generate_entries(table, address, count, dest);
+    return 0;
+}
+
+/**
+ * Function to publish new values into a range of table entries.
+ * The caller must hold the store's write lock, which orders the server's own
+ * writers; readers never take it. Missing pages of a sparse table are allocated before
+ * the blocks are marked busy, so readers never spin on an allocation.
+ *
+ * @param table    The table to write to.
+ * @param address  The first address to write, must be mapped.
+ * @param count    The number of entries to write.
+ * @param src      The uint8_t bits or uint16_t registers to store.
+ *
+ * @return 0 if successful, -1 if a page could not be allocated or a block stayed busy for SEQ_WAIT_MS.
+ */
+int reg_table_write(reg_table_t *table, int address, int count, const void *src) {
+    if (count <= 0) return 0;
+
+    int index = address - table->start;
+    int first = index / REG_BLOCK_SIZE;
+    int last = (index + count - 1) / REG_BLOCK_SIZE;
+    size_t entry_size = table->bits ? sizeof(uint8_t) : sizeof(uint16_t);
+
+    for (int p = index / REG_PAGE_SIZE; p <= (index + count - 1) / REG_PAGE_SIZE; p++) {
+        if (atomic_load_explicit(&table->pages[p], memory_order_relaxed) != NULL) continue;
+        void *page = calloc(REG_PAGE_SIZE, entry_size);
+        if (page == NULL) return -1;
+        atomic_store_explicit(&table->pages[p], page, memory_order_release);
+    }
+
+    // An odd sequence number tells readers the block is being updated. Blocks are
+    // claimed from even to odd in ascending order, so a producer sharing the map
+    // through modbus_shm.h never publishes into the same block at the same time.
+    uint64_t deadline = 0;
+    for (int b = first; b <= last; b++) {
+        unsigned int seq = atomic_load_explicit(&table->seq[b], memory_order_relaxed);
+        while ((seq & 1) || !atomic_compare_exchange_weak_explicit(&table->seq[b], &seq, seq + 1,
+                                                                   memory_order_acquire, memory_order_relaxed)) {
+            if (!(seq & 1)) continue;
+            if (pause_on_busy_block(&deadline) == -1) {
+                // Nothing was copied yet, the blocks already claimed are released unchanged
+                for (int claimed = first; claimed < b; claimed++) {
+                    atomic_fetch_add_explicit(&table->seq[claimed], 1, memory_order_release);
+                }
+                return -1;
+            }
+            seq = atomic_load_explicit(&table->seq[b], memory_order_relaxed);
+        }
+    }
+    atomic_thread_fence(memory_order_release);
+
+    for (int done = 0; done < count;) {
+        int page = (index + done) / REG_PAGE_SIZE;
+        int offset = (index + done) % REG_PAGE_SIZE;
+        int chunk = count - done < REG_PAGE_SIZE - offset ? count - done : REG_PAGE_SIZE - offset;
+        void *data = atomic_load_explicit(&table->pages[page], memory_order_relaxed);
+        copy_page_entries(table, data, offset, chunk, (uint8_t *)src + done * entry_size, 1);
+        done += chunk;
+    }
+
+    for (int b = first; b <= last; b++) {
+        atomic_fetch_add_explicit(&table->seq[b], 1, memory_order_release);
+    }
+
+    // The notifier clears the bits when it reads the blocks, after the values are published
+    if (table->dirty) {
+        for (int b = first; b <= last; b++) {
+            atomic_fetch_or_explicit(&table->dirty[b / 64], 1ull << (b % 64), memory_order_release);
+        }
+    }
+    return 0;
+}
+
+/**
+ * Function to store initial values into a range of table entries before the server starts.
+ * Private dense tables are filled with memcpy(), nothing else can see them yet.
+ * Mapped tables go through reg_table_write() since --shm producers may already
+ * be running, and pages of a sparse table that would only hold zeros are skipped.
+ *
+ * @param table    The table to fill.
+ * @param address  The first address to fill, must be mapped.
+ * @param count    The number of entries to fill.
+ * @param src      The uint8_t bits or uint16_t registers to store.
+ *
+ * @return 0 if successful, -1 if a page could not be allocated.
+ */
+int load_table_entries(reg_table_t *table, int address, int count, const void *src) {
+    int index = address - table->start;
+    size_t entry_size = table->bits ? sizeof(uint8_t) : sizeof(uint16_t);
+    if (table->dense && !table->mapped) {
+        uint8_t *dest = (uint8_t *)table->dense + index * entry_size;
+        if (!table->bits) {
+            memcpy(dest, src, count * entry_size);
+        } else {
+            for (int i = 0; i < count; i++) dest[i] = ((const uint8_t *)src)[i] ? 1 : 0;
+        }
+        return 0;
+    }
+
+    for (int done = 0; done < count;) {
+        int offset = (index + done) % REG_PAGE_SIZE;
+        int chunk = count - done < REG_PAGE_SIZE - offset ? count - done : REG_PAGE_SIZE - offset;
+        const uint8_t *values = (const uint8_t *)src + done * entry_size;
+        int zero = table->sparse && atomic_load(&table->pages[(index + done) / REG_PAGE_SIZE]) == NULL;
+        for (size_t i = 0; zero && i < chunk * entry_size; i++) zero = values[i] == 0;
+        if (!zero && reg_table_write(table, address + done, chunk, values) == -1) return -1;
+        done += chunk;
+    }
+    return 0;
+}
+
+/**
+ * Function to load a register map image in the modbus_shm.h layout, such as a
+ * --persist file or a copy of a --shm segment.
+ * The file is mapped and each table is copied in one piece. Tables are matched
+ * by address, entries outside the configured tables are ignored. An image of a
+ * single map loads into every unit; an image with separate unit maps needs --units
+ * and loads the units both serve.
+ *
+ * @param units  The register maps to fill.
+ * @param path   The image file, already known to start with MODBUS_SHM_MAGIC.
+ * @param fd     The open image file.
+ *
+ * @return 0 if successful, -1 otherwise.
+ */
+int load_map_image(unit_map_t *units, const char *path, int fd) {
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        log_message(LOG_LEVEL_ERROR, "Error reading register map %s: %s", path, strerror(errno));
+        return -1;
+    }
+    if ((size_t)st.st_size < sizeof(modbus_shm_header_t)) {
+        log_message(LOG_LEVEL_ERROR, "Register map %s is truncated", path);
+        return -1;
+    }
+    uint8_t *base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (base == MAP_FAILED) {
+        log_message(LOG_LEVEL_ERROR, "Error mapping register map %s: %s", path, strerror(errno));
+        return -1;
+    }
+    madvise(base, st.st_size, MADV_SEQUENTIAL);
+
+    modbus_shm_header_t header;
+    memcpy(&header, base, sizeof(header));
+    table_layout_t layouts[TABLE_COUNT];
+    int multi_unit = 0;
+    for (int i = 0; i < TABLE_COUNT; i++) {
+        layouts[i].start = header.layouts[i][0];
+        layouts[i].count = header.layouts[i][1];
+        if (header.layouts[i][0] > ADDRESS_SPACE || header.layouts[i][1] > ADDRESS_SPACE - header.layouts[i][0]) {
+            layouts[i].count = -1;
+        }
+    }
+    for (int unit = 0; unit < UNIT_ID_COUNT; unit++) multi_unit |= header.units[unit];
+    int valid = header.version == MODBUS_SHM_VERSION && header.header_size >= sizeof(header);
+    for (int i = 0; i < TABLE_COUNT; i++) valid &= layouts[i].count >= 0;
+    if (!valid || (size_t)st.st_size != header.header_size + header.nb_stores * store_storage_size(layouts)) {
+        log_message(LOG_LEVEL_ERROR, "Register map %s is not a valid version %d image", path, MODBUS_SHM_VERSION);
+        munmap(base, st.st_size);
+        return -1;
+    }
+    if (multi_unit && units->nb_stores == 1 && units->by_unit[0] == units->by_unit[1]) {
+        log_message(LOG_LEVEL_ERROR, "Register map %s holds separate unit maps, it needs --units", path);
+        munmap(base, st.st_size);
+        return -1;
+    }
+
+    int loaded = 0;
+    uint8_t *map = base + header.header_size;
+    for (int unit = 0, image = 0; unit < UNIT_ID_COUNT && image < (int)header.nb_stores; unit++) {
+        if (multi_unit && !header.units[unit]) continue;
+        for (int s = 0; s < units->nb_stores; s++) {
+            register_store_t *store = &units->stores[s];
+            if (multi_unit && units->by_unit[unit] != store) continue;
+
+            uint8_t *table = map;
+            for (int i = 0; i < TABLE_COUNT; i++) {
+                int bits = i == TABLE_COILS || i == TABLE_DISCRETE_INPUTS;
+                reg_table_t *dest = &store->tables[i];
+                int first = layouts[i].start > dest->start ? layouts[i].start : dest->start;
+                int end = layouts[i].start + layouts[i].count < dest->start + dest->count
+                              ? layouts[i].start + layouts[i].count
+                              : dest->start + dest->count;
+                const uint8_t *entries = table + modbus_shm_seq_size(layouts[i].count);
+                entries += (size_t)(first - layouts[i].start) * (bits ? sizeof(uint8_t) : sizeof(uint16_t));
+                if (first < end && load_table_entries(dest, first, end - first, entries) == -1) {
+                    log_message(LOG_LEVEL_ERROR, "Error allocating table pages: %s", strerror(errno));
+                    munmap(base, st.st_size);
+                    return -1;
+                }
+                table += modbus_shm_table_size(layouts[i].count, bits);
+            }
+            loaded++;
+        }
+        map += store_storage_size(layouts);
+        image++;
+        if (!multi_unit) break;
+    }
+    munmap(base, st.st_size);
+    log_message(LOG_LEVEL_INFO, "Loaded register map %s into %d register map%s (%lld bytes)", path, loaded,
+                loaded == 1 ? "" : "s", (long long)st.st_size);
+    return 0;
+}
+
+/**
+ * Function to parse a table name of a register map CSV file or a generated range.
+ *
+ * @param name  The name, as in the --coils, --discrete-inputs, --holding-registers
+ *              and --input-registers options.
+ *
+ * @return The TABLE_* index, -1 if the name is unknown.
+ */
+int parse_table_name(const char *name) {
+    for (int i = 0; i < TABLE_COUNT; i++) {
+        if (strcmp(name, table_options[i]) == 0) return i;
+    }
+    return -1;
+}
+
+/**
+ * Function to load a register map from a CSV file.
+ * Each line is UNIT,TABLE,ADDRESS,VALUE[,VALUE...] and sets consecutive entries
+ * from ADDRESS; UNIT is * for every register map, and # starts a comment.
+ * Lines continuing the previous one's range are collected and stored with a
+ * single write.
+ *
+ * @param units  The register maps to fill.
+ * @param path   The CSV file.
+ * @param file   The open CSV file.
+ *
+ * @return 0 if successful, -1 otherwise.
+ */
+int load_map_csv(unit_map_t *units, const char *path, FILE *file) {
+    uint16_t *values = malloc(ADDRESS_SPACE * sizeof(uint16_t));
+    uint8_t *bits = malloc(ADDRESS_SPACE * sizeof(uint8_t));
+    char *line = NULL;
+    size_t size = 0;
+    int rc = -1, number = 0, entries = 0;
+    int unit = -1, table_id = -1, start = 0, count = 0;  // Range collected so far
+    if (values == NULL || bits == NULL) {
+        log_message(LOG_LEVEL_ERROR, "Error allocating register map buffers: %s", strerror(errno));
+        goto out;
+    }
+
+    while (1) {
+        ssize_t length = getline(&line, &size, file);
+        char *fields[4] = { NULL };
+        int next_unit = -1, next_table = -1, address = 0;
+        if (length != -1) {
+            number++;
+            char *comment = strchr(line, '#');
+            if (comment) *comment = '\0';
+            char *rest = line;
+            for (int i = 0; i < 4 && rest; i++) fields[i] = strsep(&rest, i < 3 ? "," : "\r\n");
+            if (fields[0] == NULL || strspn(fields[0], " \t\r\n") == strlen(fields[0])) continue;
+
+            char *end;
+            long value;
+            next_table = fields[1] ? parse_table_name(fields[1]) : -1;
+            if (strcmp(fields[0], "*") != 0) {
+                value = strtol(fields[0], &end, 0);
+                next_unit = end != fields[0] && *end == '\0' && value >= 0 && value < UNIT_ID_COUNT ? value : -2;
+            }
+            if (fields[2]) {
+                value = strtol(fields[2], &end, 0);
+                address = end != fields[2] && *end == '\0' && value >= 0 && value < ADDRESS_SPACE ? value : -1;
+            }
+            if (next_unit == -2 || next_table == -1 || fields[2] == NULL || address == -1 || fields[3] == NULL) {
+                log_message(LOG_LEVEL_ERROR, "%s:%d: expected UNIT,TABLE,ADDRESS,VALUE[,VALUE...]", path, number);
+                goto out;
+            }
+            if (next_unit >= 0 && units->by_unit[next_unit] == NULL) {
+                log_message(LOG_LEVEL_ERROR, "%s:%d: unit %d is not served", path, number, next_unit);
+                goto out;
+            }
+        } else if (ferror(file)) {
+            log_message(LOG_LEVEL_ERROR, "Error reading register map %s: %s", path, strerror(errno));
+            goto out;
+        }
+
+        // Store the collected range unless this line continues it
+        if (count > 0 && (length == -1 || next_unit != unit || next_table != table_id || address != start + count)) {
+            for (int s = 0; s < units->nb_stores; s++) {
+                register_store_t *store = &units->stores[s];
+                if (unit >= 0 && units->by_unit[unit] != store) continue;
+                reg_table_t *table = &store->tables[table_id];
+                if (load_table_entries(table, start, count, table->bits ? (void *)bits : (void *)values) == -1) {
+                    log_message(LOG_LEVEL_ERROR, "Error allocating table pages: %s", strerror(errno));
+                    goto out;
+                }
+            }
+            entries += count;
+            count = 0;
+        }
+        if (length == -1) break;
+        if (count == 0) {
+            unit = next_unit;
+            table_id = next_table;
+            start = address;
+        }
+
+        for (char *rest = fields[3]; rest;) {
+            char *field = strsep(&rest, ",");
+            char *end;
+            long value = strtol(field, &end, 0);
+            while (*end == ' ' || *end == '\t') end++;
+            if (end == field || *end != '\0' || value < -32768 || value > 65535) {
+                log_message(LOG_LEVEL_ERROR, "%s:%d: invalid value '%s'", path, number, field);
+                goto out;
+            }
+            reg_table_t *table = &(unit >= 0 ? units->by_unit[unit] : &units->stores[0])->tables[table_id];
+            if (!reg_table_contains(table, start + count, 1)) {
+                log_message(LOG_LEVEL_ERROR, "%s:%d: address %d is outside the table", path, number, start + count);
+                goto out;
+            }
+            values[count] = (uint16_t)value;
+            bits[count] = value != 0;
+            count++;
+        }
+    }
+    log_message(LOG_LEVEL_INFO, "Loaded register map %s (%d entries)", path, entries);
+    rc = 0;
+
+out:
+    free(line);
+    free(values);
+    free(bits);
+    return rc;
+}
+
+/**
+ * Function to compare generated ranges by table and address, for qsort().
+ *
+ * @param a  The first generator_t.
+ * @param b  The second generator_t.
+ *
+ * @return A negative, zero or positive value as a sorts before, with or after b.
+ */
+int compare_generators(const void *a, const void *b) {
+    const generator_t *left = a, *right = b;
+    if (left->table != right->table) return left->table - right->table;
+    return left->address - right->address;
+}
+
+/**
+ * Function to hand the sorted generated ranges to the tables of every register map.
+ *
+ * @param units   The register maps.
+ * @param config  The server settings holding the ranges.
+ */
+void link_generators(unit_map_t *units, server_config_t *config) {
+    for (int s = 0; s < units->nb_stores; s++) {
+        for (int i = 0; i < config->nb_generators;) {
+            int table = config->generators[i].table, first = i;
+            while (i < config->nb_generators && config->generators[i].table == table) i++;
+            units->stores[s].tables[table].generators = &config->generators[first];
+            units->stores[s].tables[table].nb_generators = i - first;
+        }
+    }
+}
+
+/**
+ * Function to prepare the generated ranges and hand them to every register map.
+ * Each table gets the slice of the sorted ranges that belongs to it. Register
+ * maps of different units share the ranges, and so their values.
+ *
+ * @param units   The register maps.
+ * @param config  The server settings holding the ranges.
+ *
+ * @return 0 if successful, -1 otherwise.
+ */
+int attach_generators(unit_map_t *units, server_config_t *config) {
+    qsort(config->generators, config->nb_generators, sizeof(generator_t), compare_generators);
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    for (int i = 0; i < config->nb_generators; i++) {
+        generator_t *generator = &config->generators[i];
+        const table_layout_t *layout = &config->layouts[generator->table];
+        if (generator->address < layout->start ||
+            generator->address + generator->count > layout->start + layout->count) {
+            log_message(LOG_LEVEL_ERROR, "Generated range %s:%d:%d lies outside the table",
+                        table_options[generator->table], generator->address, generator->count);
+            return -1;
+        }
+        const generator_t *previous = i > 0 ? &config->generators[i - 1] : NULL;
+        if (previous && previous->table == generator->table &&
+            previous->address + previous->count > generator->address) {
+            log_message(LOG_LEVEL_ERROR, "Generated ranges overlap at %s:%d", table_options[generator->table],
+                        generator->address);
+            return -1;
+        }
+
+        generator->start_ns = (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+        generator->rng = generator->start_ns ^ ((uint64_t)generator->address << 32) ^ 0x9E3779B97F4A7C15ull;
+        pthread_mutex_init(&generator->lock, NULL);
+        if (generator->kind != GENERATOR_RANDOM) continue;
+        generator->walk = malloc(generator->count * sizeof(double));
+        if (generator->walk == NULL) {
+            log_message(LOG_LEVEL_ERROR, "Error allocating random walk state: %s", strerror(errno));
+            return -1;
+        }
+        for (int j = 0; j < generator->count; j++) generator->walk[j] = (generator->min + generator->max) / 2;
+    }
+    link_generators(units, config);
+    return 0;
+}
+
+/**
+ * Function to release the state of the generated ranges.
+ *
+ * @param config  The server settings holding the ranges.
+ */
+void free_generators(server_config_t *config) {
+    for (int i = 0; i < config->nb_generators; i++) {
+        free(config->generators[i].walk);
+        pthread_mutex_destroy(&config->generators[i].lock);
+    }
+}
+
+/**
+ * Function to fill the register maps from a file before the server starts listening.
+ * A file starting with MODBUS_SHM_MAGIC is a binary image in the modbus_shm.h
+ * layout, anything else is read as CSV.
+ *
+ * @param units  The register maps to fill.
+ * @param path   The register map file.
+ *
+ * @return 0 if successful, -1 otherwise.
+ */
+int load_register_map(unit_map_t *units, const char *path) {
+    FILE *file = fopen(path, "re");
+    if (file == NULL) {
+        log_message(LOG_LEVEL_ERROR, "Error opening register map %s: %s", path, strerror(errno));
+        return -1;
+    }
+    uint32_t magic = 0;
+    int binary = pread(fileno(file), &magic, sizeof(magic), 0) == sizeof(magic) && magic == MODBUS_SHM_MAGIC;
+    int rc = binary ? load_map_image(units, path, fileno(file)) : load_map_csv(units, path, file);
+    fclose(file);
+    return rc;
+}
+
+/**
+ * Function to decode which part of the data model a request touches.
+ * Quantity, byte count and value checks mirror the ones modbus_reply() performs,
+ * so a request is only applied to the store when libmodbus would accept it.
+ *
+ * @param query   The request received from the client.
+ * @param offset  The offset of the function code in the request (the header length).
+ * @param length  The length of the request.
+ * @param info    The decoded request.
+ */
+void decode_request(const uint8_t *query, int offset, int length, request_info_t *info) {
+    const uint8_t *pdu = query + offset;
+    int pdu_length = length - offset;
+    memset(info, 0, sizeof(*info));
+    info->function = pdu[0];
+    info->valid_quantity = 1;
+    info->valid_data = 1;
+    if (pdu_length < 5) return;  // Left to libmodbus
+
+    int address = (pdu[1] << 8) | pdu[2];
+    int value = (pdu[3] << 8) | pdu[4];
+    request_span_t *span = &info->spans[0];
+    span->address = address;
+    span->count = value;
+    info->nb_spans = 1;
+
+    switch (info->function) {
+        case MODBUS_FC_READ_COILS:
+        case MODBUS_FC_READ_DISCRETE_INPUTS:
+            span->table = info->function == MODBUS_FC_READ_COILS ? TABLE_COILS : TABLE_DISCRETE_INPUTS;
+            if (value < 1 || value > MODBUS_MAX_READ_BITS) info->valid_quantity = 0;
+            break;
+        case MODBUS_FC_READ_HOLDING_REGISTERS:
+        case MODBUS_FC_READ_INPUT_REGISTERS:
+            span->table = info->function == MODBUS_FC_READ_HOLDING_REGISTERS ? TABLE_HOLDING_REGISTERS
+                                                                             : TABLE_INPUT_REGISTERS;
+            if (value < 1 || value > MODBUS_MAX_READ_REGISTERS) info->valid_quantity = 0;
+            break;
+        case MODBUS_FC_WRITE_SINGLE_COIL:
+            span->table = TABLE_COILS;
+            span->count = 1;
+            span->write = 1;
+            if (value != 0xFF00 && value != 0x0000) info->valid_data = 0;
+            break;
+        case MODBUS_FC_WRITE_SINGLE_REGISTER:
+            span->table = TABLE_HOLDING_REGISTERS;
+            span->count = 1;
+            span->write = 1;
+            break;
+        case MODBUS_FC_WRITE_MULTIPLE_COILS:
+            span->table = TABLE_COILS;
+            span->write = 1;
+            if (value < 1 || value > MODBUS_MAX_WRITE_BITS || pdu_length < 6 ||
+                pdu[5] != (value + 7) / 8 || pdu_length < 6 + pdu[5]) info->valid_quantity = 0;
+            break;
+        case MODBUS_FC_WRITE_MULTIPLE_REGISTERS:
+            span->table = TABLE_HOLDING_REGISTERS;
+            span->write = 1;
+            if (value < 1 || value > MODBUS_MAX_WRITE_REGISTERS || pdu_length < 6 ||
+                pdu[5] != value * 2 || pdu_length < 6 + pdu[5]) info->valid_quantity = 0;
+            break;
+        case MODBUS_FC_MASK_WRITE_REGISTER:
+            span->table = TABLE_HOLDING_REGISTERS;
+            span->count = 1;
+            span->write = 1;
+            if (pdu_length < 7) info->valid_quantity = 0;
+            break;
+        case MODBUS_FC_WRITE_AND_READ_REGISTERS: {
+            // The write is performed before the read, both on holding registers
+            span->table = TABLE_HOLDING_REGISTERS;
+            request_span_t *write = &info->spans[1];
+            info->nb_spans = 2;
+            write->table = TABLE_HOLDING_REGISTERS;
+            write->write = 1;
+            if (pdu_length < 10) {
+                info->valid_quantity = 0;
+                break;
+            }
+            write->address = (pdu[5] << 8) | pdu[6];
+            write->count = (pdu[7] << 8) | pdu[8];
+            if (value < 1 || value > MODBUS_MAX_WR_READ_REGISTERS ||
+                write->count < 1 || write->count > MODBUS_MAX_WR_WRITE_REGISTERS ||
+                pdu[9] != write->count * 2 || pdu_length < 10 + pdu[9]) info->valid_quantity = 0;
+            break;
+        }
+        default:
+            // Function codes that do not touch the data model are left to libmodbus
+            info->nb_spans = 0;
+            break;
+    }
+}
+
+/**
+ * Function to copy table entries into journal values, coils packed eight per byte.
+ * A failed read leaves them unset; the write then fails on the same blocks and
+ * the record is dropped.
+ *
+ * @param table    The table.
+ * @param address  The first address.
+ * @param count    The number of entries.
+ * @param values   The journal values receiving them.
+ */
+void journal_values(const reg_table_t *table, int address, int count, uint8_t *values) {
+    if (!table->bits) {
+        reg_table_read(table, address, count, values);
+        return;
+    }
+    uint8_t bits[MODBUS_MAX_WRITE_BITS];
+    reg_table_read(table, address, count, bits);
+    memset(values, 0, (count + 7) / 8);
+    for (int i = 0; i < count; i++) values[i / 8] |= bits[i] << (i % 8);
+}
+
+/**
+ * Function to start journaling a write, with the entries it is about to replace.
+ * The caller must hold the store's write lock. The write is only numbered by
+ * journal_commit(), once it is applied.
+ *
+ * @param worker    The worker applying the write.
+ * @param store     The register store written.
+ * @param unit      The unit identifier of the request.
+ * @param function  The function code of the request.
+ * @param span      The range written.
+ *
+ * @return The slot to pass to journal_commit() once the write is applied, NULL if the ring is full
+ *         or the journal disabled.
+ */
+journal_slot_t *journal_begin(worker_t *worker, const register_store_t *store, int unit, int function,
+                              const request_span_t *span) {
+    if (worker->journal == NULL) return NULL;
+    journal_ring_t *ring = &worker->journal->rings[worker->id];
+    unsigned int head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    unsigned int tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    if (head - tail >= JOURNAL_RING_SLOTS) return NULL;
+
+    journal_slot_t *slot = &ring->slots[head & (JOURNAL_RING_SLOTS - 1)];
+    slot->record = (journal_record_t){
+        .client = worker->request_client,
+        .connection = worker->request_connection,
+        .address = span->address,
+        .count = span->count,
+        .type = JOURNAL_WRITE,
+        .unit = unit,
+        .table = span->table,
+        .function = function,
+    };
+    journal_values(&store->tables[span->table], span->address, span->count, slot->values);
+    return slot;
+}
+
+/**
+ * Function to number an applied write, complete its journal record with the
+ * entries it stored and hand it to the journal thread. Only called for writes
+ * that were applied, with the store's write lock still held. A write the ring
+ * had no slot for is numbered too and counted as dropped, so the journal
+ * shows the gap.
+ *
+ * @param worker  The worker that applied the write.
+ * @param slot    The slot returned by journal_begin().
+ * @param store   The register store written.
+ */
+void journal_commit(worker_t *worker, journal_slot_t *slot, const register_store_t *store) {
+    if (worker->journal == NULL) return;
+    journal_ring_t *ring = &worker->journal->rings[worker->id];
+    uint64_t sequence = atomic_fetch_add_explicit(&worker->journal->sequence, 1, memory_order_relaxed) + 1;
+    if (slot == NULL) {
+        atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+        return;
+    }
+    journal_record_t *record = &slot->record;
+    record->sequence = sequence;
+    journal_values(&store->tables[record->table], record->address, record->count,
+                   slot->values + journal_value_bytes(record));
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    record->timestamp_ns = (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+    atomic_store_explicit(&ring->head, atomic_load_explicit(&ring->head, memory_order_relaxed) + 1,
+                          memory_order_release);
+}
+
+/**
+ * Function to apply the write part of a request to the register store.
+ * The caller must hold the store's write lock and the request must be valid.
+ *
+ * @param store   The register store.
+ * @param pdu     The request PDU, starting at the function code.
+ * @param info    The decoded request.
+ *
+ * @return 0 if successful, -1 if the store could not allocate memory for the write or a block stayed busy.
+ */
+int apply_write(register_store_t *store, const uint8_t *pdu, const request_info_t *info) {
+    uint16_t registers[MODBUS_MAX_WRITE_REGISTERS];
+    uint8_t bits[MODBUS_MAX_WRITE_BITS];
+    const request_span_t *span = &info->spans[info->nb_spans - 1];
+    reg_table_t *table = &store->tables[span->table];
+
+    switch (info->function) {
+        case MODBUS_FC_WRITE_SINGLE_COIL:
+            bits[0] = pdu[3] == 0xFF;
+            return reg_table_write(table, span->address, 1, bits);
+        case MODBUS_FC_WRITE_SINGLE_REGISTER:
+            registers[0] = (pdu[3] << 8) | pdu[4];
+            return reg_table_write(table, span->address, 1, registers);
+        case MODBUS_FC_WRITE_MULTIPLE_COILS:
+            for (int i = 0; i < span->count; i++) {
+                bits[i] = (pdu[6 + i / 8] >> (i % 8)) & 1;
+            }
+            return reg_table_write(table, span->address, span->count, bits);
+        case MODBUS_FC_WRITE_MULTIPLE_REGISTERS:
+        case MODBUS_FC_WRITE_AND_READ_REGISTERS: {
+            const uint8_t *data = pdu + (info->function == MODBUS_FC_WRITE_MULTIPLE_REGISTERS ? 6 : 10);
+            for (int i = 0; i < span->count; i++) {
+                registers[i] = (data[2 * i] << 8) | data[2 * i + 1];
+            }
+            return reg_table_write(table, span->address, span->count, registers);
+        }
+        case MODBUS_FC_MASK_WRITE_REGISTER: {
+            uint16_t and_mask = (pdu[3] << 8) | pdu[4];
+            uint16_t or_mask = (pdu[5] << 8) | pdu[6];
+            if (reg_table_read(table, span->address, 1, registers) == -1) return -1;
+            registers[0] = (registers[0] & and_mask) | (or_mask & ~and_mask);
+            return reg_table_write(table, span->address, 1, registers);
+        }
+    }
+    return 0;
+}
+
+/**
+ * Function to point the worker's reply window at the part of the store a request touches.
+ * The window is a modbus_mapping_t whose single non-empty table covers exactly the
+ * requested addresses and is backed by the worker's scratch buffers.
+ *
+ * @param worker  The worker serving the request.
+ * @param info    The decoded request.
+ */
+void prepare_window(worker_t *worker, const request_info_t *info) {
+    modbus_mapping_t *window = &worker->window;
+    memset(window, 0, sizeof(*window));
+    if (info->nb_spans == 0 || !info->valid_quantity) return;
+
+    int start = info->spans[0].address;
+    int end = start + info->spans[0].count;
+    for (int i = 1; i < info->nb_spans; i++) {
+        if (info->spans[i].address < start) start = info->spans[i].address;
+        if (info->spans[i].address + info->spans[i].count > end) {
+            end = info->spans[i].address + info->spans[i].count;
+        }
+    }
+
+    switch (info->spans[0].table) {
+        case TABLE_COILS:
+            window->start_bits = start;
+            window->nb_bits = end - start;
+            window->tab_bits = worker->bit_scratch;
+            break;
+        case TABLE_DISCRETE_INPUTS:
+            window->start_input_bits = start;
+            window->nb_input_bits = end - start;
+            window->tab_input_bits = worker->bit_scratch;
+            break;
+        case TABLE_HOLDING_REGISTERS:
+            window->start_registers = start;
+            window->nb_registers = end - start;
+            window->tab_registers = worker->reg_scratch;
+            break;
+        case TABLE_INPUT_REGISTERS:
+            window->start_input_registers = start;
+            window->nb_input_registers = end - start;
+            window->tab_input_registers = worker->reg_scratch;
+            break;
+    }
+    worker->window_start = start;
+}
+
+/**
+ * Function to move a worker to other register maps.
+ * The read cache is cleared, since its entries point into the old maps.
+ *
+ * @param worker  The worker.
+ * @param map     The register maps to serve.
+ */
+void switch_map(worker_t *worker, unit_map_t *map) {
+    worker->units = map;
+    if (worker->read_cache) memset(worker->read_cache, 0, (worker->read_cache_mask + 1) * sizeof(cached_reply_t));
+}
+
+/**
+ * Function to reply to a request from the register store.
+ * The store is picked by the unit identifier of the request; units without a
+ * register map get a gateway target exception.
+ * Reads copy a lock-free snapshot of the requested range into the worker's window.
+ * Writes are published to the store under the write lock, which is released
+ * before the reply is sent. modbus_reply() then encodes the reply from the window.
+ *
+ * @param worker  The worker serving the request.
+ * @param ctx        The context the request was received on, TCP or RTU.
+ * @param query      The request received from the client.
+ * @param length     The length of the request.
+ * @param exception  Set to the exception code of the reply, 0 for a normal reply.
+ *
+ * @return The length of the reply if successful, -1 otherwise.
+ */
+int reply_from_store(worker_t *worker, modbus_t *ctx, const uint8_t *query, int length, int *exception) {
+    int offset = modbus_get_header_length(ctx);
+    register_store_t *store = worker->units->by_unit[query[offset - 1]];  // Unit ID precedes the PDU
+    *exception = 0;
+    if (store == NULL) {
+        *exception = MODBUS_EXCEPTION_GATEWAY_TARGET;
+        return modbus_reply_exception(ctx, query, MODBUS_EXCEPTION_GATEWAY_TARGET);
+    }
+    request_info_t info;
+    decode_request(query, offset, length, &info);
+
+    // Out-of-range quantities are rejected by modbus_reply() before addresses are checked
+    if (info.valid_quantity) {
+        for (int i = 0; i < info.nb_spans; i++) {
+            const request_span_t *span = &info.spans[i];
+            if (!reg_table_contains(&store->tables[span->table], span->address, span->count)) {
+                *exception = MODBUS_EXCEPTION_ILLEGAL_DATA_ADDRESS;
+                return modbus_reply_exception(ctx, query, MODBUS_EXCEPTION_ILLEGAL_DATA_ADDRESS);
+            }
+        }
+    }
+
+    prepare_window(worker, &info);
+    if (!info.valid_quantity || !info.valid_data) {
+        *exception = MODBUS_EXCEPTION_ILLEGAL_DATA_VALUE;
+        return modbus_reply(ctx, query, length, &worker->window);
+    }
+
+    int writes = info.nb_spans > 0 && info.spans[info.nb_spans - 1].write;
+    if (writes) {
+        pthread_mutex_lock(&store->write_lock);
+        if (store->retired) {
+            // A reload replaced the map after it was picked, the request is served again from the new one
+            pthread_mutex_unlock(&store->write_lock);
+            switch_map(worker, atomic_load(worker->live)->map);
+            return reply_from_store(worker, ctx, query, length, exception);
+        }
+        journal_slot_t *entry = journal_begin(worker, store, query[offset - 1], info.function,
+                                              &info.spans[info.nb_spans - 1]);
+        if (apply_write(store, query + offset, &info) == -1) {
+            pthread_mutex_unlock(&store->write_lock);
+            log_message(LOG_LEVEL_ERROR, "Error writing to the register map: %s", strerror(errno));
+            *exception = MODBUS_EXCEPTION_SLAVE_OR_SERVER_FAILURE;
+            return modbus_reply_exception(ctx, query, MODBUS_EXCEPTION_SLAVE_OR_SERVER_FAILURE);
+        }
+        journal_commit(worker, entry, store);
+    }
+    int rc = 0;
+    for (int i = 0; i < info.nb_spans && rc == 0; i++) {
+        const request_span_t *span = &info.spans[i];
+        if (span->write) continue;
+        int index = span->address - worker->window_start;
+        const reg_table_t *table = &store->tables[span->table];
+        rc = reg_table_read(table, span->address, span->count, table->bits ? (void *)(worker->bit_scratch + index) :
+                                                                             (void *)(worker->reg_scratch + index));
+    }
+    if (writes) pthread_mutex_unlock(&store->write_lock);
+    if (rc == -1) {
+        log_message(LOG_LEVEL_ERROR, "Error reading the register map: %s", strerror(errno));
+        *exception = MODBUS_EXCEPTION_SLAVE_OR_SERVER_FAILURE;
+        return modbus_reply_exception(ctx, query, MODBUS_EXCEPTION_SLAVE_OR_SERVER_FAILURE);
+    }
+
+    // Report slave ID is the only function outside the data model that libmodbus implements
+    if (info.nb_spans == 0 && info.function != MODBUS_FC_REPORT_SLAVE_ID) {
+        *exception = MODBUS_EXCEPTION_ILLEGAL_FUNCTION;
+    }
+    return modbus_reply(ctx, query, length, &worker->window);
+}
+
+/**
+ * Function to build an exception reply for a native request.
+ *
+ * @param frame      The request frame, starting at the MBAP header.
+ * @param exception  The Modbus exception code.
+ * @param rsp        The buffer receiving the reply frame.
+ *
+ * @return The length of the reply.
+ */
+int build_exception(const uint8_t *frame, int exception, uint8_t *rsp) {
+    memcpy(rsp, frame, MBAP_HEADER_LENGTH);
+    rsp[4] = 0;
+    rsp[5] = 3;
+    rsp[7] = frame[7] | 0x80;
+    rsp[8] = exception;
+    return MBAP_HEADER_LENGTH + 2;
+}
+
+/**
+ * Function to check whether an address range includes an address no client may write.
+ * Whole words of the bitmap are tested at once, so the largest write costs a few loads.
+ *
+ * @param bitmap   The table's read-only bitmap.
+ * @param address  The first address, the range must end within the address space.
+ * @param count    The number of addresses.
+ *
+ * @return 1 if the range includes a read-only address, 0 otherwise.
+ */
+static inline int range_read_only(const uint64_t *bitmap, int address, int count) {
+    int last = address + count - 1;
+    for (int word = address / 64; word <= last / 64; word++) {
+        uint64_t mask = ~0ull;
+        if (word == address / 64) mask &= ~0ull << (address % 64);
+        if (word == last / 64) mask &= ~0ull >> (63 - last % 64);
+        if (bitmap[word] & mask) return 1;
+    }
+    return 0;
+}
+
+/**
+ * Function to check a request against --write-allow and --read-only before it is served.
+ * Reads pass on their function code alone. A write from a client outside the
+ * allowed subnets gets Illegal Function, the answer Modbus/TCP Security gives
+ * to unauthorized requests; a write reaching a read-only address gets Illegal
+ * Data Address, as if the address did not exist. Writes with invalid
+ * quantities are left to the regular checks.
+ *
+ * @param config     The server settings.
+ * @param may_write  The client passed --write-allow.
+ * @param query      The request.
+ * @param offset     The offset of the function code in the request (the header length).
+ * @param length     The length of the request.
+ *
+ * @return The exception code to answer, 0 if the request may be served.
+ */
+int access_exception(const server_config_t *config, int may_write, const uint8_t *query, int offset, int length) {
+    int function = query[offset];
+    if (function >= 32 || !(WRITE_FUNCTIONS >> function & 1)) return 0;
+    if (!may_write) return MODBUS_EXCEPTION_ILLEGAL_FUNCTION;
+
+    request_info_t info;
+    decode_request(query, offset, length, &info);
+    if (info.nb_spans == 0 || !info.valid_quantity) return 0;
+    const request_span_t *span = &info.spans[info.nb_spans - 1];
+    const uint64_t *bitmap = config->read_only[span->table];
+    if (bitmap && span->address + span->count <= ADDRESS_SPACE &&
+        range_read_only(bitmap, span->address, span->count)) return MODBUS_EXCEPTION_ILLEGAL_DATA_ADDRESS;
+    return 0;
+}
+
+/**
+ * Function to check whether a client address may write, from the --write-allow subnets.
+ *
+ * @param config  The server settings.
+ * @param addr    The client IPv4 address in network byte order, 0 if unknown.
+ *
+ * @return 1 if the client may write, 0 otherwise.
+ */
+int client_may_write(const server_config_t *config, uint32_t addr) {
+    if (config->nb_write_allow == 0) return 1;
+    uint32_t host = ntohl(addr);
+    for (int i = 0; addr != 0 && i < config->nb_write_allow; i++) {
+        if ((host & config->write_allow[i].mask) == config->write_allow[i].network) return 1;
+    }
+    return 0;
+}
+
+/**
+ * Function to add to a counter owned by the calling worker.
+ * Only the owning worker writes its counters, so a relaxed load and store is
+ * enough and avoids a locked instruction; the stats thread only reads.
+ *
+ * @param counter  The counter to update.
+ * @param value    The amount to add.
+ */
+static inline void stat_add(atomic_ullong *counter, uint64_t value) {
+    atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + value,
+                          memory_order_relaxed);
+}
+
+/**
+ * Function to find the read cache entry of a register read request.
+ * Requests hash on their unit ID, function code, address and quantity, and
+ * each hash has a single entry, which the next reply built for it replaces.
+ *
+ * @param worker  The worker serving the request.
+ * @param frame   The FC03 or FC04 request, with its MBAP header.
+ * @param key     Set to the key of the request.
+ *
+ * @return The entry, NULL if the cache is disabled.
+ */
+cached_reply_t *read_cache_entry(worker_t *worker, const uint8_t *frame, uint64_t *key) {
+    if (worker->read_cache == NULL) return NULL;
+    const uint8_t *pdu = frame + MBAP_HEADER_LENGTH;
+    *key = (uint64_t)frame[6] << 40 | (uint64_t)pdu[0] << 32 | (uint32_t)pdu[1] << 24 | pdu[2] << 16 | pdu[3] << 8 |
+           pdu[4];
+    return &worker->read_cache[(*key * 0x9E3779B97F4A7C15ull) >> 40 & worker->read_cache_mask];
+}
+
+/**
+ * Function to check that a cached reply still holds the current values.
+ *
+ * @param entry  The cache entry.
+ *
+ * @return 1 if no block it was read from changed since, 0 otherwise.
+ */
+static inline int cached_reply_valid(const cached_reply_t *entry) {
+    for (int b = 0; b < entry->nb_blocks; b++) {
+        if (atomic_load_explicit(&entry->seq[b], memory_order_acquire) != entry->seen[b]) return 0;
+    }
+    return 1;
+}
+
+/**
+ * Function to answer the hot function codes without going through libmodbus.
+ * FC03/FC04 reads, FC06 single writes and FC16 multiple writes are decoded in
+ * place and the reply is encoded straight into the caller's buffer, with the
+ * same checks and exceptions as modbus_reply(). Anything else is left to
+ * reply_from_store().
+ *
+ * @param worker  The worker serving the request.
+ * @param frame   The request frame, starting at the MBAP header.
+ * @param length  The length of the frame.
+ * @param rsp     The buffer receiving the reply frame, MODBUS_TCP_MAX_ADU_LENGTH bytes.
+ *
+ * @return The length of the reply, 0 if the request must go through libmodbus.
+ */
+int fast_path_reply(worker_t *worker, const uint8_t *frame, int length, uint8_t *rsp) {
+    const uint8_t *pdu = frame + MBAP_HEADER_LENGTH;
+    int function = pdu[0];
+    if (function != MODBUS_FC_READ_HOLDING_REGISTERS && function != MODBUS_FC_READ_INPUT_REGISTERS &&
+        function != MODBUS_FC_WRITE_SINGLE_REGISTER && function != MODBUS_FC_WRITE_MULTIPLE_REGISTERS) return 0;
+    if (length < MBAP_HEADER_LENGTH + 5) return 0;
+
+    // A cached reply is already checked and encoded, only the transaction and protocol IDs are the client's
+    uint64_t key = 0;
+    cached_reply_t *cached = NULL;
+    if (function == MODBUS_FC_READ_HOLDING_REGISTERS || function == MODBUS_FC_READ_INPUT_REGISTERS) {
+        cached = read_cache_entry(worker, frame, &key);
+        if (cached && cached->key == key && cached_reply_valid(cached)) {
+            memcpy(rsp, cached->reply, cached->length);
+            memcpy(rsp, frame, 4);
+            stat_add(&worker->stats->read_cache_hits, 1);
+            return cached->length;
+        }
+    }
+
+    register_store_t *store = worker->units->by_unit[frame[6]];
+    if (store == NULL) return build_exception(frame, MODBUS_EXCEPTION_GATEWAY_TARGET, rsp);
+
+    int address = (pdu[1] << 8) | pdu[2];
+    int value = (pdu[3] << 8) | pdu[4];
+    uint16_t registers[MODBUS_MAX_READ_REGISTERS];
+    int pdu_length;
+
+    if (function == MODBUS_FC_READ_HOLDING_REGISTERS || function == MODBUS_FC_READ_INPUT_REGISTERS) {
+        reg_table_t *table = &store->tables[function == MODBUS_FC_READ_HOLDING_REGISTERS ?
+                                            TABLE_HOLDING_REGISTERS : TABLE_INPUT_REGISTERS];
+        if (value < 1 || value > MODBUS_MAX_READ_REGISTERS) {
+            return build_exception(frame, MODBUS_EXCEPTION_ILLEGAL_DATA_VALUE, rsp);
+        }
+        if (!reg_table_contains(table, address, value)) {
+            return build_exception(frame, MODBUS_EXCEPTION_ILLEGAL_DATA_ADDRESS, rsp);
+        }
+
+        // Generated values change without a write, their tables are never cached
+        int first = (address - table->start) / REG_BLOCK_SIZE;
+        int nb_blocks = (address - table->start + value - 1) / REG_BLOCK_SIZE - first + 1;
+        unsigned int seen[CACHE_SPAN_BLOCKS];
+        if (table->nb_generators > 0) cached = NULL;
+        for (int b = 0; cached && b < nb_blocks; b++) {
+            seen[b] = atomic_load_explicit(&table->seq[first + b], memory_order_acquire);
+            if (seen[b] & 1) cached = NULL;
+        }
+
+        if (reg_table_read(table, address, value, registers) == -1) {
+            return build_exception(frame, MODBUS_EXCEPTION_SLAVE_OR_SERVER_FAILURE, rsp);
+        }
+        uint8_t *out = rsp + MBAP_HEADER_LENGTH;
+        out[0] = function;
+        out[1] = value * 2;
+        for (int i = 0; i < value; i++) {
+            out[2 + 2 * i] = registers[i] >> 8;
+            out[3 + 2 * i] = registers[i] & 0xFF;
+        }
+        pdu_length = 2 + value * 2;
+
+        // The values belong to the saved counters if no block changed during the read
+        if (cached) {
+            atomic_thread_fence(memory_order_acquire);
+            cached->key = 0;
+            cached->seq = &table->seq[first];
+            cached->nb_blocks = nb_blocks;
+            memcpy(cached->seen, seen, nb_blocks * sizeof(unsigned int));
+            if (cached_reply_valid(cached)) {
+                cached->key = key;
+                cached->length = MBAP_HEADER_LENGTH + pdu_length;
+                memcpy(cached->reply, frame, MBAP_HEADER_LENGTH);
+                cached->reply[4] = (pdu_length + 1) >> 8;
+                cached->reply[5] = (pdu_length + 1) & 0xFF;
+                memcpy(cached->reply + MBAP_HEADER_LENGTH, out, pdu_length);
+            }
+        }
+    } else {
+        reg_table_t *table = &store->tables[TABLE_HOLDING_REGISTERS];
+        int count = 1;
+        const uint8_t *data = pdu + 3;
+        if (function == MODBUS_FC_WRITE_MULTIPLE_REGISTERS) {
+            count = value;
+            data = pdu + 6;
+            if (count < 1 || count > MODBUS_MAX_WRITE_REGISTERS || length < MBAP_HEADER_LENGTH + 6 ||
+                pdu[5] != count * 2 || length < MBAP_HEADER_LENGTH + 6 + count * 2) {
+                return build_exception(frame, MODBUS_EXCEPTION_ILLEGAL_DATA_VALUE, rsp);
+            }
+        }
+        if (!reg_table_contains(table, address, count)) {
+            return build_exception(frame, MODBUS_EXCEPTION_ILLEGAL_DATA_ADDRESS, rsp);
+        }
+
+        for (int i = 0; i < count; i++) {
+            registers[i] = (data[2 * i] << 8) | data[2 * i + 1];
+        }
+        pthread_mutex_lock(&store->write_lock);
+        if (store->retired) {
+            pthread_mutex_unlock(&store->write_lock);
+            switch_map(worker, atomic_load(worker->live)->map);  // Replaced by a reload, see reply_from_store()
+            return fast_path_reply(worker, frame, length, rsp);
+        }
+        request_span_t span = { TABLE_HOLDING_REGISTERS, address, count, 1 };
+        journal_slot_t *entry = journal_begin(worker, store, frame[6], function, &span);
+        int rc = reg_table_write(table, address, count, registers);
+        if (rc == 0) journal_commit(worker, entry, store);
+        pthread_mutex_unlock(&store->write_lock);
+        if (rc == -1) return build_exception(frame, MODBUS_EXCEPTION_SLAVE_OR_SERVER_FAILURE, rsp);
+
+        // Both write replies echo the address and the value or quantity
+        memcpy(rsp + MBAP_HEADER_LENGTH, pdu, 5);
+        pdu_length = 5;
+    }
+
+    memcpy(rsp, frame, MBAP_HEADER_LENGTH);
+    rsp[4] = (pdu_length + 1) >> 8;
+    rsp[5] = (pdu_length + 1) & 0xFF;
+    return MBAP_HEADER_LENGTH + pdu_length;
+}
+
+/**
+ * Function to map a function code to its statistics slot.
+ *
+ * @param function  The Modbus function code.
+ *
+ * @return The index into stat_functions, or STAT_FUNCTION_OTHER.
+ */
+int function_slot(int function) {
+    for (int i = 0; i < STAT_FUNCTION_OTHER; i++) {
+        if (stat_functions[i] == function) return i;
+    }
+    return STAT_FUNCTION_OTHER;
+}
+
+/**
+ * Function to map a latency to its histogram bucket.
+ * Buckets are log-linear: each power of two is split into 8 sub-buckets, so
+ * every bucket is within 12.5% of the values it holds.
+ *
+ * @param ns  The latency in nanoseconds.
+ *
+ * @return The bucket index.
+ */
+int latency_bucket(uint64_t ns) {
+    if (ns < 8) return (int)ns;
+    int shift = 63 - __builtin_clzll(ns) - 3;
+    int bucket = shift * 8 + (int)(ns >> shift);
+    return bucket < LATENCY_BUCKETS ? bucket : LATENCY_BUCKETS - 1;
+}
+
+/**
+ * Function to get the smallest latency held by a histogram bucket.
+ *
+ * @param bucket  The bucket index.
+ *
+ * @return The latency in nanoseconds.
+ */
+uint64_t latency_bucket_floor(int bucket) {
+    if (bucket < 16) return bucket;
+    int shift = bucket / 8 - 1;
+    return (uint64_t)(bucket % 8 + 8) << shift;
+}
+
+/**
+ * Function to record a latency sample in a histogram.
+ *
+ * @param histogram  The histogram owned by the calling worker.
+ * @param ns         The latency in nanoseconds.
+ */
+void record_latency(latency_histogram_t *histogram, uint64_t ns) {
+    stat_add(&histogram->buckets[latency_bucket(ns)], 1);
+    stat_add(&histogram->count, 1);
+    stat_add(&histogram->sum_ns, ns);
+}
+
+/**
+ * Function to account for one served request.
+ * The unit histograms are allocated by init_worker(), so this never allocates.
+ *
+ * @param stats      The statistics of the serving worker.
+ * @param frame      The request frame; the unit ID is right before the function code.
+ * @param offset     The offset of the function code in the frame.
+ * @param length     The length of the request.
+ * @param reply      The length of the reply.
+ * @param exception  The exception code returned, 0 for a normal reply.
+ * @param started    The monotonic time at which the request was complete.
+ */
+void record_request(worker_stats_t *stats, const uint8_t *frame, int offset, int length, int reply,
+                    int exception, uint64_t started) {
+    uint64_t ns = monotonic_ns() - started;
+    int unit = frame[offset - 1];
+    stat_add(&stats->requests, 1);
+    stat_add(&stats->rx_bytes, length);
+    stat_add(&stats->tx_bytes, reply);
+    if (exception) stat_add(&stats->exceptions, 1);
+    record_latency(&stats->by_function[function_slot(frame[offset])], ns);
+
+    record_latency(atomic_load_explicit(&stats->by_unit[unit], memory_order_relaxed), ns);
+}
+
+/**
+ * Function to add a worker histogram into a merged snapshot.
+ *
+ * @param merged     The snapshot to add to.
+ * @param histogram  The worker histogram to read.
+ */
+void merge_histogram(histogram_snapshot_t *merged, const latency_histogram_t *histogram) {
+    for (int b = 0; b < LATENCY_BUCKETS; b++) {
+        merged->buckets[b] += atomic_load_explicit(&histogram->buckets[b], memory_order_relaxed);
+    }
+    merged->count += atomic_load_explicit(&histogram->count, memory_order_relaxed);
+    merged->sum_ns += atomic_load_explicit(&histogram->sum_ns, memory_order_relaxed);
+}
+
+/**
+ * Function to estimate a quantile from a merged histogram.
+ *
+ * @param merged    The merged histogram.
+ * @param quantile  The quantile, between 0 and 1.
+ *
+ * @return The quantile in nanoseconds, the floor of the bucket holding it.
+ */
+uint64_t histogram_quantile(const histogram_snapshot_t *merged, double quantile) {
+    uint64_t rank = (uint64_t)(quantile * merged->count);
+    uint64_t seen = 0;
+    for (int b = 0; b < LATENCY_BUCKETS; b++) {
+        seen += merged->buckets[b];
+        if (seen > rank) return latency_bucket_floor(b);
+    }
+    return latency_bucket_floor(LATENCY_BUCKETS - 1);
+}
+
+/**
+ * Function to write one latency summary in the Prometheus text format.
+ *
+ * @param out     The stream receiving the metrics.
+ * @param name    The metric name.
+ * @param label   The label name.
+ * @param value   The label value.
+ * @param merged  The merged histogram.
+ */
+void write_summary(FILE *out, const char *name, const char *label, const char *value,
+                   const histogram_snapshot_t *merged) {
+    static const double quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+    for (size_t q = 0; q < sizeof(quantiles) / sizeof(quantiles[0]); q++) {
+        fprintf(out, "%s{%s=\"%s\",quantile=\"%g\"} %.9f\n", name, label, value, quantiles[q],
+                histogram_quantile(merged, quantiles[q]) / 1e9);
+    }
+    fprintf(out, "%s_sum{%s=\"%s\"} %.9f\n", name, label, value, merged->sum_ns / 1e9);
+    fprintf(out, "%s_count{%s=\"%s\"} %llu\n", name, label, value, (unsigned long long)merged->count);
+}
+
+/**
+ * Function to write the statistics of all workers in the Prometheus text format.
+ *
+ * @param out      The stream receiving the metrics.
+ * @param workers  The statistics of each worker.
+ * @param count    The number of workers.
+ */
+void write_stats(FILE *out, worker_stats_t *workers, int count) {
+    static const struct { const char *name; const char *type; size_t offset; } counters[] = {
+        { "modbus_requests_total", "counter", offsetof(worker_stats_t, requests) },
+        { "modbus_exceptions_total", "counter", offsetof(worker_stats_t, exceptions) },
+        { "modbus_received_bytes_total", "counter", offsetof(worker_stats_t, rx_bytes) },
+        { "modbus_sent_bytes_total", "counter", offsetof(worker_stats_t, tx_bytes) },
+        { "modbus_connections_accepted_total", "counter", offsetof(worker_stats_t, connections_opened) },
+        { "modbus_connections_closed_total", "counter", offsetof(worker_stats_t, connections_closed) },
+        { "modbus_connections_evicted_total", "counter", offsetof(worker_stats_t, connections_evicted) },
+        { "modbus_tls_handshakes_total", "counter", offsetof(worker_stats_t, tls_handshakes) },
+        { "modbus_tls_resumed_sessions_total", "counter", offsetof(worker_stats_t, tls_resumed) },
+        { "modbus_read_cache_hits_total", "counter", offsetof(worker_stats_t, read_cache_hits) },
+        { "modbus_requests_throttled_total", "counter", offsetof(worker_stats_t, throttled) },
+        { "modbus_writes_denied_total", "counter", offsetof(worker_stats_t, denied) },
+    };
+    uint64_t totals[sizeof(counters) / sizeof(counters[0])] = { 0 };
+    for (size_t c = 0; c < sizeof(counters) / sizeof(counters[0]); c++) {
+        for (int w = 0; w < count; w++) {
+            totals[c] += atomic_load_explicit((atomic_ullong *)((char *)&workers[w] + counters[c].offset),
+                                              memory_order_relaxed);
+        }
+        fprintf(out, "# TYPE %s %s\n%s %llu\n", counters[c].name, counters[c].type, counters[c].name,
+                (unsigned long long)totals[c]);
+    }
+    fprintf(out, "# TYPE modbus_connections_active gauge\nmodbus_connections_active %llu\n",
+            (unsigned long long)(totals[4] - totals[5]));
+
+    static histogram_snapshot_t merged;  // Only the stats thread writes metrics
+    char value[16];
+    fprintf(out, "# TYPE modbus_function_request_duration_seconds summary\n");
+    for (int f = 0; f <= STAT_FUNCTION_OTHER; f++) {
+        memset(&merged, 0, sizeof(merged));
+        for (int w = 0; w < count; w++) merge_histogram(&merged, &workers[w].by_function[f]);
+        if (merged.count == 0) continue;
+        if (f == STAT_FUNCTION_OTHER) snprintf(value, sizeof(value), "other");
+        else snprintf(value, sizeof(value), "%d", stat_functions[f]);
+        write_summary(out, "modbus_function_request_duration_seconds", "function", value, &merged);
+    }
+
+    fprintf(out, "# TYPE modbus_unit_request_duration_seconds summary\n");
+    for (int unit = 0; unit < UNIT_ID_COUNT; unit++) {
+        memset(&merged, 0, sizeof(merged));
+        for (int w = 0; w < count; w++) {
+            latency_histogram_t *by_unit = atomic_load_explicit(&workers[w].by_unit[unit], memory_order_acquire);
+            if (by_unit) merge_histogram(&merged, by_unit);
+        }
+        if (merged.count == 0) continue;
+        snprintf(value, sizeof(value), "%d", unit);
+        write_summary(out, "modbus_unit_request_duration_seconds", "unit", value, &merged);
+    }
+}
+
+/**
+ * Function to send a whole buffer on a client socket.
+ *
+ * @param fd      The client socket descriptor.
+ * @param buf     The bytes to send.
+ * @param length  The number of bytes to send.
+ *
+ * @return The number of bytes sent if successful, -1 otherwise.
+ */
+int send_all(int fd, const uint8_t *buf, int length) {
+    int sent = 0;
+    while (sent < length) {
+        ssize_t rc = send(fd, buf + sent, length - sent, MSG_NOSIGNAL);
+        if (rc == -1) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        sent += rc;
+    }
+    return sent;
+}
+
+/**
+ * Function to answer one HTTP scrape on the statistics port.
+ *
+ * @param client   The accepted HTTP client socket, closed by this call.
+ * @param workers  The statistics of each worker.
+ * @param count    The number of workers.
+ */
+void serve_stats_client(int client, worker_stats_t *workers, int count) {
+    char request[1024];
+    struct timeval timeout = { .tv_sec = 1 };
+    setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    if (recv(client, request, sizeof(request), 0) <= 0) {
+        close(client);
+        return;
+    }
+
+    char *body = NULL;
+    size_t body_length = 0;
+    FILE *out = open_memstream(&body, &body_length);
+    if (out == NULL) {
+        close(client);
+        return;
+    }
+    write_stats(out, workers, count);
+    fclose(out);
+
+    char header[128];
+    int header_length = snprintf(header, sizeof(header),
+                                 "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+                                 "Content-Length: %zu\r\n\r\n", body_length);
+    send_all(client, (uint8_t *)header, header_length);
+    send_all(client, (uint8_t *)body, (int)body_length);
+    free(body);
+    close(client);
+}
+
+/**
+ * Thread entry point serving statistics.
+ * Metrics are served over HTTP when a statistics port is configured and
+ * dumped to stderr whenever the process receives SIGUSR1.
+ *
+ * @param arg  The stats_server_t to run.
+ *
+ * @return NULL if the statistics thread fails.
+ */
+void *stats_main(void *arg) {
+    stats_server_t *server = arg;
+    struct pollfd fds[2] = {
+        { .fd = server->signal_fd, .events = POLLIN },
+        { .fd = server->listen_fd, .events = POLLIN },
+    };
+    int nfds = server->listen_fd != -1 ? 2 : 1;
+
+    while (1) {
+        if (poll(fds, nfds, -1) == -1) {
+            if (errno == EINTR) continue;
+            log_message(LOG_LEVEL_ERROR, "Statistics thread stopped: %s", strerror(errno));
+            return NULL;
+        }
+
+        if (fds[0].revents & POLLIN) {
+            struct signalfd_siginfo info;
+            if (read(server->signal_fd, &info, sizeof(info)) == sizeof(info)) {
+                write_stats(stderr, server->workers, server->count);
+                fflush(stderr);
+            }
+        }
+        if (nfds == 2 && (fds[1].revents & POLLIN)) {
+            int client = accept(server->listen_fd, NULL, NULL);
+            if (client != -1) serve_stats_client(client, server->workers, server->count);
+        }
+    }
+}
+
+/**
+ * Function to start the statistics thread.
+ * SIGUSR1 must already be blocked in every thread so it is only seen through the signalfd.
+ *
+ * @param server   The statistics server to start.
+ * @param workers  The statistics of each worker.
+ * @param count    The number of workers.
+ * @param config   The server settings.
+ *
+ * @return 0 if successful, -1 otherwise.
+ */
+int start_stats(stats_server_t *server, worker_stats_t *workers, int count, const server_config_t *config) {
+    server->workers = workers;
+    server->count = count;
+    server->listen_fd = -1;
+
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGUSR1);
+    server->signal_fd = signalfd(-1, &mask, SFD_CLOEXEC);
+    if (server->signal_fd == -1) {
+        log_message(LOG_LEVEL_ERROR, "Error creating statistics signal descriptor: %s", strerror(errno));
+        return -1;
+    }
+
+    if (config->stats_port > 0) {
+        struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(config->stats_port) };
+        int on = 1;
+        server->listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (server->listen_fd == -1 || inet_pton(AF_INET, config->server_ip, &addr.sin_addr) != 1 ||
+            setsockopt(server->listen_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) == -1 ||
+            bind(server->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+            listen(server->listen_fd, LISTEN_BACKLOG) == -1) {
+            log_message(LOG_LEVEL_ERROR, "Error listening on statistics port %d: %s", config->stats_port,
+                        strerror(errno));
+            if (server->listen_fd != -1) close(server->listen_fd);
+            close(server->signal_fd);
+            return -1;
+        }
+    }
+
+    int rc = pthread_create(&server->thread, NULL, stats_main, server);
+    if (rc != 0) {
+        log_message(LOG_LEVEL_ERROR, "Error starting statistics thread: %s", strerror(rc));
+        if (server->listen_fd != -1) close(server->listen_fd);
+        close(server->signal_fd);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Function to stop the statistics thread and release its descriptors.
+ *
+ * @param server  The running statistics server.
+ */
+void stop_stats(stats_server_t *server) {
+    pthread_cancel(server->thread);  // The thread only blocks in poll(), a cancellation point
+    pthread_join(server->thread, NULL);
+    if (server->listen_fd != -1) close(server->listen_fd);
+    close(server->signal_fd);
+}
+
+/**
+ * Function to release the statistics of all workers.
+ * The workers and the statistics thread must not be running.
+ *
+ * @param stats  The statistics, one entry per worker.
+ * @param count  The number of workers.
+ */
+void free_stats(worker_stats_t *stats, int count) {
+    for (int w = 0; w < count; w++) {
+        free(atomic_load(&stats[w].by_unit[0]));  // The first unit's histogram starts the block
+    }
+    free(stats);
+}
+
+/**
+ * Function to drop a change subscriber.
+ *
+ * @param notifier  The notification server.
+ * @param slot      The subscriber's slot.
+ */
+void close_subscriber(notifier_t *notifier, int slot) {
+    close(notifier->subscribers[slot].fd);
+    notifier->subscribers[slot].fd = -1;
+}
+
+/**
+ * Function to send the message being built and start the next one.
+ * Change sets never wait for a subscriber: one whose socket is full misses the
+ * rest of the change set and sees a gap in the sequence numbers. A snapshot only
+ * goes to the new subscriber in notifier->target and may block up to its send
+ * timeout; a subscriber that cannot take it is dropped.
+ *
+ * @param notifier  The notification server.
+ * @param more      1 if more messages of the same change set follow.
+ */
+void flush_notification(notifier_t *notifier, int more) {
+    modbus_notify_header_t *header = (modbus_notify_header_t *)notifier->message;
+    *header = (modbus_notify_header_t){
+        .magic = MODBUS_NOTIFY_MAGIC,
+        .version = MODBUS_NOTIFY_VERSION,
+        .flags = notifier->flags | (more ? MODBUS_NOTIFY_FLAG_MORE : 0),
+        .sequence = notifier->sequence,
+        .timestamp_ns = notifier->timestamp_ns,
+        .nb_changes = notifier->nb_changes,
+        .length = notifier->length,
+    };
+
+    for (int i = 0; i < MAX_SUBSCRIBERS; i++) {
+        subscriber_t *subscriber = &notifier->subscribers[i];
+        if (subscriber->fd == -1) continue;
+        if (notifier->target != -1) {
+            if (i != notifier->target) continue;
+            if (send(subscriber->fd, notifier->message, notifier->length, MSG_NOSIGNAL) != (ssize_t)notifier->length) {
+                log_message(LOG_LEVEL_ERROR, "Dropping change subscriber, snapshot not delivered: %s", strerror(errno));
+                close_subscriber(notifier, i);
+            }
+            continue;
+        }
+
+        if (subscriber->skip == notifier->sequence) continue;
+        if (send(subscriber->fd, notifier->message, notifier->length, MSG_NOSIGNAL | MSG_DONTWAIT) ==
+            (ssize_t)notifier->length) continue;
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            subscriber->skip = notifier->sequence;
+        } else {
+            close_subscriber(notifier, i);
+        }
+    }
+    notifier->length = sizeof(modbus_notify_header_t);
+    notifier->nb_changes = 0;
+    notifier->messages++;
+}
+
+/**
+ * Function to append a run of consecutive blocks of a table to the change set.
+ * Each block is read with the store's seqlock, so it never mixes old and new
+ * values of a single write. Runs that do not fit are continued in the next message.
+ *
+ * @param notifier  The notification server.
+ * @param unit      The unit identifier reported for the table's store.
+ * @param table_id  The TABLE_* index of the table.
+ * @param table     The table to read.
+ * @param first     The first block of the run.
+ * @param last      The last block of the run.
+ */
+void add_change(notifier_t *notifier, int unit, int table_id, const reg_table_t *table, int first, int last) {
+    size_t entry_size = table->bits ? sizeof(uint8_t) : sizeof(uint16_t);
+    int index = first * REG_BLOCK_SIZE;
+    int end = (last + 1) * REG_BLOCK_SIZE < table->count ? (last + 1) * REG_BLOCK_SIZE : table->count;
+
+    while (index < end) {
+        size_t room = sizeof(notifier->message) - notifier->length - sizeof(modbus_notify_change_t);
+        int count = end - index;
+        if ((size_t)count * entry_size > room) count = room / entry_size / REG_BLOCK_SIZE * REG_BLOCK_SIZE;
+        if (count == 0) {
+            flush_notification(notifier, 1);
+            continue;
+        }
+
+        modbus_notify_change_t *change = (modbus_notify_change_t *)(notifier->message + notifier->length);
+        *change = (modbus_notify_change_t){
+            .unit = unit,
+            .table = table_id,
+            .address = table->start + index,
+            .count = count,
+        };
+        uint8_t *entries = (uint8_t *)(change + 1);
+        for (int done = 0; done < count; done += REG_BLOCK_SIZE) {
+            int chunk = count - done < REG_BLOCK_SIZE ? count - done : REG_BLOCK_SIZE;
+            if (reg_table_read(table, table->start + index + done, chunk, entries + done * entry_size) == -1) {
+                // Sent as read, the block stays marked so the next change set carries its values
+                int block = (index + done) / REG_BLOCK_SIZE;
+                atomic_fetch_or_explicit(&table->dirty[block / 64], 1ull << (block % 64), memory_order_relaxed);
+            }
+        }
+        notifier->length += sizeof(*change) + ((count * entry_size + 3) & ~(size_t)3);
+        notifier->nb_changes++;
+        index += count;
+    }
+}
+
+/**
+ * Function to collect the blocks changed since the last change set and send them.
+ * Blocks written by the server are found in the dirty bitmaps; when producers
+ * share the map, blocks whose sequence word moved are included as well.
+ *
+ * @param notifier  The notification server.
+ * @param snapshot  1 to send every block to the subscriber in notifier->target instead.
+ */
+void send_change_set(notifier_t *notifier, int snapshot) {
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    notifier->timestamp_ns = (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+    notifier->flags = snapshot ? MODBUS_NOTIFY_FLAG_SNAPSHOT : 0;
+    notifier->length = sizeof(modbus_notify_header_t);
+    notifier->nb_changes = 0;
+    notifier->messages = 0;
+    if (!snapshot) notifier->sequence++;  // A snapshot carries the number of the last change set it includes
+
+    for (int s = 0; s < notifier->units->nb_stores; s++) {
+        for (int t = 0; t < TABLE_COUNT; t++) {
+            reg_table_t *table = &notifier->units->stores[s].tables[t];
+            if (table->count == 0) continue;
+            int blocks = (table->count + REG_BLOCK_SIZE - 1) / REG_BLOCK_SIZE;
+            int words = (blocks + 63) / 64;
+            uint64_t pending[DIRTY_WORDS];
+
+            for (int w = 0; w < words; w++) {
+                pending[w] = snapshot ? ~0ull : atomic_exchange_explicit(&table->dirty[w], 0, memory_order_acq_rel);
+            }
+            if (!snapshot && notifier->seen) {
+                unsigned int *seen = notifier->seen[s * TABLE_COUNT + t];
+                for (int b = 0; b < blocks; b++) {
+                    unsigned int seq = atomic_load_explicit(&table->seq[b], memory_order_acquire);
+                    if (seq == seen[b] || (seq & 1)) continue;  // Odd: a producer is still publishing
+                    seen[b] = seq;
+                    pending[b / 64] |= 1ull << (b % 64);
+                }
+            }
+
+            for (int b = 0; b < blocks; b++) {
+                if (!(pending[b / 64] & (1ull << (b % 64)))) continue;
+                int last = b;
+                while (last + 1 < blocks && (pending[(last + 1) / 64] & (1ull << ((last + 1) % 64)))) last++;
+                add_change(notifier, notifier->store_units[s], t, table, b, last);
+                b = last;
+            }
+        }
+    }
+
+    if (snapshot || notifier->nb_changes > 0 || notifier->messages > 0) {
+        flush_notification(notifier, 0);
+    } else {
+        notifier->sequence--;  // Nothing changed, the number is reused
+    }
+}
+
+/**
+ * Function to accept a change subscriber and send it a snapshot of the register maps.
+ *
+ * @param notifier  The notification server.
+ */
+void accept_subscriber(notifier_t *notifier) {
+    int fd = accept4(notifier->listen_fd, NULL, NULL, SOCK_CLOEXEC);
+    if (fd == -1) {
+        log_message(LOG_LEVEL_ERROR, "Error accepting change subscriber: %s", strerror(errno));
+        return;
+    }
+
+    int slot = 0;
+    while (slot < MAX_SUBSCRIBERS && notifier->subscribers[slot].fd != -1) slot++;
+    if (slot == MAX_SUBSCRIBERS) {
+        log_message(LOG_LEVEL_ERROR, "Too many change subscribers, at most %d are served", MAX_SUBSCRIBERS);
+        close(fd);
+        return;
+    }
+
+    // Bounds how long a subscriber that does not read its snapshot holds up every other one
+    struct timeval timeout = { .tv_sec = 1 };
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    notifier->subscribers[slot] = (subscriber_t){ .fd = fd };
+    notifier->target = slot;
+    send_change_set(notifier, 1);
+    notifier->target = -1;
+}
+
+/**
+ * Thread entry point sending change sets.
+ * Changes are collected once per interval, between which the thread accepts
+ * new subscribers and notices the ones that went away.
+ *
+ * @param arg  The notifier_t to run.
+ *
+ * @return NULL if the notification thread fails.
+ */
+void *notifier_main(void *arg) {
+    notifier_t *notifier = arg;
+    uint64_t interval_ns = (uint64_t)notifier->interval_ms * 1000000;
+    uint64_t next = monotonic_ns() + interval_ns;
+
+    while (1) {
+        struct pollfd fds[MAX_SUBSCRIBERS + 1] = { { .fd = notifier->listen_fd, .events = POLLIN } };
+        int slots[MAX_SUBSCRIBERS + 1];
+        int nfds = 1;
+        for (int i = 0; i < MAX_SUBSCRIBERS; i++) {
+            if (notifier->subscribers[i].fd == -1) continue;
+            fds[nfds] = (struct pollfd){ .fd = notifier->subscribers[i].fd, .events = POLLIN };
+            slots[nfds++] = i;
+        }
+
+        uint64_t now = monotonic_ns();
+        int timeout = now >= next ? 0 : (int)((next - now + 999999) / 1000000);
+        if (poll(fds, nfds, timeout) == -1) {
+            if (errno == EINTR) continue;
+            log_message(LOG_LEVEL_ERROR, "Change notification thread stopped: %s", strerror(errno));
+            return NULL;
+        }
+
+        // Subscribers never send anything, readable means closed
+        for (int i = 1; i < nfds; i++) {
+            if (!fds[i].revents) continue;
+            uint8_t discard[64];
+            ssize_t rc = recv(fds[i].fd, discard, sizeof(discard), MSG_DONTWAIT);
+            if (rc == 0 || (rc == -1 && errno != EAGAIN && errno != EINTR)) close_subscriber(notifier, slots[i]);
+        }
+        if (fds[0].revents & POLLIN) accept_subscriber(notifier);
+
+        now = monotonic_ns();
+        if (now >= next) {
+            send_change_set(notifier, 0);
+            next += interval_ns;
+            if (next <= now) next = now + interval_ns;  // Fell behind, do not send sets back to back
+        }
+    }
+}
+
+/**
+ * Function to release the sockets and tracking state of the change notification server.
+ * The notification thread must not be running.
+ *
+ * @param notifier  The notification server.
+ */
+void free_notifier(notifier_t *notifier) {
+    for (int i = 0; i < MAX_SUBSCRIBERS; i++) {
+        if (notifier->subscribers[i].fd != -1) close_subscriber(notifier, i);
+    }
+    if (notifier->listen_fd != -1) close(notifier->listen_fd);
+    if (notifier->path) unlink(notifier->path);
+    for (int i = 0; notifier->seen && i < notifier->units->nb_stores * TABLE_COUNT; i++) free(notifier->seen[i]);
+    free(notifier->seen);
+    memset(notifier, 0, sizeof(*notifier));
+}
+
+/**
+ * Function to enable change tracking and start the change notification thread.
+ * Must be called before the workers start so that no write goes unrecorded.
+ *
+ * @param notifier  The notification server to start.
+ * @param units     The register maps to watch.
+ * @param config    The server settings.
+ *
+ * @return 0 if successful, -1 otherwise.
+ */
+int start_notifier(notifier_t *notifier, unit_map_t *units, const server_config_t *config) {
+    memset(notifier, 0, sizeof(*notifier));
+    notifier->units = units;
+    notifier->interval_ms = config->notify_interval;
+    notifier->listen_fd = -1;
+    notifier->target = -1;
+    for (int i = 0; i < MAX_SUBSCRIBERS; i++) notifier->subscribers[i].fd = -1;
+    for (int unit = 0; unit < UNIT_ID_COUNT && config->multi_unit; unit++) {
+        if (units->by_unit[unit]) notifier->store_units[units->by_unit[unit] - units->stores] = unit;
+    }
+    if (enable_change_tracking(units) == -1) return -1;
+
+    // Producers sharing the segment and other server processes do not set this process's
+    // dirty bits, their sequence words show what they wrote
+    if (config->shm_name || config->reuseport > 0) {
+        notifier->seen = calloc(units->nb_stores * TABLE_COUNT, sizeof(*notifier->seen));
+        for (int i = 0; notifier->seen && i < units->nb_stores * TABLE_COUNT; i++) {
+            reg_table_t *table = &units->stores[i / TABLE_COUNT].tables[i % TABLE_COUNT];
+            int blocks = (table->count + REG_BLOCK_SIZE - 1) / REG_BLOCK_SIZE;
+            notifier->seen[i] = calloc(blocks ? blocks : 1, sizeof(unsigned int));
+            if (notifier->seen[i] == NULL) break;
+            for (int b = 0; b < blocks; b++) notifier->seen[i][b] = atomic_load(&table->seq[b]);
+        }
+        if (notifier->seen == NULL || notifier->seen[units->nb_stores * TABLE_COUNT - 1] == NULL) {
+            log_message(LOG_LEVEL_ERROR, "Error allocating change tracking state: %s", strerror(errno));
+            free_notifier(notifier);
+            return -1;
+        }
+    }
+
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(config->notify_path) >= sizeof(addr.sun_path)) {
+        log_message(LOG_LEVEL_ERROR, "Notification socket path is too long: %s", config->notify_path);
+        free_notifier(notifier);
+        return -1;
+    }
+    strcpy(addr.sun_path, config->notify_path);
+    unlink(config->notify_path);  // Left over by a previous run
+    notifier->listen_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (notifier->listen_fd == -1 || bind(notifier->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+        listen(notifier->listen_fd, LISTEN_BACKLOG) == -1) {
+        log_message(LOG_LEVEL_ERROR, "Error listening on notification socket %s: %s", config->notify_path,
+                    strerror(errno));
+        free_notifier(notifier);
+        return -1;
+    }
+    notifier->path = config->notify_path;
+
+    int rc = pthread_create(&notifier->thread, NULL, notifier_main, notifier);
+    if (rc != 0) {
+        log_message(LOG_LEVEL_ERROR, "Error starting change notification thread: %s", strerror(rc));
+        free_notifier(notifier);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Function to stop the change notification thread and disconnect its subscribers.
+ *
+ * @param notifier  The notification server, started or never started.
+ */
+void stop_notifier(notifier_t *notifier) {
+    if (notifier->path == NULL) return;
+    pthread_cancel(notifier->thread);  // The thread only blocks in poll(), accept() and send(), cancellation points
+    pthread_join(notifier->thread, NULL);
+    free_notifier(notifier);
+}
+
+/**
+ * Function to start the server socket and begin listening for incoming client connections.
+ * In multi-process mode every process binds the port itself with SO_REUSEPORT,
+ * so the kernel spreads new connections across them.
+ * 
+ * @param ctx     The Modbus context.
+ * @param config  The server settings.
+ * 
+ * @return The server socket descriptor if successful, -1 otherwise.
+ */
+int start_listening(modbus_t *ctx, const server_config_t *config) {
+    if (config->reuseport > 0) {
+        struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(config->server_port) };
+        int on = 1;
+        int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd == -1 || inet_pton(AF_INET, config->server_ip, &addr.sin_addr) != 1 ||
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) == -1 ||
+            setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) == -1 ||
+            bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 || listen(fd, LISTEN_BACKLOG) == -1) {
+            log_message(LOG_LEVEL_ERROR, "Error listening on TCP socket: %s", strerror(errno));
+            if (fd != -1) close(fd);
+            return -1;
+        }
+        return fd;
+    }
+
+    int server_socket = modbus_tcp_listen(ctx, LISTEN_BACKLOG);
+    if (server_socket == -1) {
+        log_message(LOG_LEVEL_ERROR, "Error listening on TCP socket: %s", modbus_strerror(errno));
+        return -1;
+    }
+    return server_socket;
+}
+
+/**
+ * Function to check whether a connection's receive buffer starts with a complete frame.
+ *
+ * @param conn  The client connection.
+ *
+ * @return 1 if a frame can be served without receiving more, 0 otherwise.
+ */
+int has_complete_frame(const connection_t *conn) {
+    return conn->rx_len >= MBAP_HEADER_LENGTH && conn->rx_len >= 6 + ((conn->rx[4] << 8) | conn->rx[5]);
+}
+
+/**
+ * Function to take a request from a token bucket only its owner updates.
+ *
+ * @param due    The bucket, the time its next request is due.
+ * @param limit  The rate limit.
+ * @param now    The current monotonic time.
+ *
+ * @return 1 if the request is admitted, 0 if it is over the limit.
+ */
+static inline int take_token(uint64_t *due, const rate_limit_t *limit, uint64_t now) {
+    uint64_t start = *due > now ? *due : now;
+    if (start - now > limit->tolerance_ns) return 0;
+    *due = start + limit->interval_ns;
+    return 1;
+}
+
+/**
+ * Function to find the bucket of a client address, claiming one if needed.
+ * A bucket whose due time has passed is full, so it can be handed to another
+ * address without changing what its previous owner may send.
+ *
+ * @param buckets  The client buckets, MAX_RATE_CLIENTS entries.
+ * @param addr     The client address.
+ * @param now      The current monotonic time.
+ *
+ * @return The bucket, NULL if every candidate entry belongs to an active client.
+ */
+client_bucket_t *find_client_bucket(client_bucket_t *buckets, uint32_t addr, uint64_t now) {
+    uint32_t hash = (addr * 0x9E3779B1u) >> 20;  // MAX_RATE_CLIENTS is 2^12
+    client_bucket_t *spare = NULL;
+    unsigned int spare_addr = 0;
+    for (int i = 0; i < CLIENT_PROBES; i++) {
+        client_bucket_t *bucket = &buckets[(hash + i) % MAX_RATE_CLIENTS];
+        unsigned int owner = atomic_load_explicit(&bucket->addr, memory_order_acquire);
+        if (owner == addr) return bucket;
+        if (spare == NULL && (owner == 0 || atomic_load_explicit(&bucket->due_ns, memory_order_relaxed) <= now)) {
+            spare = bucket;
+            spare_addr = owner;
+        }
+    }
+    if (spare == NULL || !atomic_compare_exchange_strong(&spare->addr, &spare_addr, addr)) return NULL;
+    atomic_store_explicit(&spare->due_ns, 0, memory_order_relaxed);
+    return spare;
+}
+
+/**
+ * Function to take a request from the bucket shared by a client's connections.
+ * Workers serving connections of the same client update it with a compare-and-swap.
+ *
+ * @param worker     The worker owning the connection.
+ * @param client     The connection's cached bucket, updated if it now belongs to another client.
+ * @param peer_addr  The client's IPv4 address in network byte order.
+ * @param now        The current monotonic time.
+ *
+ * @return 1 if the request is admitted, 0 if it is over the limit.
+ */
+int take_client_token(worker_t *worker, client_bucket_t **client, uint32_t peer_addr, uint64_t now) {
+    const rate_limit_t *limit = &worker->config->client_rate;
+    client_bucket_t *bucket = *client;
+    if (bucket == NULL || atomic_load_explicit(&bucket->addr, memory_order_relaxed) != peer_addr) {
+        bucket = *client = find_client_bucket(worker->clients, peer_addr, now);
+        if (bucket == NULL) return 1;  // More active clients than entries, only the connection limit applies
+    }
+
+    unsigned long long due = atomic_load_explicit(&bucket->due_ns, memory_order_relaxed);
+    unsigned long long next;
+    do {
+        uint64_t start = due > now ? due : now;
+        if (start - now > limit->tolerance_ns) return 0;
+        next = start + limit->interval_ns;
+    } while (!atomic_compare_exchange_weak_explicit(&bucket->due_ns, &due, next, memory_order_relaxed,
+                                                    memory_order_relaxed));
+    return 1;
+}
+
+/**
+ * Function to apply the rate limits to a request about to be served.
+ * Modbus TCP connections and RTU streams pass their own rate limit state.
+ *
+ * @param worker     The worker owning the connection.
+ * @param due        When the connection's next request is due under --rate-limit.
+ * @param client     The connection's cached --client-rate-limit bucket.
+ * @param peer_addr  The client's IPv4 address in network byte order, 0 if it has none.
+ *
+ * @return 1 if the request may be served, 0 if it must be answered Server Device Busy.
+ */
+int admit_request(worker_t *worker, uint64_t *due, client_bucket_t **client, uint32_t peer_addr) {
+    const server_config_t *config = worker->config;
+    if (config->connection_rate.interval_ns == 0 && worker->clients == NULL) return 1;
+
+    uint64_t now = monotonic_ns();
+    int admitted = 1;
+    if (config->connection_rate.interval_ns > 0) admitted = take_token(due, &config->connection_rate, now);
+    if (admitted && worker->clients && peer_addr != 0) admitted = take_client_token(worker, client, peer_addr, now);
+    if (!admitted) stat_add(&worker->stats->throttled, 1);
+    return admitted;
+}
+
+/**
+ * Function to give a connection with frames left another turn after the others.
+ *
+ * @param worker  The worker owning the connection.
+ * @param conn    The client connection, not in the ready list.
+ */
+void queue_ready(worker_t *worker, connection_t *conn) {
+    conn->ready = 1;
+    conn->ready_next = NULL;
+    conn->ready_prev = worker->ready_tail;
+    if (worker->ready_tail) worker->ready_tail->ready_next = conn;
+    else worker->ready_head = conn;
+    worker->ready_tail = conn;
+    worker->nb_ready++;
+}
+
+/**
+ * Function to take a connection out of the worker's ready list.
+ *
+ * @param worker  The worker owning the connection.
+ * @param conn    The client connection, in the ready list.
+ */
+void unqueue_ready(worker_t *worker, connection_t *conn) {
+    if (conn->ready_prev) conn->ready_prev->ready_next = conn->ready_next;
+    else worker->ready_head = conn->ready_next;
+    if (conn->ready_next) conn->ready_next->ready_prev = conn->ready_prev;
+    else worker->ready_tail = conn->ready_prev;
+    conn->ready = 0;
+    worker->nb_ready--;
+}
+
+#ifdef USE_IO_URING
+/**
+ * Function to release a worker's io_uring.
+ *
+ * @param ring  The ring to release, may be partially set up.
+ */
+void uring_free(uring_t *ring) {
+    if (ring->buffers) munmap(ring->buffers, URING_BUFFERS * sizeof(struct io_uring_buf));
+    free(ring->buffer_memory);
+    if (ring->sqes) munmap(ring->sqes, ring->sqes_size);
+    if (ring->rings) munmap(ring->rings, ring->rings_size);
+    if (ring->fd != -1) close(ring->fd);
+    free(ring);
+}
+
+/**
+ * Function to hand a receive buffer back to the kernel.
+ *
+ * @param ring  The ring owning the buffer.
+ * @param bid   The buffer identifier.
+ */
+void uring_recycle_buffer(uring_t *ring, unsigned bid) {
+    struct io_uring_buf *buf = &ring->buffers->bufs[ring->buffer_tail & (URING_BUFFERS - 1)];
+    buf->addr = (uintptr_t)(ring->buffer_memory + (size_t)bid * URING_BUFFER_SIZE);
+    buf->len = URING_BUFFER_SIZE;
+    buf->bid = bid;
+    __atomic_store_n(&ring->buffers->tail, (uint16_t)++ring->buffer_tail, __ATOMIC_RELEASE);
+}
+
+/**
+ * Function to set up an io_uring for a worker's client sockets.
+ * Must run on the thread that will submit to it. Completions are only processed
+ * when the worker waits for them, so they never interrupt a batch being served.
+ *
+ * @return The ring, NULL if the kernel does not provide what the backend needs.
+ */
+uring_t *uring_create(void) {
+    uring_t *ring = calloc(1, sizeof(*ring));
+    if (ring == NULL) return NULL;
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_SUBMIT_ALL | IORING_SETUP_COOP_TASKRUN | IORING_SETUP_SINGLE_ISSUER |
+                   IORING_SETUP_DEFER_TASKRUN;
+    ring->fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &params);
+    if (ring->fd == -1 && errno == EINVAL) {
+        memset(&params, 0, sizeof(params));  // Kernels before 6.1 lack some of the flags
+        ring->fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &params);
+    }
+    if (ring->fd == -1) {
+        free(ring);
+        return NULL;
+    }
+    unsigned needed = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | IORING_FEAT_EXT_ARG;
+    if ((params.features & needed) != needed) {
+        errno = ENOSYS;
+        uring_free(ring);
+        return NULL;
+    }
+
+    size_t sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    size_t cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->rings_size = sq_size > cq_size ? sq_size : cq_size;
+    ring->rings = mmap(NULL, ring->rings_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+                       IORING_OFF_SQ_RING);
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+                      IORING_OFF_SQES);
+    if (ring->rings == MAP_FAILED || ring->sqes == MAP_FAILED) {
+        if (ring->rings == MAP_FAILED) ring->rings = NULL;
+        if (ring->sqes == MAP_FAILED) ring->sqes = NULL;
+        uring_free(ring);
+        return NULL;
+    }
+    uint8_t *base = ring->rings;
+    ring->sq_head = (unsigned *)(base + params.sq_off.head);
+    ring->sq_tail = (unsigned *)(base + params.sq_off.tail);
+    ring->sq_mask = *(unsigned *)(base + params.sq_off.ring_mask);
+    ring->sq_entries = params.sq_entries;
+    ring->sq_local_tail = *ring->sq_tail;
+    unsigned *array = (unsigned *)(base + params.sq_off.array);
+    for (unsigned i = 0; i < params.sq_entries; i++) array[i] = i;
+    ring->cq_head = (unsigned *)(base + params.cq_off.head);
+    ring->cq_tail = (unsigned *)(base + params.cq_off.tail);
+    ring->cq_mask = *(unsigned *)(base + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(base + params.cq_off.cqes);
+
+    // Receives pick a buffer when data arrives, idle connections hold none
+    ring->buffers = mmap(NULL, URING_BUFFERS * sizeof(struct io_uring_buf), PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    ring->buffer_memory = malloc((size_t)URING_BUFFERS * URING_BUFFER_SIZE);
+    if (ring->buffers == MAP_FAILED || ring->buffer_memory == NULL) {
+        if (ring->buffers == MAP_FAILED) ring->buffers = NULL;
+        uring_free(ring);
+        return NULL;
+    }
+    struct io_uring_buf_reg reg = {
+        .ring_addr = (uintptr_t)ring->buffers,
+        .ring_entries = URING_BUFFERS,
+        .bgid = URING_BUFFER_GROUP,
+    };
+    if (syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) == -1) {
+        uring_free(ring);
+        return NULL;
+    }
+    for (unsigned bid = 0; bid < URING_BUFFERS; bid++) uring_recycle_buffer(ring, bid);
+    return ring;
+}
+
+/**
+ * Function to submit the prepared entries and optionally wait for completions.
+ *
+ * @param ring        The ring.
+ * @param wait        1 to wait for at least one completion, 0 to only submit.
+ * @param timeout_ms  The longest wait in milliseconds, -1 for no limit.
+ *
+ * @return 0 if successful or the wait timed out, -1 otherwise.
+ */
+int uring_submit(uring_t *ring, int wait, int timeout_ms) {
+    __atomic_store_n(ring->sq_tail, ring->sq_local_tail, __ATOMIC_RELEASE);
+    unsigned pending = ring->sq_local_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    struct __kernel_timespec ts = { .tv_sec = timeout_ms / 1000, .tv_nsec = timeout_ms % 1000 * 1000000L };
+    struct io_uring_getevents_arg arg = { .ts = timeout_ms >= 0 ? (uintptr_t)&ts : 0 };
+    unsigned flags = wait ? IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG : 0;
+    long rc = syscall(__NR_io_uring_enter, ring->fd, pending, wait, flags, wait ? &arg : NULL, wait ? sizeof(arg) : 0);
+    if (rc == -1 && errno != ETIME && errno != EINTR && errno != EBUSY && errno != EAGAIN) {
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Function to get a cleared submission queue entry.
+ * A full submission queue is submitted first.
+ *
+ * @param ring       The ring.
+ * @param opcode     The IORING_OP_* operation.
+ * @param fd         The file descriptor the operation works on.
+ * @param ptr        The worker or connection the completion is for.
+ * @param operation  The URING_* operation reported with ptr by the completion.
+ *
+ * @return The entry, to complete and submit with the next uring_submit().
+ */
+struct io_uring_sqe *uring_prepare(uring_t *ring, int opcode, int fd, void *ptr, int operation) {
+    while (ring->sq_local_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >= ring->sq_entries) {
+        if (uring_submit(ring, 0, 0) == -1) {
+            log_message(LOG_LEVEL_ERROR, "Error submitting to io_uring: %s", strerror(errno));
+        }
+    }
+    struct io_uring_sqe *sqe = &ring->sqes[ring->sq_local_tail++ & ring->sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->user_data = (uintptr_t)ptr | operation;
+    return sqe;
+}
+
+/**
+ * Function to queue the next io_uring operations of a client connection.
+ * Batched replies go out with one send; when the connection may read again,
+ * the next receive is linked behind the send, so it only starts once every
+ * reply is out and a client that stops reading is not read either. Frames
+ * already received are served before anything more is received.
+ *
+ * @param worker  The worker owning the connection.
+ * @param conn    The client connection.
+ *
+ * @return 0, the operations are submitted with the worker's next wait.
+ */
+int uring_arm(worker_t *worker, connection_t *conn) {
+    if (conn->closing) return 0;
+    int room = (int)sizeof(conn->rx) - conn->rx_len;
+    int receive = !conn->receiving && !conn->sending && room > 0 && !has_complete_frame(conn);
+    if (conn->tx_len > 0 && !conn->sending) {
+        struct io_uring_sqe *sqe = uring_prepare(worker->ring, IORING_OP_SEND, conn->source.fd, conn, URING_SEND);
+        sqe->addr = (uintptr_t)conn->tx;
+        sqe->len = conn->tx_len;
+        sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;  // A short send breaks the link, the receive is cancelled
+        if (receive) sqe->flags |= IOSQE_IO_LINK;
+        conn->sending = conn->tx_len;
+        conn->inflight++;
+        if (conn->blocked_since_ns == 0) conn->blocked_since_ns = monotonic_ns();
+    }
+    if (receive) {
+        struct io_uring_sqe *sqe = uring_prepare(worker->ring, IORING_OP_RECV, conn->source.fd, conn, URING_RECV);
+        sqe->len = room < URING_BUFFER_SIZE ? room : URING_BUFFER_SIZE;
+        sqe->flags |= IOSQE_BUFFER_SELECT;
+        sqe->buf_group = URING_BUFFER_GROUP;
+        conn->receiving = 1;
+        conn->inflight++;
+    }
+    return 0;
+}
+#endif
+
+#ifdef USE_TLS
+/**
+ * Function to report why a TLS operation on a client connection failed.
+ * OpenSSL's error queue belongs to the thread, not to the connection, so it is
+ * emptied here before the next connection of the worker is served.
+ *
+ * @param conn       The client connection.
+ * @param err        The SSL_get_error() code of the failed operation.
+ * @param operation  What was being done, for the message.
+ *
+ * @return -1, the connection must be closed.
+ */
+int tls_failed(connection_t *conn, int err, const char *operation) {
+    unsigned long code = ERR_get_error();
+    if (err == SSL_ERROR_ZERO_RETURN || (err == SSL_ERROR_SYSCALL && code == 0)) {
+        log_message(LOG_LEVEL_DEBUG, "Client disconnected.");
+    } else {
+        char reason[256];
+        ERR_error_string_n(code, reason, sizeof(reason));
+        log_message(LOG_LEVEL_ERROR, "TLS error while %s on socket %d: %s", operation, conn->source.fd,
+                    code ? reason : strerror(errno));
+    }
+    ERR_clear_error();
+    return -1;
+}
+
+/**
+ * Function to load the session ticket key shared by a group of servers.
+ * A client then resumes its session on whichever server of the group it
+ * reconnects to, e.g. after a failover, without a full handshake.
+ *
+ * @param tls   The TLS context.
+ * @param path  The key file, TLS_TICKET_KEY_LENGTH random bytes.
+ *
+ * @return 0 if successful, -1 otherwise.
+ */
+int load_ticket_key(tls_context_t *tls, const char *path) {
+    unsigned char key[TLS_TICKET_KEY_LENGTH + 1];
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        log_message(LOG_LEVEL_ERROR, "Error opening session ticket key %s: %s", path, strerror(errno));
+        return -1;
+    }
+    size_t length = fread(key, 1, sizeof(key), file);
+    fclose(file);
+    if (length != TLS_TICKET_KEY_LENGTH) {
+        log_message(LOG_LEVEL_ERROR, "Session ticket key %s must be exactly %d bytes", path, TLS_TICKET_KEY_LENGTH);
+        return -1;
+    }
+    int rc = SSL_CTX_set_tlsext_ticket_keys(tls, key, TLS_TICKET_KEY_LENGTH) == 1 ? 0 : -1;
+    OPENSSL_cleanse(key, sizeof(key));
+    if (rc == -1) log_message(LOG_LEVEL_ERROR, "Error setting session ticket key %s", path);
+    return rc;
+}
+
+/**
+ * Function to create the TLS context of Modbus/TCP Security client sessions.
+ * Sessions resume from a ticket, or from the session cache for TLS 1.2 clients
+ * without ticket support, so a reconnecting client skips the certificate
+ * exchange. The context is created before workers and server processes start,
+ * so all of them accept each other's tickets.
+ *
+ * @param config  The server settings.
+ *
+ * @return The TLS context if successful, NULL otherwise.
+ */
+tls_context_t *create_tls_context(const server_config_t *config) {
+    SSL_CTX *tls = SSL_CTX_new(TLS_server_method());
+    if (tls == NULL) {
+        log_message(LOG_LEVEL_ERROR, "Error creating TLS context: %s", ERR_error_string(ERR_get_error(), NULL));
+        return NULL;
+    }
+    SSL_CTX_set_min_proto_version(tls, TLS1_2_VERSION);
+    SSL_CTX_set_options(tls, SSL_OP_NO_RENEGOTIATION | SSL_OP_CIPHER_SERVER_PREFERENCE);
+#ifdef SSL_OP_IGNORE_UNEXPECTED_EOF
+    SSL_CTX_set_options(tls, SSL_OP_IGNORE_UNEXPECTED_EOF);  // Clients closing without close_notify just disconnect
+#endif
+    // A write waiting for the socket is retried from the start of tx, with whatever it holds by then
+    SSL_CTX_set_mode(tls, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER |
+                     SSL_MODE_RELEASE_BUFFERS);
+
+    const char *key = config->tls_key ? config->tls_key : config->tls_cert;
+    if (SSL_CTX_use_certificate_chain_file(tls, config->tls_cert) != 1 ||
+        SSL_CTX_use_PrivateKey_file(tls, key, SSL_FILETYPE_PEM) != 1 || SSL_CTX_check_private_key(tls) != 1) {
+        log_message(LOG_LEVEL_ERROR, "Error loading server certificate %s and key %s: %s", config->tls_cert, key,
+                    ERR_error_string(ERR_get_error(), NULL));
+        SSL_CTX_free(tls);
+        return NULL;
+    }
+    if (config->tls_ca) {
+        STACK_OF(X509_NAME) *names = SSL_load_client_CA_file(config->tls_ca);
+        if (names == NULL || SSL_CTX_load_verify_locations(tls, config->tls_ca, NULL) != 1) {
+            log_message(LOG_LEVEL_ERROR, "Error loading client CA certificates %s: %s", config->tls_ca,
+                        ERR_error_string(ERR_get_error(), NULL));
+            sk_X509_NAME_pop_free(names, X509_NAME_free);
+            SSL_CTX_free(tls);
+            return NULL;
+        }
+        SSL_CTX_set_client_CA_list(tls, names);
+        SSL_CTX_set_verify(tls, SSL_VERIFY_PEER | SSL_VERIFY_FAIL_IF_NO_PEER_CERT, NULL);
+    }
+
+    static const unsigned char session_context[] = "modbus_server";
+    SSL_CTX_set_session_id_context(tls, session_context, sizeof(session_context) - 1);
+    SSL_CTX_set_session_cache_mode(tls, SSL_SESS_CACHE_SERVER);
+    if (config->tls_ticket_key && load_ticket_key(tls, config->tls_ticket_key) == -1) {
+        SSL_CTX_free(tls);
+        return NULL;
+    }
+    ERR_clear_error();
+    return tls;
+}
+
+/**
+ * Function to encrypt and send the replies batched on a TLS connection.
+ * The whole batch goes to one SSL_write(), so pipelined replies share their
+ * TLS records instead of paying a record header and MAC each.
+ *
+ * @param conn    The client connection.
+ *
+ * @return 0 if everything was sent, 1 if replies are still pending, -1 if the connection failed.
+ */
+int flush_tls_replies(connection_t *conn) {
+    while (conn->tx_len > 0) {
+        int rc = SSL_write(conn->ssl, conn->tx, conn->tx_len);
+        if (rc <= 0) {
+            int err = SSL_get_error(conn->ssl, rc);
+            if (err == SSL_ERROR_WANT_WRITE) return 1;
+            return tls_failed(conn, err, "sending reply");
+        }
+        conn->tx_len -= rc;
+        memmove(conn->tx, conn->tx + rc, conn->tx_len);
+    }
+    return 0;
+}
+#endif
+
+/**
+ * Function to move a reply libmodbus sent into the worker's socket pair to the
+ * transmit buffer of a connection, where it is batched with the others.
+ *
+ * @param worker  The worker owning the connection.
+ * @param buf     The free end of the transmit buffer.
+ * @param room    The free space in the transmit buffer.
+ *
+ * @return The length of the reply if successful, -1 otherwise.
+ */
+int capture_reply(worker_t *worker, uint8_t *buf, int room) {
+    ssize_t len = recv(worker->reply_pair[1], buf, room, MSG_DONTWAIT);
+    if (len <= 0) {
+        log_message(LOG_LEVEL_ERROR, "Error capturing reply: %s", len == 0 ? "socket pair closed" : strerror(errno));
+        return -1;
+    }
+    return len;
+}
+
+/**
+ * Function to send as much of a transmit buffer as a non-blocking socket takes.
+ * What the socket does not take is moved to the front of the buffer.
+ *
+ * @param fd      The client socket.
+ * @param buf     The transmit buffer.
+ * @param length  The bytes waiting in the buffer, updated to what is left.
+ *
+ * @return 0 if everything was sent, 1 if bytes are still pending, -1 if the socket failed.
+ */
+int send_pending(int fd, uint8_t *buf, int *length) {
+    int sent = 0;
+    while (sent < *length) {
+        ssize_t rc = send(fd, buf + sent, *length - sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (rc == -1) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            log_message(LOG_LEVEL_DEBUG, "Error sending reply: %s", strerror(errno));
+            return -1;
+        }
+        sent += rc;
+    }
+    *length -= sent;
+    memmove(buf, buf + sent, *length);
+    return *length > 0;
+}
+
+/**
+ * Function to send the replies batched on a connection.
+ * The send never blocks: what the socket does not take stays at the front of
+ * the transmit buffer until the connection is writable. With io_uring the
+ * replies are left for uring_arm(), which sends them when the batch is done.
+ *
+ * @param worker  The worker owning the connection.
+ * @param conn    The client connection.
+ *
+ * @return 0 if everything was sent, 1 if replies are still pending, -1 if the connection failed.
+ */
+int flush_replies(worker_t *worker, connection_t *conn) {
+    (void)worker;  // Only needed by the io_uring and TLS builds
+#ifdef USE_IO_URING
+    if (worker->ring) return conn->tx_len > 0;
+#endif
+#ifdef USE_TLS
+    if (conn->ssl) return flush_tls_replies(conn);
+#endif
+    return send_pending(conn->source.fd, conn->tx, &conn->tx_len);
+}
+
+/**
+ * Function to choose which events of a client connection the event loop waits for.
+ *
+ * @param worker  The worker owning the connection.
+ * @param conn    The client connection.
+ * @param events  EPOLLIN to read requests, EPOLLOUT to wait until pending replies can be sent.
+ *
+ * @return 0 if successful, -1 otherwise.
+ */
+int watch_connection(worker_t *worker, connection_t *conn, uint32_t events) {
+#ifdef USE_IO_URING
+    if (worker->ring) return uring_arm(worker, conn);  // The pending replies decide what comes next
+#endif
+    struct epoll_event ev = { .events = events, .data.ptr = conn };
+    if (epoll_ctl(worker->epoll_fd, EPOLL_CTL_MOD, conn->source.fd, &ev) == -1) {
+        log_message(LOG_LEVEL_ERROR, "Error updating client socket events: %s", strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Function to serve one complete request frame received natively.
+ * Hot function codes are answered by the fast path into the connection's
+ * transmit buffer, which is flushed once per batch, and so are requests over a
+ * rate limit, with a Server Device Busy exception. Everything else is encoded
+ * by libmodbus from the register store into the worker's socket pair, and its
+ * reply is appended to the batch like a fast-path one, so replies always leave
+ * in request order and never with a blocking send.
+ *
+ * @param worker  The worker owning the connection.
+ * @param conn    The client connection.
+ * @param frame   The request frame, starting at the MBAP header.
+ * @param length  The length of the frame.
+ *
+ * @return 1 if the frame was served, 0 if it must wait until the client reads
+ *         its pending replies, -1 if the connection failed.
+ */
+int serve_frame(worker_t *worker, connection_t *conn, const uint8_t *frame, int length) {
+    if (CONN_TX_BUFFER - conn->tx_len < MODBUS_TCP_MAX_ADU_LENGTH) {
+        int pending = flush_replies(worker, conn);
+        if (pending != 0) return pending == -1 ? -1 : 0;
+    }
+
+    uint64_t started = monotonic_ns();
+    if (log_enabled(LOG_LEVEL_DEBUG)) print_query(frame, length);
+    trace_frame(worker->trace, conn->id, TRACE_REQUEST, frame, length);
+    worker->request_client = conn->peer_addr;
+    worker->request_connection = conn->id;
+
+    uint8_t *rsp = conn->tx + conn->tx_len;
+    int refused = !admit_request(worker, &conn->due_ns, &conn->client, conn->peer_addr) ?
+                  MODBUS_EXCEPTION_SLAVE_OR_SERVER_BUSY :
+                  worker->access_control ? access_exception(worker->config, conn->may_write, frame,
+                                                            MBAP_HEADER_LENGTH, length) : 0;
+    if (refused && refused != MODBUS_EXCEPTION_SLAVE_OR_SERVER_BUSY) stat_add(&worker->stats->denied, 1);
+    int rc = refused ? build_exception(frame, refused, rsp) :
+             worker->fast_path ? fast_path_reply(worker, frame, length, rsp) : 0;
+    if (rc > 0) {
+        conn->tx_len += rc;
+        if (log_enabled(LOG_LEVEL_DEBUG)) print_response(rsp, rc);
+        trace_frame(worker->trace, conn->id, TRACE_RESPONSE, rsp, rc);
+        // Batched replies are timed until encoded, their send is shared by the whole batch
+        record_request(worker->stats, frame, MBAP_HEADER_LENGTH, length, rc,
+                       rsp[MBAP_HEADER_LENGTH] & 0x80 ? rsp[MBAP_HEADER_LENGTH + 1] : 0, started);
+        return 1;
+    }
+
+    // libmodbus only encodes: its reply is caught from the socket pair and batched, never sent on the client socket
+    modbus_set_socket(worker->ctx, worker->reply_pair[0]);
+    int exception;
+    rc = reply_from_store(worker, worker->ctx, frame, length, &exception);
+    if (rc > 0) rc = capture_reply(worker, rsp, CONN_TX_BUFFER - conn->tx_len);
+    if (rc > 0) {
+        conn->tx_len += rc;
+        if (log_enabled(LOG_LEVEL_DEBUG)) print_response(rsp, rc);
+        trace_frame(worker->trace, conn->id, TRACE_RESPONSE, rsp, rc);
+    }
+    record_request(worker->stats, frame, MBAP_HEADER_LENGTH, length, rc > 0 ? rc : 0, exception, started);
+    return rc == -1 ? -1 : 1;
+}
+
+/**
+ * Function to serve the complete frames waiting in a connection's receive buffer,
+ * up to FRAMES_PER_TURN; a connection with more joins the worker's ready list.
+ * Their replies are sent together. If the client does not take them all, the
+ * connection stops reading requests and waits until it is writable; frames
+ * that did not fit stay in the receive buffer until then.
+ *
+ * @param worker  The worker owning the connection.
+ * @param conn    The client connection.
+ *
+ * @return 0 if the connection stays open, -1 if it must be closed.
+ */
+int serve_buffered_frames(worker_t *worker, connection_t *conn) {
+    int consumed = 0;
+    int pending = 0;
+    int served = 0;
+    while (conn->rx_len - consumed >= MBAP_HEADER_LENGTH && served < FRAMES_PER_TURN) {
+        const uint8_t *frame = conn->rx + consumed;
+        int protocol = (frame[2] << 8) | frame[3];
+        int mbap_length = (frame[4] << 8) | frame[5];
+        if (protocol != 0 || mbap_length < 2 || mbap_length > MODBUS_TCP_MAX_ADU_LENGTH - 6) {
+            log_message(LOG_LEVEL_ERROR, "Invalid MBAP header, closing connection");
+            return -1;
+        }
+
+        int frame_length = 6 + mbap_length;
+        if (conn->rx_len - consumed < frame_length) break;  // Wait for the rest of the frame
+        int rc = serve_frame(worker, conn, frame, frame_length);
+        if (rc == -1) return -1;
+        if (rc == 0) {
+            pending = 1;
+            break;
+        }
+        consumed += frame_length;
+        served++;
+    }
+    if (!pending) pending = flush_replies(worker, conn);
+    if (pending == -1) return -1;
+
+    conn->rx_len -= consumed;
+    memmove(conn->rx, conn->rx + consumed, conn->rx_len);
+    if (pending) {
+        // Stop reading until the client catches up, the sweep evicts it if it never does
+        conn->blocked_since_ns = monotonic_ns();
+        return watch_connection(worker, conn, EPOLLOUT);
+    }
+    if (!conn->ready && has_complete_frame(conn)) queue_ready(worker, conn);
+    return 0;
+}
+
+/**
+ * Function to serve the requests completed by bytes just appended to a connection's receive buffer.
+ *
+ * @param worker  The worker owning the connection.
+ * @param conn    The client connection.
+ * @param len     The number of bytes received, already copied after the rx_len bytes of rx.
+ *
+ * @return 0 if the connection stays open, -1 if it must be closed.
+ */
+int serve_received(worker_t *worker, connection_t *conn, int len) {
+    conn->last_active_ns = monotonic_ns();
+    if (conn->rx_len == 0) conn->frame_started_ns = conn->last_active_ns;
+    conn->rx_len += len;
+
+    int rc = serve_buffered_frames(worker, conn);
+    // A partial frame left behind started in this read at the latest
+    if (conn->rx_len > 0 && conn->rx_len < len) conn->frame_started_ns = conn->last_active_ns;
+    return rc;
+}
+
+#ifdef USE_TLS
+/**
+ * Function to receive and serve requests on a TLS connection.
+ * The handshake runs inside the first reads. Each SSL_read() returns at most
+ * one record, and records OpenSSL already decrypted never wake up epoll, so
+ * reading goes on while plaintext is pending and the client reads its replies.
+ *
+ * @param worker  The worker owning the connection.
+ * @param conn    The client connection.
+ *
+ * @return 0 if the connection stays open, -1 if it must be closed.
+ */
+int serve_tls_connection(worker_t *worker, connection_t *conn) {
+    conn->tls_want_write = 0;
+    do {
+        if (conn->rx_len == (int)sizeof(conn->rx)) return 0;  // Full of frames waiting behind unread replies
+        int len = SSL_read(conn->ssl, conn->rx + conn->rx_len, sizeof(conn->rx) - conn->rx_len);
+        if (!conn->tls_established && SSL_is_init_finished(conn->ssl)) {
+            conn->tls_established = 1;
+            stat_add(&worker->stats->tls_handshakes, 1);
+            if (SSL_session_reused(conn->ssl)) stat_add(&worker->stats->tls_resumed, 1);
+        }
+        if (len <= 0) {
+            int err = SSL_get_error(conn->ssl, len);
+            if (err == SSL_ERROR_WANT_READ) return 0;
+            if (err == SSL_ERROR_WANT_WRITE) {
+                conn->tls_want_write = 1;
+                return watch_connection(worker, conn, EPOLLIN | EPOLLOUT);
+            }
+            return tls_failed(conn, err, "receiving request");
+        }
+        if (serve_received(worker, conn, len) == -1) return -1;
+    } while (conn->blocked_since_ns == 0 && !conn->ready && SSL_pending(conn->ssl) > 0);
+    return 0;
+}
+#endif
+
+/**
+ * Function to receive and serve requests on a connection.
+ * Whatever the socket has buffered is read with one non-blocking recv(); every
+ * complete MBAP frame in the buffer is served in order and their replies are sent
+ * together, so pipelined transactions cost one recv() and one send() per batch.
+ * A partial frame is kept for the next event, so a slow sender never stalls the worker.
+ *
+ * @param worker  The worker owning the connection.
+ * @param conn    The client connection.
+ *
+ * @return 0 if the connection stays open, -1 if it must be closed.
+ */
+int serve_connection(worker_t *worker, connection_t *conn) {
+#ifdef USE_TLS
+    if (conn->ssl) return serve_tls_connection(worker, conn);
+#endif
+    ssize_t len = recv(conn->source.fd, conn->rx + conn->rx_len, sizeof(conn->rx) - conn->rx_len, MSG_DONTWAIT);
+    if (len == 0 || (len == -1 && errno == ECONNRESET)) {
+        log_message(LOG_LEVEL_DEBUG, "Client disconnected.");
+        return -1;
+    }
+    if (len == -1) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) return 0;
+        log_message(LOG_LEVEL_ERROR, "Error while receiving request: %s", strerror(errno));
+        return -1;
+    }
+    return serve_received(worker, conn, len);
+}
+
+/**
+ * Function to resume a connection that was waiting to send its pending replies.
+ *
+ * @param worker  The worker owning the connection.
+ * @param conn    The client connection, now writable.
+ *
+ * @return 0 if the connection stays open, -1 if it must be closed.
+ */
+int resume_connection(worker_t *worker, connection_t *conn) {
+    int pending = flush_replies(worker, conn);
+    if (pending != 0) return pending == -1 ? -1 : 0;
+
+    conn->blocked_since_ns = 0;
+    if (watch_connection(worker, conn, EPOLLIN) == -1) return -1;
+    int rc = serve_buffered_frames(worker, conn);  // Requests received before the client stopped reading
+#ifdef USE_TLS
+    // Plaintext left in OpenSSL raises no EPOLLIN, and a handshake may wait to write
+    if (rc == 0 && conn->ssl && conn->blocked_since_ns == 0 &&
+        (conn->tls_want_write || SSL_pending(conn->ssl) > 0)) {
+        rc = serve_tls_connection(worker, conn);
+    }
+#endif
+    return rc;
+}
+
+/**
+ * Function to apply the user timeout, TCP keepalive and busy poll settings to a client socket.
+ * Replies are never sent with a blocking call, unread ones are bounded by the
+ * sweep; TCP_USER_TIMEOUT gives up on a peer that stops acknowledging data
+ * after the response timeout.
+ *
+ * @param worker  The worker taking the socket.
+ * @param fd      The client socket.
+ */
+void configure_client_socket(const worker_t *worker, int fd) {
+    const server_config_t *config = worker->config;
+    int response_timeout = worker->response_timeout_ns / 1000000;
+    if (response_timeout > 0) {
+        unsigned int user_timeout = response_timeout;
+        setsockopt(fd, IPPROTO_TCP, TCP_USER_TIMEOUT, &user_timeout, sizeof(user_timeout));
+    }
+    if (config->keepalive_idle > 0) {
+        int on = 1;
+        setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &on, sizeof(on));
+        setsockopt(fd, IPPROTO_TCP, TCP_KEEPIDLE, &config->keepalive_idle, sizeof(config->keepalive_idle));
+        setsockopt(fd, IPPROTO_TCP, TCP_KEEPINTVL, &config->keepalive_interval, sizeof(config->keepalive_interval));
+        setsockopt(fd, IPPROTO_TCP, TCP_KEEPCNT, &config->keepalive_count, sizeof(config->keepalive_count));
+    }
+    if (config->busy_poll > 0) {
+        // Raising it above net.core.busy_read needs CAP_NET_ADMIN, the spin in the event loop works regardless
+        setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &config->busy_poll, sizeof(config->busy_poll));
+    }
+}
+
+/**
+ * Function to compute the CRC of an RTU frame.
+ *
+ * @param buf     The frame bytes.
+ * @param length  The number of bytes covered by the CRC.
+ *
+ * @return The CRC, sent low byte first.
+ */
+uint16_t rtu_crc16(const uint8_t *buf, int length) {
+    uint16_t crc = 0xFFFF;
+    for (int i = 0; i < length; i++) {
+        crc ^= buf[i];
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc & 1) ? (crc >> 1) ^ 0xA001 : crc >> 1;
+        }
+    }
+    return crc;
+}
+
+/**
+ * Function to get the length of an RTU request from its first bytes.
+ * Every function code served here has a length known from its header, so a
+ * frame is complete as soon as its last byte arrives; the server does not
+ * wait for the 3.5 character silence that ends it on the bus.
+ *
+ * @param frame   The bytes received so far, starting at the unit identifier.
+ * @param length  The number of bytes received so far, at least 2.
+ *
+ * @return The length of the frame including its CRC, 0 if more bytes are needed
+ *         to know it, -1 if the function code has no known length.
+ */
+int rtu_frame_length(const uint8_t *frame, int length) {
+    switch (frame[1]) {
+        case MODBUS_FC_READ_COILS:
+        case MODBUS_FC_READ_DISCRETE_INPUTS:
+        case MODBUS_FC_READ_HOLDING_REGISTERS:
+        case MODBUS_FC_READ_INPUT_REGISTERS:
+        case MODBUS_FC_WRITE_SINGLE_COIL:
+        case MODBUS_FC_WRITE_SINGLE_REGISTER:
+            return 8;
+        case MODBUS_FC_WRITE_MULTIPLE_COILS:
+        case MODBUS_FC_WRITE_MULTIPLE_REGISTERS:
+            return length > 6 ? 9 + frame[6] : 0;
+        case MODBUS_FC_MASK_WRITE_REGISTER:
+            return 10;
+        case MODBUS_FC_WRITE_AND_READ_REGISTERS:
+            return length > 10 ? 13 + frame[10] : 0;
+        case MODBUS_FC_READ_EXCEPTION_STATUS:
+        case MODBUS_FC_REPORT_SLAVE_ID:
+            return 4;
+        default:
+            return -1;
+    }
+}
+
+/**
+ * Function to compute the silence that separates RTU frames on a serial line.
+ * The Modbus serial line specification sets it to 3.5 character times, with a
+ * fixed 1750 us above 19200 baud.
+ *
+ * @param serial  The serial port settings.
+ * @param gap_us  The configured gap in microseconds, 0 for the specification value.
+ *
+ * @return The gap in nanoseconds.
+ */
+uint64_t rtu_frame_gap_ns(const serial_config_t *serial, int gap_us) {
+    if (gap_us > 0) return (uint64_t)gap_us * 1000;
+    if (serial->baud > 19200) return 1750000;
+    int bits = 1 + serial->data_bits + (serial->parity != 'N') + serial->stop_bits;
+    return 3500000000ull * bits / serial->baud;
+}
+
+/**
+ * Function to write a whole buffer to a non-blocking serial port.
+ * A port that stalls, e.g. held by hardware flow control, must not hang the
+ * worker: once the timeout expires, the unsent bytes are discarded.
+ *
+ * @param fd          The serial port descriptor.
+ * @param buf         The bytes to write.
+ * @param length      The number of bytes to write.
+ * @param timeout_ns  The longest time the write may take.
+ *
+ * @return The number of bytes written if successful, -1 otherwise, with errno ETIMEDOUT if the port stalled.
+ */
+int write_all(int fd, const uint8_t *buf, int length, uint64_t timeout_ns) {
+    uint64_t deadline = monotonic_ns() + timeout_ns;
+    int written = 0;
+    while (written < length) {
+        ssize_t rc = write(fd, buf + written, length - written);
+        if (rc == -1) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN) {
+                uint64_t now = monotonic_ns();
+                if (now >= deadline) {
+                    tcflush(fd, TCOFLUSH);  // What the driver still holds would delay the next reply
+                    errno = ETIMEDOUT;
+                    return -1;
+                }
+                struct pollfd pfd = { .fd = fd, .events = POLLOUT };
+                poll(&pfd, 1, (deadline - now + 999999) / 1000000);
+                continue;
+            }
+            return -1;
+        }
+        written += rc;
+    }
+    return written;
+}
+
+/**
+ * Function to check whether an RTU stream answers a unit identifier.
+ * Other units belong to other devices sharing the bus and are ignored silently.
+ *
+ * @param worker  The worker owning the stream.
+ * @param unit    The unit identifier of the request.
+ *
+ * @return 1 if the request must be served, 0 otherwise.
+ */
+int rtu_unit_served(const worker_t *worker, int unit) {
+    if (unit == MODBUS_BROADCAST_ADDRESS) return 1;
+    if (worker->rtu_unit != -1) return unit == worker->rtu_unit;
+    return worker->units->by_unit[unit] != NULL;
+}
+
+/**
+ * Function to apply an RTU broadcast to the register map of every served unit.
+ * With --units, unit 0 has no map of its own: the request is served once per
+ * unit with a map, under that unit's identifier, and the replies are discarded.
+ *
+ * @param worker  The worker owning the stream.
+ * @param stream  The serial port or RTU-over-TCP connection.
+ * @param query   The request in MBAP form, its unit identifier is restored afterwards.
+ * @param frame   The request in RTU form.
+ * @param length  The length of the RTU request.
+ */
+void apply_broadcast(worker_t *worker, rtu_stream_t *stream, uint8_t *query, const uint8_t *frame, int length) {
+    uint8_t request[MODBUS_RTU_MAX_ADU_LENGTH];
+    uint8_t rsp[MODBUS_TCP_MAX_ADU_LENGTH];
+    if (length > (int)sizeof(request)) return;
+    memcpy(request, frame, length);
+    for (int unit = 0; unit < UNIT_ID_COUNT; unit++) {
+        if (worker->units->by_unit[unit] == NULL) continue;
+        query[6] = request[0] = unit;
+        if (worker->fast_path && fast_path_reply(worker, query, MBAP_HEADER_LENGTH + length - 3, rsp) > 0) continue;
+        int exception;
+        modbus_set_socket(stream->ctx, worker->reply_pair[0]);
+        if (reply_from_store(worker, stream->ctx, request, length, &exception) > 0) {
+            capture_reply(worker, rsp, sizeof(rsp));  // A broadcast is never answered
+        }
+    }
+    query[6] = MODBUS_BROADCAST_ADDRESS;
+}
+
+/**
+ * Function to serve one complete RTU request.
+ * The request is rewritten in MBAP form so the fast path serves it exactly as
+ * a TCP request; its reply is converted back to RTU. Other function codes are
+ * answered by libmodbus through the stream's RTU context. Replies on a serial
+ * port are written out right away, within a bound; on an RTU-over-TCP
+ * connection they join its transmit buffer, which serve_rtu() flushes without
+ * blocking. Broadcasts are applied but never answered.
+ *
+ * @param worker  The worker owning the stream.
+ * @param stream  The serial port or RTU-over-TCP connection.
+ * @param frame   The request, starting at the unit identifier and ending with a valid CRC.
+ * @param length  The length of the request.
+ *
+ * @return 0 if successful, -1 if the stream failed.
+ */
+int serve_rtu_frame(worker_t *worker, rtu_stream_t *stream, const uint8_t *frame, int length) {
+    int unit = frame[0];
+    if (!rtu_unit_served(worker, unit)) return 0;
+
+    uint64_t started = monotonic_ns();
+    uint8_t query[MODBUS_TCP_MAX_ADU_LENGTH];
+    uint8_t rsp[MODBUS_TCP_MAX_ADU_LENGTH];
+    int pdu_length = length - 3;  // Unit identifier and CRC around the PDU
+    memset(query, 0, 4);
+    query[4] = (pdu_length + 1) >> 8;
+    query[5] = (pdu_length + 1) & 0xFF;
+    query[6] = unit;
+    memcpy(query + MBAP_HEADER_LENGTH, frame + 1, pdu_length);
+    if (log_enabled(LOG_LEVEL_DEBUG)) print_query(frame, length);
+    trace_frame(worker->trace, stream->id, TRACE_REQUEST, query, MBAP_HEADER_LENGTH + pdu_length);
+    worker->request_client = stream->peer_addr;
+    worker->request_connection = stream->id;
+
+    int refused = !admit_request(worker, &stream->due_ns, &stream->client, stream->peer_addr) ?
+                  MODBUS_EXCEPTION_SLAVE_OR_SERVER_BUSY :
+                  worker->access_control ? access_exception(worker->config, stream->may_write, query,
+                                                            MBAP_HEADER_LENGTH, MBAP_HEADER_LENGTH + pdu_length) : 0;
+    if (refused && refused != MODBUS_EXCEPTION_SLAVE_OR_SERVER_BUSY) stat_add(&worker->stats->denied, 1);
+    if (!refused && unit == MODBUS_BROADCAST_ADDRESS && worker->config->multi_unit) {
+        apply_broadcast(worker, stream, query, frame, length);
+        record_request(worker->stats, query, MBAP_HEADER_LENGTH, length, 0, 0, started);
+        return 0;
+    }
+    int rc = refused ? build_exception(query, refused, rsp) :
+             worker->fast_path ? fast_path_reply(worker, query, MBAP_HEADER_LENGTH + pdu_length, rsp) : 0;
+    if (rc > 0) {
+        trace_frame(worker->trace, stream->id, TRACE_RESPONSE, rsp, rc);
+        int exception = rsp[MBAP_HEADER_LENGTH] & 0x80 ? rsp[MBAP_HEADER_LENGTH + 1] : 0;
+        int reply = 0;
+        if (unit != MODBUS_BROADCAST_ADDRESS) {
+            // The MBAP unit identifier is right before the PDU, reuse it as the RTU address
+            uint8_t *out = rsp + MBAP_HEADER_LENGTH - 1;
+            reply = rc - MBAP_HEADER_LENGTH + 1;
+            uint16_t crc = rtu_crc16(out, reply);
+            out[reply++] = crc & 0xFF;
+            out[reply++] = crc >> 8;
+            if (log_enabled(LOG_LEVEL_DEBUG)) print_response(out, reply);
+            uint64_t timeout_ns = RTU_WRITE_FRAMES * reply * stream->char_ns + RTU_WRITE_SLACK_MS * 1000000ull;
+            int sent = 0;
+            if (stream->source.type == SOURCE_SERIAL) {
+                sent = write_all(stream->source.fd, out, reply, timeout_ns);
+            } else {
+                memcpy(stream->tx + stream->tx_len, out, reply);
+                stream->tx_len += reply;
+            }
+            if (sent == -1 && errno == ETIMEDOUT) {
+                // The master times out and retries, the port stays in service
+                log_message(LOG_LEVEL_ERROR, "Serial port %s stalled, RTU reply dropped", stream->device);
+                reply = 0;
+            } else if (sent == -1) {
+                log_message(LOG_LEVEL_DEBUG, "Error sending RTU reply: %s", strerror(errno));
+                return -1;
+            }
+        }
+        record_request(worker->stats, query, MBAP_HEADER_LENGTH, length, reply, exception, started);
+        return 0;
+    }
+
+    int exception;
+    int serial = stream->source.type == SOURCE_SERIAL;
+    modbus_set_socket(stream->ctx, serial ? stream->source.fd : worker->reply_pair[0]);
+    rc = reply_from_store(worker, stream->ctx, frame, length, &exception);
+    if (rc > 0 && unit == MODBUS_BROADCAST_ADDRESS) rc = 0;  // Never sent, whatever length libmodbus reports
+    if (rc > 0 && !serial) {
+        rc = capture_reply(worker, stream->tx + stream->tx_len, RTU_TX_BUFFER - stream->tx_len);
+        if (rc > 0) stream->tx_len += rc;
+    }
+    if (rc > 0) {
+        // The reply is in RTU form, the trace only records its length
+        if (log_enabled(LOG_LEVEL_DEBUG)) print_response(serial ? NULL : stream->tx + stream->tx_len - rc, rc);
+        trace_frame(worker->trace, stream->id, TRACE_RESPONSE, NULL, rc);
+    }
+    record_request(worker->stats, query, MBAP_HEADER_LENGTH, length, rc > 0 ? rc : 0, exception, started);
+    return rc == -1 && stream->source.type == SOURCE_RTU_CLIENT ? -1 : 0;
+}
+
+/**
+ * Function to give an RTU stream with frames left another turn after the others.
+ *
+ * @param worker  The worker owning the stream.
+ * @param stream  The serial port or RTU-over-TCP connection, not in the RTU ready list.
+ */
+void queue_ready_rtu_stream(worker_t *worker, rtu_stream_t *stream) {
+    stream->ready = 1;
+    stream->ready_next = NULL;
+    stream->ready_prev = worker->rtu_ready_tail;
+    if (worker->rtu_ready_tail) worker->rtu_ready_tail->ready_next = stream;
+    else worker->rtu_ready_head = stream;
+    worker->rtu_ready_tail = stream;
+}
+
+/**
+ * Function to take an RTU stream out of the worker's RTU ready list.
+ *
+ * @param worker  The worker owning the stream.
+ * @param stream  The serial port or RTU-over-TCP connection, in the RTU ready list.
+ */
+void unqueue_ready_rtu_stream(worker_t *worker, rtu_stream_t *stream) {
+    if (stream->ready_prev) stream->ready_prev->ready_next = stream->ready_next;
+    else worker->rtu_ready_head = stream->ready_next;
+    if (stream->ready_next) stream->ready_next->ready_prev = stream->ready_prev;
+    else worker->rtu_ready_tail = stream->ready_prev;
+    stream->ready = 0;
+}
+
+/**
+ * Function to watch an RTU-over-TCP connection for requests or for room to send its replies.
+ *
+ * @param worker  The worker owning the stream.
+ * @param stream  The RTU-over-TCP connection.
+ * @param events  EPOLLIN to read requests, EPOLLOUT to wait until pending replies can be sent.
+ *
+ * @return 0 if successful, -1 otherwise.
+ */
+int watch_rtu_stream(worker_t *worker, rtu_stream_t *stream, uint32_t events) {
+    struct epoll_event ev = { .events = events, .data.ptr = stream };
+    if (epoll_ctl(worker->epoll_fd, EPOLL_CTL_MOD, stream->source.fd, &ev) == -1) {
+        log_message(LOG_LEVEL_ERROR, "Error updating RTU client socket events: %s", strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Function to serve the complete RTU frames waiting in a stream's receive buffer,
+ * up to FRAMES_PER_TURN; a stream with more joins the worker's RTU ready list.
+ * A frame is served as soon as its expected length has arrived with a valid CRC;
+ * frames with a bad CRC are dropped, so the stream resynchronizes on the next
+ * frame. On an RTU-over-TCP connection the replies are then sent together. If
+ * the client does not take them all, or the transmit buffer fills up, the
+ * connection stops reading requests and waits until it is writable; frames not
+ * served yet stay in the receive buffer until then.
+ *
+ * @param worker  The worker owning the stream.
+ * @param stream  The serial port or RTU-over-TCP connection.
+ * @param now     The current monotonic time.
+ *
+ * @return 0 if the stream stays open, -1 if it must be closed.
+ */
+int serve_rtu_frames(worker_t *worker, rtu_stream_t *stream, uint64_t now) {
+    int tcp = stream->source.type == SOURCE_RTU_CLIENT;
+    int consumed = 0;
+    int pending = 0;
+    int served = 0;
+    while (stream->rx_len - consumed >= 4 && served < FRAMES_PER_TURN) {
+        const uint8_t *frame = stream->rx + consumed;
+        int available = stream->rx_len - consumed;
+        int frame_length = rtu_frame_length(frame, available);
+        if (frame_length == -1) {
+            // Unknown length, the frame ends where the buffered bytes carry a valid CRC
+            frame_length = available;
+        }
+        if (frame_length == 0 || frame_length > available) break;
+
+        uint16_t crc = rtu_crc16(frame, frame_length - 2);
+        if (frame[frame_length - 2] != (crc & 0xFF) || frame[frame_length - 1] != (crc >> 8)) {
+            if (rtu_frame_length(frame, available) == -1 && available < (int)sizeof(stream->rx)) break;
+            log_message(LOG_LEVEL_DEBUG, "Dropping RTU frame with a bad CRC.");
+            consumed = stream->rx_len;
+            break;
+        }
+        if (tcp && RTU_TX_BUFFER - stream->tx_len < MODBUS_RTU_MAX_ADU_LENGTH) {
+            pending = send_pending(stream->source.fd, stream->tx, &stream->tx_len);
+            if (pending == -1) return -1;
+            if (pending) break;
+        }
+        if (serve_rtu_frame(worker, stream, frame, frame_length) == -1) return -1;
+        consumed += frame_length;
+        served++;
+    }
+
+    // A full buffer without a frame is garbage, unless its frames only wait for the client to read
+    if (consumed == 0 && !pending && stream->rx_len == (int)sizeof(stream->rx)) consumed = stream->rx_len;
+    if (consumed > 0 && consumed < stream->rx_len) stream->frame_started_ns = now;
+    stream->rx_len -= consumed;
+    memmove(stream->rx, stream->rx + consumed, stream->rx_len);
+    if (tcp && !pending) pending = send_pending(stream->source.fd, stream->tx, &stream->tx_len);
+    if (pending == -1) return -1;
+    if (pending) {
+        // Stop reading until the client catches up, the sweep evicts it if it never does
+        stream->blocked_since_ns = now;
+        return watch_rtu_stream(worker, stream, EPOLLOUT);
+    }
+    // The next turn finds out whether the bytes left hold another complete frame
+    if (served == FRAMES_PER_TURN && stream->rx_len >= 4 && !stream->ready) queue_ready_rtu_stream(worker, stream);
+    return 0;
+}
+
+/**
+ * Function to receive and serve RTU requests on a serial port or an RTU-over-TCP connection.
+ * On a serial line, bytes left over from before a silence of at least the frame
+ * gap belong to a broken frame and are dropped.
+ *
+ * @param worker  The worker owning the stream.
+ * @param stream  The serial port or RTU-over-TCP connection.
+ *
+ * @return 0 if the stream stays open, -1 if it must be closed.
+ */
+int serve_rtu(worker_t *worker, rtu_stream_t *stream) {
+    uint8_t *buf = stream->rx + stream->rx_len;
+    size_t room = sizeof(stream->rx) - stream->rx_len;
+    ssize_t len = stream->source.type == SOURCE_SERIAL ? read(stream->source.fd, buf, room)
+                                                       : recv(stream->source.fd, buf, room, MSG_DONTWAIT);
+    if (len == 0 && stream->source.type == SOURCE_RTU_CLIENT) {
+        log_message(LOG_LEVEL_DEBUG, "RTU client disconnected.");
+        return -1;
+    }
+    if (len == -1) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) return 0;
+        log_message(LOG_LEVEL_ERROR, "Error while receiving RTU request: %s", strerror(errno));
+        return -1;
+    }
+
+    uint64_t now = monotonic_ns();
+    if (stream->gap_ns && stream->rx_len > 0 && now - stream->last_rx_ns >= stream->gap_ns) {
+        log_message(LOG_LEVEL_DEBUG, "Dropping %d bytes of an incomplete RTU frame.", stream->rx_len);
+        memmove(stream->rx, buf, len);
+        stream->rx_len = 0;
+    }
+    if (stream->rx_len == 0) stream->frame_started_ns = now;
+    stream->rx_len += len;
+    stream->last_rx_ns = now;
+    return serve_rtu_frames(worker, stream, now);
+}
+
+/**
+ * Function to resume an RTU-over-TCP connection that was waiting to send its pending replies.
+ *
+ * @param worker  The worker owning the stream.
+ * @param stream  The RTU-over-TCP connection, now writable.
+ *
+ * @return 0 if the stream stays open, -1 if it must be closed.
+ */
+int resume_rtu_stream(worker_t *worker, rtu_stream_t *stream) {
+    int pending = send_pending(stream->source.fd, stream->tx, &stream->tx_len);
+    if (pending != 0) return pending == -1 ? -1 : 0;
+
+    stream->blocked_since_ns = 0;
+    if (watch_rtu_stream(worker, stream, EPOLLIN) == -1) return -1;
+    return serve_rtu_frames(worker, stream, monotonic_ns());  // Requests received before the client stopped reading
+}
+
+/**
+ * Function to stop serving an RTU stream.
+ * A serial port is closed and left unused, an RTU-over-TCP connection is released.
+ *
+ * @param worker  The worker owning the stream.
+ * @param stream  The stream to close.
+ */
+void close_rtu_stream(worker_t *worker, rtu_stream_t *stream) {
+    if (stream->ready) unqueue_ready_rtu_stream(worker, stream);
+    epoll_ctl(worker->epoll_fd, EPOLL_CTL_DEL, stream->source.fd, NULL);
+    if (stream->source.type == SOURCE_SERIAL) {
+        log_message(LOG_LEVEL_ERROR, "Serial port %s stopped.", stream->device);
+        modbus_close(stream->ctx);
+        stream->source.fd = -1;
+        return;
+    }
+    if (stream->prev) stream->prev->next = stream->next;
+    else worker->rtu_clients = stream->next;
+    if (stream->next) stream->next->prev = stream->prev;
+    worker->nb_connections--;
+    close(stream->source.fd);
+    stream->next = worker->free_rtu_streams;
+    worker->free_rtu_streams = stream;
+    stat_add(&worker->stats->connections_closed, 1);
+    log_message(LOG_LEVEL_DEBUG, "RTU client closed.");
+}
+
+/**
+ * Function to accept a pending RTU-over-TCP connection.
+ *
+ * @param worker  The worker owning the RTU listening socket.
+ */
+void accept_rtu_client(worker_t *worker) {
+    struct sockaddr_in peer;
+    socklen_t peer_length = sizeof(peer);
+    int fd = accept4(worker->rtu_listener.fd, (struct sockaddr *)&peer, &peer_length, SOCK_CLOEXEC);
+    if (fd == -1) {
+        log_message(LOG_LEVEL_ERROR, "Error accepting RTU client connection: %s", strerror(errno));
+        return;
+    }
+    if (worker->nb_connections >= worker->max_connections) {
+        log_message(LOG_LEVEL_ERROR, "Worker %d already serves %d connections, rejecting RTU client socket %d",
+                    worker->id, worker->max_connections, fd);
+        close(fd);
+        return;
+    }
+
+    // The pool holds max_connections streams, so one is always free below the limit
+    rtu_stream_t *stream = worker->free_rtu_streams;
+    worker->free_rtu_streams = stream->next;
+    memset(stream, 0, offsetof(rtu_stream_t, rx));  // The buffer is only read up to rx_len
+    stream->source.type = SOURCE_RTU_CLIENT;
+    stream->source.fd = fd;
+    configure_client_socket(worker, fd);
+    stream->ctx = worker->rtu_ctx;
+    stream->id = ((uint32_t)worker->id << 24) | (worker->next_connection++ & 0xFFFFFF);
+    stream->peer_addr = peer.sin_family == AF_INET ? peer.sin_addr.s_addr : 0;
+    stream->may_write = client_may_write(worker->config, stream->peer_addr);
+    stream->last_rx_ns = monotonic_ns();
+
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = stream };
+    if (epoll_ctl(worker->epoll_fd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+        log_message(LOG_LEVEL_ERROR, "Error registering RTU client socket: %s", strerror(errno));
+        close(fd);
+        stream->next = worker->free_rtu_streams;
+        worker->free_rtu_streams = stream;
+        return;
+    }
+    stream->next = worker->rtu_clients;
+    if (stream->next) stream->next->prev = stream;
+    worker->rtu_clients = stream;
+    worker->nb_connections++;
+    stat_add(&worker->stats->connections_opened, 1);
+    log_message(LOG_LEVEL_DEBUG, "RTU client connected (socket %d).", fd);
+}
+
+/**
+ * Function to open a serial port and add it to a worker's event loop.
+ * libmodbus configures the line; the port is switched to non-blocking reads and,
+ * where the driver supports it, to low-latency mode so received bytes are not
+ * held back by the UART or USB adapter.
+ *
+ * @param worker  The worker serving the port.
+ * @param stream  The stream to initialize.
+ * @param serial  The serial port settings.
+ * @param config  The server settings.
+ *
+ * @return 0 if successful, -1 otherwise.
+ */
+int open_serial_port(worker_t *worker, rtu_stream_t *stream, const serial_config_t *serial,
+                     const server_config_t *config) {
+    memset(stream, 0, sizeof(*stream));
+    stream->source.type = SOURCE_SERIAL;
+    stream->source.fd = -1;
+    stream->device = serial->device;
+    stream->gap_ns = rtu_frame_gap_ns(serial, config->rtu_gap_us);
+    stream->char_ns = 1000000000ull * (1 + serial->data_bits + (serial->parity != 'N') + serial->stop_bits) /
+                      serial->baud;
+    stream->may_write = 1;  // Whoever is on the bus, no address to check
+    stream->id = ((uint32_t)worker->id << 24) | (worker->next_connection++ & 0xFFFFFF);
+
+    stream->ctx = modbus_new_rtu(serial->device, serial->baud, serial->parity, serial->data_bits, serial->stop_bits);
+    if (stream->ctx == NULL) {
+        log_message(LOG_LEVEL_ERROR, "Unable to create RTU context for %s: %s", serial->device, modbus_strerror(errno));
+        return -1;
+    }
+    if (modbus_connect(stream->ctx) == -1) {
+        log_message(LOG_LEVEL_ERROR, "Unable to open serial port %s: %s", serial->device, modbus_strerror(errno));
+        modbus_free(stream->ctx);
+        stream->ctx = NULL;
+        return -1;
+    }
+    stream->source.fd = modbus_get_socket(stream->ctx);
+    // The driver switches the transceiver direction, replies need no RTS handling here
+    if (config->rs485 && modbus_rtu_set_serial_mode(stream->ctx, MODBUS_RTU_RS485) == -1) {
+        log_message(LOG_LEVEL_ERROR, "Unable to enable RS-485 on %s: %s", serial->device, modbus_strerror(errno));
+    }
+
+    fcntl(stream->source.fd, F_SETFL, fcntl(stream->source.fd, F_GETFL) | O_NONBLOCK);
+    struct serial_struct info;
+    if (ioctl(stream->source.fd, TIOCGSERIAL, &info) == 0) {
+        info.flags |= ASYNC_LOW_LATENCY;
+        ioctl(stream->source.fd, TIOCSSERIAL, &info);
+    }
+
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = stream };
+    if (epoll_ctl(worker->epoll_fd, EPOLL_CTL_ADD, stream->source.fd, &ev) == -1) {
+        log_message(LOG_LEVEL_ERROR, "Error registering serial port %s: %s", serial->device, strerror(errno));
+        modbus_close(stream->ctx);
+        modbus_free(stream->ctx);
+        stream->ctx = NULL;
+        return -1;
+    }
+    log_message(LOG_LEVEL_INFO, "Serving Modbus RTU on %s at %d baud, frame gap %llu us", serial->device, serial->baud,
+                (unsigned long long)(stream->gap_ns / 1000));
+    return 0;
+}
+
+/**
+ * Function to open the RTU-over-TCP listening socket and add it to a worker's event loop.
+ *
+ * @param worker  The worker accepting RTU-over-TCP connections.
+ * @param config  The server settings.
+ *
+ * @return 0 if successful, -1 otherwise.
+ */
+int open_rtu_listener(worker_t *worker, const server_config_t *config) {
+    // Never connected, it only encodes replies on the socket of each request
+    worker->rtu_ctx = modbus_new_rtu("/dev/null", 9600, 'N', 8, 1);
+    if (worker->rtu_ctx == NULL) {
+        log_message(LOG_LEVEL_ERROR, "Unable to create RTU context: %s", modbus_strerror(errno));
+        return -1;
+    }
+
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(config->rtu_over_tcp_port) };
+    int on = 1;
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1 || inet_pton(AF_INET, config->server_ip, &addr.sin_addr) != 1 ||
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) == -1 ||
+        bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 || listen(fd, LISTEN_BACKLOG) == -1) {
+        log_message(LOG_LEVEL_ERROR, "Error listening on RTU-over-TCP port %d: %s", config->rtu_over_tcp_port,
+                    strerror(errno));
+        if (fd != -1) close(fd);
+        return -1;
+    }
+    worker->rtu_listener.type = SOURCE_RTU_LISTENER;
+    worker->rtu_listener.fd = fd;
+
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = &worker->rtu_listener };
+    if (epoll_ctl(worker->epoll_fd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+        log_message(LOG_LEVEL_ERROR, "Error registering RTU-over-TCP socket: %s", strerror(errno));
+        return -1;
+    }
+    log_message(LOG_LEVEL_INFO, "Serving Modbus RTU over TCP on %s:%d", config->server_ip, config->rtu_over_tcp_port);
+    return 0;
+}
+
+/**
+ * Function to accept a pending client connection.
+ *
+ * @param ctx            The Modbus context owning the listening socket.
+ * @param server_socket  The listening socket descriptor.
+ *
+ * @return The client socket descriptor if successful, -1 otherwise.
+ */
+int accept_client(modbus_t *ctx, int *server_socket) {
+    int client_socket = modbus_tcp_accept(ctx, server_socket);
+    if (client_socket == -1) {
+        log_message(LOG_LEVEL_ERROR, "Error accepting client connection: %s", modbus_strerror(errno));
+        return -1;
+    }
+
+    log_message(LOG_LEVEL_DEBUG, "Client connected successfully (socket %d).", client_socket);
+    return client_socket;
+}
+
+/**
+ * Function to register a client socket with a worker's event loop.
+ * The socket is closed if it cannot be registered.
+ *
+ * @param worker         The worker taking ownership of the socket.
+ * @param client_socket  The client socket descriptor.
+ *
+ * @return 0 if successful, -1 otherwise.
+ */
+int register_client(worker_t *worker, int client_socket) {
+    connection_t *conn = worker->free_slots;
+    if (conn == NULL || worker->nb_connections >= worker->max_connections) {
+        log_message(LOG_LEVEL_ERROR, "Worker %d already serves %d connections, rejecting socket %d", worker->id,
+                    worker->max_connections, client_socket);
+        close(client_socket);
+        return -1;
+    }
+    worker->free_slots = conn->next;
+    memset(conn, 0, offsetof(connection_t, rx));  // The buffers are only read up to rx_len and tx_len
+    conn->source.type = SOURCE_CLIENT;
+    conn->source.fd = client_socket;
+    conn->id = ((uint32_t)worker->id << 24) | (worker->next_connection++ & 0xFFFFFF);
+    conn->last_active_ns = monotonic_ns();
+    configure_client_socket(worker, client_socket);
+    if (worker->clients || worker->config->nb_write_allow > 0 || worker->journal) {
+        struct sockaddr_in peer;
+        socklen_t peer_length = sizeof(peer);
+        if (getpeername(client_socket, (struct sockaddr *)&peer, &peer_length) == 0 && peer.sin_family == AF_INET) {
+            conn->peer_addr = peer.sin_addr.s_addr;
+        }
+    }
+    conn->may_write = client_may_write(worker->config, conn->peer_addr);
+#ifdef USE_TLS
+    // The handshake itself waits for the client's first bytes
+    if (worker->tls) {
+        conn->ssl = SSL_new(worker->tls);
+        if (conn->ssl == NULL || SSL_set_fd(conn->ssl, client_socket) != 1) {
+            log_message(LOG_LEVEL_ERROR, "Error creating TLS session: %s", ERR_error_string(ERR_get_error(), NULL));
+            ERR_clear_error();
+            SSL_free(conn->ssl);
+            close(client_socket);
+            conn->next = worker->free_slots;
+            worker->free_slots = conn;
+            return -1;
+        }
+        SSL_set_accept_state(conn->ssl);
+    }
+#endif
+
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = conn };
+#ifdef USE_IO_URING
+    if (worker->ring) {
+        uring_arm(worker, conn);
+    } else
+#endif
+    if (epoll_ctl(worker->epoll_fd, EPOLL_CTL_ADD, client_socket, &ev) == -1) {
+        log_message(LOG_LEVEL_ERROR, "Error registering client socket: %s", strerror(errno));
+#ifdef USE_TLS
+        SSL_free(conn->ssl);
+#endif
+        close(client_socket);
+        conn->next = worker->free_slots;
+        worker->free_slots = conn;
+        return -1;
+    }
+    conn->next = worker->connections;
+    if (conn->next) conn->next->prev = conn;
+    worker->connections = conn;
+    worker->nb_connections++;
+
+    stat_add(&worker->stats->connections_opened, 1);
+    log_message(LOG_LEVEL_DEBUG, "Worker %d serving socket %d.", worker->id, client_socket);
+    return 0;
+}
+
+/**
+ * Function to drop a client connection and remove it from the event loop.
+ *
+ * @param worker  The worker owning the connection.
+ * @param conn    The client connection, its slot is returned to the slab.
+ */
+void close_client(worker_t *worker, connection_t *conn) {
+    int client_socket = conn->source.fd;
+    if (conn->ready) unqueue_ready(worker, conn);
+    if (conn->prev) conn->prev->next = conn->next;
+    else worker->connections = conn->next;
+    if (conn->next) conn->next->prev = conn->prev;
+    worker->nb_connections--;
+    stat_add(&worker->stats->connections_closed, 1);
+    log_message(LOG_LEVEL_DEBUG, "Client on socket %d closed.", client_socket);
+#ifdef USE_TLS
+    if (conn->ssl) {
+        // No close_notify, the peer may be gone; marked shut down so the session stays resumable
+        SSL_set_shutdown(conn->ssl, SSL_SENT_SHUTDOWN | SSL_RECEIVED_SHUTDOWN);
+        SSL_free(conn->ssl);
+        conn->ssl = NULL;
+    }
+#endif
+#ifdef USE_IO_URING
+    if (worker->ring) {
+        // Operations in flight still use the socket and the buffers, they fail fast once it is shut down
+        if (conn->inflight > 0) {
+            conn->closing = 1;
+            shutdown(client_socket, SHUT_RDWR);
+            return;
+        }
+    } else
+#endif
+    epoll_ctl(worker->epoll_fd, EPOLL_CTL_DEL, client_socket, NULL);
+    close(client_socket);
+    conn->next = worker->free_slots;
+    worker->free_slots = conn;
+}
+
+/**
+ * Function to close the connections that exceeded one of their timeouts.
+ * A connection waiting for its client to read replies is held to the response
+ * timeout, one with an incomplete frame to the byte timeout, and any other to
+ * the idle timeout. RTU-over-TCP connections are held to the same three.
+ *
+ * @param worker  The worker owning the connections.
+ * @param now     The current monotonic time.
+ */
+void sweep_connections(worker_t *worker, uint64_t now) {
+    connection_t *next;
+    for (connection_t *conn = worker->connections; conn != NULL; conn = next) {
+        next = conn->next;
+        const char *reason = NULL;
+        if (conn->blocked_since_ns) {
+            if (worker->response_timeout_ns && now - conn->blocked_since_ns >= worker->response_timeout_ns) {
+                reason = "replies left unread";
+            }
+        } else if (conn->rx_len > 0) {
+            if (worker->byte_timeout_ns && now - conn->frame_started_ns >= worker->byte_timeout_ns) {
+                reason = "incomplete frame";
+            }
+        } else if (worker->idle_timeout_ns && now - conn->last_active_ns >= worker->idle_timeout_ns) {
+            reason = "idle";
+        }
+        if (reason == NULL) continue;
+
+        log_message(LOG_LEVEL_DEBUG, "Evicting client on socket %d: %s.", conn->source.fd, reason);
+        stat_add(&worker->stats->connections_evicted, 1);
+        close_client(worker, conn);
+    }
+
+    rtu_stream_t *next_stream;
+    for (rtu_stream_t *stream = worker->rtu_clients; stream != NULL; stream = next_stream) {
+        next_stream = stream->next;
+        const char *reason = NULL;
+        if (stream->blocked_since_ns) {
+            if (worker->response_timeout_ns && now - stream->blocked_since_ns >= worker->response_timeout_ns) {
+                reason = "replies left unread";
+            }
+        } else if (stream->rx_len > 0) {
+            if (worker->byte_timeout_ns && now - stream->frame_started_ns >= worker->byte_timeout_ns) {
+                reason = "incomplete frame";
+            }
+        } else if (worker->idle_timeout_ns && now - stream->last_rx_ns >= worker->idle_timeout_ns) {
+            reason = "idle";
+        }
+        if (reason == NULL) continue;
+
+        log_message(LOG_LEVEL_DEBUG, "Evicting RTU client on socket %d: %s.", stream->source.fd, reason);
+        stat_add(&worker->stats->connections_evicted, 1);
+        close_rtu_stream(worker, stream);
+    }
+}
+
+/**
+ * Function to register the sockets handed over through a worker's notification pipe.
+ *
+ * @param worker  The worker receiving the sockets.
+ *
+ * @return 0 if successful, -1 if the pipe failed.
+ */
+int receive_handoffs(worker_t *worker) {
+    int sockets[MAX_EPOLL_EVENTS];
+    ssize_t len = read(worker->notify_pipe[0], sockets, sizeof(sockets));
+    if (len == -1) {
+        if (errno == EINTR || errno == EAGAIN) return 0;
+        log_message(LOG_LEVEL_ERROR, "Worker %d failed reading handoff pipe: %s", worker->id, strerror(errno));
+        return -1;
+    }
+
+    // Writes of a single descriptor are atomic, so reads always return whole entries
+    for (size_t i = 0; i < (size_t)len / sizeof(int); i++) {
+        register_client(worker, sockets[i]);
+    }
+    return 0;
+}
+
+/**
+ * Function to handle one event of a worker's epoll instance.
+ *
+ * @param worker         The worker owning the event source.
+ * @param event          The event.
+ * @param server_socket  The listening socket descriptor, when the worker accepts connections itself.
+ *
+ * @return 0 if successful, -1 if the event loop must stop.
+ */
+int dispatch_event(worker_t *worker, const struct epoll_event *event, int *server_socket) {
+    event_source_t *source = event->data.ptr;
+    if (source->type == SOURCE_LISTENER) {
+        int client_socket = accept_client(worker->ctx, server_socket);
+        if (client_socket != -1) register_client(worker, client_socket);
+        return 0;
+    }
+    if (source->type == SOURCE_HANDOFF) return receive_handoffs(worker);
+    if (source->type == SOURCE_RTU_LISTENER) {
+        accept_rtu_client(worker);
+        return 0;
+    }
+    if (source->type == SOURCE_SERIAL || source->type == SOURCE_RTU_CLIENT) {
+        rtu_stream_t *stream = (rtu_stream_t *)source;
+        if (!(event->events & EPOLLOUT) && stream->ready) return 0;  // Frames already received are served first
+        int rc = event->events & EPOLLOUT ? resume_rtu_stream(worker, stream) : serve_rtu(worker, stream);
+        if (rc == -1) close_rtu_stream(worker, stream);
+        return 0;
+    }
+
+    connection_t *conn = (connection_t *)source;
+    if (event->events & (EPOLLERR | EPOLLHUP) && !(event->events & EPOLLIN)) {
+        close_client(worker, conn);
+        return 0;
+    }
+
+    int rc;
+    if (event->events & EPOLLOUT) {
+        rc = resume_connection(worker, conn);
+    } else {
+        if (conn->ready) return 0;  // Frames already received are served first, in the connection's next turn
+        rc = serve_connection(worker, conn);
+    }
+    if (rc == -1) close_client(worker, conn);  // Error or disconnect
+    return 0;
+}
+
+/**
+ * Function to find the NUMA node of a CPU.
+ *
+ * @param cpu  The CPU.
+ *
+ * @return The node, -1 if the kernel does not report one.
+ */
+int cpu_node(int cpu) {
+    char path[64];
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+    DIR *dir = opendir(path);
+    if (dir == NULL) return -1;
+
+    int node = -1;
+    struct dirent *entry;
+    while (node == -1 && (entry = readdir(dir)) != NULL) {
+        if (sscanf(entry->d_name, "node%d", &node) != 1) node = -1;
+    }
+    closedir(dir);
+    return node;
+}
+
+/**
+ * Function to move a buffer to a NUMA node.
+ * Only the pages the buffer covers whole are moved, so a heap buffer never
+ * drags its neighbours along. Errors are ignored: the buffer then just stays
+ * where the kernel put it.
+ *
+ * @param buffer  The buffer.
+ * @param length  The length of the buffer in bytes.
+ * @param node    The node, -1 to leave the buffer where it is.
+ */
+void place_on_node(void *buffer, size_t length, int node) {
+    if (node < 0 || node >= (int)(sizeof(unsigned long) * CHAR_BIT)) return;
+    uintptr_t page = sysconf(_SC_PAGESIZE);
+    uintptr_t start = ((uintptr_t)buffer + page - 1) & ~(page - 1);
+    uintptr_t end = ((uintptr_t)buffer + length) & ~(page - 1);
+    if (end <= start) return;
+
+    unsigned long nodes = 1ul << node;
+    syscall(SYS_mbind, start, end - start, MPOL_PREFERRED, &nodes, sizeof(nodes) * CHAR_BIT + 1, MPOL_MF_MOVE);
+}
+
+/**
+ * Function to pin the calling thread to the worker's CPU, if it has one.
+ * Memory the thread touches first afterwards, such as its io_uring buffers,
+ * is then allocated on the node of that CPU.
+ *
+ * @param worker  The worker run by the calling thread.
+ */
+void pin_worker_thread(const worker_t *worker) {
+    if (worker->cpu == -1) return;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(worker->cpu, &set);
+    int rc = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (rc != 0) {
+        log_message(LOG_LEVEL_ERROR, "Error pinning worker %d to CPU %d: %s", worker->id, worker->cpu, strerror(rc));
+        return;
+    }
+    log_message(LOG_LEVEL_INFO, "Worker %d pinned to CPU %d (NUMA node %d)", worker->id, worker->cpu, worker->node);
+}
+
+/**
+ * Function to wait for events on a worker's epoll instance.
+ * With busy polling enabled the instance is polled for up to the busy poll
+ * time first, so a request arriving meanwhile is served without the wakeup
+ * latency of a blocking wait.
+ *
+ * @param worker   The worker.
+ * @param events   The events to fill, MAX_EPOLL_EVENTS entries.
+ * @param timeout  The longest wait in milliseconds, -1 for no limit.
+ *
+ * @return The number of events, -1 on error.
+ */
+int wait_for_events(worker_t *worker, struct epoll_event *events, int timeout) {
+    if (worker->busy_poll_ns > 0 && timeout != 0) {
+        uint64_t deadline = monotonic_ns() + worker->busy_poll_ns;
+        do {
+            int n = epoll_wait(worker->epoll_fd, events, MAX_EPOLL_EVENTS, 0);
+            if (n != 0) return n;
+        } while (monotonic_ns() < deadline);
+    }
+    return epoll_wait(worker->epoll_fd, events, MAX_EPOLL_EVENTS, timeout);
+}
+
+/**
+ * Function to switch a worker to newly published settings.
+ * The timeout sweep is rescheduled from now, and the byte timeout is handed
+ * to libmodbus again.
+ *
+ * @param worker    The worker.
+ * @param settings  The settings to serve.
+ */
+void apply_settings(worker_t *worker, const live_settings_t *settings) {
+    worker->settings = settings;
+    switch_map(worker, settings->map);
+    worker->rtu_unit = settings->multi_unit ? -1 : worker->config->rtu_unit;
+
+    // The sweep runs four times per shortest timeout, so connections are closed at most a quarter late
+    worker->idle_timeout_ns = (uint64_t)settings->idle_timeout * 1000000;
+    worker->byte_timeout_ns = (uint64_t)settings->byte_timeout * 1000000;
+    worker->response_timeout_ns = (uint64_t)settings->response_timeout * 1000000;
+    worker->sweep_interval_ns = 0;
+    uint64_t timeouts[] = { worker->idle_timeout_ns, worker->byte_timeout_ns, worker->response_timeout_ns };
+    for (size_t i = 0; i < sizeof(timeouts) / sizeof(timeouts[0]); i++) {
+        uint64_t interval = timeouts[i] / 4;
+        if (interval < MIN_SWEEP_INTERVAL_MS * 1000000ull) interval = MIN_SWEEP_INTERVAL_MS * 1000000ull;
+        if (timeouts[i] && (worker->sweep_interval_ns == 0 || interval < worker->sweep_interval_ns)) {
+            worker->sweep_interval_ns = interval;
+        }
+    }
+    worker->next_sweep_ns = monotonic_ns() + worker->sweep_interval_ns;
+}
+
+/**
+ * Function to give the connections of the ready list their next turn.
+ * Each connection in the list when the round starts serves up to
+ * FRAMES_PER_TURN more frames, and queues again behind the others if it
+ * still has frames left, so a client pipelining deeply never holds up the
+ * worker's other clients for more than one turn. RTU streams of the RTU ready
+ * list then get their turn the same way.
+ *
+ * @param worker  The worker owning the connections.
+ */
+void serve_ready_connections(worker_t *worker) {
+    for (int turns = worker->nb_ready; turns > 0 && worker->ready_head; turns--) {
+        connection_t *conn = worker->ready_head;
+        unqueue_ready(worker, conn);
+        int rc = serve_buffered_frames(worker, conn);
+#ifdef USE_TLS
+        // Plaintext left in OpenSSL raises no EPOLLIN
+        if (rc == 0 && conn->ssl && !conn->ready && conn->blocked_since_ns == 0 && SSL_pending(conn->ssl) > 0) {
+            rc = serve_tls_connection(worker, conn);
+        }
+#endif
+        if (rc == -1) {
+            close_client(worker, conn);
+            continue;
+        }
+#ifdef USE_IO_URING
+        if (worker->ring) uring_arm(worker, conn);
+#endif
+    }
+
+    rtu_stream_t *last = worker->rtu_ready_tail;
+    while (last) {
+        rtu_stream_t *stream = worker->rtu_ready_head;
+        unqueue_ready_rtu_stream(worker, stream);
+        if (serve_rtu_frames(worker, stream, monotonic_ns()) == -1) close_rtu_stream(worker, stream);
+        if (stream == last) break;
+    }
+}
+
+/**
+ * Function to start handling a batch of events.
+ * The worker's epoch stays odd until end_batch(), so a reload knows the worker
+ * may still use the settings it held before; the current settings are picked
+ * up after the epoch is raised, so either the worker sees a new publication or
+ * the reloader sees the worker busy.
+ *
+ * @param worker  The worker.
+ */
+void begin_batch(worker_t *worker) {
+    atomic_fetch_add(&worker->epoch, 1);
+    live_settings_t *settings = atomic_load(worker->live);
+    if (settings != worker->settings) apply_settings(worker, settings);
+}
+
+/**
+ * Function to finish handling a batch of events.
+ *
+ * @param worker  The worker, which uses no settings until its next begin_batch().
+ */
+void end_batch(worker_t *worker) {
+    atomic_fetch_add_explicit(&worker->epoch, 1, memory_order_release);
+}
+
+/**
+ * Function to run the connection timeout sweep when it is due.
+ *
+ * @param worker  The worker owning the connections.
+ *
+ * @return The time until the next sweep in milliseconds, -1 if no timeout is enabled.
+ */
+int sweep_if_due(worker_t *worker) {
+    if (worker->sweep_interval_ns == 0) return -1;
+    uint64_t now = monotonic_ns();
+    if (now >= worker->next_sweep_ns) {
+        sweep_connections(worker, now);
+        worker->next_sweep_ns = now + worker->sweep_interval_ns;
+    }
+    return (int)((worker->next_sweep_ns - now + 999999) / 1000000);
+}
+
+#ifdef USE_IO_URING
+/**
+ * Function to handle the completion of an io_uring operation on a client connection.
+ *
+ * @param worker  The worker owning the connection.
+ * @param cqe     The completion.
+ */
+void complete_client_operation(worker_t *worker, const struct io_uring_cqe *cqe) {
+    uring_t *ring = worker->ring;
+    connection_t *conn = (connection_t *)(uintptr_t)(cqe->user_data & ~(uint64_t)3);
+    int operation = cqe->user_data & 3;
+    int res = cqe->res;
+    const uint8_t *data = NULL;
+    unsigned bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+    if (cqe->flags & IORING_CQE_F_BUFFER) data = ring->buffer_memory + (size_t)bid * URING_BUFFER_SIZE;
+    int sent = conn->sending;
+
+    conn->inflight--;
+    if (operation == URING_SEND) conn->sending = 0;
+    else conn->receiving = 0;
+    if (conn->closing) {
+        if (data) uring_recycle_buffer(ring, bid);
+        if (conn->inflight == 0) {
+            close(conn->source.fd);
+            conn->next = worker->free_slots;
+            worker->free_slots = conn;
+        }
+        return;
+    }
+
+    int rc = 0;
+    if (operation == URING_SEND) {
+        if (res >= 0) {
+            conn->tx_len -= res;
+            memmove(conn->tx, conn->tx + res, conn->tx_len);
+        }
+        if (res != sent) {
+            log_message(LOG_LEVEL_DEBUG, "Error sending reply: %s", strerror(res < 0 ? -res : EPIPE));
+            rc = -1;
+        } else {
+            rc = resume_connection(worker, conn);
+        }
+    } else if (res > 0) {
+        memcpy(conn->rx + conn->rx_len, data, res);
+        uring_recycle_buffer(ring, bid);
+        rc = serve_received(worker, conn, res);
+    } else if (res == 0 || res == -ECONNRESET) {
+        log_message(LOG_LEVEL_DEBUG, "Client disconnected.");
+        rc = -1;
+    } else if (res != -ENOBUFS) {  // Out of buffers only delays the receive until they are recycled
+        log_message(LOG_LEVEL_ERROR, "Error while receiving request: %s", strerror(-res));
+        rc = -1;
+    }
+    if (rc == -1) close_client(worker, conn);  // The slot is released once nothing uses it
+    else uring_arm(worker, conn);
+}
+
+/**
+ * Function to queue a multishot accept, which keeps reporting new connections
+ * until the kernel ends it.
+ *
+ * @param worker         The worker accepting the connections.
+ * @param server_socket  The listening socket descriptor.
+ */
+void uring_accept(worker_t *worker, int server_socket) {
+    struct io_uring_sqe *sqe = uring_prepare(worker->ring, IORING_OP_ACCEPT, server_socket, worker, URING_ACCEPT);
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_CLOEXEC;
+}
+
+/**
+ * Function to run a worker's event loop on io_uring.
+ * Client connections are accepted with a multishot accept, read into buffers
+ * the kernel picks from the worker's buffer ring, and answered with one send
+ * per batch, so a single io_uring_enter() submits and reaps the I/O of every
+ * connection that was active. Serial ports, RTU-over-TCP and the handoff pipe
+ * stay on the worker's epoll instance, which the ring watches with a poll.
+ *
+ * @param worker         The worker to run, with its ring set up.
+ * @param server_socket  The listening socket descriptor, -1 if connections are handed over by an acceptor.
+ *
+ * @return -1 if the event loop failed, does not return otherwise.
+ */
+int run_uring_loop(worker_t *worker, int server_socket) {
+    uring_t *ring = worker->ring;
+    if (server_socket != -1) uring_accept(worker, server_socket);
+    uring_prepare(ring, IORING_OP_POLL_ADD, worker->epoll_fd, worker, URING_POLL)->poll32_events = EPOLLIN;
+
+    struct epoll_event events[MAX_EPOLL_EVENTS];
+    while (1) {
+        int timeout = sweep_if_due(worker);
+        if (worker->nb_ready > 0 || worker->rtu_ready_head) timeout = 0;  // Frames left only wait for completions
+
+        // Deferred completions are only posted from io_uring_enter(), busy polling keeps calling it without waiting
+        uint64_t deadline = worker->busy_poll_ns > 0 && timeout != 0 ? monotonic_ns() + worker->busy_poll_ns : 0;
+        while (*ring->cq_head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE) && monotonic_ns() < deadline) {
+            if (uring_submit(ring, 1, 0) == -1) break;
+        }
+        if (uring_submit(ring, 1, timeout) == -1) {
+            log_message(LOG_LEVEL_ERROR, "Error waiting for io_uring completions: %s", strerror(errno));
+            return -1;
+        }
+
+        begin_batch(worker);
+        unsigned head = *ring->cq_head;
+        while (head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+            struct io_uring_cqe cqe = ring->cqes[head & ring->cq_mask];
+            __atomic_store_n(ring->cq_head, ++head, __ATOMIC_RELEASE);
+
+            int operation = cqe.user_data & 3;
+            if (operation == URING_ACCEPT) {
+                if (cqe.res >= 0) {
+                    log_message(LOG_LEVEL_DEBUG, "Client connected successfully (socket %d).", cqe.res);
+                    register_client(worker, cqe.res);
+                } else {
+                    log_message(LOG_LEVEL_ERROR, "Error accepting client connection: %s", strerror(-cqe.res));
+                }
+                if (!(cqe.flags & IORING_CQE_F_MORE)) uring_accept(worker, server_socket);
+            } else if (operation == URING_POLL) {
+                // The poll is one-shot, re-arming it reports sources that are still ready
+                int n = epoll_wait(worker->epoll_fd, events, MAX_EPOLL_EVENTS, 0);
+                for (int i = 0; i < n; i++) {
+                    if (dispatch_event(worker, &events[i], &server_socket) == -1) return -1;
+                }
+                uring_prepare(ring, IORING_OP_POLL_ADD, worker->epoll_fd, worker, URING_POLL)->poll32_events = EPOLLIN;
+            } else {
+                complete_client_operation(worker, &cqe);
+            }
+        }
+        serve_ready_connections(worker);
+        end_batch(worker);
+    }
+}
+#endif
+
+/**
+ * Function to run a worker's event loop.
+ * The worker's client sockets are multiplexed with epoll, so a slow or idle
+ * client never blocks requests from other clients. Readable client sockets are
+ * served natively by serve_connection().
+ * New sockets come either from the listening socket, when the worker accepts
+ * connections itself, or from the worker's notification pipe. Serial ports and
+ * RTU-over-TCP connections are served from worker 0's loop. When a connection
+ * timeout is enabled, epoll_wait() wakes up at least once per sweep interval.
+ * The calling thread is first pinned to the worker's CPU, if it has one.
+ * Built with USE_IO_URING, client connections are served by run_uring_loop()
+ * instead, unless they use TLS or the kernel does not support it.
+ *
+ * @param worker         The worker to run.
+ * @param server_socket  The listening socket descriptor, -1 if connections are handed over by an acceptor.
+ *
+ * @return -1 if the event loop failed, does not return otherwise.
+ */
+int run_event_loop(worker_t *worker, int server_socket) {
+    pin_worker_thread(worker);
+#ifdef USE_IO_URING
+    // The ring is created here, on the thread that submits to it; TLS records are read and written by OpenSSL
+    worker->ring = worker->tls ? NULL : uring_create();
+    if (worker->ring) {
+        struct epoll_event ev = { .events = EPOLLIN, .data.ptr = &worker->handoff };
+        if (server_socket == -1 && epoll_ctl(worker->epoll_fd, EPOLL_CTL_ADD, worker->handoff.fd, &ev) == -1) {
+            log_message(LOG_LEVEL_ERROR, "Error registering server socket: %s", strerror(errno));
+            return -1;
+        }
+        return run_uring_loop(worker, server_socket);
+    }
+    if (worker->tls == NULL) {
+        log_message(LOG_LEVEL_INFO, "Worker %d cannot use io_uring (%s), serving clients with epoll", worker->id,
+                    strerror(errno));
+    }
+#endif
+    event_source_t *watched = &worker->handoff;
+    if (server_socket != -1) {
+        worker->listener.type = SOURCE_LISTENER;
+        worker->listener.fd = server_socket;
+        watched = &worker->listener;
+    }
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = watched };
+    if (epoll_ctl(worker->epoll_fd, EPOLL_CTL_ADD, watched->fd, &ev) == -1) {
+        log_message(LOG_LEVEL_ERROR, "Error registering server socket: %s", strerror(errno));
+        return -1;
+    }
+
+    struct epoll_event events[MAX_EPOLL_EVENTS];
+    while (1) {
+        int timeout = sweep_if_due(worker);
+        if (worker->nb_ready > 0 || worker->rtu_ready_head) timeout = 0;  // Frames left only wait for new events
+        int n = wait_for_events(worker, events, timeout);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            log_message(LOG_LEVEL_ERROR, "Error waiting for socket events: %s", strerror(errno));
+            return -1;
+        }
+
+        begin_batch(worker);
+        int rc = 0;
+        for (int i = 0; i < n && rc == 0; i++) rc = dispatch_event(worker, &events[i], &server_socket);
+        if (rc == 0) serve_ready_connections(worker);
+        end_batch(worker);
+        if (rc == -1) return -1;
+    }
+}
+
+/**
+ * Thread entry point running a worker's event loop.
+ *
+ * @param arg  The worker_t to run.
+ *
+ * @return NULL when the event loop fails.
+ */
+void *worker_main(void *arg) {
+    worker_t *worker = arg;
+    run_event_loop(worker, -1);
+    atomic_store_explicit(&worker->stopped, 1, memory_order_release);
+    log_message(LOG_LEVEL_ERROR, "Worker %d stopped.", worker->id);
+    return NULL;
+}
+
+/**
+ * Function to release a worker's resources.
+ * The worker's thread must not be running.
+ *
+ * @param worker  The worker to release.
+ */
+void free_worker(worker_t *worker) {
+    if (worker->notify_pipe[0] != -1) close(worker->notify_pipe[0]);
+    if (worker->notify_pipe[1] != -1) close(worker->notify_pipe[1]);
+    if (worker->epoll_fd != -1) close(worker->epoll_fd);
+#ifdef USE_IO_URING
+    if (worker->ring) uring_free(worker->ring);
+#endif
+    free(worker->bit_scratch);
+    free(worker->reg_scratch);
+    for (connection_t *conn = worker->connections; conn != NULL; conn = conn->next) {
+#ifdef USE_TLS
+        SSL_free(conn->ssl);
+#endif
+        close(conn->source.fd);
+    }
+    if (worker->reply_pair[0] != -1) close(worker->reply_pair[0]);
+    if (worker->reply_pair[1] != -1) close(worker->reply_pair[1]);
+    free(worker->slab);
+    free(worker->read_cache);
+    for (int i = 0; i < worker->nb_serial; i++) {
+        if (worker->serial[i].source.fd != -1) modbus_close(worker->serial[i].ctx);
+        modbus_free(worker->serial[i].ctx);
+    }
+    for (rtu_stream_t *stream = worker->rtu_clients; stream != NULL; stream = stream->next) {
+        close(stream->source.fd);
+    }
+    free(worker->rtu_pool);
+    if (worker->rtu_listener.fd != -1) close(worker->rtu_listener.fd);
+    if (worker->rtu_ctx) modbus_free(worker->rtu_ctx);
+}
+
+/**
+ * Function to initialize a worker.
+ *
+ * @param worker        The worker to initialize.
+ * @param id            The worker index.
+ * @param ctx           The Modbus context owned by the worker.
+ * @param live          The settings published by the reloader, holding the register maps.
+ * @param trace         The worker's frame trace ring, NULL if tracing is disabled.
+ * @param journal       The write journal with one ring per worker, NULL if journaling is disabled.
+ * @param stats         The worker's statistics.
+ * @param config        The server settings.
+ * @param tls           The TLS context of client sessions, NULL for plain Modbus TCP.
+ * @param clients       The buckets of --client-rate-limit shared by all workers, NULL if disabled.
+ *
+ * @return 0 if successful, -1 otherwise.
+ */
+int init_worker(worker_t *worker, int id, modbus_t *ctx, _Atomic(live_settings_t *) *live, trace_ring_t *trace,
+                journal_t *journal, worker_stats_t *stats, const server_config_t *config, tls_context_t *tls, client_bucket_t *clients) {
+    memset(worker, 0, sizeof(*worker));
+    worker->id = id;
+    worker->ctx = ctx;
+    worker->live = live;
+    worker->trace = trace;
+    worker->journal = journal;
+    worker->stats = stats;
+    worker->fast_path = config->fast_path;
+    worker->notify_pipe[0] = worker->notify_pipe[1] = -1;
+    worker->config = config;
+    worker->tls = tls;
+    worker->clients = clients;
+    worker->access_control = config->nb_write_allow > 0;
+    for (int t = 0; t < TABLE_COUNT; t++) {
+        if (config->read_only[t]) worker->access_control = 1;
+    }
+    worker->reply_pair[0] = worker->reply_pair[1] = -1;
+    worker->cpu = config->nb_cpus > 0 ? config->cpus[id % config->nb_cpus] : -1;
+    worker->node = worker->cpu != -1 ? cpu_node(worker->cpu) : -1;
+    worker->busy_poll_ns = config->busy_poll * 1000ull;
+    apply_settings(worker, atomic_load(live));
+
+    // Every unit identifier a client may send has its histogram up front, freed with the statistics
+    latency_histogram_t *unit_histograms = calloc(UNIT_ID_COUNT, sizeof(latency_histogram_t));
+    if (unit_histograms == NULL) {
+        log_message(LOG_LEVEL_ERROR, "Error allocating unit statistics: %s", strerror(errno));
+        return -1;
+    }
+    place_on_node(unit_histograms, UNIT_ID_COUNT * sizeof(latency_histogram_t), worker->node);
+    for (int unit = 0; unit < UNIT_ID_COUNT; unit++) {
+        atomic_store_explicit(&stats->by_unit[unit], &unit_histograms[unit], memory_order_release);
+    }
+
+    // Sized for the whole address space so an FC23 window always fits
+    worker->bit_scratch = calloc(ADDRESS_SPACE, sizeof(uint8_t));
+    worker->reg_scratch = calloc(ADDRESS_SPACE, sizeof(uint16_t));
+    if (worker->bit_scratch == NULL || worker->reg_scratch == NULL) {
+        log_message(LOG_LEVEL_ERROR, "Error allocating worker buffers: %s", strerror(errno));
+        free(worker->bit_scratch);
+        free(worker->reg_scratch);
+        return -1;
+    }
+
+    // Connection state is taken from the slab, so accepting a client never allocates
+    worker->max_connections = config->max_connections;
+    worker->slab = calloc(worker->max_connections, sizeof(connection_t));
+    if (worker->slab == NULL) {
+        log_message(LOG_LEVEL_ERROR, "Error allocating %d connection slots: %s", worker->max_connections,
+                    strerror(errno));
+        free(worker->bit_scratch);
+        free(worker->reg_scratch);
+        return -1;
+    }
+
+    // Allocated by the thread starting the workers, the hot buffers are moved next to the worker's CPU
+    place_on_node(worker->bit_scratch, ADDRESS_SPACE * sizeof(uint8_t), worker->node);
+    place_on_node(worker->reg_scratch, ADDRESS_SPACE * sizeof(uint16_t), worker->node);
+    place_on_node(worker->slab, worker->max_connections * sizeof(connection_t), worker->node);
+    if (config->read_cache > 0) {
+        worker->read_cache = calloc(config->read_cache, sizeof(cached_reply_t));
+        if (worker->read_cache == NULL) {
+            log_message(LOG_LEVEL_ERROR, "Error allocating read cache: %s", strerror(errno));
+            free(worker->bit_scratch);
+            free(worker->reg_scratch);
+            free(worker->slab);
+            return -1;
+        }
+        worker->read_cache_mask = config->read_cache - 1;
+        place_on_node(worker->read_cache, config->read_cache * sizeof(cached_reply_t), worker->node);
+    }
+    for (int i = worker->max_connections - 1; i >= 0; i--) {
+        worker->slab[i].next = worker->free_slots;
+        worker->free_slots = &worker->slab[i];
+    }
+
+    worker->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (worker->epoll_fd == -1) {
+        log_message(LOG_LEVEL_ERROR, "Error creating epoll instance: %s", strerror(errno));
+        free(worker->bit_scratch);
+        free(worker->reg_scratch);
+        free(worker->slab);
+        free(worker->read_cache);
+        return -1;
+    }
+    // A worker that falls behind must not stall the acceptor, a socket it cannot take is closed
+    if (pipe2(worker->notify_pipe, O_CLOEXEC | O_NONBLOCK) == -1) {
+        log_message(LOG_LEVEL_ERROR, "Error creating worker handoff pipe: %s", strerror(errno));
+        close(worker->epoll_fd);
+        free(worker->bit_scratch);
+        free(worker->reg_scratch);
+        free(worker->slab);
+        free(worker->read_cache);
+        return -1;
+    }
+    worker->handoff.type = SOURCE_HANDOFF;
+    worker->handoff.fd = worker->notify_pipe[0];
+
+    // RTU streams join the first worker's event loop, next to its TCP clients
+    worker->rtu_listener.fd = -1;
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, worker->reply_pair) == -1) {
+        log_message(LOG_LEVEL_ERROR, "Error creating worker reply socket pair: %s", strerror(errno));
+        free_worker(worker);
+        return -1;
+    }
+    if (id != 0) return 0;
+    for (int i = 0; i < config->nb_serial_ports; i++) {
+        if (open_serial_port(worker, &worker->serial[i], &config->serial_ports[i], config) == -1) {
+            free_worker(worker);
+            return -1;
+        }
+        worker->nb_serial++;
+    }
+    if (config->rtu_over_tcp_port > 0) {
+        // RTU-over-TCP connections are taken from their own pool, so accepting one never allocates either
+        worker->rtu_pool = calloc(worker->max_connections, sizeof(rtu_stream_t));
+        if (worker->rtu_pool == NULL) {
+            log_message(LOG_LEVEL_ERROR, "Error allocating %d RTU-over-TCP connection slots: %s",
+                        worker->max_connections, strerror(errno));
+            free_worker(worker);
+            return -1;
+        }
+        place_on_node(worker->rtu_pool, worker->max_connections * sizeof(rtu_stream_t), worker->node);
+        for (int i = worker->max_connections - 1; i >= 0; i--) {
+            worker->rtu_pool[i].next = worker->free_rtu_streams;
+            worker->free_rtu_streams = &worker->rtu_pool[i];
+        }
+        if (open_rtu_listener(worker, config) == -1) {
+            free_worker(worker);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Function to start the worker threads.
+ * Each worker gets its own Modbus context so requests can be framed in parallel.
+ *
+ * @param workers       The array of workers to start.
+ * @param count         The number of workers.
+ * @param config        The server settings.
+ * @param live          The settings published by the reloader, holding the register maps.
+ * @param tracer        The frame tracer with one ring per worker, NULL if tracing is disabled.
+ * @param journal       The write journal with one ring per worker, NULL if journaling is disabled.
+ * @param stats         The statistics, one entry per worker.
+ * @param tls           The TLS context shared by all workers, NULL for plain Modbus TCP.
+ * @param clients       The buckets of --client-rate-limit shared by all workers, NULL if disabled.
+ *
+ * @return The number of workers started, -1 if none could be started.
+ */
+int start_workers(worker_t *workers, int count, const server_config_t *config, _Atomic(live_settings_t *) *live,
+                  tracer_t *tracer, journal_t *journal, worker_stats_t *stats, tls_context_t *tls,
+                  client_bucket_t *clients) {
+    int started = 0;
+    for (int i = 0; i < count; i++) {
+        modbus_t *ctx = init_modbus_server(config->server_ip, config->server_port);
+        if (ctx == NULL) break;
+
+        if (init_worker(&workers[i], i, ctx, live, tracer ? &tracer->rings[i] : NULL, journal, &stats[i],
+                        config, tls, clients) == -1) {
+            modbus_free(ctx);
+            break;
+        }
+
+        int rc = pthread_create(&workers[i].thread, NULL, worker_main, &workers[i]);
+        if (rc != 0) {
+            log_message(LOG_LEVEL_ERROR, "Error starting worker thread: %s", strerror(rc));
+            free_worker(&workers[i]);
+            modbus_free(ctx);
+            break;
+        }
+        started++;
+    }
+    return started > 0 ? started : -1;
+}
+
+/**
+ * Function to hand an accepted client socket to a worker.
+ * The write never blocks: if the worker's pipe is full, the socket is closed
+ * and the client reconnects.
+ *
+ * @param worker         The worker taking ownership of the socket.
+ * @param client_socket  The client socket descriptor.
+ *
+ * @return 0 if successful, -1 otherwise.
+ */
+int dispatch_client(worker_t *worker, int client_socket) {
+    ssize_t len;
+    do {
+        len = write(worker->notify_pipe[1], &client_socket, sizeof(client_socket));
+    } while (len == -1 && errno == EINTR);
+
+    if (len == -1 && errno == EAGAIN) {
+        log_message(LOG_LEVEL_ERROR, "Worker %d is not keeping up, closing client socket %d", worker->id,
+                    client_socket);
+        close(client_socket);
+        return -1;
+    }
+    if (len != sizeof(client_socket)) {
+        log_message(LOG_LEVEL_ERROR, "Error handing socket to worker %d: %s", worker->id, strerror(errno));
+        close(client_socket);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Function to accept client connections and spread them across the workers.
+ * Sockets are assigned round-robin and stay with their worker until they close.
+ *
+ * @param ctx            The Modbus context owning the listening socket.
+ * @param server_socket  The listening socket descriptor.
+ * @param workers        The running workers.
+ * @param count          The number of running workers.
+ *
+ * @return -1 once every worker stopped, does not return otherwise.
+ */
+int run_acceptor(modbus_t *ctx, int server_socket, worker_t *workers, int count) {
+    int next = 0;
+    while (1) {
+        int client_socket = accept_client(ctx, &server_socket);
+        if (client_socket == -1) continue;
+
+        // Workers whose event loop stopped take no more sockets
+        int tries = 0;
+        while (tries < count && atomic_load_explicit(&workers[next].stopped, memory_order_acquire)) {
+            next = (next + 1) % count;
+            tries++;
+        }
+        if (tries == count) {
+            log_message(LOG_LEVEL_ERROR, "Every worker stopped, no client can be served");
+            close(client_socket);
+            return -1;
+        }
+        dispatch_client(&workers[next], client_socket);
+        next = (next + 1) % count;
+    }
+}
+
+/**
+ * Function to parse a table layout given as [START:]COUNT.
+ *
+ * @param arg     The option argument.
+ * @param layout  The layout to update.
+ *
+ * @return 0 if successful, -1 if the argument is malformed or leaves the address space.
+ */
+int parse_table_layout(const char *arg, table_layout_t *layout) {
+    char *end;
+    long start = 0;
+    long count = strtol(arg, &end, 10);
+    if (*end == ':') {
+        start = count;
+        count = strtol(end + 1, &end, 10);
+    }
+    if (*end != '\0' || start < 0 || count < 0 || start + count > ADDRESS_SPACE) return -1;
+
+    layout->start = (int)start;
+    layout->count = (int)count;
+    return 0;
+}
+
+/**
+ * Function to parse a list of unit identifiers such as 1-32,100.
+ *
+ * @param arg    The option argument.
+ * @param units  The unit flags to set, indexed by unit identifier.
+ *
+ * @return 0 if successful, -1 if the list is malformed.
+ */
+int parse_unit_list(const char *arg, uint8_t *units) {
+    const char *p = arg;
+    if (*p == '\0') return -1;
+    while (*p) {
+        char *end;
+        long first = strtol(p, &end, 10);
+        long last = first;
+        if (end == p) return -1;
+        if (*end == '-') {
+            p = end + 1;
+            last = strtol(p, &end, 10);
+            if (end == p) return -1;
+        }
+        if (first < 0 || last >= UNIT_ID_COUNT || first > last) return -1;
+        for (long unit = first; unit <= last; unit++) units[unit] = 1;
+
+        if (*end == ',') end++;
+        else if (*end != '\0') return -1;
+        p = end;
+    }
+    return 0;
+}
+
+/**
+ * Function to parse a list of CPUs such as 2-5,8, keeping the order given.
+ * Every CPU must be one the process is allowed to run on.
+ *
+ * @param arg    The option argument.
+ * @param cpus   The CPUs to fill, CPU_SETSIZE entries.
+ * @param count  Set to the number of CPUs in the list.
+ *
+ * @return 0 if successful, -1 if the list is malformed or names an unavailable CPU.
+ */
+int parse_cpu_list(const char *arg, int *cpus, int *count) {
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == -1) return -1;
+
+    const char *p = arg;
+    *count = 0;
+    if (*p == '\0') return -1;
+    while (*p) {
+        char *end;
+        long first = strtol(p, &end, 10);
+        long last = first;
+        if (end == p) return -1;
+        if (*end == '-') {
+            p = end + 1;
+            last = strtol(p, &end, 10);
+            if (end == p) return -1;
+        }
+        if (first < 0 || last >= CPU_SETSIZE || first > last || *count + (last - first) >= CPU_SETSIZE) return -1;
+        for (long cpu = first; cpu <= last; cpu++) {
+            if (!CPU_ISSET(cpu, &allowed)) return -1;
+            cpus[(*count)++] = cpu;
+        }
+
+        if (*end == ',') end++;
+        else if (*end != '\0') return -1;
+        p = end;
+    }
+    return 0;
+}
+
+/**
+ * Function to parse a rate limit given as RATE[:BURST] requests per second.
+ * The burst defaults to one second's worth of requests.
+ *
+ * @param arg    The option argument.
+ * @param limit  The limit to fill.
+ *
+ * @return 0 if successful, -1 if the argument is malformed.
+ */
+int parse_rate_limit(const char *arg, rate_limit_t *limit) {
+    char *end;
+    long rate = strtol(arg, &end, 10);
+    long burst = rate;
+    if (end == arg) return -1;
+    if (*end == ':') {
+        const char *p = end + 1;
+        burst = strtol(p, &end, 10);
+        if (end == p) return -1;
+    }
+    if (*end != '\0' || rate < 1 || rate > 1000000000 || burst < 1 || burst > 1000000000) return -1;
+    limit->interval_ns = 1000000000ull / rate;
+    limit->tolerance_ns = (uint64_t)(burst - 1) * limit->interval_ns;
+    return 0;
+}
+
+/**
+ * Function to parse a client subnet given as ADDRESS[/LENGTH].
+ * A bare address is a /32; host bits set in the address are ignored.
+ *
+ * @param arg     The option argument.
+ * @param prefix  The subnet to fill.
+ *
+ * @return 0 if successful, -1 if the argument is malformed.
+ */
+int parse_ip_prefix(const char *arg, ip_prefix_t *prefix) {
+    char address[INET_ADDRSTRLEN];
+    const char *slash = strchr(arg, '/');
+    size_t address_length = slash ? (size_t)(slash - arg) : strlen(arg);
+    if (address_length >= sizeof(address)) return -1;
+    memcpy(address, arg, address_length);
+    address[address_length] = '\0';
+
+    struct in_addr network;
+    if (inet_pton(AF_INET, address, &network) != 1) return -1;
+    long length = 32;
+    if (slash) {
+        char *end;
+        length = strtol(slash + 1, &end, 10);
+        if (end == slash + 1 || *end != '\0' || length < 0 || length > 32) return -1;
+    }
+    prefix->mask = length == 0 ? 0 : ~0u << (32 - length);
+    prefix->network = ntohl(network.s_addr) & prefix->mask;
+    return 0;
+}
+
+/**
+ * Function to mark a range given as TABLE:ADDRESS[:COUNT] read-only.
+ * Only coils and holding registers can be written, so only they take ranges.
+ *
+ * @param arg     The option argument.
+ * @param config  The server settings holding the read-only bitmaps.
+ *
+ * @return 0 if successful, -1 if the argument is malformed or memory ran out.
+ */
+int parse_read_only(const char *arg, server_config_t *config) {
+    char buffer[64];
+    if (strlen(arg) >= sizeof(buffer)) return -1;
+    char *rest = strcpy(buffer, arg);
+    char *table_name = strsep(&rest, ":");
+    char *address_arg = strsep(&rest, ":");
+    int table = parse_table_name(table_name);
+    if ((table != TABLE_COILS && table != TABLE_HOLDING_REGISTERS) || address_arg == NULL) return -1;
+
+    char *end;
+    long address = strtol(address_arg, &end, 10);
+    long count = 1;
+    if (end == address_arg || *end != '\0' || address < 0 || address >= ADDRESS_SPACE) return -1;
+    if (rest) {
+        count = strtol(rest, &end, 10);
+        if (end == rest || *end != '\0' || count < 1 || address + count > ADDRESS_SPACE) return -1;
+    }
+
+    if (config->read_only[table] == NULL) {
+        config->read_only[table] = calloc(ADDRESS_SPACE / 64, sizeof(uint64_t));
+        if (config->read_only[table] == NULL) return -1;
+    }
+    for (long a = address; a < address + count; a++) config->read_only[table][a / 64] |= 1ull << (a % 64);
+    return 0;
+}
+
+/**
+ * Function to parse serial port settings given as DEVICE[:BAUD[:FORMAT]].
+ * FORMAT is data bits, parity and stop bits, e.g. 8E1 or 8N2.
+ *
+ * @param arg     The option argument, modified in place.
+ * @param serial  The settings to fill.
+ *
+ * @return 0 if successful, -1 if the argument is malformed.
+ */
+int parse_serial_port(char *arg, serial_config_t *serial) {
+    serial->device = arg;
+    serial->baud = DEFAULT_RTU_BAUD;
+    serial->data_bits = 8;
+    serial->parity = 'E';
+    serial->stop_bits = 1;
+
+    char *colon = strchr(arg, ':');
+    if (colon == NULL) return *arg ? 0 : -1;
+    *colon = '\0';
+    char *end;
+    serial->baud = (int)strtol(colon + 1, &end, 10);
+    if (colon == arg || end == colon + 1 || serial->baud <= 0) return -1;
+    if (*end == '\0') return 0;
+    if (*end != ':' || strlen(end + 1) != 3) return -1;
+
+    const char *format = end + 1;
+    serial->data_bits = format[0] - '0';
+    serial->parity = format[1];
+    serial->stop_bits = format[2] - '0';
+    if (serial->data_bits < 5 || serial->data_bits > 8 || !strchr("NEO", serial->parity) ||
+        serial->stop_bits < 1 || serial->stop_bits > 2) return -1;
+    return 0;
+}
+
+/**
+ * Function to parse a generated range given as TABLE:ADDRESS[:COUNT]=KIND[:ARG...].
+ * KIND is counter[:STEP[:PERIOD_MS]], sine[:AMPLITUDE[:OFFSET[:PERIOD_MS]]],
+ * random[:STEP[:MIN[:MAX[:PERIOD_MS]]]] or clock.
+ *
+ * @param spec       The option argument.
+ * @param generator  The parsed range.
+ *
+ * @return 0 if successful, -1 if the argument is malformed.
+ */
+int parse_generator(const char *spec, generator_t *generator) {
+    static const char *kinds[] = {
+        [GENERATOR_COUNTER] = "counter",
+        [GENERATOR_SINE] = "sine",
+        [GENERATOR_RANDOM] = "random",
+        [GENERATOR_CLOCK] = "clock",
+    };
+    memset(generator, 0, sizeof(*generator));
+    char buffer[128];
+    if (strlen(spec) >= sizeof(buffer)) return -1;
+    char *arg = strcpy(buffer, spec);
+    char *kind = strchr(arg, '=');
+    if (kind == NULL) return -1;
+    *kind++ = '\0';
+
+    char *table = strsep(&arg, ":");
+    char *address = strsep(&arg, ":");
+    char *end;
+    generator->table = parse_table_name(table);
+    if (generator->table != TABLE_HOLDING_REGISTERS && generator->table != TABLE_INPUT_REGISTERS) return -1;
+    if (address == NULL) return -1;
+    generator->address = strtol(address, &end, 10);
+    if (end == address || *end != '\0' || generator->address < 0 || generator->address >= ADDRESS_SPACE) return -1;
+    if (arg) {
+        generator->count = strtol(arg, &end, 10);
+        if (end == arg || *end != '\0' || generator->count < 1) return -1;
+    }
+
+    char *name = strsep(&kind, ":");
+    generator->kind = -1;
+    for (int i = 0; i < (int)(sizeof(kinds) / sizeof(kinds[0])); i++) {
+        if (strcmp(name, kinds[i]) == 0) generator->kind = i;
+    }
+    double args[4];
+    int nb_args = 0;
+    while (kind && nb_args < 4) {
+        char *field = strsep(&kind, ":");
+        args[nb_args++] = strtod(field, &end);
+        if (end == field || *end != '\0' || fabs(args[nb_args - 1]) > 1e9) return -1;
+    }
+    if (kind) return -1;
+
+    double period_ms = 1000;
+    switch (generator->kind) {
+        case GENERATOR_COUNTER:
+            if (generator->count == 0) generator->count = 1;
+            if (nb_args > 2 || generator->count > 4) return -1;
+            generator->step = nb_args > 0 ? args[0] : 1;
+            if (nb_args > 1) period_ms = args[1];
+            break;
+        case GENERATOR_SINE:
+            if (nb_args > 3) return -1;
+            generator->amplitude = nb_args > 0 ? args[0] : 1000;
+            generator->offset = nb_args > 1 ? args[1] : generator->amplitude;
+            period_ms = nb_args > 2 ? args[2] : 10000;
+            break;
+        case GENERATOR_RANDOM:
+            generator->step = nb_args > 0 ? args[0] : 10;
+            generator->min = nb_args > 1 ? args[1] : 0;
+            generator->max = nb_args > 2 ? args[2] : 1000;
+            if (nb_args > 3) period_ms = args[3];
+            if (generator->min > generator->max || generator->min < -32768 || generator->max > 65535) return -1;
+            break;
+        case GENERATOR_CLOCK:
+            if (generator->count == 0) generator->count = 2;
+            if (nb_args > 0 || generator->count > 4) return -1;
+            break;
+        default:
+            return -1;
+    }
+    if (generator->count == 0) generator->count = 1;
+    if (period_ms < 1) return -1;
+    generator->period_ns = (uint64_t)(period_ms * 1000000);
+    return 0;
+}
+
+/**
+ * Function to parse command-line arguments.
+ * This function processes the command-line options and updates the server settings accordingly.
+ *
+ * @param argc          The number of command-line arguments.
+ * @param argv          The array of command-line arguments.
+ * @param config        The server settings to update.
+ */
+void parse_arguments(int argc, char *argv[], server_config_t *config) {
+    static struct option long_options[] = {
+        {"debug", no_argument, NULL, 'd'},
+        {"version", no_argument, NULL, 'v'},
+        {"threads", required_argument, NULL, 't'},
+        {"coils", required_argument, NULL, OPT_COILS},
+        {"discrete-inputs", required_argument, NULL, OPT_DISCRETE_INPUTS},
+        {"holding-registers", required_argument, NULL, OPT_HOLDING_REGISTERS},
+        {"input-registers", required_argument, NULL, OPT_INPUT_REGISTERS},
+        {"sparse", no_argument, NULL, OPT_SPARSE},
+        {"persist", required_argument, NULL, OPT_PERSIST},
+        {"persist-interval", required_argument, NULL, OPT_PERSIST_INTERVAL},
+        {"shm", required_argument, NULL, OPT_SHM},
+        {"load-map", required_argument, NULL, OPT_LOAD_MAP},
+        {"reload", required_argument, NULL, OPT_RELOAD},
+        {"cpu-affinity", required_argument, NULL, OPT_CPU_AFFINITY},
+        {"busy-poll", required_argument, NULL, OPT_BUSY_POLL},
+        {"read-cache", required_argument, NULL, OPT_READ_CACHE},
+        {"rate-limit", required_argument, NULL, OPT_RATE_LIMIT},
+        {"client-rate-limit", required_argument, NULL, OPT_CLIENT_RATE_LIMIT},
+        {"write-allow", required_argument, NULL, OPT_WRITE_ALLOW},
+        {"read-only", required_argument, NULL, OPT_READ_ONLY},
+        {"generator", required_argument, NULL, OPT_GENERATOR},
+        {"rtu", required_argument, NULL, OPT_RTU},
+        {"rtu-unit", required_argument, NULL, OPT_RTU_UNIT},
+        {"rtu-over-tcp", required_argument, NULL, OPT_RTU_OVER_TCP},
+        {"rtu-gap", required_argument, NULL, OPT_RTU_GAP},
+        {"rs485", no_argument, NULL, OPT_RS485},
+        {"notify", required_argument, NULL, OPT_NOTIFY},
+        {"idle-timeout", required_argument, NULL, OPT_IDLE_TIMEOUT},
+        {"byte-timeout", required_argument, NULL, OPT_BYTE_TIMEOUT},
+        {"response-timeout", required_argument, NULL, OPT_RESPONSE_TIMEOUT},
+        {"keepalive", required_argument, NULL, OPT_KEEPALIVE},
+        {"reuseport", required_argument, NULL, OPT_REUSEPORT},
+        {"max-connections", required_argument, NULL, OPT_MAX_CONNECTIONS},
+        {"tls", no_argument, NULL, OPT_TLS},
+        {"tls-cert", required_argument, NULL, OPT_TLS_CERT},
+        {"tls-key", required_argument, NULL, OPT_TLS_KEY},
+        {"tls-ca", required_argument, NULL, OPT_TLS_CA},
+        {"tls-ticket-key", required_argument, NULL, OPT_TLS_TICKET_KEY},
+        {"notify-interval", required_argument, NULL, OPT_NOTIFY_INTERVAL},
+        {"units", required_argument, NULL, 'u'},
+        {"fast-path", no_argument, NULL, OPT_FAST_PATH},
+        {"trace", required_argument, NULL, OPT_TRACE},
+        {"journal", required_argument, NULL, OPT_JOURNAL},
+        {"log-level", required_argument, NULL, OPT_LOG_LEVEL},
+        {"log-format", required_argument, NULL, OPT_LOG_FORMAT},
+        {"stats-port", required_argument, NULL, OPT_STATS_PORT},
+        {0, 0, 0, 0}
+    };
+
+    int opt;
+    int port_given = 0;
+    while ((opt = getopt_long(argc, argv, "i:p:r:t:u:hv", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'i':
+                config->server_ip = optarg;
+                break;
+            case 'p':
+                config->server_port = atoi(optarg);
+                port_given = 1;
+                break;
+            case 'r':
+                config->layouts[TABLE_HOLDING_REGISTERS].count = atoi(optarg);
+                if (config->layouts[TABLE_HOLDING_REGISTERS].count < 0 ||
+                    config->layouts[TABLE_HOLDING_REGISTERS].start +
+                    config->layouts[TABLE_HOLDING_REGISTERS].count > ADDRESS_SPACE) {
+                    log_message(LOG_LEVEL_ERROR, "Register count must be between 0 and %d", ADDRESS_SPACE);
+                    exit(-1);
+                }
+                break;
+            case OPT_COILS:
+            case OPT_DISCRETE_INPUTS:
+            case OPT_HOLDING_REGISTERS:
+            case OPT_INPUT_REGISTERS:
+                if (parse_table_layout(optarg, &config->layouts[opt - OPT_COILS]) == -1) {
+                    log_message(LOG_LEVEL_ERROR, "Invalid table layout '%s', expected [START:]COUNT within %d "
+                                "addresses", optarg, ADDRESS_SPACE);
+                    exit(-1);
+                }
+                break;
+            case 't':
+                config->threads = atoi(optarg);
+                if (config->threads < 1 || config->threads > MAX_THREADS) {
+                    log_message(LOG_LEVEL_ERROR, "Thread count must be between 1 and %d", MAX_THREADS);
+                    exit(-1);
+                }
+                break;
+            case OPT_REUSEPORT:
+                config->reuseport = atoi(optarg);
+                if (config->reuseport < 1 || config->reuseport > MAX_PROCESSES) {
+                    log_message(LOG_LEVEL_ERROR, "Process count must be between 1 and %d", MAX_PROCESSES);
+                    exit(-1);
+                }
+                break;
+            case OPT_MAX_CONNECTIONS:
+                config->max_connections = atoi(optarg);
+                if (config->max_connections < 1) {
+                    log_message(LOG_LEVEL_ERROR, "Connection limit must be at least 1");
+                    exit(-1);
+                }
+                break;
+            case OPT_TLS:
+                config->tls = 1;
+                break;
+            case OPT_TLS_CERT:
+                config->tls_cert = optarg;
+                break;
+            case OPT_TLS_KEY:
+                config->tls_key = optarg;
+                break;
+            case OPT_TLS_CA:
+                config->tls_ca = optarg;
+                break;
+            case OPT_TLS_TICKET_KEY:
+                config->tls_ticket_key = optarg;
+                break;
+            case OPT_SPARSE:
+                config->sparse = 1;
+                break;
+            case OPT_PERSIST:
+                config->persist_file = optarg;
+                break;
+            case OPT_LOAD_MAP:
+                config->load_map = optarg;
+                break;
+            case OPT_RELOAD:
+                config->reload_file = optarg;
+                break;
+            case OPT_CPU_AFFINITY:
+                if (parse_cpu_list(optarg, config->cpus, &config->nb_cpus) == -1) {
+                    log_message(LOG_LEVEL_ERROR, "Invalid CPU list '%s', expected CPUs the server may run on, e.g. 2-5",
+                                optarg);
+                    exit(-1);
+                }
+                break;
+            case OPT_BUSY_POLL:
+                config->busy_poll = atoi(optarg);
+                if (config->busy_poll < 1) {
+                    log_message(LOG_LEVEL_ERROR, "Busy poll time must be at least 1 microsecond");
+                    exit(-1);
+                }
+                break;
+            case OPT_READ_CACHE:
+                config->read_cache = atoi(optarg);
+                if (config->read_cache < 1 || config->read_cache > MAX_READ_CACHE) {
+                    log_message(LOG_LEVEL_ERROR, "Read cache size must be between 1 and %d", MAX_READ_CACHE);
+                    exit(-1);
+                }
+                // Rounded up to a power of two so a hash is masked into an entry
+                while (config->read_cache & (config->read_cache - 1)) config->read_cache++;
+                break;
+            case OPT_RATE_LIMIT:
+            case OPT_CLIENT_RATE_LIMIT:
+                if (parse_rate_limit(optarg, opt == OPT_RATE_LIMIT ? &config->connection_rate :
+                                                                     &config->client_rate) == -1) {
+                    log_message(LOG_LEVEL_ERROR, "Invalid rate limit '%s', expected RATE[:BURST] requests per second",
+                                optarg);
+                    exit(-1);
+                }
+                break;
+            case OPT_WRITE_ALLOW:
+                if (config->nb_write_allow == MAX_WRITE_PREFIXES) {
+                    log_message(LOG_LEVEL_ERROR, "At most %d write subnets are supported", MAX_WRITE_PREFIXES);
+                    exit(-1);
+                }
+                if (parse_ip_prefix(optarg, &config->write_allow[config->nb_write_allow]) == -1) {
+                    log_message(LOG_LEVEL_ERROR, "Invalid subnet '%s', expected ADDRESS[/LENGTH] such as 10.1.0.0/16",
+                                optarg);
+                    exit(-1);
+                }
+                config->nb_write_allow++;
+                break;
+            case OPT_READ_ONLY:
+                if (parse_read_only(optarg, config) == -1) {
+                    log_message(LOG_LEVEL_ERROR, "Invalid read-only range '%s', expected TABLE:ADDRESS[:COUNT] of "
+                                "coils or holding-registers", optarg);
+                    exit(-1);
+                }
+                break;
+            case OPT_GENERATOR:
+                if (config->nb_generators == MAX_GENERATORS) {
+                    log_message(LOG_LEVEL_ERROR, "At most %d generated ranges are supported", MAX_GENERATORS);
+                    exit(-1);
+                }
+                if (parse_generator(optarg, &config->generators[config->nb_generators]) == -1) {
+                    log_message(LOG_LEVEL_ERROR, "Invalid generator '%s', expected TABLE:ADDRESS[:COUNT]=KIND[:ARG...]",
+                                optarg);
+                    exit(-1);
+                }
+                config->nb_generators++;
+                break;
+            case OPT_RTU:
+                if (config->nb_serial_ports == MAX_SERIAL_PORTS) {
+                    log_message(LOG_LEVEL_ERROR, "At most %d serial ports can be served", MAX_SERIAL_PORTS);
+                    exit(-1);
+                }
+                if (parse_serial_port(optarg, &config->serial_ports[config->nb_serial_ports]) == -1) {
+                    log_message(LOG_LEVEL_ERROR, "Invalid serial port '%s', expected DEVICE[:BAUD[:FORMAT]] such as "
+                                "/dev/ttyUSB0:115200:8E1", optarg);
+                    exit(-1);
+                }
+                config->nb_serial_ports++;
+                break;
+            case OPT_RTU_UNIT:
+                config->rtu_unit = atoi(optarg);
+                if (config->rtu_unit < 1 || config->rtu_unit > 247) {
+                    log_message(LOG_LEVEL_ERROR, "RTU unit ID must be between 1 and 247");
+                    exit(-1);
+                }
+                break;
+            case OPT_RTU_OVER_TCP:
+                config->rtu_over_tcp_port = atoi(optarg);
+                if (config->rtu_over_tcp_port < 1 || config->rtu_over_tcp_port > 65535) {
+                    log_message(LOG_LEVEL_ERROR, "RTU-over-TCP port must be between 1 and 65535");
+                    exit(-1);
+                }
+                break;
+            case OPT_RTU_GAP:
+                config->rtu_gap_us = atoi(optarg);
+                if (config->rtu_gap_us < 1) {
+                    log_message(LOG_LEVEL_ERROR, "RTU frame gap must be at least 1 us");
+                    exit(-1);
+                }
+                break;
+            case OPT_IDLE_TIMEOUT:
+            case OPT_BYTE_TIMEOUT:
+            case OPT_RESPONSE_TIMEOUT: {
+                char *end;
+                long timeout = strtol(optarg, &end, 10);
+                if (end == optarg || *end != '\0' || timeout < 0 || timeout > INT_MAX) {
+                    log_message(LOG_LEVEL_ERROR, "Timeouts must be a number of milliseconds, 0 to disable");
+                    exit(-1);
+                }
+                if (opt == OPT_IDLE_TIMEOUT) config->idle_timeout = timeout;
+                else if (opt == OPT_BYTE_TIMEOUT) config->byte_timeout = timeout;
+                else config->response_timeout = timeout;
+                break;
+            }
+            case OPT_KEEPALIVE: {
+                config->keepalive_interval = DEFAULT_KEEPALIVE_INTERVAL;
+                config->keepalive_count = DEFAULT_KEEPALIVE_COUNT;
+                int fields = sscanf(optarg, "%d:%d:%d", &config->keepalive_idle, &config->keepalive_interval,
+                                    &config->keepalive_count);
+                if (fields < 1 || config->keepalive_idle < 1 || config->keepalive_interval < 1 ||
+                    config->keepalive_count < 1) {
+                    log_message(LOG_LEVEL_ERROR, "Invalid keepalive '%s', expected IDLE[:INTERVAL[:COUNT]] in seconds",
+                                optarg);
+                    exit(-1);
+                }
+                break;
+            }
+            case OPT_NOTIFY:
+                config->notify_path = optarg;
+                break;
+            case OPT_NOTIFY_INTERVAL:
+                config->notify_interval = atoi(optarg);
+                if (config->notify_interval < 1) {
+                    log_message(LOG_LEVEL_ERROR, "Notification interval must be at least 1 ms");
+                    exit(-1);
+                }
+                break;
+            case OPT_RS485:
+                config->rs485 = 1;
+                break;
+            case OPT_SHM:
+                config->shm_name = optarg;
+                break;
+            case OPT_PERSIST_INTERVAL:
+                config->persist_interval = atoi(optarg);
+                if (config->persist_interval < 1) {
+                    log_message(LOG_LEVEL_ERROR, "Store flush interval must be at least 1 ms");
+                    exit(-1);
+                }
+                break;
+            case OPT_FAST_PATH:
+                config->fast_path = 1;
+                break;
+            case OPT_TRACE:
+                config->trace_file = optarg;
+                break;
+            case OPT_JOURNAL:
+                config->journal_file = optarg;
+                break;
+            case OPT_LOG_LEVEL:
+                config->log_level = parse_log_level(optarg);
+                if (config->log_level == -1) {
+                    log_message(LOG_LEVEL_ERROR, "Invalid log level '%s', expected error, info or debug", optarg);
+                    exit(-1);
+                }
+                break;
+            case OPT_LOG_FORMAT:
+                config->log_format = -1;
+                for (int f = LOG_FORMAT_TEXT; f <= LOG_FORMAT_KV; f++) {
+                    if (strcmp(optarg, log_format_names[f]) == 0) config->log_format = f;
+                }
+                if (config->log_format == -1) {
+                    log_message(LOG_LEVEL_ERROR, "Invalid log format '%s', expected text, json or kv", optarg);
+                    exit(-1);
+                }
+                break;
+            case OPT_STATS_PORT:
+                config->stats_port = atoi(optarg);
+                if (config->stats_port < 1 || config->stats_port > 65535) {
+                    log_message(LOG_LEVEL_ERROR, "Statistics port must be between 1 and 65535");
+                    exit(-1);
+                }
+                break;
+            case 'u':
+                if (parse_unit_list(optarg, config->units) == -1) {
+                    log_message(LOG_LEVEL_ERROR, "Invalid unit ID list '%s', expected IDs or ranges within 0-%d",
+                                optarg, UNIT_ID_COUNT - 1);
+                    exit(-1);
+                }
+                config->multi_unit = 1;
+                break;
+            case 'd':
+                config->log_level = LOG_LEVEL_DEBUG;
+                break;
+            case 'v':
+                printf("Modbus Server - Version %s\n", VERSION);
+                exit(0);
+            case 'h':
+                print_usage();
+                exit(0);
+            default:
+                log_message(LOG_LEVEL_ERROR, "Invalid option: %c", optopt);
+                print_usage();
+                exit(-1);
+        }
+    }
+
+    if ((config->persist_file || config->shm_name) && config->sparse) {
+        // The kernel already faults in pages of a mapped store on demand
+        log_message(LOG_LEVEL_ERROR, "--sparse cannot be combined with --persist or --shm");
+        exit(-1);
+    }
+    if (config->persist_file && config->shm_name) {
+        log_message(LOG_LEVEL_ERROR, "--persist and --shm cannot be combined");
+        exit(-1);
+    }
+    if (config->read_cache > 0 && !config->fast_path) {
+        log_message(LOG_LEVEL_ERROR, "--read-cache needs --fast-path");
+        exit(-1);
+    }
+    if (config->reuseport > 0 && !config->persist_file && !config->shm_name) {
+        // Memory allocated before fork() would give every process a private copy of the map
+        log_message(LOG_LEVEL_ERROR, "--reuseport needs --shm or --persist to share the register map");
+        exit(-1);
+    }
+    if (!config->tls && (config->tls_cert || config->tls_key || config->tls_ca || config->tls_ticket_key)) {
+        log_message(LOG_LEVEL_ERROR, "--tls-cert, --tls-key, --tls-ca and --tls-ticket-key need --tls");
+        exit(-1);
+    }
+    if (config->tls) {
+#ifndef USE_TLS
+        log_message(LOG_LEVEL_ERROR, "--tls needs a server built with -DUSE_TLS");
+        exit(-1);
+#endif
+        if (config->tls_cert == NULL) {
+            log_message(LOG_LEVEL_ERROR, "--tls needs the server certificate in --tls-cert");
+            exit(-1);
+        }
+        if (!port_given) config->server_port = DEFAULT_TLS_PORT;
+    }
+}
+
 /**
- * Function to display the usage/help message.
- * This function provides information about the available options and configuration
- * arguments for the Modbus server.
+ * Function to take the reloadable part of the server settings.
+ *
+ * @param settings  The settings to fill.
+ * @param config    The server settings.
+ * @param map       The register maps built from config.
  */
-void print_usage() {
-    printf("Modbus Server - Version %s\n", VERSION);
-    printf("Copyright (c) 2025 Aleksandra Matysik MikroB S.A.\n\n");
-    printf("Usage: modbus_server [OPTIONS]\n\n");
+void init_live_settings(live_settings_t *settings, const server_config_t *config, unit_map_t *map) {
+    memcpy(settings->layouts, config->layouts, sizeof(settings->layouts));
+    settings->multi_unit = config->multi_unit;
+    memcpy(settings->units, config->units, sizeof(settings->units));
+    settings->map = map;
+    settings->idle_timeout = config->idle_timeout;
+    settings->byte_timeout = config->byte_timeout;
+    settings->response_timeout = config->response_timeout;
+    settings->log_level = config->log_level;
+}
 
-    printf("General Options:\n");
-    printf("  -h, --help        Show this help message\n");
-    printf("  -v, --version     Show version information\n");
+/**
+ * Function to read reloadable settings from a file.
+ * Each line holds a long option without its dashes and its value, such as
+ * "holding-registers 40000:2000", "units 1-8" ("units all" for one shared map)
+ * "idle-timeout 60000" or "log-level debug"; '#' starts a comment. Settings
+ * the file does not mention keep their value.
+ *
+ * @param path      The settings file.
+ * @param settings  The settings to update, left partly updated on error.
+ *
+ * @return 0 if successful, -1 otherwise.
+ */
+int read_reload_file(const char *path, live_settings_t *settings) {
+    FILE *file = fopen(path, "re");
+    if (file == NULL) {
+        log_message(LOG_LEVEL_ERROR, "Error opening reload file %s: %s", path, strerror(errno));
+        return -1;
+    }
 
-    printf("\nServer Configuration:\n");
-    printf("  -i IP             Set server IP address (default: 0.0.0.0)\n");
-    printf("  -p PORT           Set server port (default: 502)\n");
-    printf("  -r REG_COUNT      Set number of registers (default: 10)\n");
-    printf("  --debug           Enable debug output (default: off)\n");
-    
-    printf("\nExample:\n");
-    printf("  modbus_server -i 192.168.1.100 -p 502 -r 20 --debug\n");
+    char *line = NULL;
+    size_t size = 0;
+    int rc = 0, number = 0;
+    while (rc == 0 && getline(&line, &size, file) != -1) {
+        number++;
+        char *comment = strchr(line, '#');
+        if (comment) *comment = '\0';
+        char *rest;
+        char *name = strtok_r(line, " \t\r\n=", &rest);
+        if (name == NULL) continue;
+        char *value = strtok_r(NULL, " \t\r\n", &rest);
+        if (strncmp(name, "--", 2) == 0) name += 2;
+
+        char *end;
+        long timeout = value ? strtol(value, &end, 10) : 0;
+        int table = parse_table_name(name);
+        rc = -1;
+        if (value == NULL || strtok_r(NULL, " \t\r\n", &rest) != NULL) {
+            log_message(LOG_LEVEL_ERROR, "%s:%d: expected OPTION VALUE", path, number);
+        } else if (table != -1) {
+            if (parse_table_layout(value, &settings->layouts[table]) == 0) rc = 0;
+            else log_message(LOG_LEVEL_ERROR, "%s:%d: invalid table layout '%s', expected [START:]COUNT", path, number,
+                             value);
+        } else if (strcmp(name, "units") == 0) {
+            memset(settings->units, 0, sizeof(settings->units));
+            settings->multi_unit = strcmp(value, "all") != 0;
+            if (!settings->multi_unit || parse_unit_list(value, settings->units) == 0) rc = 0;
+            else log_message(LOG_LEVEL_ERROR, "%s:%d: invalid unit ID list '%s'", path, number, value);
+        } else if (strcmp(name, "idle-timeout") == 0 || strcmp(name, "byte-timeout") == 0 ||
+                   strcmp(name, "response-timeout") == 0) {
+            if (end == value || *end != '\0' || timeout < 0 || timeout > INT_MAX) {
+                log_message(LOG_LEVEL_ERROR, "%s:%d: timeouts must be a number of milliseconds", path, number);
+            } else {
+                if (name[0] == 'i') settings->idle_timeout = timeout;
+                else if (name[0] == 'b') settings->byte_timeout = timeout;
+                else settings->response_timeout = timeout;
+                rc = 0;
+            }
+        } else if (strcmp(name, "log-level") == 0) {
+            settings->log_level = parse_log_level(value);
+            if (settings->log_level != -1) rc = 0;
+            else log_message(LOG_LEVEL_ERROR, "%s:%d: invalid log level '%s', expected error, info or debug", path,
+                             number, value);
+        } else {
+            log_message(LOG_LEVEL_ERROR, "%s:%d: %s cannot be reloaded", path, number, name);
+        }
+    }
+    if (rc == 0 && ferror(file)) {
+        log_message(LOG_LEVEL_ERROR, "Error reading reload file %s: %s", path, strerror(errno));
+        rc = -1;
+    }
+    free(line);
+    fclose(file);
+    return rc;
 }
 
 /**
- * Function for debugging output.
- * If debugging is enabled, it prints the formatted string to stderr.
+ * Function to apply the reload file to the settings before the server starts,
+ * so a restart comes up with what was last reloaded.
+ *
+ * @param config  The server settings.
  *
- * @param debug    The debug flag (1 for enabled, 0 for disabled).
- * @param fmt      The format string for the message.
- * @param ...      The variable arguments to format the message.
+ * @return 0 if successful, -1 otherwise.
  */
-void debug_print_func(int debug, const char *fmt, ...) {
-    if (debug) {
-        va_list args;
-        va_start(args, fmt);
-        vfprintf(stderr, fmt, args);
-        va_end(args);
-    }
+int load_reload_file(server_config_t *config) {
+    live_settings_t settings;
+    init_live_settings(&settings, config, NULL);
+    if (read_reload_file(config->reload_file, &settings) == -1) return -1;
+    memcpy(config->layouts, settings.layouts, sizeof(config->layouts));
+    config->multi_unit = settings.multi_unit;
+    memcpy(config->units, settings.units, sizeof(config->units));
+    config->idle_timeout = settings.idle_timeout;
+    config->byte_timeout = settings.byte_timeout;
+    config->response_timeout = settings.response_timeout;
+    config->log_level = settings.log_level;
+    return 0;
 }
 
 /**
- * Function to print the Modbus query received.
- * This function prints the received query in hexadecimal format.
+ * Function to copy the entries two tables of the same kind have in common.
+ * The destination must not be published yet. Pages missing from the source
+ * hold zeros, which the new destination already reads as.
  *
- * @param query    The Modbus query byte array.
- * @param length   The length of the query.
+ * @param dst   The table to fill.
+ * @param src   The table to copy from.
+ * @param from  The first address to copy.
+ * @param to    The address after the last one to copy.
+ *
+ * @return 0 if successful, -1 if a page could not be allocated.
  */
-void print_query(uint8_t *query, int length) {
-    printf("[QUERY] Received query (Length: %d): ", length);
-    for (int i = 0; i < length; i++) {
-        printf("%02X ", query[i]);
+int copy_common_entries(reg_table_t *dst, const reg_table_t *src, int from, int to) {
+    if (from < src->start) from = src->start;
+    if (from < dst->start) from = dst->start;
+    if (to > src->start + src->count) to = src->start + src->count;
+    if (to > dst->start + dst->count) to = dst->start + dst->count;
+
+    uint16_t entries[REG_PAGE_SIZE];  // Large enough for a page of either kind
+    for (int address = from; address < to;) {
+        int index = address - src->start;
+        int offset = index % REG_PAGE_SIZE;
+        int chunk = to - address < REG_PAGE_SIZE - offset ? to - address : REG_PAGE_SIZE - offset;
+        void *page = atomic_load_explicit(&src->pages[index / REG_PAGE_SIZE], memory_order_acquire);
+        if (page) {
+            copy_page_entries(src, page, offset, chunk, entries, 0);
+            if (load_table_entries(dst, address, chunk, entries) == -1) return -1;
+        }
+        address += chunk;
     }
-    printf("\n");
+    return 0;
 }
 
 /**
- * Function to print the Modbus response being sent.
- * This function prints the response in hexadecimal format.
+ * Function to build the register maps of reloaded layouts and units, holding
+ * the values of the current maps where they overlap.
+ * A new map takes its values from the current map of the first unit both
+ * serve. Entries are copied while the current maps keep serving; the caller
+ * then copies the blocks written meanwhile with copy_written_blocks().
  *
- * @param response    The Modbus response byte array.
- * @param length      The length of the response.
+ * @param reloader  The reloader.
+ * @param current   The settings being served.
+ * @param next      The reloaded settings, whose map is built.
+ * @param sources   Set to the index of the current store each new store copies, -1 for none.
+ * @param saved     Set to the sequence counters of the current tables before the copy.
+ *
+ * @return 0 if successful, -1 otherwise.
  */
-void print_response(uint8_t *response, int length) {
-    printf("[RESPONSE] Sending response (Length: %d): ", length);
-    for (int i = 0; i < length; i++) {
-        printf("%02X ", response[i]);
+int build_reloaded_map(reloader_t *reloader, const live_settings_t *current, live_settings_t *next,
+                       int *sources, unsigned int *saved) {
+    server_config_t *config = reloader->config;
+    if (config->persist_file || config->shm_name) {
+        log_message(LOG_LEVEL_ERROR, "The tables and units of a --persist or --shm store are fixed by its layout");
+        return -1;
     }
-    printf("\n");
+    if (config->notify_path) {
+        log_message(LOG_LEVEL_ERROR, "Tables and units cannot be reloaded while --notify serves change sets");
+        return -1;
+    }
+    for (int i = 0; i < config->nb_generators; i++) {
+        const generator_t *generator = &config->generators[i];
+        const table_layout_t *layout = &next->layouts[generator->table];
+        if (generator->address < layout->start ||
+            generator->address + generator->count > layout->start + layout->count) {
+            log_message(LOG_LEVEL_ERROR, "Generated range %s:%d:%d lies outside the reloaded table",
+                        table_options[generator->table], generator->address, generator->count);
+            return -1;
+        }
+    }
+
+    server_config_t *layout = malloc(sizeof(*layout));
+    next->map = calloc(1, sizeof(unit_map_t));
+    if (layout == NULL || next->map == NULL) {
+        log_message(LOG_LEVEL_ERROR, "Error allocating reloaded register map: %s", strerror(errno));
+        free(layout);
+        free(next->map);
+        return -1;
+    }
+    *layout = *config;
+    memcpy(layout->layouts, next->layouts, sizeof(layout->layouts));
+    layout->multi_unit = next->multi_unit;
+    memcpy(layout->units, next->units, sizeof(layout->units));
+    int rc = init_unit_map(next->map, layout, NULL);
+    free(layout);
+    if (rc == -1) {
+        free(next->map);
+        return -1;
+    }
+
+    const unit_map_t *old = current->map;
+    unit_map_t *map = next->map;
+    for (int s = 0; s < map->nb_stores; s++) sources[s] = -1;
+    for (int unit = 0; unit < UNIT_ID_COUNT; unit++) {
+        if (map->by_unit[unit] && old->by_unit[unit] && sources[map->by_unit[unit] - map->stores] == -1) {
+            sources[map->by_unit[unit] - map->stores] = old->by_unit[unit] - old->stores;
+        }
+    }
+
+    // A block written after its counter was saved is copied again by copy_written_blocks()
+    for (int s = 0; s < old->nb_stores; s++) {
+        for (int t = 0; t < TABLE_COUNT; t++) {
+            const reg_table_t *table = &old->stores[s].tables[t];
+            unsigned int *seen = saved + (s * TABLE_COUNT + t) * (ADDRESS_SPACE / REG_BLOCK_SIZE);
+            for (int b = 0; b < (table->count + REG_BLOCK_SIZE - 1) / REG_BLOCK_SIZE; b++) {
+                seen[b] = atomic_load_explicit(&table->seq[b], memory_order_acquire);
+            }
+        }
+    }
+    for (int s = 0; s < map->nb_stores; s++) {
+        for (int t = 0; t < TABLE_COUNT && sources[s] != -1; t++) {
+            if (copy_common_entries(&map->stores[s].tables[t], &old->stores[sources[s]].tables[t], 0,
+                                    ADDRESS_SPACE) == -1) {
+                log_message(LOG_LEVEL_ERROR, "Error allocating reloaded register page: %s", strerror(errno));
+                free_unit_map(map);
+                free(map);
+                return -1;
+            }
+        }
+    }
+    link_generators(map, config);
+    return 0;
 }
 
 /**
- * Function to print the server's current settings.
- * Displays the server's IP, port, register count, and debug mode status.
+ * Function to copy again the blocks of the current maps written since
+ * build_reloaded_map() saved their sequence counters.
+ * The write locks of the current stores must be held, so nothing changes them.
  *
- * @param server_ip    The IP address of the server.
- * @param server_port  The port number the server is listening on.
- * @param reg_count    The number of Modbus registers.
- * @param debug        The debug flag indicating if debugging is enabled.
+ * @param current  The settings being served.
+ * @param next     The reloaded settings.
+ * @param sources  The current store each new store copies, -1 for none.
+ * @param saved    The sequence counters saved before the first copy.
+ *
+ * @return 0 if successful, -1 if a page could not be allocated.
  */
-void print_server_settings(char *server_ip, int server_port, int reg_count, int debug) {
-    printf("[INFO] Modbus Server Settings:\n");
-    printf("  IP Address: %s\n", server_ip);
-    printf("  Port: %d\n", server_port);
-    printf("  Register Count: %d\n", reg_count);
-    printf("  Debug Mode: %s\n", debug ? "Enabled" : "Disabled");
-    printf("\n");
+int copy_written_blocks(const live_settings_t *current, live_settings_t *next, const int *sources,
+                        const unsigned int *saved) {
+    for (int s = 0; s < next->map->nb_stores; s++) {
+        for (int t = 0; t < TABLE_COUNT && sources[s] != -1; t++) {
+            const reg_table_t *src = &current->map->stores[sources[s]].tables[t];
+            const unsigned int *seen = saved + (sources[s] * TABLE_COUNT + t) * (ADDRESS_SPACE / REG_BLOCK_SIZE);
+            for (int b = 0; b < (src->count + REG_BLOCK_SIZE - 1) / REG_BLOCK_SIZE; b++) {
+                if (atomic_load_explicit(&src->seq[b], memory_order_acquire) == seen[b]) continue;
+                int from = src->start + b * REG_BLOCK_SIZE;
+                if (copy_common_entries(&next->map->stores[s].tables[t], src, from, from + REG_BLOCK_SIZE) == -1) {
+                    return -1;
+                }
+            }
+        }
+    }
+    return 0;
 }
 
 /**
- * Function to initialize a Modbus TCP server context.
- * This function creates and returns a new Modbus context for the TCP server.
+ * Function to apply the reload file to the running server, RCU style.
+ * A new register map is built off to the side when the layouts or units
+ * change, while the current one keeps serving. Its last changes are copied
+ * under the write locks of the current stores, which are retired there, so
+ * a writer that still holds one moves to the new map and no write is lost.
+ * The new settings are then published, and the replaced ones released once
+ * every worker has finished the batch of events it was handling.
  *
- * @param server_ip    The IP address of the server.
- * @param server_port  The port number to listen on.
- * 
- * @return A pointer to the Modbus context if successful, NULL otherwise.
+ * @param reloader  The reloader.
+ *
+ * @return 0 if the new settings are served, -1 if the current ones are kept.
  */
-modbus_t* init_modbus_server(char *server_ip, int server_port) {
-    modbus_t *ctx = modbus_new_tcp(server_ip, server_port);
-    if (ctx == NULL) {
-        fprintf(stderr, "[ERROR] Error initializing Modbus server: %s\n", modbus_strerror(errno));
-        return NULL;
+int reload_settings(reloader_t *reloader) {
+    live_settings_t *current = atomic_load(&reloader->live);
+    live_settings_t *next = malloc(sizeof(*next));
+    if (next == NULL) {
+        log_message(LOG_LEVEL_ERROR, "Error allocating reloaded settings: %s", strerror(errno));
+        return -1;
     }
-    return ctx;
+    *next = *current;
+    if (read_reload_file(reloader->config->reload_file, next) == -1) {
+        free(next);
+        return -1;
+    }
+
+    unit_map_t *old = current->map;
+    int remap = memcmp(next->layouts, current->layouts, sizeof(next->layouts)) != 0 ||
+                next->multi_unit != current->multi_unit ||
+                memcmp(next->units, current->units, sizeof(next->units)) != 0;
+    int sources[UNIT_ID_COUNT];
+    unsigned int *saved = remap ? malloc(old->nb_stores * TABLE_COUNT * (ADDRESS_SPACE / REG_BLOCK_SIZE) *
+                                         sizeof(unsigned int)) : NULL;
+    if (remap && (saved == NULL || build_reloaded_map(reloader, current, next, sources, saved) == -1)) {
+        if (saved == NULL) log_message(LOG_LEVEL_ERROR, "Error allocating reload state: %s", strerror(errno));
+        free(saved);
+        free(next);
+        return -1;
+    }
+
+    // Stores are locked in index order, writers never hold more than one lock
+    for (int s = 0; remap && s < old->nb_stores; s++) pthread_mutex_lock(&old->stores[s].write_lock);
+    int rc = remap ? copy_written_blocks(current, next, sources, saved) : 0;
+    if (rc == 0) {
+        for (int s = 0; remap && s < old->nb_stores; s++) old->stores[s].retired = 1;
+        atomic_store(&reloader->live, next);
+    }
+    for (int s = 0; remap && s < old->nb_stores; s++) pthread_mutex_unlock(&old->stores[s].write_lock);
+    free(saved);
+    if (rc == -1) {
+        log_message(LOG_LEVEL_ERROR, "Error allocating reloaded register page: %s", strerror(errno));
+        free_unit_map(next->map);
+        free(next->map);
+        free(next);
+        return -1;
+    }
+
+    // A worker with an odd epoch may still use the replaced settings until its batch ends
+    for (int i = 0; i < reloader->count; i++) {
+        unsigned int epoch = atomic_load(&reloader->workers[i].epoch);
+        while ((epoch & 1) && atomic_load(&reloader->workers[i].epoch) == epoch) usleep(100);
+    }
+    if (remap) {
+        free_unit_map(old);
+        if (old != reloader->initial.map) free(old);
+    }
+    if (current != &reloader->initial) free(current);
+
+    set_log_level(next->log_level);
+    log_message(LOG_LEVEL_INFO, "Reloaded %s: %d register maps, timeouts idle %d ms, byte %d ms, response %d ms, "
+                "log level %s", reloader->config->reload_file, next->map->nb_stores, next->idle_timeout,
+                next->byte_timeout, next->response_timeout, log_level_names[next->log_level]);
+    return 0;
 }
 
 /**
- * Function to initialize the Modbus mapping.
- * This function creates and returns a Modbus mapping for the server with the specified number of registers.
+ * Thread entry point applying the reload file on every SIGHUP.
  *
- * @param reg_count  The number of registers for the Modbus server.
- * 
- * @return A pointer to the Modbus mapping if successful, NULL otherwise.
+ * @param arg  The reloader_t to run.
+ *
+ * @return NULL if the reload thread fails.
  */
-modbus_mapping_t* init_modbus_mapping(int reg_count) {
-    modbus_mapping_t *mb_mapping = modbus_mapping_new(0, 0, reg_count, 0);
-    if (mb_mapping == NULL) {
-        fprintf(stderr, "[ERROR] Error allocating memory for Modbus mapping: %s\n", modbus_strerror(errno));
-        return NULL;
+void *reloader_main(void *arg) {
+    reloader_t *reloader = arg;
+    // A SIGHUP received meanwhile stays pending in the signalfd
+    while (sem_wait(&reloader->attached) == -1) {}
+    while (1) {
+        struct signalfd_siginfo info;
+        ssize_t len = read(reloader->signal_fd, &info, sizeof(info));
+        if (len == -1 && errno == EINTR) continue;
+        if (len != sizeof(info)) {
+            log_message(LOG_LEVEL_ERROR, "Reload thread stopped: %s", strerror(errno));
+            return NULL;
+        }
+
+        // A reload runs to its end, stop_reloader() only cancels the thread while it waits
+        pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+        if (reload_settings(reloader) == -1) {
+            log_message(LOG_LEVEL_ERROR, "Reload of %s failed, serving the previous settings",
+                        reloader->config->reload_file);
+        }
+        pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
     }
-    return mb_mapping;
 }
 
 /**
- * Function to start the server socket and begin listening for incoming client connections.
- * 
- * @param ctx    The Modbus context.
- * 
- * @return The server socket descriptor if successful, -1 otherwise.
+ * Function to prepare the settings published to the workers.
+ *
+ * @param reloader  The reloader to initialize.
+ * @param config    The server settings.
+ * @param units     The register maps built from config.
  */
-int start_listening(modbus_t *ctx) {
-    int server_socket = modbus_tcp_listen(ctx, 1);
-    if (server_socket == -1) {
-        fprintf(stderr, "[ERROR] Error listening on TCP socket: %s\n", modbus_strerror(errno));
+void init_reloader(reloader_t *reloader, server_config_t *config, unit_map_t *units) {
+    memset(reloader, 0, sizeof(*reloader));
+    reloader->config = config;
+    reloader->signal_fd = -1;
+    sem_init(&reloader->attached, 0, 0);
+    init_live_settings(&reloader->initial, config, units);
+    atomic_init(&reloader->live, &reloader->initial);
+}
+
+/**
+ * Function to start the reload thread.
+ * It is started before the workers, so failing to start it leaves nothing
+ * running, and only reloads once attach_workers() hands it the workers.
+ * SIGHUP must already be blocked in every thread so it is only seen through the signalfd.
+ *
+ * @param reloader  The reloader.
+ *
+ * @return 0 if successful, -1 otherwise.
+ */
+int start_reloader(reloader_t *reloader) {
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGHUP);
+    reloader->signal_fd = signalfd(-1, &mask, SFD_CLOEXEC);
+    if (reloader->signal_fd == -1) {
+        log_message(LOG_LEVEL_ERROR, "Error creating reload signal descriptor: %s", strerror(errno));
         return -1;
     }
-    return server_socket;
+    int rc = pthread_create(&reloader->thread, NULL, reloader_main, reloader);
+    if (rc != 0) {
+        log_message(LOG_LEVEL_ERROR, "Error starting reload thread: %s", strerror(rc));
+        close(reloader->signal_fd);
+        reloader->signal_fd = -1;
+        return -1;
+    }
+    return 0;
 }
 
 /**
- * Function to handle an incoming client request.
- * This function receives a query from the client and sends a response based on the Modbus mapping.
+ * Function to hand the running workers to the reload thread.
  *
- * @param ctx          The Modbus context.
- * @param mb_mapping   The Modbus mapping containing register values.
- * @param query        The query received from the client.
- * @param debug        The debug flag indicating if debugging is enabled.
- * 
- * @return The number of bytes processed if successful, -1 if an error occurred.
+ * @param reloader  The reloader.
+ * @param workers   The running workers.
+ * @param count     The number of running workers.
  */
-int handle_client_request(modbus_t *ctx, modbus_mapping_t *mb_mapping, uint8_t *query, int debug) {
-    int rc = modbus_receive(ctx, query);
-    if (rc > 0) {
-        if (debug) print_query(query, rc);
+void attach_workers(reloader_t *reloader, worker_t *workers, int count) {
+    reloader->workers = workers;
+    reloader->count = count;
+    sem_post(&reloader->attached);
+}
+
+/**
+ * Function to stop the reload thread and release the reloaded settings.
+ * The workers must not be running.
+ *
+ * @param reloader  The reloader.
+ */
+void stop_reloader(reloader_t *reloader) {
+    if (reloader->signal_fd != -1) {
+        pthread_cancel(reloader->thread);
+        pthread_join(reloader->thread, NULL);
+        close(reloader->signal_fd);
+        reloader->signal_fd = -1;
+    }
+    live_settings_t *settings = atomic_load(&reloader->live);
+    if (settings == &reloader->initial) return;
+    if (settings->map != reloader->initial.map) {
+        free_unit_map(settings->map);
+        free(settings->map);
+    }
+    free(settings);
+    atomic_store(&reloader->live, &reloader->initial);
+}
 
-        rc = modbus_reply(ctx, query, rc, mb_mapping);
-        if (rc > 0 && debug) {
-            print_response(query, rc);
+/**
+ * Function to fork one server process.
+ * The process adjusts its copy of the settings so that what only one process
+ * can own stays with process 0, and per-process outputs do not collide.
+ *
+ * @param config   The server settings, adjusted in the new process.
+ * @param process  The index of the process.
+ *
+ * @return The process ID in the supervisor, 0 in the new process, -1 if fork() failed.
+ */
+pid_t spawn_server_process(server_config_t *config, int process) {
+    pid_t supervisor = getpid();
+    fflush(stdout);  // Buffered output would be written again by the new process
+    fflush(stderr);
+    pid_t pid = fork();
+    if (pid != 0) return pid;
+
+    // Server processes never outlive the supervisor
+    prctl(PR_SET_PDEATHSIG, SIGTERM);
+    if (getppid() != supervisor) _exit(0);
+
+    config->notify_path = NULL;  // Served by the supervisor for all processes
+    if (config->nb_cpus > 0) {
+        // Each process pins its workers to the CPUs following those of the previous process
+        int cpus[CPU_SETSIZE];
+        int shift = process * config->threads % config->nb_cpus;
+        for (int i = 0; i < config->nb_cpus; i++) cpus[i] = config->cpus[(i + shift) % config->nb_cpus];
+        memcpy(config->cpus, cpus, config->nb_cpus * sizeof(int));
+    }
+    if (process != 0) {
+        config->nb_serial_ports = 0;
+        config->rtu_over_tcp_port = 0;
+    }
+    if (config->stats_port > 0) config->stats_port += process;
+    if (config->trace_file) {
+        char *path;
+        if (asprintf(&path, "%s.%d", config->trace_file, process) == -1) {
+            log_message(LOG_LEVEL_ERROR, "Error allocating trace file name: %s", strerror(errno));
+            _exit(-1);
         }
-    } else if (rc == -1 && errno == ECONNRESET) {
-        debug_print_func(debug, "[INFO] Client disconnected (Connection reset by peer).\n");
-    } else if (rc == -1) {
-        fprintf(stderr, "[ERROR] Error while receiving request: %s\n", modbus_strerror(errno));
+        config->trace_file = path;
     }
-    return rc;
+    if (config->journal_file) {
+        char *path;
+        if (asprintf(&path, "%s.%d", config->journal_file, process) == -1) {
+            log_message(LOG_LEVEL_ERROR, "Error allocating journal file name: %s", strerror(errno));
+            _exit(-1);
+        }
+        config->journal_file = path;
+    }
+    return 0;
 }
 
 /**
- * Function to parse command-line arguments.
- * This function processes the command-line options and updates the server settings accordingly.
+ * Function to run the server as several processes accepting on the same port.
+ * The register map lives in the --shm or --persist mapping, which every process
+ * inherits; blocks are claimed with the same compare-and-swap as for producers,
+ * so processes never publish into the same block at once. The supervisor
+ * flushes the store file, serves change notifications, and restarts a process
+ * that dies, so a crash only drops that process's connections. Blocks the dead
+ * process was publishing into are released before it is restarted; until then
+ * requests touching them fail after SEQ_WAIT_MS instead of spinning.
  *
- * @param argc          The number of command-line arguments.
- * @param argv          The array of command-line arguments.
- * @param server_ip     The pointer to the server IP address.
- * @param server_port   The pointer to the server port.
- * @param reg_count     The pointer to the register count.
- * @param debug         The pointer to the debug flag.
+ * @param config   The server settings.
+ * @param units    The register maps, backed by the mapping.
+ * @param persist  The mapped store.
+ *
+ * @return The index of the process in each server process, -1 in the supervisor
+ *         if it could not start; does not return in the supervisor otherwise.
  */
-void parse_arguments(int argc, char *argv[], char **server_ip, int *server_port, int *reg_count, int *debug) {
-    static struct option long_options[] = {
-        {"debug", no_argument, NULL, 'd'},
-        {"version", no_argument, NULL, 'v'},
-        {0, 0, 0, 0}
-    };
+int supervise_processes(server_config_t *config, unit_map_t *units, persist_t *persist) {
+    pid_t pids[MAX_PROCESSES];
+    uint64_t started[MAX_PROCESSES];
+    for (int i = 0; i < config->reuseport; i++) {
+        pids[i] = spawn_server_process(config, i);
+        if (pids[i] == 0) return i;
+        if (pids[i] == -1) {
+            log_message(LOG_LEVEL_ERROR, "Error starting server process: %s", strerror(errno));
+            for (int j = 0; j < i; j++) kill(pids[j], SIGTERM);
+            while (wait(NULL) > 0) {}
+            return -1;
+        }
+        started[i] = monotonic_ns();
+    }
+    log_message(LOG_LEVEL_INFO, "Started %d server processes on port %d", config->reuseport, config->server_port);
 
-    int opt;
-    while ((opt = getopt_long(argc, argv, "i:p:r:hv", long_options, NULL)) != -1) {
-        switch (opt) {
-            case 'i':
-                *server_ip = optarg;
-                break;
-            case 'p':
-                *server_port = atoi(optarg);
-                break;
-            case 'r':
-                *reg_count = atoi(optarg);
-                break;
-            case 'd':
-                *debug = 1;
-                break;
-            case 'v':
-                printf("Modbus Server - Version %s\n", VERSION);
-                exit(0);
-            case 'h':
-                print_usage();
-                exit(0);
-            default:
-                fprintf(stderr, "[ERROR] Invalid option: %c\n", optopt);
-                print_usage();
-                exit(-1);
+    static notifier_t notifier;
+    if (start_persist(persist) == -1 || (config->notify_path && start_notifier(&notifier, units, config) == -1)) {
+        for (int i = 0; i < config->reuseport; i++) kill(pids[i], SIGTERM);
+        while (wait(NULL) > 0) {}
+        return -1;
+    }
+
+    while (1) {
+        int status;
+        pid_t pid = wait(&status);
+        if (pid == -1) {
+            if (errno == EINTR) continue;
+            log_message(LOG_LEVEL_ERROR, "No server process left: %s", strerror(errno));
+            stop_notifier(&notifier);
+            return -1;
+        }
+
+        int i = 0;
+        while (i < config->reuseport && pids[i] != pid) i++;
+        if (i == config->reuseport) continue;
+        if (WIFSIGNALED(status)) {
+            log_message(LOG_LEVEL_ERROR, "Server process %d (pid %d) killed by signal %d, restarting", i, pid,
+                        WTERMSIG(status));
+        } else {
+            log_message(LOG_LEVEL_ERROR, "Server process %d (pid %d) exited with status %d, restarting", i, pid,
+                        WEXITSTATUS(status));
         }
+
+        release_stale_sequence_words(persist);
+
+        // A process that keeps failing at startup is retried at a slow pace
+        if (monotonic_ns() - started[i] < RESPAWN_DELAY_MS * 1000000ull) usleep(RESPAWN_DELAY_MS * 1000);
+        pids[i] = spawn_server_process(config, i);
+        if (pids[i] == 0) return i;
+        if (pids[i] == -1) log_message(LOG_LEVEL_ERROR, "Error restarting server process %d: %s", i, strerror(errno));
+        started[i] = monotonic_ns();
     }
 }
 
 /**
  * Main function to run the Modbus server.
  * This function initializes the Modbus server, sets up the register mapping,
- * and enters a loop to handle client requests.
+ * and serves all connected clients either from a single event loop or from
+ * a pool of worker threads.
  *
  * @param argc          The number of command-line arguments.
  * @param argv          The array of command-line arguments.
- * 
+ *
  * @return 0 if the server shuts down successfully, -1 if an error occurs.
  */
 int main(int argc, char *argv[]) {
-    char *server_ip = DEFAULT_SERVER_IP;
-    int server_port = DEFAULT_SERVER_PORT;
-    int reg_count = DEFAULT_REG_COUNT;
-    int debug = 0;
+    server_config_t config = {
+        .server_ip = DEFAULT_SERVER_IP,
+        .server_port = DEFAULT_SERVER_PORT,
+        .layouts[TABLE_HOLDING_REGISTERS] = { .start = 0, .count = DEFAULT_REG_COUNT },
+        .log_level = LOG_LEVEL_INFO,
+        .threads = DEFAULT_THREADS,
+        .persist_interval = DEFAULT_PERSIST_INTERVAL_MS,
+        .rtu_unit = DEFAULT_RTU_UNIT,
+        .notify_interval = DEFAULT_NOTIFY_INTERVAL_MS,
+        .byte_timeout = DEFAULT_BYTE_TIMEOUT_MS,
+        .response_timeout = DEFAULT_RESPONSE_TIMEOUT_MS,
+        .max_connections = DEFAULT_MAX_CONNECTIONS,
+    };
+
+    parse_arguments(argc, argv, &config);
+    if (config.reload_file && load_reload_file(&config) == -1) return -1;
+    init_logger(config.log_level, config.log_format);
+    print_server_settings(&config);
+
+    // Created before any fork, so every worker of every server process accepts the same session tickets
+    tls_context_t *tls = NULL;
+#ifdef USE_TLS
+    if (config.tls && (tls = create_tls_context(&config)) == NULL) return -1;
+#endif
 
-    parse_arguments(argc, argv, &server_ip, &server_port, &reg_count, &debug);
-    print_server_settings(server_ip, server_port, reg_count, debug);
+    // Shared by the workers of a process, each --reuseport process limits its own clients
+    client_bucket_t *clients = NULL;
+    if (config.client_rate.interval_ns > 0 && (clients = calloc(MAX_RATE_CLIENTS, sizeof(client_bucket_t))) == NULL) {
+        log_message(LOG_LEVEL_ERROR, "Error allocating client rate limits: %s", strerror(errno));
+        return -1;
+    }
 
     // Initialize Modbus TCP server
-    modbus_t *ctx = init_modbus_server(server_ip, server_port);
+    modbus_t *ctx = init_modbus_server(config.server_ip, config.server_port);
     if (ctx == NULL) return -1;
 
+    // Block SIGUSR1, SIGUSR2 and SIGHUP before any thread starts, the statistics, log and reload threads read
+    // them from signalfds
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGUSR1);
+    sigaddset(&mask, SIGUSR2);
+    if (config.reload_file) sigaddset(&mask, SIGHUP);
+    pthread_sigmask(SIG_BLOCK, &mask, NULL);
+
+    // libmodbus writes RTU replies and OpenSSL TLS records with write(), a peer closing must not kill the server
+    if (config.rtu_over_tcp_port > 0 || config.tls) signal(SIGPIPE, SIG_IGN);
+
+    // Map the store file or shared-memory segment, its tables back the register maps
+    static persist_t persist;
+    uint8_t *storage = NULL;
+    if (config.persist_file || config.shm_name) {
+        if (open_persist(&persist, &config) == -1) {
+            modbus_free(ctx);
+            return -1;
+        }
+        storage = persist_storage(&persist);
+    }
+
     // Create register map
-    modbus_mapping_t *mb_mapping = init_modbus_mapping(reg_count);
-    if (mb_mapping == NULL) {
+    static unit_map_t units;
+    if (init_unit_map(&units, &config, storage) == -1) {
+        if (persist.base) close_persist(&persist);
+        modbus_free(ctx);
+        return -1;
+    }
+    if ((config.load_map && load_register_map(&units, config.load_map) == -1) ||
+        attach_generators(&units, &config) == -1) {
+        free_generators(&config);
+        free_unit_map(&units);
+        if (persist.base) close_persist(&persist);
         modbus_free(ctx);
         return -1;
     }
 
-    // Start listening on the server socket
-    int server_socket = start_listening(ctx);
-    if (server_socket == -1) {
-        modbus_mapping_free(mb_mapping);
+    // Workers pick the register maps and timeouts up from the reloader, which replaces them on SIGHUP
+    static reloader_t reloader;
+    init_reloader(&reloader, &config, &units);
+
+    // In multi-process mode this process only supervises, the server processes continue below
+    if (config.reuseport > 0) {
+        int process = supervise_processes(&config, &units, &persist);
+        if (process == -1) {
+            free_unit_map(&units);
+            close_persist(&persist);
+            modbus_free(ctx);
+            return -1;
+        }
+        persist.base = NULL;  // Flushed by the supervisor, the process only drops its mapping at exit
+        persist.flushing = 0;
+    }
+    if (persist.base && start_persist(&persist) == -1) {
+        free_unit_map(&units);
+        close_persist(&persist);
         modbus_free(ctx);
         return -1;
     }
 
-    printf("[INFO] Modbus server listening on %s:%d\n\n", server_ip, server_port);
+    // Start the statistics thread, one entry per worker
+    static stats_server_t stats_server;
+    worker_stats_t *stats = aligned_alloc(CACHE_LINE_SIZE, config.threads * sizeof(worker_stats_t));
+    if (stats == NULL) {
+        log_message(LOG_LEVEL_ERROR, "Error allocating statistics: %s", strerror(errno));
+        free_unit_map(&units);
+        if (persist.base) close_persist(&persist);
+        modbus_free(ctx);
+        return -1;
+    }
+    memset(stats, 0, config.threads * sizeof(worker_stats_t));
+    if (start_stats(&stats_server, stats, config.threads, &config) == -1) {
+        free(stats);
+        free_unit_map(&units);
+        if (persist.base) close_persist(&persist);
+        modbus_free(ctx);
+        return -1;
+    }
 
-    while (1) {
-        // Accept client connections
-        int client_socket = modbus_tcp_accept(ctx, &server_socket);
-        if (client_socket == -1) {
-            fprintf(stderr, "[ERROR] Error accepting client connection: %s\n", modbus_strerror(errno));
-            continue;
+    // Start the frame tracer, one ring per worker
+    static tracer_t tracer;
+    tracer_t *trace = NULL;
+    if (config.trace_file) {
+        if (init_tracer(&tracer, config.trace_file, config.threads) == -1 || start_tracer(&tracer) == -1) {
+            free_tracer(&tracer);
+            stop_stats(&stats_server);
+            free_stats(stats, config.threads);
+            free_unit_map(&units);
+            if (persist.base) close_persist(&persist);
+            modbus_free(ctx);
+            return -1;
         }
+        trace = &tracer;
+    }
 
-        debug_print_func(debug, "[INFO] Client connected successfully.\n");
+    // Open the write journal, one ring per worker
+    static journal_t journal;
+    if (config.journal_file && (init_journal(&journal, config.journal_file, config.threads) == -1 ||
+                                start_journal(&journal) == -1)) {
+        free_journal(&journal);
+        stop_tracer(&tracer);
+        free_tracer(&tracer);
+        stop_stats(&stats_server);
+        free_stats(stats, config.threads);
+        free_unit_map(&units);
+        if (persist.base) close_persist(&persist);
+        modbus_free(ctx);
+        return -1;
+    }
+
+    // Start the change notification thread before any worker can write
+    static notifier_t notifier;
+    if (config.notify_path && start_notifier(&notifier, &units, &config) == -1) {
+        stop_journal(&journal);
+        free_journal(&journal);
+        stop_tracer(&tracer);
+        free_tracer(&tracer);
+        stop_stats(&stats_server);
+        free_stats(stats, config.threads);
+        free_unit_map(&units);
+        if (persist.base) close_persist(&persist);
+        modbus_free(ctx);
+        return -1;
+    }
+
+    // Start listening on the server socket
+    int server_socket = start_listening(ctx, &config);
+    if (server_socket == -1) {
+        stop_notifier(&notifier);
+        stop_journal(&journal);
+        free_journal(&journal);
+        stop_tracer(&tracer);
+        free_tracer(&tracer);
+        stop_stats(&stats_server);
+        free_stats(stats, config.threads);
+        free_unit_map(&units);
+        if (persist.base) close_persist(&persist);
+        modbus_free(ctx);
+        return -1;
+    }
+
+    // From here on the serving threads only queue their messages, the log thread writes them out
+    start_logger();
+    log_message(LOG_LEVEL_INFO, "Modbus server listening on %s:%d", config.server_ip, config.server_port);
 
-        // Main loop to handle requests
-        uint8_t query[MODBUS_TCP_MAX_ADU_LENGTH];
-        while (1) {
-            int rc = handle_client_request(ctx, mb_mapping, query, debug);
-            if (rc == -1) break;  // End client handling if error or disconnect
+    // The reloader starts before the workers, the teardown below must never run while they do
+    int rc = -1;
+    int ready = !config.reload_file || start_reloader(&reloader) == 0;  // The reloader runs or is not needed
+    if (ready && config.threads > 1) {
+        // Accept on the main thread and shard connections across the workers
+        static worker_t workers[MAX_THREADS];
+        int started = start_workers(workers, config.threads, &config, &reloader.live, trace,
+                                    config.journal_file ? &journal : NULL, stats, tls, clients);
+        if (started != -1) {
+            if (started < config.threads) {
+                log_message(LOG_LEVEL_ERROR, "Only %d of %d worker threads started", started, config.threads);
+            }
+            attach_workers(&reloader, workers, started);
+            rc = run_acceptor(ctx, server_socket, workers, started);
+        }
+    } else if (ready) {
+        // Accept and serve all clients from a single event loop
+        worker_t worker;
+        if (init_worker(&worker, 0, ctx, &reloader.live, trace ? &trace->rings[0] : NULL,
+                        config.journal_file ? &journal : NULL, &stats[0], &config, tls, clients) == 0) {
+            attach_workers(&reloader, &worker, 1);
+            rc = run_event_loop(&worker, server_socket);
+            stop_reloader(&reloader);
+            free_worker(&worker);
         }
     }
 
     // Cleanup and shutdown
-    printf("[INFO] Server shutting down gracefully...\n");
-    modbus_mapping_free(mb_mapping);
+    log_message(LOG_LEVEL_INFO, "Server shutting down gracefully...");
+    close(server_socket);
+    stop_reloader(&reloader);
+    stop_notifier(&notifier);
+    stop_journal(&journal);
+    free_journal(&journal);
+    stop_tracer(&tracer);
+    free_tracer(&tracer);
+    stop_stats(&stats_server);
+    free_stats(stats, config.threads);
+    free_unit_map(&units);
+    free_generators(&config);
+    if (persist.base) close_persist(&persist);
     modbus_free(ctx);
-    return 0;
+    free(clients);
+    for (int t = 0; t < TABLE_COUNT; t++) free(config.read_only[t]);
+#ifdef USE_TLS
+    SSL_CTX_free(tls);
+#endif
+    stop_logger();
+    return rc == -1 ? -1 : 0;
 }
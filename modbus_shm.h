@@ -0,0 +1,92 @@
+#ifndef MODBUS_SHM_H
+#define MODBUS_SHM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Register map shared by modbus_server --shm NAME (a POSIX shared-memory
+ * segment, /dev/shm/NAME) and modbus_server --persist FILE (a regular file).
+ *
+ * The mapping starts with a modbus_shm_header_t padded to header_size bytes.
+ * The register maps follow, one per entry of units[] set to 1 in ascending
+ * unit order, or a single map shared by every unit if units[] is all zero.
+ * Each map holds the four tables in MODBUS_SHM_TABLE_* order, and each table
+ * is laid out as:
+ *
+ *   uint32_t seq[blocks]     one sequence word per MODBUS_SHM_BLOCK_SIZE entries
+ *   entries[pages * MODBUS_SHM_PAGE_SIZE]
+ *                            uint8_t 0/1 per bit, or uint16_t per register
+ *
+ * with both parts padded to MODBUS_SHM_ALIGN bytes, so a table takes
+ * modbus_shm_table_size() bytes. Everything is in host byte order; registers
+ * hold the value itself, not its big-endian wire encoding. Entry i of a table
+ * is address layouts[table][0] + i.
+ *
+ * Sequence words implement a seqlock per block. A producer updates entries
+ * with plain stores:
+ *
+ *   1. for every block it writes, in ascending block order, wait until the
+ *      sequence word is even and compare-and-swap it to the next odd value;
+ *   2. issue a release fence, then store the new entries;
+ *   3. increment every claimed sequence word back to even with release order.
+ *
+ * Readers load the words with acquire order, copy the entries, and retry if a
+ * word was odd or changed in the meantime. Claiming blocks in ascending order
+ * keeps producers and the server from deadlocking. A producer that dies
+ * between steps 1 and 3 leaves its blocks odd: the server then waits at most
+ * 100 ms on them and answers requests touching them with a Server Device
+ * Failure exception until the segment is recreated.
+ */
+
+#define MODBUS_SHM_MAGIC 0x4D425253u     // "MBRS"
+#define MODBUS_SHM_VERSION 2             // Version 1 files had no sequence words
+#define MODBUS_SHM_HEADER_SIZE 4096      // Bytes reserved for the header
+#define MODBUS_SHM_BLOCK_SIZE 64         // Table entries covered by one sequence word
+#define MODBUS_SHM_PAGE_SIZE 256         // Table storage is rounded up to this many entries
+#define MODBUS_SHM_ALIGN 64              // Alignment of each part of a table
+#define MODBUS_SHM_UNIT_COUNT 256        // Number of Modbus unit identifiers
+
+#define MODBUS_SHM_TABLE_COILS 0
+#define MODBUS_SHM_TABLE_DISCRETE_INPUTS 1
+#define MODBUS_SHM_TABLE_HOLDING_REGISTERS 2
+#define MODBUS_SHM_TABLE_INPUT_REGISTERS 3
+#define MODBUS_SHM_TABLE_COUNT 4
+
+typedef struct {
+    uint32_t magic;                      // MODBUS_SHM_MAGIC
+    uint32_t version;                    // MODBUS_SHM_VERSION
+    uint32_t nb_stores;                  // Number of register maps
+    uint32_t header_size;                // MODBUS_SHM_HEADER_SIZE, offset of the first map
+    uint32_t layouts[MODBUS_SHM_TABLE_COUNT][2];  // Start address and number of entries of each table
+    uint8_t units[MODBUS_SHM_UNIT_COUNT];  // 1 for each unit with its own map, all zero for a single shared map
+} modbus_shm_header_t;
+
+/**
+ * Function to compute the size of the sequence words of a table.
+ *
+ * @param count  The number of entries of the table.
+ *
+ * @return The size in bytes, padded to MODBUS_SHM_ALIGN.
+ */
+static inline size_t modbus_shm_seq_size(uint32_t count) {
+    size_t size = (count + MODBUS_SHM_BLOCK_SIZE - 1) / MODBUS_SHM_BLOCK_SIZE * sizeof(uint32_t);
+    return (size + MODBUS_SHM_ALIGN - 1) & ~(size_t)(MODBUS_SHM_ALIGN - 1);
+}
+
+/**
+ * Function to compute the size of a whole table.
+ *
+ * @param count  The number of entries of the table.
+ * @param bits   1 for coil and discrete input tables, 0 for register tables.
+ *
+ * @return The size in bytes, padded to MODBUS_SHM_ALIGN.
+ */
+static inline size_t modbus_shm_table_size(uint32_t count, int bits) {
+    if (count == 0) return 0;
+    size_t pages = (count + MODBUS_SHM_PAGE_SIZE - 1) / MODBUS_SHM_PAGE_SIZE;
+    size_t size = pages * MODBUS_SHM_PAGE_SIZE * (bits ? sizeof(uint8_t) : sizeof(uint16_t));
+    return modbus_shm_seq_size(count) + ((size + MODBUS_SHM_ALIGN - 1) & ~(size_t)(MODBUS_SHM_ALIGN - 1));
+}
+
+#endif
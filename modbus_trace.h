@@ -0,0 +1,45 @@
+#ifndef MODBUS_TRACE_H
+#define MODBUS_TRACE_H
+
+#include <stdint.h>
+
+/*
+ * Frame trace file written by modbus_server --trace FILE.
+ *
+ * The file starts with one trace_file_header_t followed by records. Every
+ * record is a trace_record_t immediately followed by captured_length bytes
+ * of the raw frame (MBAP header included). Fields are stored in the byte
+ * order of the host that wrote the file; a reader that sees the magic
+ * number byte-swapped must swap every field, as with pcap.
+ *
+ * Frames received over Modbus RTU are recorded in MBAP form as well: a zero
+ * transaction identifier, the unit address as unit identifier, and no CRC.
+ */
+
+#define TRACE_MAGIC 0x4D425452u          // "MBTR"
+#define TRACE_VERSION_MAJOR 1
+#define TRACE_VERSION_MINOR 0
+
+#define TRACE_REQUEST 0                  // Frame received from a client
+#define TRACE_RESPONSE 1                 // Frame sent to a client
+
+#define TRACE_FLAG_NO_PAYLOAD 0x01       // Reply encoded by libmodbus, only its length is known
+
+typedef struct {
+    uint32_t magic;                      // TRACE_MAGIC
+    uint16_t version_major;              // TRACE_VERSION_MAJOR
+    uint16_t version_minor;              // TRACE_VERSION_MINOR
+    uint32_t reserved;                   // Zero
+} trace_file_header_t;
+
+typedef struct {
+    uint64_t timestamp_ns;               // CLOCK_REALTIME when the frame was received or sent
+    uint32_t connection;                 // Identifier of the client connection, unique per server run
+    uint16_t captured_length;            // Bytes of the frame stored after this record
+    uint16_t frame_length;               // Length of the frame on the wire
+    uint8_t direction;                   // TRACE_REQUEST or TRACE_RESPONSE
+    uint8_t flags;                       // TRACE_FLAG_* bits
+    uint8_t reserved[6];                 // Zero, keeps the record 8-byte aligned
+} trace_record_t;
+
+#endif